@@ -1,27 +1,161 @@
 #version 410
-in vec3 vertexPosition;
-in vec3 vertexNormal;
-in vec4 vertexViewCol1;
-in vec4 vertexViewCol2;
-in vec4 vertexViewCol3;
-in vec4 vertexViewCol4;
-in vec4 vertexColor;
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec4 vertexViewCol1;
+layout(location = 3) in vec4 vertexViewCol2;
+layout(location = 4) in vec4 vertexViewCol3;
+layout(location = 5) in vec4 vertexViewCol4;
+layout(location = 6) in vec4 vertexColor;
+layout(location = 7) in vec2 vertexScalar;
+layout(location = 8) in vec4 instanceStart;
+layout(location = 9) in vec4 instanceEnd;
+layout(location = 10) in vec3 elementStart;
+layout(location = 11) in vec3 elementEnd;
+layout(location = 12) in vec3 elementNormal;
+layout(location = 13) in uvec2 elementNodes;
 
 uniform mat4 modelview;
 uniform mat4 modelnormal;
 uniform mat4 projection;
 
+// compact encoding: positions and normals are normalized shorts, instances are two endpoints quantized to bounds
+uniform bool compactAttributes = false;
+uniform float vertexPositionScale = 1.0;
+uniform vec3 instanceBoundsMin;
+uniform vec3 instanceBoundsExtent;
+
+// animated instances: every element is split into segments bent by the displacements of its two nodes,
+// blended between the frames bound to displacementFrames[0] and displacementFrames[1]
+uniform bool animatedInstances = false;
+uniform samplerBuffer displacementFrames[2];
+uniform float frameBlend;
+uniform float deformationScale = 1.0;
+uniform float animatedRadialScale = 1.0;
+uniform int segmentsPerElement = 1;
+
+// modal superposition: the displacements are the weighted sum of the mode shapes stored back to back in modeShapes,
+// modeStride texels apart; the array size matches ModalBasis::maxModes
+uniform bool modalInstances = false;
+uniform samplerBuffer modeShapes;
+uniform int modeCount = 0;
+uniform int modeStride;
+uniform float modeWeights[32];
+
 out vec4 vPosition;
 out vec3 normalInterp;
 out vec4 vColor;
+out float vScalar;
+
+// depth, G-buffer and forward programs share this shader; identical depths are required for GL_LEQUAL re-draws
+invariant gl_Position;
+
+// rebuilds the matrix of TrussScene::buildVertexMatrix: rotate y onto the element, scale, translate, mirror z
+mat4 endpointTransform(vec3 start, vec3 end, float radialScale) {
+    vec3 direction = end - start;
+    float len = length(direction);
+    direction /= max(len, tolerance);
+
+    vec3 axis = vec3(direction.z, 0.0, -direction.x);
+    float s = length(axis);
+    float c = direction.y;
+    mat3 rotation;
+
+    if (s < tolerance) {
+        rotation = c < 0.0 ? mat3(-1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, 1.0) : mat3(1.0);
+    }
+    else {
+        axis /= s;
+        mat3 cross = mat3(0.0, axis.z, -axis.y, -axis.z, 0.0, axis.x, axis.y, -axis.x, 0.0);
+        rotation = c * mat3(1.0) + s * cross + (1.0 - c) * outerProduct(axis, axis);
+    }
+
+    const vec3 mirror = vec3(1.0, 1.0, -1.0);
+    return mat4(vec4(mirror * rotation[0] * radialScale, 0.0),
+                vec4(mirror * rotation[1] * len, 0.0),
+                vec4(mirror * rotation[2] * radialScale, 0.0),
+                vec4(mirror * start, 1.0));
+}
+
+// translations and rotations of a node are two consecutive texels of every frame
+void nodeDisplacement(uint node, out vec3 translation, out vec3 rotation) {
+    int texel = 2 * int(node);
+
+    if (modalInstances) {
+        translation = vec3(0.0);
+        rotation = vec3(0.0);
+        for (int k = 0; k < modeCount; ++k) {
+            // uniform branch: silent modes cost no fetches
+            if (modeWeights[k] != 0.0) {
+                translation += modeWeights[k] * texelFetch(modeShapes, k * modeStride + texel).xyz;
+                rotation += modeWeights[k] * texelFetch(modeShapes, k * modeStride + texel + 1).xyz;
+            }
+        }
+        return;
+    }
+
+    translation = mix(texelFetch(displacementFrames[0], texel).xyz,
+                      texelFetch(displacementFrames[1], texel).xyz, frameBlend);
+    rotation = mix(texelFetch(displacementFrames[0], texel + 1).xyz,
+                   texelFetch(displacementFrames[1], texel + 1).xyz, frameBlend);
+}
+
+// same cubic beam interpolation as createNodeStrips, evaluated at both ends of this instance's segment
+mat4 animatedTransform() {
+    vec3 axis = elementEnd - elementStart;
+    float len = length(axis);
+    vec3 nx = axis / max(len, tolerance);
+    vec3 ny = normalize(elementNormal);
+    vec3 nz = normalize(cross(nx, ny));
+    mat3 toLocal = transpose(mat3(nx, ny, nz));
+    mat3 toGlobal = inverse(toLocal);
+
+    vec3 u1, r1, u2, r2;
+    nodeDisplacement(elementNodes.x, u1, r1);
+    nodeDisplacement(elementNodes.y, u2, r2);
+    u1 = toLocal * u1;
+    u2 = toLocal * u2;
+    r1 = vec3(dot(nx, r1), -dot(ny, r1), dot(nz, r1));
+    r2 = vec3(dot(nx, r2), -dot(ny, r2), dot(nz, r2));
+
+    int segment = gl_InstanceID % segmentsPerElement;
+    vec3 ends[2];
+    for (int i = 0; i < 2; ++i) {
+        float t = float(segment + i) / float(segmentsPerElement);
+        float t2 = t * t;
+        float t3 = t2 * t;
+        vec4 hermite = vec4(1.0 - 3.0 * t2 + 2.0 * t3, t - 2.0 * t2 + t3, 3.0 * t2 - 2.0 * t3, t3 - t2);
+        vec3 local = vec3(mix(u1.x, u2.x, t),
+                          dot(hermite, vec4(u1.y, len * r1.z, u2.y, len * r2.z)),
+                          dot(hermite, vec4(u1.z, len * r1.y, u2.z, len * r2.y)));
+        ends[i] = mix(elementStart, elementEnd, t) + deformationScale * (toGlobal * local);
+    }
+    return endpointTransform(ends[0], ends[1], animatedRadialScale);
+}
 
 void main(){
-    vec4 offsetPos4 = vec4(vertexPosition, 1.0);
-    mat4 vertexView = mat4(vertexViewCol1, vertexViewCol2, vertexViewCol3, vertexViewCol4);
+    vec4 offsetPos4 = vec4(vertexPosition * vertexPositionScale, 1.0);
+    mat4 vertexView;
+    vec3 normal;
+
+    if (animatedInstances) {
+        vertexView = animatedTransform();
+    }
+    else if (compactAttributes) {
+        vertexView = endpointTransform(instanceBoundsMin + instanceStart.xyz * instanceBoundsExtent,
+                                       instanceBoundsMin + instanceEnd.xyz * instanceBoundsExtent,
+                                       instanceStart.w);
+    }
+    else {
+        vertexView = mat4(vertexViewCol1, vertexViewCol2, vertexViewCol3, vertexViewCol4);
+    }
+    normal = compactAttributes ? octDecode(vertexNormal.xy) : vertexNormal;
 
     gl_Position = projection * modelview * (vertexView * offsetPos4);
 
     vPosition = gl_Position;
-    normalInterp = vec3(modelnormal * vec4(vertexNormal, 0.0));
+    normalInterp = vec3(modelnormal * vec4(normal, 0.0));
     vColor = vertexColor;
+
+    // node fields hold the values at both ends of the instance; the decoded cylinder runs from y = 0 to y = 1
+    vScalar = scalarMode == 2 ? mix(vertexScalar.x, vertexScalar.y, offsetPos4.y) : vertexScalar.x;
 }
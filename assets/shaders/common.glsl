@@ -0,0 +1,79 @@
+// Shared by the shaders. Inserted after the #version line when the programs are built.
+
+const vec3 specColor = vec3(1.0, 1.0, 1.0);
+const vec3 sceneAmbient = vec3(0.3, 0.3, 0.3);
+const float shininess = 50.0;
+const float tolerance = 1.e-6;
+const int numberOfLights = 4;
+
+struct lightSource {
+    vec3 position;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+const lightSource lights[numberOfLights] = lightSource[numberOfLights](
+    lightSource(vec3(1.0,  0.0,  0.0), vec3(1.0,  1.0,  1.0), vec3(1.0,  1.0,  1.0)),
+    lightSource(vec3(-1.0, 0.0,  0.0), vec3(1.0,  1.0,  1.0), vec3(1.0,  1.0,  1.0)),
+    lightSource(vec3(0.0,  0.0,  1.0), vec3(1.0,  1.0,  1.0), vec3(1.0,  1.0,  1.0)),
+    lightSource(vec3(0.0,  0.0, -1.0), vec3(1.0,  1.0,  1.0), vec3(1.0,  1.0,  1.0))
+);
+
+// scalar field coloring: 0 = off, 1 = per element, 2 = per node
+uniform int scalarMode = 0;
+uniform vec2 scalarRange = vec2(0.0, 1.0);
+uniform float colormapRow = 0.5;
+uniform sampler2D colormap;
+
+bool lessThan(float a, float b, float tolerance) {
+    return (b - a) > ( (abs(a) < abs(b) ? abs(b) : abs(a)) * tolerance);
+}
+
+vec3 blinnLighting(vec3 normalDirection, vec3 viewDirection, vec3 diffuse) {
+    vec3 lightDirection, specularReflection, diffuseReflection;
+    float angle;
+
+    // initialize total lighting with ambient lighting
+    vec3 totalLighting = sceneAmbient * sceneAmbient;
+
+    for (int index = 0; index < numberOfLights; ++index) {
+        lightDirection = lights[index].position;
+        angle =  dot(normalDirection, lightDirection);
+        diffuseReflection = lights[index].diffuse * diffuse * max(0.0, angle);
+        if (lessThan(angle, 0.0, tolerance)) { // light source on the wrong side?
+            specularReflection = vec3(0.0, 0.0, 0.0); // no specular reflection
+        }
+        else { // light source on the right side
+            specularReflection = lights[index].specular * specColor * pow(max(0.0, dot(reflect(-lightDirection, normalDirection), viewDirection)), shininess);
+        }
+        totalLighting += diffuseReflection + specularReflection;
+    }
+
+    return totalLighting;
+}
+
+// maps the scalar through the colormap, keeping the alpha of the mesh color
+vec4 surfaceColor(vec4 meshColor, float scalar) {
+    if (scalarMode == 0)
+        return meshColor;
+
+    float t = clamp((scalar - scalarRange.x) / max(scalarRange.y - scalarRange.x, tolerance), 0.0, 1.0);
+    float width = float(textureSize(colormap, 0).x);
+    vec3 mapped = texture(colormap, vec2((t * (width - 1.0) + 0.5) / width, colormapRow)).rgb;
+    return vec4(mapped, meshColor.w);
+}
+
+// octahedral mapping of a unit vector onto [-1, 1]^2
+vec2 octEncode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 wrapped = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : wrapped;
+}
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
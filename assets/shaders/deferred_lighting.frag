@@ -0,0 +1,30 @@
+#version 410
+uniform sampler2D colorTexture;
+uniform sampler2D normalTexture;
+uniform sampler2D depthTexture;
+
+uniform mat4 projection;
+uniform mat4 projection_inv;
+uniform vec2 viewportSize;
+uniform vec3 eyePosition;
+
+out vec4 color;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(depthTexture, texel, 0).r;
+    if (depth >= 1.0)
+        discard;
+
+    // rebuild the clip space position the forward shader interpolates
+    vec4 ndc = vec4(2.0 * gl_FragCoord.xy / viewportSize - 1.0, 2.0 * depth - 1.0, 1.0);
+    vec4 viewPosition = projection_inv * ndc;
+    vec4 clipPosition = projection * (viewPosition / viewPosition.w);
+
+    vec4 diffuse = texelFetch(colorTexture, texel, 0);
+    vec3 normalDirection = octDecode(texelFetch(normalTexture, texel, 0).xy);
+    vec3 viewDirection = normalize(eyePosition - clipPosition.xyz);
+
+    color = vec4(blinnLighting(normalDirection, viewDirection, diffuse.xyz), diffuse.w);
+    gl_FragDepth = depth;
+}
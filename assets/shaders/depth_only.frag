@@ -0,0 +1,9 @@
+#version 410
+in vec4 vColor;
+
+uniform float alphaCutoff = 0.0;
+
+void main() {
+    if (lessThan(vColor.w, alphaCutoff, tolerance))
+        discard;
+}
@@ -0,0 +1,7 @@
+#version 410
+
+// single triangle covering the viewport, drawn with glDrawArrays(GL_TRIANGLES, 0, 3) and no attributes
+void main() {
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(2.0 * corner - 1.0, 0.0, 1.0);
+}
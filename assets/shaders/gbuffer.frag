@@ -0,0 +1,17 @@
+#version 410
+in vec4 vColor;
+in float vScalar;
+in vec3 normalInterp;
+
+uniform float alphaCutoff = 0.0;
+
+layout(location = 0) out vec4 gColor;
+layout(location = 1) out vec2 gNormal;
+
+void main() {
+    if (lessThan(vColor.w, alphaCutoff, tolerance))
+        discard;
+
+    gColor = surfaceColor(vColor, vScalar);
+    gNormal = octEncode(normalize(normalInterp));
+}
@@ -0,0 +1,63 @@
+#ifndef TRESTA_CAMERA_PATH_H
+#define TRESTA_CAMERA_PATH_H
+
+#include <QVector3D>
+#include <string>
+
+namespace tresta {
+
+    /**
+     * @brief Scripted camera motion for render benchmarks, see `tresta-render-bench`.
+     * @details A path is sampled at fractions of its length, so the same path covers the same views whatever the
+     * number of frames it is rendered with.
+     */
+    class CameraPath {
+    public:
+        enum Kind {
+            ORBIT,/**<One turn about the vertical axis at the starting distance.*/
+            ZOOM_IN,/**<Moves from the starting distance to a tenth of it, in equal steps of magnification.*/
+            FLY_THROUGH,/**<Moves into the middle of the truss while turning a quarter turn and levelling the view.*/
+            NUM_KINDS
+        };
+
+        /**
+         * Camera placement as taken by `TrussScene::setCameraView`.
+         */
+        struct Pose {
+            QVector3D rotation;/**<Degrees about x, y and z.*/
+            float distance;/**<Relative to the distance that fits the job.*/
+        };
+
+        /**
+         * @param kind Kind. Motion of the camera.
+         * @param rotation QVector3D. Rotation at the start of the path, in degrees about x, y and z.
+         * @param distance float. Distance at the start of the path, relative to the one that fits the job.
+         */
+        CameraPath(Kind kind, const QVector3D &rotation, float distance);
+
+        /**
+         * Placement at `fraction` of the path, 0 being its start and 1 its end.
+         */
+        Pose poseAt(float fraction) const;
+
+        Kind getKind() const;
+
+        /**
+         * Name of a kind as used on the command line: `orbit`, `zoom` or `fly`.
+         */
+        static std::string kindName(Kind kind);
+
+        /**
+         * Looks up a kind by its name. Returns `false` if the name is unknown.
+         */
+        static bool parseKind(const std::string &name, Kind &kind);
+
+    private:
+        Kind kind;
+        QVector3D startRotation;
+        float startDistance;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_CAMERA_PATH_H
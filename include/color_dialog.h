@@ -4,7 +4,10 @@
 #include <QDialog>
 #include <QColor>
 
+#include "scalar_field.h"
+
 class QCheckBox;
+class QComboBox;
 class QDoubleSpinBox;
 class QGroupBox;
 class QHBoxLayout;
@@ -13,14 +16,40 @@ class QPushButton;
 
 namespace tresta {
 
+    /**
+     * @brief Snapshot of the color dialog state used by the scene when rendering.
+     */
+    struct ColorSettings {
+        ColorSettings() :
+                useUserColors(false),
+                transparencyEnabled(true),
+                alphaCutoff(0.0f),
+                useScalars(false),
+                colormap(0),
+                scalarMin(0.0f),
+                scalarMax(1.0f) {};
+
+        QColor origColor;/**<Color of the undeformed mesh.*/
+        QColor defColor;/**<Color of the deformed mesh.*/
+        bool useUserColors;/**<Whether to use custom defined elemental colors.*/
+        bool transparencyEnabled;/**<Whether transparency is enabled.*/
+        float alphaCutoff;/**<Alpha values below this value are discarded by the shader.*/
+        bool useScalars;/**<Whether to color elements by the scalar field.*/
+        int colormap;/**<Index of the selected colormap.*/
+        float scalarMin;/**<Scalar value mapped to the lowest colormap entry.*/
+        float scalarMax;/**<Scalar value mapped to the highest colormap entry.*/
+    };
+
     class ColorDialog : public QDialog {
     Q_OBJECT
 
     signals:
         void origColorChanged();
         void defColorChanged();
+        void useUserColorsChanged(bool);
         void transparencyEnabledChanged(bool);
         void alphaCutoffChanged(float);
+        void scalarColoringChanged();
 
     public slots:
         /**
@@ -51,8 +80,45 @@ namespace tresta {
          */
         void setAlphaCutoff(double cutoff);
 
+        /**
+         * Sets whether the scalar field should be mapped through the colormap.
+         * Takes precedence over user defined colors.
+         * @param state bool. Whether to color by the scalar field.
+         */
+        void setUseScalars(bool state);
+
+        /**
+         * Selects the colormap.
+         * @param index int. Index into `tresta::colormapNames()`.
+         */
+        void setColormap(int index);
+
+        /**
+         * Selects how the color range is chosen: full range, percentiles, or custom.
+         * @param index int. Index of the range combo box entry.
+         */
+        void setScalarRangeMode(int index);
+
+        /**
+         * Sets the scalar value mapped to the lowest colormap entry.
+         */
+        void setScalarMin(double value);
+
+        /**
+         * Sets the scalar value mapped to the highest colormap entry.
+         */
+        void setScalarMax(double value);
+
     public:
-        ColorDialog(bool userColorProvided, bool displacementsProvided, QWidget *parent = 0);
+        /**
+         * @brief Constructor
+         * @param userColorsProvided bool. Whether elemental colors were provided.
+         * @param displacementsProvided bool. Whether nodal displacements were provided.
+         * @param scalarStatistics ScalarStatistics. Summary of the scalar field. A count of zero disables scalar coloring.
+         * @param parent QWidget. Parent widget.
+         */
+        ColorDialog(bool userColorsProvided, bool displacementsProvided,
+                    const ScalarStatistics &scalarStatistics = ScalarStatistics(), QWidget *parent = 0);
 
         /**
          * Gets the currently stored color to assign to the undeformed mesh.
@@ -84,6 +150,34 @@ namespace tresta {
          */
         void setOrigColorAlpha(float alpha);
 
+        /**
+         * Gets the bool that determines whether the scalar field should be mapped through the colormap.
+         * @return useScalars bool. True if elements should be colored by the scalar field.
+         */
+        const bool getUseScalars() const;
+
+        /**
+         * Gets the index of the selected colormap.
+         * @return colormap int. Index into `tresta::colormapNames()`.
+         */
+        int getColormap() const;
+
+        /**
+         * Gets the scalar value mapped to the lowest colormap entry.
+         */
+        float getScalarMin() const;
+
+        /**
+         * Gets the scalar value mapped to the highest colormap entry.
+         */
+        float getScalarMax() const;
+
+        /**
+         * Gets a copy of every setting that affects rendering.
+         * @return settings ColorSettings.
+         */
+        ColorSettings getSettings() const;
+
     private:
         /**
          * Creates the group box containing the buttons that prompt the user to choose 
@@ -106,6 +200,11 @@ namespace tresta {
          */
         void createSpinBoxLayout();
 
+        /**
+         * Creates the checkable group box holding the colormap and color range selection.
+         */
+        void createScalarGroupBox();
+
         /**
          * Creates the button used to close the dialog.
          */
@@ -114,6 +213,11 @@ namespace tresta {
         bool useUserColors;/**<Whether to use custom defined elemental colors instead of single colors chosen for each mesh.*/
         bool transparencyEnabled;/**<Whether transparency is enabled.*/
         float alphaCutoff;/**<If transparency is enabled, alpha values below this value will be discarded by the shader.*/
+        bool useScalars;/**<Whether to color elements by mapping the scalar field through the colormap.*/
+        int colormap;/**<Index of the selected colormap.*/
+        float scalarMin;/**<Scalar value mapped to the lowest colormap entry.*/
+        float scalarMax;/**<Scalar value mapped to the highest colormap entry.*/
+        ScalarStatistics scalarStatistics;/**<Range and percentiles of the scalar field computed at load.*/
 
         QColor origColor;/**<Color of the undeformed mesh.*/
         QColor defColor;/**<Color of the deformed mesh.*/
@@ -127,6 +231,11 @@ namespace tresta {
         QDoubleSpinBox *alphaCutoffSpinBox;/**<Spin box that allows the user to set the alpha cutoff threshold.*/
         QLabel *alphaCutoffLabel;/**<Label displayed beside the alpha cutoff spinbox*/;
         QHBoxLayout *alphaCutoffLayout;/**<Layout that holds the alpha cutoff label and spin box*/
+        QGroupBox *scalarGroupBox;/**<When checked elements are colored by the scalar field.*/
+        QComboBox *colormapComboBox;/**<Selects the colormap.*/
+        QComboBox *scalarRangeComboBox;/**<Selects whether the color range is the full range, the percentiles or custom.*/
+        QDoubleSpinBox *scalarMinSpinBox;/**<Scalar value mapped to the lowest colormap entry.*/
+        QDoubleSpinBox *scalarMaxSpinBox;/**<Scalar value mapped to the highest colormap entry.*/
     };
 
 } // namespace tresta
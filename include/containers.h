@@ -3,6 +3,7 @@
 
 #include <Eigen/Core>
 #include <QColor>
+#include <string>
 #include <vector>
 
 namespace tresta {
@@ -86,6 +87,15 @@ namespace tresta {
         }
     };
 
+    /**
+     * Where the values of a scalar field are defined.
+     */
+    enum ScalarLocation {
+        NO_SCALARS,/**<No scalar field was provided.*/
+        ELEMENT_SCALARS,/**<One value per element, constant along the element.*/
+        NODE_SCALARS/**<One value per node, linearly interpolated along each element.*/
+    };
+
     /**
      * @brief Contains all the required information to render a mesh.
      * @details A job holds information on the node and element lists as well as any nodal displacements, deformed
@@ -93,7 +103,7 @@ namespace tresta {
      */
     struct Job {
 
-        Job() {};
+        Job() : scalar_location(NO_SCALARS), frame_rate(24.0f) {};
         Job(const std::vector<Node> &nodes,
             const std::vector<Elem> &elems,
             const std::vector<Displacement> &displacements,
@@ -103,7 +113,9 @@ namespace tresta {
                 elems(elems),
                 displacements(displacements),
                 node_strips(node_strips),
-                colors(colors) {
+                colors(colors),
+                scalar_location(NO_SCALARS),
+                frame_rate(24.0f) {
             if (colors.size() > 0) {
                 assert(elems.size() == colors.size() && "Elements and colors are not the same length.");
             }
@@ -122,6 +134,15 @@ namespace tresta {
         std::vector<std::vector<Node>> node_strips;
         /**<Interpolated deformed nodal coordinates.*/
         std::vector<QColor> colors;/**<Color to render each element.*/
+        std::vector<float> scalars;/**<Scalar field mapped through a colormap, e.g. stress or strain.*/
+        ScalarLocation scalar_location;/**<Whether `scalars` holds one value per element or per node.*/
+        std::vector<std::string> displacement_frames;
+        /**<Files of a displacement time series. Empty for a single set of displacements.
+                                            `displacements` then holds the first frame.*/
+        float frame_rate;/**<Playback rate of the displacement time series in frames per second.*/
+        std::vector<std::string> mode_shapes;
+        /**<Files of the mode shapes superposed on the GPU. `displacements` then holds the first mode.*/
+        std::vector<float> mode_frequencies;/**<Animation frequency of every mode shape in Hz.*/
     };
 
     enum DOF {
@@ -6,6 +6,10 @@
 #define TRESTA_DEMODIALOG_H
 
 #include <QDialog>
+#include <QSize>
+
+#include "frame_stream.h"
+#include "image_encoder_pool.h"
 
 class QAction;
 
@@ -17,8 +21,41 @@ class QLineEdit;
 
 class QLabel;
 
+class QSpinBox;
+
+class QComboBox;
+
 namespace tresta {
 
+    /**
+     * @brief Snapshot of the demo dialog state used by the render thread when saving frames.
+     */
+    struct DemoSettings {
+        /**
+         * Where the frames go.
+         */
+        enum Output {
+            IMAGE_FILES,/**<One image file per frame in `directory`.*/
+            Y4M_STREAM,/**<A single YUV4MPEG2 stream written to `streamTarget`.*/
+            PPM_STREAM/**<A single stream of concatenated PPM images written to `streamTarget`.*/
+        };
+
+        DemoSettings() :
+                output(IMAGE_FILES),
+                format(ImageEncoderPool::PNG),
+                compressionLevel(1),
+                framesPerSecond(30) {};
+
+        QString directory;/**<Directory to save frames to.*/
+        QString prefix;/**<Root prepended to each frame.*/
+        QSize frameSize;/**<Size of the saved frames in pixels. Invalid for the window size.*/
+        Output output;/**<Whether frames are saved as images or streamed.*/
+        ImageEncoderPool::Format format;/**<File format of the frames.*/
+        int compressionLevel;/**<zlib level of PNG frames from 0 (fastest) to 9 (smallest).*/
+        QString streamTarget;/**<File or named pipe the stream is written to, `-` for standard output.*/
+        int framesPerSecond;/**<Frame rate stored in a Y4M stream.*/
+    };
+
     class DemoDialog : public QDialog {
         Q_OBJECT
 
@@ -31,6 +68,18 @@ namespace tresta {
 
         pickDirectory();
 
+        /**
+         * Enables the compression level for formats that are compressed.
+         * @param index int. Index of the selected format.
+         */
+        void setImageFormat(int index);
+
+        /**
+         * Enables the widgets that apply to the selected output.
+         * @param index int. Index of the selected `DemoSettings::Output`.
+         */
+        void setOutput(int index);
+
     public:
         DemoDialog(QWidget *parent = 0);
 
@@ -46,6 +95,18 @@ namespace tresta {
          */
         const QString &getFilenamePrefix() const;
 
+        /**
+         * Gets the size of the saved frames. Frames are rendered offscreen, so it does not depend on the window.
+         * @return size QSize. Width and height in pixels.
+         */
+        QSize getFrameSize() const;
+
+        /**
+         * Gathers the directory, prefix, frame size and image format.
+         * @return settings DemoSettings.
+         */
+        DemoSettings getSettings() const;
+
     private:
 
 
@@ -80,6 +141,28 @@ namespace tresta {
         /**<Holds the directory to save files to.*/
         QLineEdit *prefixLineEdit;
         /**<Holds the filename prefix.*/
+        QLabel *sizeLabel;
+        /**<Label for the frame size spin boxes.*/
+        QSpinBox *widthSpinBox;
+        /**<Holds the frame width.*/
+        QSpinBox *heightSpinBox;
+        /**<Holds the frame height.*/
+        QLabel *formatLabel;
+        /**<Label for the image format combo box.*/
+        QComboBox *formatComboBox;
+        /**<Selects the image format of the frames.*/
+        QSpinBox *compressionSpinBox;
+        /**<Holds the PNG compression level.*/
+        QLabel *outputLabel;
+        /**<Label for the output combo box.*/
+        QComboBox *outputComboBox;
+        /**<Selects whether frames are saved as images or streamed.*/
+        QSpinBox *fpsSpinBox;
+        /**<Holds the frame rate of a Y4M stream.*/
+        QLabel *streamLabel;
+        /**<Label for the stream target line edit.*/
+        QLineEdit *streamLineEdit;
+        /**<Holds the file or named pipe to stream to.*/
         QGroupBox *groupBox;
         /**<Holds the buttons and line edit of the dialog in a managed box.*/
         QPushButton *chooseDirButton;
@@ -0,0 +1,102 @@
+#ifndef TRESTA_DISPLACEMENT_CONTAINER_H
+#define TRESTA_DISPLACEMENT_CONTAINER_H
+
+#include <QMutex>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tresta {
+
+    /**
+     * @brief Compressed, seekable container of displacement frames (extension `.tdc`).
+     * @details Frames are grouped into blocks of `framesPerBlock` consecutive frames that are compressed
+     * independently, and a block index in the header locates every block, so reading any frame decodes exactly one
+     * block. Within a block every column (x, y and z translations and rotations) of every frame is quantized to
+     * 16 bits relative to that column's range in the frame, the codes of each frame are stored as differences to the
+     * codes of the previous frame, and the low and high bytes of all differences are stored as separate planes
+     * before zlib compression. Slowly varying sequences therefore compress to a small fraction of their CSV size.
+     * The quantization error of a value is at most 1/131070 of its column's range in that frame.
+     *
+     * All integers and floats are stored little-endian:
+     *
+     *     "TDC1" | version | nodes | frames | framesPerBlock | blocks      (uint32 each)
+     *     blocks x (offset uint64, bytes uint32)                           block index
+     *     blocks x zlib(payload)
+     *
+     * where the payload of a block of F frames of N nodes is F x 6 x (min, step) floats followed by the low and the
+     * high bytes of F x N x 6 zigzag coded differences.
+     */
+    class DisplacementContainer {
+    public:
+        /**
+         * @brief Opens a container and reads its block index.
+         * @param filename std::string. Container file.
+         */
+        explicit DisplacementContainer(const std::string &filename);
+
+        size_t frameCount() const;
+
+        size_t nodeCount() const;
+
+        unsigned int framesPerBlock() const;
+
+        /**
+         * Decodes one frame. Safe to call from several threads at once. Recently decoded blocks are cached, so
+         * reading consecutive frames decodes every block only once.
+         *
+         * @param frame size_t. Frame index on the range `[0, frameCount())`.
+         * @param values `std::vector<float>`. Resized to `6 * nodeCount()` and filled with
+         *               `dx, dy, dz, rx, ry, rz` of every node.
+         */
+        void readFrame(size_t frame, std::vector<float> &values) const;
+
+        /**
+         * Decodes several frames, decompressing the distinct blocks they fall in concurrently.
+         *
+         * @param frames `std::vector<size_t>`. Frame indices in any order.
+         * @param values `std::vector<std::vector<float>>`. One frame per entry of `frames`, laid out as in `readFrame`.
+         */
+        void readFrames(const std::vector<size_t> &frames, std::vector<std::vector<float>> &values) const;
+
+        /**
+         * Converts CSV displacement frames into a container. Blocks are read, encoded and compressed concurrently.
+         *
+         * @param csvFrames `std::vector<std::string>`. Frame files in playback order, all with the same number of rows.
+         * @param filename std::string. Container to write.
+         * @param framesPerBlock unsigned int. Frames compressed together. Larger blocks compress better but make
+         *                       random access decode more frames.
+         * @param compressionLevel int. zlib level from 0 (none) to 9 (smallest), -1 for the default.
+         */
+        static void pack(const std::vector<std::string> &csvFrames,
+                         const std::string &filename,
+                         unsigned int framesPerBlock = defaultFramesPerBlock,
+                         int compressionLevel = -1);
+
+        static const unsigned int defaultFramesPerBlock;
+
+    private:
+        typedef std::shared_ptr<const std::vector<float>> BlockPtr;
+
+        struct BlockEntry {
+            unsigned long long offset;
+            unsigned int bytes;
+        };
+
+        BlockPtr getBlock(size_t block) const;
+        BlockPtr decodeBlock(size_t block) const;
+
+        std::string filename;
+        size_t numNodes;
+        size_t numFrames;
+        unsigned int blockFrames;
+        std::vector<BlockEntry> index;
+
+        mutable QMutex cacheMutex;
+        mutable std::list<std::pair<size_t, BlockPtr>> cache;/**<Most recently used blocks first.*/
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_DISPLACEMENT_CONTAINER_H
@@ -0,0 +1,178 @@
+#ifndef TRESTA_DISPLACEMENT_PLAYBACK_H
+#define TRESTA_DISPLACEMENT_PLAYBACK_H
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <qopengl.h>
+#include <map>
+#include <vector>
+
+#include "displacement_sequence.h"
+
+class QOpenGLFunctions_3_3_Core;
+
+namespace tresta {
+
+    /**
+     * @brief Reads displacement frames on a background thread ahead of playback.
+     * @details The consumer names the frames it wants, most urgent first. The reader loads all missing frames as one
+     * concurrent batch and keeps at most one decoded copy of each wanted frame, so memory is bounded by the length of the wanted list.
+     * Frames that stop being wanted before they are taken are dropped.
+     */
+    class FramePrefetcher : public QThread {
+    public:
+        /**
+         * @brief Constructor
+         * @param sequence DisplacementSequence. Frame source. Must outlive the prefetcher.
+         */
+        FramePrefetcher(const DisplacementSequence &sequence);
+
+        ~FramePrefetcher();
+
+        /**
+         * Replaces the list of wanted frames.
+         * @param frames `std::vector<size_t>`. Frames in the order they should be read.
+         */
+        void setWanted(const std::vector<size_t> &frames);
+
+        /**
+         * Removes one frame that has finished loading.
+         * @param frame size_t. Set to the index of the returned frame.
+         * @param values `std::vector<float>`. Swapped with the frame's values.
+         * @return taken bool. `false` if no wanted frame is ready.
+         */
+        bool takeFrame(size_t &frame, std::vector<float> &values);
+
+        /**
+         * Stops the reader and waits for it to finish the frame it is loading.
+         */
+        void stop();
+
+    protected:
+        void run();
+
+    private:
+        const DisplacementSequence &sequence;
+        QMutex mutex;
+        QWaitCondition wantedChanged;
+        std::vector<size_t> wanted;
+        std::map<size_t, std::vector<float>> ready;
+        bool stopping;
+    };
+
+    /**
+     * @brief Plays a displacement time series through a ring of GPU frame buffers.
+     * @details Each ring slot is a texture buffer holding the translations and rotations of every node of one frame
+     * as two `GL_RGB32F` texels per node. The slots are filled from a background prefetcher with the frames following
+     * the playhead, so only the ring and the prefetched frames are ever resident. The vertex shader reads the two
+     * frames around the playhead and blends them by `getBlend()`. If the next frame has not arrived yet the playhead
+     * holds instead of skipping ahead.
+     */
+    class DisplacementPlayback {
+    public:
+        DisplacementPlayback();
+
+        /**
+         * Stops the prefetcher and deletes the ring buffers. Must run with the context current if `initialize` was called.
+         */
+        ~DisplacementPlayback();
+
+        /**
+         * Sets the sequence to play. Must be called before `initialize`.
+         * @param sequence DisplacementSequence. Frames to play.
+         * @param frameRate float. Playback rate in frames per second.
+         */
+        void setSequence(const DisplacementSequence &sequence, float frameRate);
+
+        /**
+         * Whether a sequence was set.
+         */
+        bool isActive() const;
+
+        /**
+         * Creates the ring buffers and starts the prefetcher. Must be called with a current context. Throws
+         * `std::runtime_error` if a frame exceeds `GL_MAX_TEXTURE_BUFFER_SIZE` texels.
+         * @param glFunc QOpenGLFunctions_3_3_Core. Resolved functions of the current context.
+         */
+        void initialize(QOpenGLFunctions_3_3_Core *glFunc);
+
+        /**
+         * Advances the playhead if playing and uploads frames that finished loading.
+         * @param dt float. Elapsed time in seconds.
+         */
+        void update(float dt);
+
+        /**
+         * Binds the two frames around the playhead to consecutive texture units.
+         * @param firstUnit int. Texture unit of the frame at or before the playhead; the next frame uses `firstUnit + 1`.
+         */
+        void bindFrames(int firstUnit);
+
+        /**
+         * Weight of the second bound frame on the range `[0, 1)`.
+         */
+        float getBlend() const;
+
+        void setPlaying(bool isPlaying);
+
+        bool isPlaying() const;
+
+        /**
+         * Moves the playhead. Frames outside the sequence wrap around.
+         * @param frame float. Fractional frame index.
+         */
+        void seek(float frame);
+
+        /**
+         * Moves the playhead by a whole number of frames from the frame currently shown.
+         */
+        void step(int frames);
+
+        /**
+         * Index of the frame at or before the playhead that is currently shown.
+         */
+        size_t getDisplayedFrame() const;
+
+        size_t frameCount() const;
+
+        /**
+         * Bytes of video memory used by the ring.
+         */
+        size_t gpuBytes() const;
+
+        const DisplacementSequence &getSequence() const;
+
+    private:
+        struct Slot {
+            Slot() : buffer(0), texture(0), frame(-1) {};
+
+            GLuint buffer;
+            GLuint texture;
+            long frame;/**<Frame held by the slot, `-1` if empty.*/
+        };
+
+        int findSlot(size_t frame) const;
+        size_t wrapFrame(long frame) const;
+        void uploadReadyFrames();
+        void requestFrames();
+
+        QOpenGLFunctions_3_3_Core *mGLFunc;
+        DisplacementSequence sequence;
+        FramePrefetcher *prefetcher;
+        std::vector<Slot> ring;
+        std::vector<float> frameValues;
+
+        float playhead;
+        float frameRate;
+        float blend;
+        int currentSlot;/**<Slot bound as the frame at or before the playhead, `-1` before the first upload.*/
+        int nextSlot;/**<Slot bound as the frame after the playhead.*/
+        bool playing;
+
+        static const unsigned int ringSize;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_DISPLACEMENT_PLAYBACK_H
@@ -0,0 +1,90 @@
+#ifndef TRESTA_DISPLACEMENT_SEQUENCE_H
+#define TRESTA_DISPLACEMENT_SEQUENCE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "containers.h"
+
+namespace tresta {
+
+    class DisplacementContainer;
+
+    /**
+     * @brief Ordered sequence of nodal displacement frames read from disk on demand.
+     * @details A sequence is either a list of CSV files holding one frame each, or a single stacked binary file
+     * (extension `.bin`) holding every frame back to back as little-endian 32-bit floats, 6 per node, in the column
+     * order of the displacements CSV, or a single compressed `DisplacementContainer` (extension `.tdc`). Apart from the
+     * few blocks a container caches, only the frames a caller asks for are in memory.
+     */
+    class DisplacementSequence {
+    public:
+        /**
+         * @brief Constructs an empty sequence.
+         */
+        DisplacementSequence();
+
+        /**
+         * @brief Constructor
+         * @details The size of a stacked binary file and the node count of a container are checked against the
+         * number of nodes.
+         *
+         * @param files `std::vector<std::string>`. CSV frame files in playback order, or one stacked binary file.
+         * @param num_nodes size_t. Number of nodes every frame must hold.
+         */
+        DisplacementSequence(const std::vector<std::string> &files, size_t num_nodes);
+
+        /**
+         * Number of frames in the sequence.
+         */
+        size_t frameCount() const;
+
+        /**
+         * Number of nodes in every frame.
+         */
+        size_t nodeCount() const;
+
+        /**
+         * Whether the sequence holds no frames.
+         */
+        bool isEmpty() const;
+
+        /**
+         * Reads one frame. Safe to call from several threads at once; every call opens its own file handle.
+         *
+         * @param frame size_t. Frame index on the range `[0, frameCount())`.
+         * @param values `std::vector<float>`. Resized to `6 * nodeCount()` and filled with
+         *               `dx, dy, dz, rx, ry, rz` of every node.
+         */
+        void readFrame(size_t frame, std::vector<float> &values) const;
+
+        /**
+         * Reads several frames concurrently.
+         *
+         * @param frames `std::vector<size_t>`. Frame indices on the range `[0, frameCount())`.
+         * @param values `std::vector<std::vector<float>>`. One frame per entry of `frames`, laid out as in `readFrame`.
+         */
+        void readFrames(const std::vector<size_t> &frames, std::vector<std::vector<float>> &values) const;
+
+        /**
+         * Reads one frame into the layout used by `Job::displacements`.
+         *
+         * @param frame size_t. Frame index on the range `[0, frameCount())`.
+         * @return displacements `std::vector<tresta::Displacement>`. One entry per node.
+         */
+        std::vector<Displacement> readDisplacements(size_t frame) const;
+
+        static const unsigned int valuesPerNode;/**<Translations and rotations of one node.*/
+
+    private:
+        std::vector<std::string> files;
+        size_t numNodes;
+        size_t numFrames;
+        bool stacked;/**<Whether all frames live in one binary file.*/
+        std::shared_ptr<const DisplacementContainer> container;/**<Set if the frames live in a compressed container.*/
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_DISPLACEMENT_SEQUENCE_H
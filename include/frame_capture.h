@@ -0,0 +1,103 @@
+#ifndef TRESTA_FRAME_CAPTURE_H
+#define TRESTA_FRAME_CAPTURE_H
+
+#include <QImage>
+#include <qopengl.h>
+#include <deque>
+
+#include "memory_tracker.h"
+
+class QOpenGLFunctions_3_3_Core;
+
+namespace tresta {
+
+    /**
+     * @brief Offscreen framebuffer whose frames are read back asynchronously.
+     * @details Frames are rendered into an `RGBA8` color and `DEPTH24_STENCIL8` renderbuffer of a fixed size that
+     * does not depend on the window. `read` only queues a `glReadPixels` into the next pixel buffer object of a
+     * ring and fences it, so the transfer of one frame overlaps the rendering of the following ones; `takeFrame`
+     * maps a pixel buffer once its fence has signaled. Must only be used with the owning context current.
+     */
+    class FrameCapture {
+    public:
+        FrameCapture();
+        ~FrameCapture();
+
+        /**
+         * (Re)allocates the framebuffer and the pixel buffers if the requested size differs from the current one.
+         * Frames that were not taken yet are dropped.
+         * @param width Frame width in pixels.
+         * @param height Frame height in pixels.
+         */
+        void resize(int width, int height);
+
+        /**
+         * Binds the framebuffer for reading and drawing.
+         */
+        void bind();
+
+        /**
+         * Starts reading back the frame in the framebuffer. Never waits for the GPU.
+         * The ring must not be full; take a frame first if it is.
+         * @param frameNumber int. Returned with the image by `takeFrame`.
+         */
+        void read(int frameNumber);
+
+        /**
+         * Returns the oldest frame whose readback has been started.
+         * @param image QImage. Set to the frame, top row first.
+         * @param frameNumber int. Set to the number given to `read`.
+         * @param wait bool. Whether to wait for the readback to complete.
+         * @return Whether a frame was returned. Without `wait`, `false` if the oldest readback is still in flight.
+         */
+        bool takeFrame(QImage &image, int &frameNumber, bool wait);
+
+        /**
+         * Copies the current frame to `targetFramebuffer`, scaled to fit, e.g. to show it in the window.
+         */
+        void blit(GLuint targetFramebuffer, int targetWidth, int targetHeight);
+
+        /**
+         * Whether every pixel buffer of the ring holds a frame that was not taken yet.
+         */
+        bool isFull() const;
+
+        /**
+         * Whether the buffers are allocated.
+         */
+        bool isAllocated() const;
+
+        /**
+         * Frees the framebuffer and the pixel buffers. Frames that were not taken yet are dropped.
+         */
+        void release();
+
+        int getWidth() const;
+
+        int getHeight() const;
+
+        static const unsigned int ringSize = 3;/**<Number of pixel buffers, i.e. frames that can be in flight.*/
+
+    private:
+        struct Pending {
+            unsigned int buffer;/**<Index into `pixelBuffers`.*/
+            GLsync fence;
+            int frameNumber;
+        };
+
+        QOpenGLFunctions_3_3_Core *mGLFunc;
+
+        GLuint framebuffer;
+        GLuint colorRenderbuffer;
+        GLuint depthRenderbuffer;
+        GLuint pixelBuffers[ringSize];
+        TrackedBytes trackedPixelBuffers;/**<Counts the storage of `pixelBuffers`.*/
+        unsigned int nextBuffer;
+        std::deque<Pending> pending;/**<Readbacks in the order they were started.*/
+        int width;
+        int height;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_FRAME_CAPTURE_H
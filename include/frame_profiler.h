@@ -0,0 +1,176 @@
+#ifndef TRESTA_FRAME_PROFILER_H
+#define TRESTA_FRAME_PROFILER_H
+
+#include <QElapsedTimer>
+#include <qopengl.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+class QOpenGLFunctions_3_3_Core;
+
+namespace tresta {
+
+    /**
+     * @brief Measures the CPU and GPU cost of the frames of a scene.
+     * @details Every pass of a frame is wrapped in a `GL_TIME_ELAPSED` and a `GL_PRIMITIVES_GENERATED` query, so
+     * GPU times and triangle counts are exact even for draws whose instances are chosen by the occlusion culler
+     * on the GPU. Results are read back a few frames later, once the GPU has finished them, so profiling never
+     * stalls the pipeline. Passes must not nest. While disabled every call returns immediately.
+     */
+    class FrameProfiler {
+    public:
+        /**
+         * Parts of a frame timed separately.
+         */
+        enum Pass {
+            ORIGINAL_PASS,/**<Draws of the original mesh, including depth pre-pass and G-buffer draws.*/
+            DEFORMED_PASS,/**<Draws of the deformed mesh.*/
+            CULLING_PASS,/**<Depth pyramid and cluster tests of the occlusion culler.*/
+            COMPOSITE_PASS,/**<Fullscreen lighting pass of deferred shading.*/
+            NUM_PASSES
+        };
+
+        /**
+         * Costs of one finished frame.
+         */
+        struct Sample {
+            Sample();
+
+            double frameMs;/**<Time since the previous frame started, 0 for the first frame.*/
+            double cpuMs;/**<Time spent issuing the commands of the frame.*/
+            double gpuMs[NUM_PASSES];
+            unsigned long long instances;/**<Instances shaded, counted once even if a depth pre-pass drew them too.*/
+            unsigned long long triangles;/**<Triangles of the shaded instances.*/
+            unsigned int drawCalls;/**<Multi-draws of the culler count once.*/
+
+            double gpuTotalMs() const;
+        };
+
+        /**
+         * Copy of the recorded frames, e.g. to show or save them on another thread.
+         */
+        struct Statistics {
+            std::string renderer;/**<`GL_RENDERER` of the context the frames were drawn with.*/
+            std::vector<Sample> samples;/**<Oldest first.*/
+
+            /**
+             * Value below which `fraction` of the values lie, using the nearest rank. 0 if there are no values.
+             */
+            static double percentile(std::vector<double> values, double fraction);
+
+            /**
+             * Writes one row per frame. Throws `std::runtime_error` if the file cannot be written.
+             */
+            void saveCsv(const std::string &fileName) const;
+
+            /**
+             * Writes the sum, mean and percentiles of the frame, CPU and GPU times followed by every frame.
+             * Throws `std::runtime_error` if the file cannot be written.
+             */
+            void saveJson(const std::string &fileName) const;
+        };
+
+        FrameProfiler();
+
+        /**
+         * Deletes the queries if a context is current.
+         */
+        ~FrameProfiler();
+
+        /**
+         * Starts or stops recording. Starting discards the frames recorded before; stopping keeps them, but drops
+         * the frames still in flight. Must be called with the context of the scene current.
+         */
+        void setEnabled(bool enabled);
+
+        bool isEnabled() const;
+
+        /**
+         * Starts a frame and collects the results of earlier frames the GPU has finished.
+         */
+        void beginFrame();
+
+        void endFrame();
+
+        /**
+         * Waits for the frames in flight and collects them, e.g. before reading the statistics of a benchmark.
+         */
+        void finish();
+
+        /**
+         * Starts timing a pass of the current frame.
+         * @param pass Pass. Pass the following commands belong to.
+         * @param trianglesPerInstance unsigned int. Triangles of the instanced shape, or 0 if the draws of the pass
+         * should not count towards the instances and triangles, e.g. depth-only or fullscreen draws.
+         */
+        void beginPass(Pass pass, unsigned int trianglesPerInstance = 0);
+
+        void endPass();
+
+        /**
+         * Counts draw calls of the current frame.
+         */
+        void countDrawCalls(unsigned int calls = 1);
+
+        /**
+         * Copies the most recent finished frames, at most `setHistoryLimit` of them.
+         */
+        Statistics getStatistics() const;
+
+        /**
+         * Sets how many finished frames are kept, `historySize` by default. Older frames are dropped.
+         */
+        void setHistoryLimit(size_t frames);
+
+        /**
+         * Name of a pass as used in the overlay and the exported files, e.g. `deformed`.
+         */
+        static std::string passName(Pass pass);
+
+        static const size_t historySize;
+
+    private:
+        /**
+         * Queries of one pass of a frame.
+         */
+        struct PassQueries {
+            GLuint timeQuery;
+            GLuint primitiveQuery;
+            Pass pass;
+            unsigned int trianglesPerInstance;
+        };
+
+        /**
+         * Frame whose queries have been issued but not read back yet.
+         */
+        struct PendingFrame {
+            PendingFrame() : numPasses(0), pending(false) {}
+
+            std::vector<PassQueries> queries;/**<Grows to the most passes a frame has needed and is reused.*/
+            size_t numPasses;
+            Sample sample;
+            bool pending;
+        };
+
+        bool isAvailable(const PendingFrame &frame);
+        void collect(PendingFrame &frame);
+        void release();
+
+        QOpenGLFunctions_3_3_Core *mGLFunc;
+        std::vector<PendingFrame> frames;/**<Ring of frames in flight.*/
+        size_t currentFrame;
+        std::deque<Sample> history;
+        size_t historyLimit;
+        std::string renderer;
+        QElapsedTimer frameTimer;
+        QElapsedTimer cpuTimer;
+        bool enabled;
+        bool inPass;
+
+        static const size_t framesInFlight;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_FRAME_PROFILER_H
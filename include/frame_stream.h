@@ -0,0 +1,110 @@
+#ifndef TRESTA_FRAME_STREAM_H
+#define TRESTA_FRAME_STREAM_H
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <deque>
+#include <memory>
+
+class QFile;
+class QThread;
+
+namespace tresta {
+
+    /**
+     * @brief Writes a sequence of frames as one raw video stream on a worker thread.
+     * @details Frames are converted and written in the order they are submitted, so an external encoder can read
+     * the stream directly, e.g. `ffmpeg -i frames.y4m out.mp4` or, through a named pipe or standard output,
+     * while frames are still being rendered. Like `ImageEncoderPool`, `submit` waits while the bounded queue is
+     * full, so rendering is slowed down to the pace of the consumer instead of holding frames in memory.
+     */
+    class FrameStream {
+    public:
+        /**
+         * Layout of the stream.
+         */
+        enum Format {
+            Y4M,/**<YUV4MPEG2 with 4:2:0 chroma, BT.601 limited range. A quarter the size of PPM at 8 bits per pixel.*/
+            PPM/**<Concatenated binary PPM (`P6`) images, e.g. for `ffmpeg -f image2pipe`.*/
+        };
+
+        FrameStream();
+
+        /**
+         * Waits for the queued frames, see `close`.
+         */
+        ~FrameStream();
+
+        /**
+         * Starts the writer thread.
+         * @details The target is opened by the writer, so opening a named pipe waits for a reader without blocking
+         * the caller, and `close` stops the wait if no reader came. If it cannot be opened the submitted frames are
+         * dropped and `takeError` reports why. Errors of an earlier stream are cleared.
+         * @param target QString. File or named pipe to write to, `-` for standard output.
+         * @param format Format. Layout of the stream.
+         * @param width int. Width in pixels of every frame.
+         * @param height int. Height in pixels of every frame.
+         * @param framesPerSecond int. Frame rate stored in a Y4M header.
+         */
+        void open(const QString &target, Format format, int width, int height, int framesPerSecond);
+
+        /**
+         * Queues a frame, waiting while the queue is full.
+         * @param frame QImage. `RGBA8888` frame of the size given to `open`, top row first.
+         */
+        void submit(const QImage &frame);
+
+        /**
+         * Waits until every submitted frame has been written and closes the target. Frames are dropped if a named
+         * pipe still has no reader.
+         */
+        void close();
+
+        /**
+         * Whether the writer is running.
+         */
+        bool isOpen() const;
+
+        /**
+         * Returns and clears the first error of the writer, or an empty string.
+         */
+        QString takeError();
+
+        /**
+         * File name extension of a format including the dot, e.g. `.y4m`.
+         */
+        static QString extension(Format format);
+
+    private:
+        class Writer;
+
+        bool pop(QImage &frame);
+        bool openTarget(QFile &file);
+#ifdef Q_OS_UNIX
+        bool isNamedPipe() const;
+        bool openNamedPipe(QFile &file);
+#endif
+        bool write(QFile &file, const QImage &frame);
+        void reportError(const QString &message);
+
+        QMutex mutex;
+        QWaitCondition notEmpty;
+        QWaitCondition notFull;
+        std::deque<QImage> frames;
+        bool closed;
+        QString errorMessage;
+
+        QString target;
+        Format format;
+        int width;
+        int height;
+        int framesPerSecond;
+        QByteArray buffer;/**<Writer thread only; one converted frame.*/
+        std::unique_ptr<QThread> writer;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_FRAME_STREAM_H
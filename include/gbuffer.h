@@ -0,0 +1,61 @@
+#ifndef TRESTA_GBUFFER_H
+#define TRESTA_GBUFFER_H
+
+#include <qopengl.h>
+
+class QOpenGLFunctions_3_3_Core;
+
+namespace tresta {
+
+    /**
+     * @brief Thin geometry buffer used by the deferred shading mode.
+     * @details Holds three attachments: the diffuse color (`RGBA8`), the octahedral encoded normal (`RG16F`) and
+     * the depth (`DEPTH24_STENCIL8`). Positions are not stored; the lighting pass rebuilds them from depth.
+     * Storage is allocated lazily by `resize`, so the buffer costs nothing while deferred shading is not used.
+     */
+    class GBuffer {
+    public:
+        GBuffer();
+        ~GBuffer();
+
+        /**
+         * (Re)allocates the attachments if the requested size differs from the current one.
+         * Must be called with a current context.
+         * @param width Framebuffer width.
+         * @param height Framebuffer height.
+         */
+        void resize(int width, int height);
+
+        /**
+         * Binds the framebuffer for reading and drawing and enables both color attachments.
+         */
+        void bind();
+
+        /**
+         * Binds the color, normal and depth textures to texture units `firstUnit`, `firstUnit + 1`
+         * and `firstUnit + 2`, respectively.
+         */
+        void bindTextures(int firstUnit);
+
+        /**
+         * Whether the attachments have been allocated.
+         */
+        bool isAllocated() const;
+
+    private:
+        void release();
+        GLuint createTexture(GLenum internalFormat, GLenum format, GLenum type);
+
+        QOpenGLFunctions_3_3_Core *mGLFunc;
+
+        GLuint framebuffer;
+        GLuint colorTexture;
+        GLuint normalTexture;
+        GLuint depthTexture;
+        int width;
+        int height;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_GBUFFER_H
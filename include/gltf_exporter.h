@@ -0,0 +1,45 @@
+#ifndef TRESTA_GLTF_EXPORTER_H
+#define TRESTA_GLTF_EXPORTER_H
+
+#include "containers.h"
+#include "shape.h"
+
+#include <QMatrix4x4>
+#include <QString>
+#include <vector>
+
+namespace tresta {
+
+    /**
+     * @brief Writes instanced meshes to binary glTF 2.0 (`.glb`) files.
+     * @details The shape is stored once and every instance only as a translation, rotation and scale through the
+     * `EXT_mesh_gpu_instancing` extension, so a strut costs 40 bytes (52 with a color) instead of a baked copy of
+     * every vertex. Instance transforms must be a rotation times an axis aligned, possibly mirrored, scale, which is
+     * how `TrussScene` builds them. Per-instance colors are written as the `_COLOR_0` instance attribute.
+     */
+    class GltfExporter {
+    public:
+        GltfExporter();
+
+        /**
+         * Whether to write the RGB of `Job::colors` as instance colors. Ignored if the job has no colors.
+         */
+        void setIncludeColors(bool include);
+
+        /**
+         * @brief Writes a shape and its instances to a `.glb` file.
+         * @param fileName QString. File to write.
+         * @param shape Shape. Mesh drawn by every instance.
+         * @param job Job. Supplies the element colors.
+         * @param vertexViewVector `std::vector<QMatrix4x4>`. Transform of every instance. If there are more instances
+         *                         than elements, consecutive instances belong to the same element.
+         */
+        void exportGlb(const QString& fileName, const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector);
+
+    private:
+        bool includeColors;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_GLTF_EXPORTER_H
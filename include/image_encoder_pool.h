@@ -0,0 +1,102 @@
+#ifndef TRESTA_IMAGE_ENCODER_POOL_H
+#define TRESTA_IMAGE_ENCODER_POOL_H
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+namespace tresta {
+
+    /**
+     * @brief Encodes and saves images on a pool of worker threads.
+     * @details Images are handed over through a bounded queue: `submit` waits while the queue is full, so a
+     * producer that renders faster than the workers encode is slowed down to their pace instead of accumulating
+     * frames in memory. At most `capacity` images are queued and one more per worker is being encoded.
+     */
+    class ImageEncoderPool {
+    public:
+        /**
+         * File format of the saved images.
+         */
+        enum Format {
+            PNG,/**<Lossless and compressed; slowest to encode.*/
+            TGA,/**<Uncompressed 32-bit BGRA with alpha.*/
+            PPM/**<Uncompressed binary RGB (`P6`).*/
+        };
+
+        ImageEncoderPool();
+
+        /**
+         * Waits for the queued images, see `finish`.
+         */
+        ~ImageEncoderPool();
+
+        /**
+         * Starts the workers.
+         * @param format Format. Format of every submitted image.
+         * @param compressionLevel int. zlib level from 0 (fastest) to 9 (smallest). Only used by PNG.
+         * @param threads unsigned int. Number of workers, 0 for one per core.
+         */
+        void start(Format format, int compressionLevel, unsigned int threads = 0);
+
+        /**
+         * Queues an image, waiting while the queue is full.
+         * @param image QImage. Image to save. Shares its pixels with the caller until it is encoded.
+         * @param fileName QString. File name without extension; `extension(format)` is appended.
+         */
+        void submit(const QImage &image, const QString &fileName);
+
+        /**
+         * Waits until every submitted image has been saved and stops the workers.
+         */
+        void finish();
+
+        /**
+         * Whether the workers are running.
+         */
+        bool isRunning() const;
+
+        /**
+         * Returns and clears the message of the first image that could not be saved, or an empty string.
+         */
+        QString takeError();
+
+        /**
+         * File name extension of a format including the dot, e.g. `.png`.
+         */
+        static QString extension(Format format);
+
+    private:
+        struct Job {
+            QImage image;
+            QString fileName;
+        };
+
+        class Worker;
+
+        bool pop(Job &job);
+        void encode(const Job &job);
+        void reportError(const QString &message);
+
+        QMutex mutex;
+        QWaitCondition notEmpty;
+        QWaitCondition notFull;
+        std::deque<Job> jobs;
+        size_t capacity;
+        bool closed;
+        QString errorMessage;
+
+        Format format;
+        int compressionLevel;
+        std::vector<std::unique_ptr<QThread>> workers;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_IMAGE_ENCODER_POOL_H
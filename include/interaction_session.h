@@ -0,0 +1,125 @@
+#ifndef TRESTA_INTERACTION_SESSION_H
+#define TRESTA_INTERACTION_SESSION_H
+
+#include <QElapsedTimer>
+#include <string>
+#include <vector>
+
+#include "truss_scene.h"
+
+namespace tresta {
+
+    /**
+     * @brief Camera and scene input of an interactive session with the times it arrived, to replay it later.
+     * @details The window records the camera and display state of the scene when recording starts, followed by the
+     * commands it posts to the scene: mouse drags as rotate, translate and zoom steps, keys handled by the scene and
+     * deformation scales chosen in the dialog. Keys that open dialogs or only concern the window are not recorded. `tresta-render-bench` replays a saved session offscreen to measure the
+     * frame times of real interaction.
+     */
+    class InteractionSession {
+    public:
+        enum EventType {
+            ROTATE_EVENT,
+            TRANSLATE_EVENT,
+            ZOOM_EVENT,
+            KEY_EVENT,
+            SCALE_EVENT,
+            NUM_EVENT_TYPES
+        };
+
+        struct Event {
+            Event() : timeMs(0.0), type(KEY_EVENT), dx(0), dy(0), key(0), scale(1.0f) {}
+
+            double timeMs;/**<Time since the recording started.*/
+            EventType type;
+            int dx;/**<Mouse movement of rotate, translate and zoom events.*/
+            int dy;
+            int key;/**<Qt key code of key events.*/
+            float scale;/**<Deformation scale of scale events.*/
+        };
+
+        InteractionSession();
+
+        /**
+         * Discards the recorded events and starts recording.
+         * @param width int. Width of the window the session is recorded in.
+         * @param height int. Height of the window.
+         * @param start TrussScene::ViewState. State of the scene the following events apply to.
+         */
+        void startRecording(int width, int height, const TrussScene::ViewState &start);
+
+        /**
+         * Stops recording. The session lasts until now, even if the last event came earlier.
+         */
+        void stopRecording();
+
+        bool isRecording() const;
+
+        /**
+         * Records a rotate, translate or zoom step. Does nothing while not recording.
+         */
+        void recordMouse(EventType type, int dx, int dy);
+
+        void recordKey(int key);
+
+        void recordScale(float scale);
+
+        /**
+         * Writes the session as JSON. Throws `std::runtime_error` if the file cannot be written.
+         */
+        void save(const std::string &fileName) const;
+
+        /**
+         * Reads a session written by `save`. Throws `std::runtime_error` if the file cannot be read or is invalid.
+         */
+        static InteractionSession load(const std::string &fileName);
+
+        /**
+         * Events in the order they were recorded.
+         */
+        const std::vector<Event> &getEvents() const;
+
+        double getDurationMs() const;
+
+        int getWidth() const;
+
+        int getHeight() const;
+
+        /**
+         * Whether the state the session started from is known. Sessions saved before it was recorded lack it.
+         */
+        bool hasStartState() const;
+
+        const TrussScene::ViewState &getStartState() const;
+
+        /**
+         * Restores the state the session started from, if known, so the events replay the recorded views.
+         */
+        void applyStartState(TrussScene &scene) const;
+
+        /**
+         * Passes an event to the scene the way the window did when it was recorded.
+         */
+        static void apply(const Event &event, TrussScene &scene);
+
+        /**
+         * Name of an event type as stored in the file, e.g. `rotate`.
+         */
+        static std::string eventTypeName(EventType type);
+
+    private:
+        void record(const Event &event);
+
+        std::vector<Event> events;
+        TrussScene::ViewState start;
+        QElapsedTimer clock;
+        double durationMs;
+        int width;
+        int height;
+        bool startRecorded;
+        bool recording;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_INTERACTION_SESSION_H
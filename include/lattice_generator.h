@@ -0,0 +1,159 @@
+#ifndef TRESTA_LATTICE_GENERATOR_H
+#define TRESTA_LATTICE_GENERATOR_H
+
+#include <string>
+#include <vector>
+
+#include "containers.h"
+
+namespace tresta {
+
+    /**
+     * @brief Builds parameterized lattices of struts, e.g. to stress-test loading and rendering reproducibly.
+     * @details A lattice is `n x n x n` repetitions of a cubic unit cell whose struts connect the sites of the cell
+     * to their nearest neighbors. Nodes on the faces of the lattice are shared by the adjoining cells, and nodes
+     * without a strut inside the lattice are left out. Nodes, elements, displacements and colors are generated in
+     * slabs of cells in parallel on the global thread pool; every random value depends only on the seed and the
+     * node it perturbs, so a lattice is the same whatever the number of threads.
+     */
+    class LatticeGenerator {
+    public:
+        /**
+         * Unit cell repeated in every direction.
+         */
+        enum CellType {
+            SIMPLE_CUBIC,/**<Struts along the edges of the cube, 3 per cell.*/
+            BODY_CENTERED_CUBIC,/**<Struts from the center to the corners of the cube, 8 per cell.*/
+            OCTET,/**<Face-centered cubic sites joined to their 12 nearest neighbors, 24 struts per cell.*/
+            KELVIN,/**<Edges of truncated octahedra packed body-centered, 24 struts per cell.*/
+            NUM_CELL_TYPES
+        };
+
+        /**
+         * Synthetic nodal displacements.
+         */
+        enum DisplacementField {
+            NO_DISPLACEMENTS,
+            BENDING,/**<Cantilever bent by a load at the end, clamped at x = 0 and deflected along y.*/
+            BUCKLING/**<Euler mode shape of a pinned column along y, deflected along x.*/
+        };
+
+        /**
+         * Colors of the elements.
+         */
+        enum ColorScheme {
+            NO_COLORS,
+            ORIENTATION_COLORS,/**<One color per strut of the unit cell.*/
+            HEIGHT_COLORS/**<Blue at the bottom of the lattice to red at the top.*/
+        };
+
+        LatticeGenerator();
+
+        void setCellType(CellType cellType);
+
+        /**
+         * @param repetitions int. Number of cells along each axis.
+         */
+        void setRepetitions(int repetitions);
+
+        /**
+         * @param cellSize float. Edge length of the unit cell.
+         */
+        void setCellSize(float cellSize);
+
+        /**
+         * Moves every node by a random offset, uniform in each coordinate.
+         * @param fraction float. Largest offset as a fraction of the cell size, 0 for a regular lattice.
+         * @param seed unsigned int. Seed of the offsets.
+         */
+        void setPerturbation(float fraction, unsigned int seed);
+
+        /**
+         * @param field DisplacementField. Displacements of the nodes.
+         * @param amplitude float. Largest translation as a fraction of the size of the lattice.
+         * @param mode int. Number of half waves of a buckling mode shape.
+         */
+        void setDisplacementField(DisplacementField field, float amplitude, int mode = 1);
+
+        void setColorScheme(ColorScheme scheme);
+
+        /**
+         * Number of elements of the lattice, computed without building it.
+         */
+        size_t elemCount() const;
+
+        /**
+         * Smallest number of repetitions whose lattice has at least `numElems` elements.
+         */
+        static int repetitionsFor(CellType cellType, size_t numElems);
+
+        /**
+         * Name of a cell type as used on the command line, e.g. `octet`.
+         */
+        static std::string cellTypeName(CellType cellType);
+
+        /**
+         * Builds a job ready to be rendered, including the node strips if there are displacements.
+         */
+        Job generate() const;
+
+        /**
+         * Writes the lattice as the CSV files of a config and the config itself.
+         * @details The data files are named after the config, e.g. `lattice_nodes.csv` next to `lattice.json`.
+         * Rows are formatted in parallel and written in order. Throws `std::runtime_error` if a file cannot be
+         * written.
+         * @param configFileName std::string. JSON file to write.
+         * @param binaryDisplacements bool. Whether to store the displacements as a stacked binary file of one
+         *                            frame, which loads many times faster than CSV and, like CSV, loads as static
+         *                            displacements.
+         */
+        void writeConfig(const std::string &configFileName, bool binaryDisplacements) const;
+
+    private:
+        /**
+         * Site of the unit cell, in fractions of the cell size.
+         */
+        struct Site {
+            float position[3];
+        };
+
+        /**
+         * Strut from a site of a cell to a site of the same or a neighboring cell, listed once per cell.
+         */
+        struct Strut {
+            int from;
+            int to;
+            int offset[3];/**<Cell of `to` relative to the cell of `from`, -1, 0 or 1.*/
+        };
+
+        /**
+         * Nodes, elements and the optional fields of a lattice, without node strips.
+         */
+        struct Geometry {
+            std::vector<Node> nodes;
+            std::vector<Elem> elems;
+            std::vector<Displacement> displacements;
+            std::vector<QColor> colors;
+        };
+
+        void buildCell();
+        bool isInside(const int cell[3], int site) const;
+        void buildGeometry(Geometry &geometry) const;
+
+        CellType cellType;
+        int repetitions;
+        float cellSize;
+        float perturbation;
+        unsigned int seed;
+        DisplacementField displacementField;
+        float amplitude;
+        int mode;
+        ColorScheme colorScheme;
+
+        std::vector<Site> sites;
+        std::vector<Strut> struts;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_LATTICE_GENERATOR_H
@@ -33,6 +33,7 @@ namespace tresta {
         void demoPressed();
         void exportPressed();
         void setColorPressed();
+        void memoryUsagePressed();
 
         void zoomChanged(bool isEnabled);
         void panChanged(bool isEnabled);
@@ -80,6 +81,7 @@ namespace tresta {
         QAction *demoAct;
         QAction *exportAct;
         QAction *setColorAct;
+        QAction *memoryUsageAct;
         QAction *exitAct;
         QAction *aboutAct;
     };
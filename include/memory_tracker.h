@@ -0,0 +1,158 @@
+#ifndef TRESTA_MEMORY_TRACKER_H
+#define TRESTA_MEMORY_TRACKER_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class QOpenGLBuffer;
+
+namespace tresta {
+
+    /**
+     * @brief Counts the bytes held by the large CPU and GPU structures of the application, per subsystem.
+     * @details Every subsystem has a current and a peak count. Counts are process wide and may be changed from any
+     * thread, e.g. by a scene built on the GUI thread and uploaded on the render thread. Structures are
+     * registered through `TrackedBytes` and `GpuBufferAccount` rather than by calling `add` directly, so their
+     * bytes are released with them.
+     */
+    class MemoryTracker {
+    public:
+        /**
+         * Structures counted separately.
+         */
+        enum Subsystem {
+            PARSE_TEMPORARIES,/**<Rows read from the CSV files and the vectors a job is assembled from.*/
+            JOB_DATA,/**<Nodes, elements, displacements, colors and scalars of the jobs of the scenes.*/
+            NODE_STRIPS,/**<`Job::node_strips` of the scenes.*/
+            VERTEX_VIEW,/**<Instance transforms of the original meshes.*/
+            DEFORMED_VERTEX_VIEW,/**<Instance transforms of the deformed meshes.*/
+            UPLOAD_STAGING,/**<Packed copies of the instance transforms while they are uploaded.*/
+            GPU_SHAPE_BUFFERS,/**<Vertex and index buffers of the instanced shapes.*/
+            GPU_INSTANCE_BUFFERS,/**<Instance transforms of the original meshes in video memory.*/
+            GPU_DEFORMED_INSTANCE_BUFFERS,/**<Instance transforms or element records of the deformed meshes.*/
+            GPU_ATTRIBUTE_BUFFERS,/**<Per-instance colors and scalars.*/
+            GPU_DISPLACEMENT_TEXTURES,/**<Frame rings of displacement sequences and mode shape bases.*/
+            GPU_CULLING_BUFFERS,/**<Cluster bounds and indirect draw commands of the occlusion culler.*/
+            GPU_READBACK_BUFFERS,/**<Pixel buffers that captured frames are read back through.*/
+            NUM_SUBSYSTEMS
+        };
+
+        struct Usage {
+            Usage() : current(0), peak(0) {}
+
+            size_t current;
+            size_t peak;/**<Largest `current` since the start or the last `resetPeaks`.*/
+        };
+
+        /**
+         * Changes the count of a subsystem.
+         * @param bytes long long. Bytes allocated, negative if released.
+         */
+        static void add(Subsystem subsystem, long long bytes);
+
+        static Usage usage(Subsystem subsystem);
+
+        /**
+         * Sum of the CPU or the GPU subsystems. Its peak is the largest sum seen, not the sum of the peaks.
+         */
+        static Usage total(bool gpu);
+
+        /**
+         * Sets the peaks to the current counts, e.g. to measure each of several jobs loaded one after another.
+         */
+        static void resetPeaks();
+
+        /**
+         * Name of a subsystem as shown in the report, e.g. `node strips`.
+         */
+        static std::string subsystemName(Subsystem subsystem);
+
+        static bool isGpu(Subsystem subsystem);
+
+        /**
+         * Table of the current and peak counts of every subsystem in MiB, followed by the CPU and GPU totals.
+         */
+        static std::string report();
+    };
+
+    /**
+     * @brief Bytes of one structure counted by the `MemoryTracker` for as long as it lives.
+     */
+    class TrackedBytes {
+    public:
+        explicit TrackedBytes(MemoryTracker::Subsystem subsystem, size_t bytes = 0);
+        ~TrackedBytes();
+
+        /**
+         * Replaces the counted bytes, e.g. after the structure was rebuilt.
+         */
+        void set(size_t bytes);
+
+        size_t bytes() const;
+
+    private:
+        TrackedBytes(const TrackedBytes &);
+        TrackedBytes &operator=(const TrackedBytes &);
+
+        const MemoryTracker::Subsystem subsystem;
+        size_t count;
+    };
+
+    /**
+     * @brief Allocates the storage of `QOpenGLBuffer`s and counts it with the `MemoryTracker`.
+     * @details Owners route every `allocate` and `destroy` of their buffers through one account. Buffers destroyed
+     * by their own destructor are released from the count when the account is destroyed.
+     */
+    class GpuBufferAccount {
+    public:
+        GpuBufferAccount() {}
+        ~GpuBufferAccount();
+
+        /**
+         * Allocates the storage of the bound `buffer` like `QOpenGLBuffer::allocate`. Storage allocated for it
+         * before is no longer counted.
+         * @param bytes size_t. Size of `data`.
+         * @param subsystem Subsystem. Subsystem the buffer is counted in.
+         */
+        void allocate(QOpenGLBuffer &buffer, const void *data, size_t bytes, MemoryTracker::Subsystem subsystem);
+
+        /**
+         * Destroys `buffer` and stops counting its storage.
+         */
+        void destroy(QOpenGLBuffer &buffer);
+
+    private:
+        GpuBufferAccount(const GpuBufferAccount &);
+        GpuBufferAccount &operator=(const GpuBufferAccount &);
+
+        typedef std::map<const QOpenGLBuffer *, std::pair<MemoryTracker::Subsystem, size_t>> BufferMap;
+
+        void release(const QOpenGLBuffer &buffer);
+
+        BufferMap buffers;
+    };
+
+    /**
+     * Bytes of the elements a vector has reserved.
+     */
+    template <typename T>
+    size_t vectorBytes(const std::vector<T> &values) {
+        return values.capacity() * sizeof(T);
+    }
+
+    /**
+     * Bytes of a vector of vectors, including the inner ones.
+     */
+    template <typename T>
+    size_t vectorBytes(const std::vector<std::vector<T>> &values) {
+        size_t bytes = values.capacity() * sizeof(std::vector<T>);
+        for (size_t i = 0; i < values.size(); ++i)
+            bytes += vectorBytes(values[i]);
+        return bytes;
+    }
+
+} // namespace tresta
+
+#endif // TRESTA_MEMORY_TRACKER_H
@@ -0,0 +1,123 @@
+#ifndef TRESTA_MODAL_BASIS_H
+#define TRESTA_MODAL_BASIS_H
+
+#include <qopengl.h>
+#include <vector>
+
+#include "containers.h"
+#include "displacement_sequence.h"
+
+class QOpenGLFunctions_3_3_Core;
+
+namespace tresta {
+
+    /**
+     * @brief Animates weighted combinations of mode shapes on the GPU.
+     * @details All mode shapes are uploaded once into a single texture buffer, mode after mode, each holding the
+     * translations and rotations of every node as two `GL_RGB32F` texels per node. The vertex shader evaluates the
+     * displacement of a node as \f$u = \sum_k w_k(t) \phi_k\f$ with \f$w_k(t) = a_k \cos(2 \pi f_k t)\f$, where the
+     * amplitudes \f$a_k\f$ select or blend modes and \f$f_k\f$ are the mode frequencies. Every mode starts at its
+     * peak, so a still frame at \f$t = 0\f$ shows the mode shapes at full amplitude. Only the weights change
+     * from frame to frame, so switching and blending modes costs nothing but a uniform upload.
+     */
+    class ModalBasis {
+    public:
+        ModalBasis();
+
+        /**
+         * Deletes the basis buffer. Must run with the context current if `initialize` was called.
+         */
+        ~ModalBasis();
+
+        /**
+         * Sets the mode shapes. Must be called before `initialize`. Only the first mode is shown at first.
+         * @param modes DisplacementSequence. One frame per mode shape. At most `maxModes` modes are allowed.
+         * @param frequencies `std::vector<float>`. Animation frequency of every mode in Hz.
+         */
+        void setModes(const DisplacementSequence &modes, const std::vector<float> &frequencies);
+
+        /**
+         * Whether mode shapes were set.
+         */
+        bool isActive() const;
+
+        /**
+         * Reads every mode shape and uploads the basis. Must be called with a current context. Throws
+         * `std::runtime_error` if the basis exceeds `GL_MAX_TEXTURE_BUFFER_SIZE` texels.
+         * @param glFunc QOpenGLFunctions_3_3_Core. Resolved functions of the current context.
+         */
+        void initialize(QOpenGLFunctions_3_3_Core *glFunc);
+
+        /**
+         * Advances the phase of every mode if playing and recomputes the weights.
+         * @param dt float. Elapsed time in seconds.
+         */
+        void update(float dt);
+
+        /**
+         * Binds the basis to a texture unit.
+         */
+        void bindBasis(int unit);
+
+        /**
+         * Weights \f$w_k\f$ of the current frame, one per mode.
+         */
+        const std::vector<float> &getWeights() const;
+
+        /**
+         * Sets the amplitude \f$a_k\f$ of every mode, e.g. to blend several modes.
+         * @param amplitudes `std::vector<float>`. One amplitude per mode.
+         */
+        void setAmplitudes(const std::vector<float> &amplitudes);
+
+        /**
+         * Shows a single mode at unit amplitude. Modes outside the basis are ignored.
+         */
+        void soloMode(size_t mode);
+
+        /**
+         * Superposes every mode at unit amplitude.
+         */
+        void superposeAll();
+
+        void setPlaying(bool isPlaying);
+
+        bool isPlaying() const;
+
+        size_t modeCount() const;
+
+        /**
+         * Texels occupied by one mode in the basis.
+         */
+        size_t modeStride() const;
+
+        /**
+         * Bytes of video memory used by the basis.
+         */
+        size_t gpuBytes() const;
+
+        /**
+         * Evaluates the displacements shown in the current frame on the CPU. Reads the mode shapes from disk.
+         * @return displacements `std::vector<tresta::Displacement>`. One entry per node.
+         */
+        std::vector<Displacement> getDisplacements() const;
+
+        static const unsigned int maxModes;/**<Size of the `modeWeights` uniform array of the vertex shader.*/
+
+    private:
+        void updateWeights();
+
+        QOpenGLFunctions_3_3_Core *mGLFunc;
+        DisplacementSequence modes;
+        std::vector<float> frequencies;
+        std::vector<float> amplitudes;
+        std::vector<float> phases;/**<Phase \f$2 \pi f_k t + \pi / 2\f$ of every mode, wrapped to one period.*/
+        std::vector<float> weights;
+        GLuint buffer;
+        GLuint texture;
+        bool playing;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_MODAL_BASIS_H
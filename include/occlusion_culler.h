@@ -0,0 +1,147 @@
+#ifndef TRESTA_OCCLUSION_CULLER_H
+#define TRESTA_OCCLUSION_CULLER_H
+
+#include <QMatrix4x4>
+#include <QOpenGLShaderProgram>
+#include <vector>
+
+#include "containers.h"
+#include "memory_tracker.h"
+#include "shape.h"
+
+class QOpenGLFunctions_4_3_Core;
+
+namespace tresta {
+
+    /**
+     * Orders the elements so that elements that are close in space are also close in the returned list.
+     * @details Elements are sorted by the Morton code of their midpoint. Consecutive runs of the returned order
+     * are used as culling clusters, so a good spatial ordering gives tight cluster bounds.
+     *
+     * @param nodes `std::vector<tresta::Node>`. Node list.
+     * @param elems `std::vector<tresta::Elem>`. Element list.
+     * @return order `std::vector<unsigned int>`. Element indices in spatial order.
+     */
+    std::vector<unsigned int> computeSpatialElementOrder(const std::vector<Node> &nodes,
+                                                         const std::vector<Elem> &elems);
+
+    /**
+     * @brief Two-pass hierarchical-Z occlusion culling for instanced meshes.
+     * @details Instances are grouped into clusters of spatially neighbouring elements. Each frame the clusters that were
+     * visible in the previous frame are drawn first. The resulting depth buffer is then reduced into a max-depth mip
+     * pyramid, and the bounds of every cluster are tested against the pyramid in a compute shader. Clusters that became
+     * visible are drawn in a second pass. All draws go through `glMultiDrawElementsIndirect`, so visibility is never
+     * read back to the CPU. Requires OpenGL 4.3; `initialize` returns `false` on older contexts and the culler must
+     * not be used.
+     *
+     * Instance attribute buffers must be uploaded in cluster order, i.e. instance `k` of the buffers must hold
+     * instance `k % instancesPerElement` of element `elementOrder[k / instancesPerElement]`.
+     */
+    class OcclusionCuller {
+    public:
+        /**
+         * @brief Constructor
+         * @param numMeshes unsigned int. Number of independently culled instanced meshes.
+         */
+        OcclusionCuller(unsigned int numMeshes);
+
+        ~OcclusionCuller();
+
+        /**
+         * Resolves the OpenGL 4.3 functions and compiles the compute shaders. Must be called with a current context.
+         * @return supported bool. `false` if the context does not provide OpenGL 4.3.
+         */
+        bool initialize();
+
+        /**
+         * Whether `initialize` succeeded and culling can be used.
+         */
+        bool isSupported() const;
+
+        /**
+         * Reallocates the depth pyramid to match the viewport size.
+         * @param width Viewport width.
+         * @param height Viewport height.
+         */
+        void resize(int width, int height);
+
+        /**
+         * Builds the culling clusters of a mesh and uploads their bounds and draw commands.
+         * @details Visibility history of the mesh is reset, so the next frame draws every cluster in the second pass.
+         *
+         * @param mesh unsigned int. Index of the mesh on the range `[0, numMeshes)`.
+         * @param shape Shape. The instanced shape. Its vertices define the local bounding box of each instance.
+         * @param matrices `std::vector<QMatrix4x4>`. Instance transforms in element order.
+         * @param elementOrder `std::vector<unsigned int>`. Element order used for the instance buffers.
+         * @param instancesPerElement unsigned int. Number of consecutive instances belonging to each element.
+         */
+        void setInstances(unsigned int mesh,
+                          const Shape &shape,
+                          const std::vector<QMatrix4x4> &matrices,
+                          const std::vector<unsigned int> &elementOrder,
+                          unsigned int instancesPerElement);
+
+        /**
+         * Draws the clusters of `mesh` that were visible last frame.
+         * The shape's VAO, the shader and the instance attributes must be bound by the caller.
+         */
+        void drawFirstPass(unsigned int mesh);
+
+        /**
+         * Copies the depth buffer of the current read framebuffer and reduces it into the max-depth pyramid.
+         */
+        void buildDepthPyramid();
+
+        /**
+         * Tests the clusters of `mesh` against the view frustum and the depth pyramid.
+         * @details Leaves the compute program bound; callers must rebind their shader before drawing.
+         * @param mesh unsigned int. Index of the mesh.
+         * @param viewProjection QMatrix4x4. Matrix taking instance space positions to clip space.
+         */
+        void cull(unsigned int mesh, const QMatrix4x4 &viewProjection);
+
+        /**
+         * Draws the clusters of `mesh` that became visible this frame.
+         * The shape's VAO, the shader and the instance attributes must be bound by the caller.
+         */
+        void drawSecondPass(unsigned int mesh);
+
+        /**
+         * Draws every cluster of `mesh` found visible by the last call to `cull`.
+         * Used to redraw the same geometry with a different shader, e.g. after a depth pre-pass.
+         */
+        void drawVisible(unsigned int mesh);
+
+    private:
+        struct ClusterSet {
+            ClusterSet() : numClusters(0), boundsBuffer(0), firstPassBuffer(0), secondPassBuffer(0), gpuBytes(0) {};
+
+            GLsizei numClusters;
+            GLuint boundsBuffer;/**<Two `vec4`s per cluster: `[min.xyz, instanceCount]` and `[max.xyz, 0]`.*/
+            GLuint firstPassBuffer;/**<Indirect commands for the clusters visible last frame.*/
+            GLuint secondPassBuffer;/**<Indirect commands for the clusters that became visible this frame.*/
+            size_t gpuBytes;/**<Storage of the three buffers.*/
+        };
+
+        void drawCommands(const ClusterSet &clusters, GLuint commandBuffer);
+
+        QOpenGLFunctions_4_3_Core *mGLFunc;
+        QOpenGLShaderProgram mPyramidShader;
+        QOpenGLShaderProgram mCullShader;
+
+        std::vector<ClusterSet> clusterSets;
+        TrackedBytes trackedBuffers;/**<Counts the buffers of all cluster sets.*/
+
+        GLuint depthTexture;
+        GLuint pyramidTexture;
+        int viewportWidth;
+        int viewportHeight;
+        int pyramidLevels;
+        bool supported;
+
+        static const unsigned int elementsPerCluster;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_OCCLUSION_CULLER_H
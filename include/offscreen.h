@@ -0,0 +1,75 @@
+#ifndef TRESTA_OFFSCREEN_H
+#define TRESTA_OFFSCREEN_H
+
+#include <QSize>
+#include <QVector3D>
+
+#include "color_dialog.h"
+#include "containers.h"
+#include "scalar_field.h"
+#include "truss_scene.h"
+
+class QOffscreenSurface;
+class QOpenGLContext;
+
+namespace tresta {
+
+    /**
+     * @brief View options shared by the command line tools that render without a window, `tresta-render` and
+     * `tresta-render-bench`.
+     */
+    struct ViewOptions {
+        explicit ViewOptions(const QSize &defaultSize) :
+                size(defaultSize),
+                sizeSet(false),
+                rotation(30.0f, -30.0f, 0.0f),
+                distance(1.0f),
+                shadingMode(TrussScene::FORWARD_SHADING),
+                shadingModeSet(false) {}
+
+        QSize size;
+        bool sizeSet;/**<Whether `-r` was given.*/
+        QVector3D rotation;/**<Degrees about x, y and z.*/
+        float distance;/**<Relative to the distance that fits the job.*/
+        TrussScene::ShadingMode shadingMode;
+        bool shadingModeSet;/**<Whether `-m` was given.*/
+    };
+
+    /**
+     * Whether `flag` is one of the view options `-r`, `-c`, `-z` and `-m`.
+     */
+    bool isViewOption(const char *flag);
+
+    /**
+     * Parses a view option: `-r WIDTHxHEIGHT`, `-c RX,RY,RZ` in degrees, `-z` distance relative to the one that
+     * fits, or `-m forward|prepass|deferred`. Returns `false` if the value is invalid.
+     */
+    bool parseViewOption(const char *flag, const char *value, ViewOptions &view);
+
+    /**
+     * Looks up a shading mode by its command line name: `forward`, `prepass` or `deferred`. Returns `false` if the
+     * name is unknown.
+     */
+    bool parseShadingMode(const char *name, TrussScene::ShadingMode &mode);
+
+    /**
+     * Colors of a freshly opened window: the color dialog defaults, plus the user colors or the scalar field
+     * of the config if it has them.
+     */
+    ColorSettings defaultColorSettings(const Job &job, const ScalarStatistics &statistics);
+
+    /**
+     * Selects the `offscreen` platform plugin unless one is chosen explicitly, so no display is needed. Must be
+     * called before the application is created.
+     */
+    void useOffscreenPlatform();
+
+    /**
+     * Creates a 4.1 core context with a 24-bit depth and 8-bit stencil buffer for `surface` and makes it current.
+     * The format also becomes the default one. Prints an error and returns `false` if that fails.
+     */
+    bool createOffscreenContext(QOffscreenSurface &surface, QOpenGLContext &context);
+
+} // namespace tresta
+
+#endif // TRESTA_OFFSCREEN_H
@@ -4,41 +4,107 @@
 #include "containers.h"
 #include "shape.h"
 
+#include <QByteArray>
 #include <QWidget>
 #include <QMatrix4x4>
 #include <QProgressDialog>
-#include <QMutex>
+#include <atomic>
 
 namespace tresta {
 
+    class PlyChunkQueue;
+
+    /**
+     * @brief Writes instanced meshes to PLY files with bounded memory.
+     * @details The vertex and face counts of the header follow from the number of instances and the size of the
+     * shape, or from a counting pass over welded meshes, so the file is streamed: a producer thread splits the
+     * instances into chunks that are transformed and encoded concurrently on the global thread pool, and hands the
+     * finished chunks, in file order, to a writer thread through a bounded queue. At most a few chunks exist at any
+     * time, whatever the size of the model; welded chunks are therefore welded again for the vertex and the face
+     * pass rather than kept from the counting pass.
+     *
+     * The workers report progress through atomic counters that the GUI thread polls while it keeps the progress
+     * dialog responsive, and they check for cancellation between batches of instances.
+     */
     class PlyExporter : public QWidget
     {
     Q_OBJECT
     public:
+        /**
+         * Encoding of the exported file.
+         */
+        enum Format {
+            ASCII,/**<`format ascii 1.0`, readable by any PLY reader.*/
+            BINARY_LITTLE_ENDIAN/**<`format binary_little_endian 1.0`, several times smaller and faster to write.*/
+        };
+
         PlyExporter(QWidget* parent=0);
-        PlyExporter( const PlyExporter& other ) {};
+        PlyExporter(const PlyExporter &other) = delete;
+
+        void setFormat(Format format);
+
+        /**
+         * Whether to add `red`, `green`, `blue` and `alpha` vertex properties from `Job::colors`. Ignored if the job
+         * has no colors.
+         */
+        void setIncludeColors(bool include);
+
+        /**
+         * Whether to write every element as one welded tube instead of a closed copy of the shape per instance.
+         * The segments of an element share the ring vertices that coincide within the tolerance, the caps between
+         * segments and at joints of several elements are dropped, and faces that collapse are skipped. Caps remain
+         * at free ends. Welds never join different elements.
+         *
+         * @param weld bool.
+         * @param tolerance float. Weld distance as a fraction of the radius of the shape.
+         */
+        void setWelded(bool weld, float tolerance = 0.25f);
+
+        /**
+         * Whether to show a modal progress dialog that can cancel the export. Without it the calling thread just
+         * blocks until the files are written and no events are processed, e.g. for benchmarks.
+         */
+        void setShowProgress(bool show);
 
         void operator() (const QString& fileName, const QString& description, const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector);
 
         void exportPly(const QString& fileName, const QString& description, const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector);
 
-    private:
-        bool createPlyVertices(const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector);
-        bool createPlyFaces(const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector);
-        void saveFile(const QString& fileName);
+        /**
+         * A file to write and the instances it contains.
+         */
+        struct Mesh {
+            QString fileName;/**<Skipped if empty.*/
+            const std::vector<QMatrix4x4>* vertexViewVector;
+        };
+
+        /**
+         * @brief Writes several meshes of the same shape at once, e.g. the original and the deformed mesh.
+         * @details All files are encoded concurrently on the shared thread pool and written by their own writer
+         * threads, behind a single progress dialog that reports the combined progress and cancels all of them.
+         * @param meshes `std::vector<Mesh>`. Files to write.
+         * @param description QString. First line of the progress dialog.
+         * @param shape Shape. Mesh drawn by every instance.
+         * @param job Job. Supplies the element colors.
+         */
+        void exportMeshes(const std::vector<Mesh>& meshes, const QString& description, const Shape* shape, const Job& job);
 
+    private:
         void handleCancelledExport();
-        
-        template <typename T>
-        void write2DVector(QTextStream & outStream, const std::vector<T> &data);
 
-        std::vector<std::vector<float>> vertices;
-        std::vector<std::vector<unsigned int>> faces;
+        std::vector<unsigned char> elementColors;/**<RGBA of every element if colors are exported.*/
+
+        Format format;
+        bool includeColors;
+        bool welded;
+        float weldTolerance;
+        bool showProgress;
 
-        QProgressDialog* progress;
-        QMutex progressMutex;
+        QProgressDialog* progress;/**<Shown while an export runs, null otherwise.*/
+        std::atomic<size_t> workDone;/**<Instances encoded so far in all files, counted once for vertices and once for faces.*/
+        std::atomic<bool> cancelRequested;
     };
 
 } // namespace tresta
 
-#endif // TRESTA_PLY_EXPORTER_H
\ No newline at end of file
+#endif // TRESTA_PLY_EXPORTER_H
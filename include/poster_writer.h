@@ -0,0 +1,89 @@
+#ifndef TRESTA_POSTER_WRITER_H
+#define TRESTA_POSTER_WRITER_H
+
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+namespace tresta {
+
+    /**
+     * @brief Writes an image too large to hold in memory as a TIFF file, one band of rows at a time.
+     * @details Bands are split into strips of `rowsPerStrip` rows that are compressed independently with Deflate
+     * and horizontal differencing, in parallel on the global thread pool, and appended to the file in order by a
+     * writer thread. Only the queued bands are held in memory, so posters of any size up to 4 GiB of compressed
+     * data can be assembled from tiles. `submit` waits while the queue is full, which paces the renderer to the
+     * encoder.
+     */
+    class PosterWriter {
+    public:
+        static const int rowsPerStrip = 64;/**<Every band except the last must be a multiple of this many rows.*/
+
+        PosterWriter();
+
+        /**
+         * Waits for the queued bands, see `close`.
+         */
+        ~PosterWriter();
+
+        /**
+         * Creates the file and starts the writer thread. Throws `std::runtime_error` if the file cannot be created.
+         * @param fileName QString. File to write, usually with the extension `.tif`.
+         * @param width int. Width of the image in pixels.
+         * @param height int. Height of the image in pixels.
+         * @param compressionLevel int. zlib level from 0 (fastest) to 9 (smallest), -1 for the default.
+         */
+        void open(const QString &fileName, int width, int height, int compressionLevel = -1);
+
+        /**
+         * Queues the next rows of the image, waiting while the queue is full.
+         * @param band QImage. `RGB888` rows of the full width, following the rows submitted before.
+         */
+        void submit(const QImage &band);
+
+        /**
+         * Waits until every band has been written and finishes the file.
+         */
+        void close();
+
+        /**
+         * Returns and clears the first error of the writer, or an empty string.
+         */
+        QString takeError();
+
+    private:
+        class Writer;
+
+        bool pop(QImage &band);
+        void writeBand(const QImage &band);
+        void writeDirectory();
+        void reportError(const QString &message);
+
+        QMutex mutex;
+        QWaitCondition notEmpty;
+        QWaitCondition notFull;
+        std::deque<QImage> bands;
+        bool closed;
+        QString errorMessage;
+
+        QFile file;/**<Writer thread only once opened.*/
+        int width;
+        int height;
+        int compressionLevel;
+        int rowsSubmitted;
+        bool failed;/**<Writer thread only; stops writing after an error.*/
+        std::vector<quint32> stripOffsets;
+        std::vector<quint32> stripByteCounts;
+        std::unique_ptr<QThread> writer;
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_POSTER_WRITER_H
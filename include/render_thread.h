@@ -0,0 +1,173 @@
+#ifndef TRESTA_RENDER_THREAD_H
+#define TRESTA_RENDER_THREAD_H
+
+#include <QThread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+
+#include "demo_dialog.h"
+#include "frame_capture.h"
+#include "frame_stream.h"
+#include "image_encoder_pool.h"
+#include "spsc_queue.h"
+
+class QOpenGLContext;
+class QWindow;
+
+namespace tresta {
+
+    class TrussScene;
+
+    /**
+     * @brief Renders a scene on a dedicated thread with its own current OpenGL context.
+     * @details The GUI thread never touches the scene or the context once the thread is started. Camera input and
+     * scene changes are posted with `enqueue` and executed on the render thread between frames, in the order they
+     * were posted. The queue is lock-free, so posting from the GUI thread never waits on a frame being drawn.
+     */
+    class RenderThread : public QThread {
+    Q_OBJECT
+    public:
+        typedef std::function<void()> Command;
+
+        /**
+         * @brief Constructor
+         * @details Creates the OpenGL context for `surface` and moves it to the render thread.
+         * @param surface QWindow. Window rendered to. Must outlive the thread.
+         * @param scene TrussScene. Scene to render. Ownership is taken; the scene is destroyed on the render thread.
+         */
+        RenderThread(QWindow *surface, TrussScene *scene);
+
+        ~RenderThread();
+
+        /**
+         * Posts a command to run on the render thread before the next frame. Must only be called from the GUI thread.
+         * @details If the queue is full the caller yields until the render thread has drained some commands.
+         * @param command Command. Function to execute with the context current.
+         */
+        void enqueue(Command command);
+
+        /**
+         * Runs `getter` on the render thread after the commands posted so far and returns its result. Must only be
+         * called from the GUI thread, which waits for the result.
+         * @details An exception thrown by `getter` is rethrown to the caller. Throws `std::runtime_error` if the
+         * render loop is not running or stops before the command ran, e.g. after the scene failed to initialize.
+         * @param getter `std::function<T()>`. Function to execute with the context current.
+         */
+        template <typename T>
+        T query(std::function<T()> getter);
+
+        /**
+         * Resizes the scene to the window. While demo mode is active the scene keeps the size of the demo frames
+         * and the new size only applies to how they are shown.
+         */
+        void resize(int width, int height);
+
+        /**
+         * Starts or stops saving one frame per demo step.
+         * @details Demo frames are rendered into an offscreen framebuffer of the chosen size, independent of the
+         * window, shown scaled in the window, read back asynchronously and either encoded by a pool of worker
+         * threads or written to a single stream. Disabling saves the frames still in flight.
+         * @param enabled bool. Whether demo mode is active. Disabling restarts the next demo at frame zero.
+         * @param settings DemoSettings. Where and how the frames are saved.
+         */
+        void setDemo(bool enabled, const DemoSettings &settings = DemoSettings());
+
+        /**
+         * Shows or hides the frame timings on top of the window and records them while shown.
+         * @details The overlay shows the CPU and per-pass GPU times, averaged over the last frames, the instance,
+         * triangle and draw call counts of the last frame, and a histogram of the recent frame times with their
+         * 50th, 95th and 99th percentiles. It is not drawn into demo frames.
+         * @param enabled bool. Whether the overlay is shown.
+         */
+        void setStatsOverlay(bool enabled);
+
+        /**
+         * Sets whether the window is exposed. Frames are only drawn while it is.
+         */
+        void setExposed(bool isExposed);
+
+        /**
+         * Whether the context supports occlusion culling. Only valid once the scene has been initialized.
+         */
+        bool isCullingSupported() const;
+
+        /**
+         * Asks the render loop to finish after the current frame. Call `wait` afterwards.
+         */
+        void stop();
+
+    signals:
+        /**
+         * Emitted on the render thread when a command or a demo frame failed, e.g. because the disk is full or the
+         * pipe a demo is streamed to was closed. Demo mode has been left by then. Connect with a queued connection.
+         * @param message QString. What failed.
+         * @param fatal bool. Whether the context or the scene could not be initialized, so nothing will be drawn.
+         */
+        void renderFailed(const QString &message, bool fatal);
+
+    protected:
+        void run();
+
+    private:
+        void drainCommands();
+        void reportFailure(const std::exception &e);
+        void abortDemo();
+        void captureDemoFrame();
+        bool saveDemoFrame(bool wait);
+        void drawStatsOverlay();
+        void printContextInfos();
+
+        QWindow *mSurface;
+        QOpenGLContext *mContext;
+        TrussScene *mScene;
+        SpscQueue<Command> commands;
+
+        std::atomic<bool> running;
+        std::atomic<bool> exposed;
+        std::atomic<bool> cullingSupported;
+
+        bool demoMode;/**<Render thread only; changed through `setDemo`.*/
+        int currDemoFrame;
+        DemoSettings demoSettings;
+        FrameCapture capture;/**<Offscreen target of demo frames.*/
+        ImageEncoderPool encoders;/**<Saves the captured frames off the render thread.*/
+        FrameStream stream;/**<Streams the captured frames instead, if open.*/
+        int windowWidth;/**<Render thread only; changed through `resize`.*/
+        int windowHeight;
+        bool statsOverlay;/**<Render thread only; changed through `setStatsOverlay`.*/
+
+        static const int frameIntervalMs;
+    };
+
+    template <typename T>
+    T RenderThread::query(std::function<T()> getter) {
+        if (!running)
+            throw std::runtime_error("The renderer is not running.");
+
+        // shared with the command, which may still be queued when the caller gives up
+        std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+        std::future<T> future = promise->get_future();
+        enqueue([promise, getter]() {
+            try {
+                promise->set_value(getter());
+            }
+            catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+
+        while (future.wait_for(std::chrono::milliseconds(frameIntervalMs)) != std::future_status::ready) {
+            if (!running)
+                throw std::runtime_error("The renderer stopped before the request was handled.");
+        }
+        return future.get();
+    }
+
+} // namespace tresta
+
+#endif // TRESTA_RENDER_THREAD_H
@@ -0,0 +1,51 @@
+#ifndef TRESTA_SCALAR_FIELD_H
+#define TRESTA_SCALAR_FIELD_H
+
+#include <string>
+#include <vector>
+
+namespace tresta {
+
+    /**
+     * @brief Summary of a scalar field used to choose the default color range.
+     */
+    struct ScalarStatistics {
+        ScalarStatistics() : count(0), min(0.0f), max(0.0f), lowPercentile(0.0f), highPercentile(0.0f) {};
+
+        size_t count;/**<Number of finite values in the field.*/
+        float min;/**<Smallest finite value.*/
+        float max;/**<Largest finite value.*/
+        float lowPercentile;/**<Value below which the lower percentile fraction of the field lies.*/
+        float highPercentile;/**<Value below which the upper percentile fraction of the field lies.*/
+    };
+
+    /**
+     * Computes the range and percentile limits of a scalar field.
+     * @details The field is split into one chunk per hardware thread. Each chunk is reduced to its minimum and maximum
+     * and then to a fixed size histogram over the global range, so the percentiles are exact to within one histogram
+     * bin (1/4096 of the range) without sorting the field. Non-finite values are ignored.
+     *
+     * @param values `std::vector<float>`. Scalar field.
+     * @param lowFraction float. Lower percentile on the range `[0, 1]`.
+     * @param highFraction float. Upper percentile on the range `[0, 1]`.
+     * @return statistics `tresta::ScalarStatistics`.
+     */
+    ScalarStatistics computeScalarStatistics(const std::vector<float> &values,
+                                             float lowFraction = 0.02f,
+                                             float highFraction = 0.98f);
+
+    /**
+     * Names of the built-in colormaps in the order of the rows returned by `buildColormapTexels`.
+     */
+    const std::vector<std::string> &colormapNames();
+
+    /**
+     * Samples every built-in colormap into an RGBA8 image with one row per colormap.
+     * @param width unsigned int. Number of texels per colormap.
+     * @return texels `std::vector<unsigned char>`. `4 * width * colormapNames().size()` bytes, row-major.
+     */
+    std::vector<unsigned char> buildColormapTexels(unsigned int width);
+
+} // namespace tresta
+
+#endif // TRESTA_SCALAR_FIELD_H
@@ -44,6 +44,36 @@ namespace tresta {
      */
     std::vector<Displacement> createDisplacementVecFromJSON(const rapidjson::Document &config_doc);
 
+    /**
+     * Expands the "displacements" key of `config_doc` into the files of a displacement time series.
+     * @details The key may hold an array of CSV files, a file pattern containing `*` or `?` (matching files are
+     * sorted in natural order, so `frame_2.csv` precedes `frame_10.csv`), a single stacked binary file with the
+     * extension `.bin`, or a compressed `DisplacementContainer` with the extension `.tdc`. A single CSV file is not
+     * a time series, and `createJobFromJSON` loads a series of one frame as static displacements.
+     *
+     * @param config_doc `rapidjson::Document`. Document storing the displacement files.
+     * @return frames `std::vector<std::string>`. Frame files in playback order; empty if there is no time series.
+     */
+    std::vector<std::string> createDisplacementFramesFromJSON(const rapidjson::Document &config_doc);
+
+    /**
+     * Expands the "modes" key of `config_doc` into the files of the mode shapes to superpose.
+     * @details Accepts the same forms as a displacement time series; a single CSV file holds one mode.
+     *
+     * @param config_doc `rapidjson::Document`. Document storing the mode shape files.
+     * @return modes `std::vector<std::string>`. Mode shape files; empty if the key is absent.
+     */
+    std::vector<std::string> createModeShapesFromJSON(const rapidjson::Document &config_doc);
+
+    /**
+     * Reads the optional "mode_frequencies" key of `config_doc`.
+     *
+     * @param config_doc `rapidjson::Document`. Document storing one frequency in Hz per mode.
+     * @param num_modes size_t. Number of mode shapes.
+     * @return frequencies `std::vector<float>`. One frequency per mode; 1 Hz for every mode if the key is absent.
+     */
+    std::vector<float> createModeFrequenciesFromJSON(const rapidjson::Document &config_doc, size_t num_modes);
+
     /**
      * Parses the file indicated by the "colors" key in `config_doc` into a vector of `QColor`'s.
      *
@@ -53,6 +83,24 @@ namespace tresta {
      */
     std::vector<QColor> createColorVecFromJSON(const rapidjson::Document &config_doc);
 
+    /**
+     * Parses the file indicated by the "scalars" key in `config_doc` into a scalar field.
+     * @details The optional "scalar_location" key selects whether the field is given per `"elements"` or per `"nodes"`.
+     * If it is absent, the location is inferred from the number of rows. The optional "scalar_column" key selects
+     * the column to read from each row and defaults to the first one.
+     *
+     * @param config_doc `rapidjson::Document`. Document storing the file name of the csv file that contains
+     *                    the scalar field.
+     * @param num_nodes size_t. Number of nodes in the job.
+     * @param num_elems size_t. Number of elements in the job.
+     * @param location `tresta::ScalarLocation`. Set to the location of the returned field.
+     * @return scalars. `std::vector<float>`. Empty if the "scalars" key is not present.
+     */
+    std::vector<float> createScalarVecFromJSON(const rapidjson::Document &config_doc,
+                                               size_t num_nodes,
+                                               size_t num_elems,
+                                               ScalarLocation &location);
+
     /**
      * Constructs the deformed elemental positions based on interpolation of nodal displacements.
      *
@@ -6,6 +6,8 @@
 
 #include <vector>
 
+#include "memory_tracker.h"
+
 namespace tresta {
 
     class Shape
@@ -14,16 +16,26 @@ namespace tresta {
         Shape();
         virtual ~Shape() {};
         virtual void initialize() = 0;
-        void prepareVertexBuffers();
+
+        /**
+         * Uploads the vertex, normal and index buffers.
+         * @param compact bool. If `true` positions are stored as normalized 16-bit integers scaled by
+         *        `positionScale` and normals as octahedral encoded normalized 16-bit pairs; otherwise both are floats.
+         *        May be called again to switch the encoding.
+         */
+        void prepareVertexBuffers(bool compact = false);
 
         std::vector<float> vertices;
         std::vector<float> normals;
         std::vector<unsigned short> indices;
 
+        float positionScale;/**<Largest absolute vertex coordinate. Compact positions are multiplied by it when decoded.*/
+
         QOpenGLVertexArrayObject mVAO;
         QOpenGLBuffer mVertexPositionBuffer;
         QOpenGLBuffer mVertexNormalBuffer;
         QOpenGLBuffer mIndexBuffer;
+        GpuBufferAccount gpuBuffers;/**<Counts the buffers above.*/
     };
 
 } // namespace tresta
@@ -0,0 +1,71 @@
+#ifndef TRESTA_SPSC_QUEUE_H
+#define TRESTA_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace tresta {
+
+    /**
+     * @brief Bounded lock-free queue for exactly one producer thread and one consumer thread.
+     * @details Items live in a power of two ring buffer. The producer only writes `tail` and the consumer only writes
+     * `head`, so neither side ever waits on a lock; a release store of the index publishes the slot to the other side.
+     */
+    template <typename T>
+    class SpscQueue {
+    public:
+        /**
+         * @brief Constructor
+         * @param capacity size_t. Minimum number of items the queue can hold. Rounded up to a power of two.
+         */
+        explicit SpscQueue(size_t capacity) : head(0), tail(0) {
+            size_t size = 1;
+            while (size < capacity)
+                size <<= 1;
+            items.resize(size);
+            mask = size - 1;
+        }
+
+        /**
+         * Appends an item. Must only be called from the producer thread.
+         * @param item T. Item to move into the queue.
+         * @return pushed bool. `false` if the queue is full; `item` is left untouched.
+         */
+        bool push(T &&item) {
+            const size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == items.size())
+                return false;
+
+            items[t & mask] = std::move(item);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Removes the oldest item. Must only be called from the consumer thread.
+         * @param item T. Receives the removed item.
+         * @return popped bool. `false` if the queue is empty.
+         */
+        bool pop(T &item) {
+            const size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire))
+                return false;
+
+            item = std::move(items[h & mask]);
+            items[h & mask] = T();
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::vector<T> items;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head;/**<Next slot to pop. Written by the consumer only.*/
+        alignas(64) std::atomic<size_t> tail;/**<Next slot to push. Written by the producer only.*/
+    };
+
+} // namespace tresta
+
+#endif // TRESTA_SPSC_QUEUE_H
@@ -0,0 +1,98 @@
+#ifndef TRESTA_TRACE_H
+#define TRESTA_TRACE_H
+
+#include <atomic>
+#include <string>
+
+namespace tresta {
+
+    /**
+     * @brief Records how long the stages of loading and initializing a job take, as Chrome trace events.
+     * @details Stages are marked with `TRESTA_TRACE_SCOPE` and may run on any thread. While not recording, a scope
+     * costs one relaxed atomic load; builds configured without `TRESTA_TRACING` compile the scopes away entirely.
+     * The file is written in the JSON object format of the Trace Event format, which `chrome://tracing` and
+     * Perfetto open.
+     */
+    class Tracer {
+    public:
+        /**
+         * Starts recording. Events recorded before are discarded.
+         * @param fileName std::string. JSON file written by `stop`.
+         */
+        static void start(const std::string &fileName);
+
+        /**
+         * Starts recording if the environment variable `TRESTA_TRACE` names the file to write.
+         */
+        static void startFromEnvironment();
+
+        /**
+         * Stops recording and writes the recorded events. Does nothing if not recording.
+         * Throws `std::runtime_error` if the file cannot be written.
+         */
+        static void stop();
+
+        static bool isEnabled() {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Names the calling thread in the trace, e.g. `render`. The thread calling `start` is named `main`.
+         */
+        static void nameThread(const char *name);
+
+        /**
+         * Nanoseconds on the monotonic clock the events are measured with.
+         */
+        static long long now();
+
+        /**
+         * Adds an event that ran from `startNs` to `endNs` on the calling thread.
+         * @param name char. Name of the stage. Must be a string literal; it is not copied.
+         * @param detail char. Optional argument shown with the event, e.g. the file read. Copied, may be `nullptr`.
+         */
+        static void record(const char *name, const char *detail, long long startNs, long long endNs);
+
+    private:
+        static std::atomic<bool> enabled;
+    };
+
+    /**
+     * @brief Records the lifetime of the scope as one event, if the tracer is recording when it begins.
+     */
+    class TraceScope {
+    public:
+        explicit TraceScope(const char *_name, const char *_detail = nullptr) :
+                name(_name),
+                detail(_detail),
+                startNs(Tracer::isEnabled() ? Tracer::now() : -1) {}
+
+        ~TraceScope() {
+            if (startNs >= 0)
+                Tracer::record(name, detail, startNs, Tracer::now());
+        }
+
+    private:
+        TraceScope(const TraceScope &);
+        TraceScope &operator=(const TraceScope &);
+
+        const char *name;
+        const char *detail;
+        const long long startNs;
+    };
+
+} // namespace tresta
+
+#define TRESTA_TRACE_CONCAT_IMPL(a, b) a##b
+#define TRESTA_TRACE_CONCAT(a, b) TRESTA_TRACE_CONCAT_IMPL(a, b)
+
+#ifdef TRESTA_TRACING
+/**
+ * Traces the rest of the enclosing scope as a stage named by a string literal, with an optional detail string.
+ */
+#define TRESTA_TRACE_SCOPE(...) tresta::TraceScope TRESTA_TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+#else
+#define TRESTA_TRACE_SCOPE(...) do {} while (0)
+#endif
+
+#endif // TRESTA_TRACE_H
@@ -2,39 +2,93 @@
 #define TRESTA_TRUSS_SCENE
 
 #include <QMatrix4x4>
+#include <QRect>
 #include <QOpenGLFunctions_3_3_Core>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
 #include <QVector3D>
+#include <memory>
+#include <string>
 
 #include "abstract_scene.h"
 #include "containers.h"
 #include "color_dialog.h"
 #include "cylinder.h"
+#include "displacement_playback.h"
+#include "frame_profiler.h"
+#include "memory_tracker.h"
+#include "modal_basis.h"
+#include "gbuffer.h"
+#include "occlusion_culler.h"
+#include "scalar_field.h"
 #include "sphere.h"
 
 namespace tresta {
 
+    /**
+     * @brief Scene data needed to export the meshes without touching the render thread's state.
+     * @details The job and the transforms of the original mesh never change once the scene is built, so they are
+     * shared with the scene rather than copied; only the transforms of the deformed mesh are copied.
+     */
+    struct SceneSnapshot {
+        std::shared_ptr<const Job> job;/**<Job as loaded, without node strips.*/
+        std::shared_ptr<const std::vector<QMatrix4x4>> vertexViewVector;/**<Instance transforms of the original mesh.*/
+        std::vector<QMatrix4x4> deformedVertexViewVector;/**<Instance transforms of the deformed mesh.*/
+    };
+
+    /**
+     * @brief Shader programs of a scene.
+     * @details Compiled and linked by the first scene initialized with them. Scenes rendered one after another
+     * with the same context, e.g. by a batch renderer, can share one instance to skip compiling the shaders again.
+     * Must be destroyed with its context current.
+     */
+    struct ScenePrograms {
+        ScenePrograms() : linked(false) {}
+
+        QOpenGLShaderProgram sphere;
+        QOpenGLShaderProgram cylinder;
+        QOpenGLShaderProgram depth;
+        QOpenGLShaderProgram gbuffer;
+        QOpenGLShaderProgram lighting;
+        bool linked;/**<Whether the programs have been built.*/
+    };
+
     class TrussScene : public QObject, public AbstractScene
             {
     Q_OBJECT
-    public slots:
+    public:
         /**
-         * Sets the vertex buffer object containing the mesh's original color to the current original color
-         * specified by the color dialog.
+         * How fragments of the opaque meshes are shaded. Transparent meshes are always shaded forward.
          */
-        void updateOrigColorBuffer();
+        enum ShadingMode {
+            FORWARD_SHADING,/**<Every rasterized fragment is lit.*/
+            DEPTH_PREPASS_SHADING,/**<A depth-only pass runs first, so only the visible fragment of each pixel is lit.*/
+            DEFERRED_SHADING,/**<Color and normal are written to a G-buffer and lit once per pixel in a fullscreen pass.*/
+            NUM_SHADING_MODES
+        };
 
         /**
-         * Sets the vertex buffer object containing the mesh's deformed color to the current deformed color
-         * specified by the color dialog.
+         * Camera placement and display toggles, e.g. the state a recorded interaction session starts from.
          */
-        void updateDefColorBuffer();
+        struct ViewState {
+            ViewState() :
+                    deformationScale(1.0f),
+                    shadingMode(FORWARD_SHADING),
+                    renderOriginal(true),
+                    renderDeformed(true),
+                    cullingEnabled(false),
+                    compactAttributes(false) {}
+
+            QVector3D translation;
+            QVector3D rotation;/**<Degrees about x, y and z.*/
+            float deformationScale;
+            ShadingMode shadingMode;
+            bool renderOriginal;
+            bool renderDeformed;
+            bool cullingEnabled;
+            bool compactAttributes;
+        };
 
-        void updateTransparencyEnabled(bool);
-
-        void updateAlphaCutoff(float);
-
-    public:
         /**
          * @brief Constructor
          * @details Builds the vertices for the original and deformed positions
@@ -42,6 +96,18 @@ namespace tresta {
          */
         TrussScene(const Job &job, QObject *parent = nullptr);
 
+        /**
+         * @brief Constructor
+         * @details Same as above, but uses the given shader programs instead of its own.
+         * @param programs ScenePrograms. Programs shared with other scenes of the same context.
+         */
+        TrussScene(const Job &job, std::shared_ptr<ScenePrograms> programs, QObject *parent = nullptr);
+
+        /**
+         * Releases the OpenGL resources that are not freed by their own destructor. The context must be current.
+         */
+        ~TrussScene();
+
         /**
          * @brief Initializes OpenGL functions, vertex buffers, and rendering properties.
          */
@@ -72,8 +138,18 @@ namespace tresta {
         void resize(int width, int height);
 
         /**
-         * Looks for keys S, O, or D to either set the deformation scale, toggle rendering
-         * the original shape, and toggle the deformed shape, respectively.
+         * Like `resize`, but the viewport only shows `tile` of an image of `imageSize`, e.g. to assemble an image
+         * larger than the largest viewport from several renders. The projection is the off-axis part of the frustum
+         * of the whole image that covers the tile.
+         * @param tile QRect. Pixels of the image covered by the viewport, top row first. May extend past the image.
+         * @param imageSize QSize. Size of the whole image.
+         */
+        void resizeTile(const QRect &tile, const QSize &imageSize);
+
+        /**
+         * Looks for keys O, D, H, M, or Q to either toggle rendering the original shape, toggle the deformed shape,
+         * toggle occlusion culling, cycle the shading mode, and toggle the compact attribute encoding, respectively.
+         * Keys that need a dialog are handled by the window.
          * @param key [description]
          */
         void handleKeyEvent(int key);
@@ -101,7 +177,25 @@ namespace tresta {
 
 
         /**
-         * Recalcualtes the deformed positions based on the input deformation scale.
+         * Places the camera directly, without the inertia of mouse input, e.g. for rendering stills.
+         * @param rotation QVector3D. Rotations in degrees about the x, y and z axes, applied in that order.
+         * @param distance float. Camera distance relative to the initial one, which fits the whole job.
+         */
+        void setCameraView(const QVector3D &rotation, float distance);
+
+        /**
+         * Returns the camera placement without the inertia of mouse input still to come, and the display toggles.
+         */
+        ViewState getViewState() const;
+
+        /**
+         * Places the camera directly and applies the display toggles. Toggles the job or context cannot honor, e.g.
+         * culling without OpenGL 4.3 or a deformation scale without displacements, are left unchanged.
+         */
+        void setViewState(const ViewState &state);
+
+        /**
+         * Recalcualtes the deformed positions based on the input deformation scale and re-uploads them.
          * @param scale Multiplier for deformations.
          */
         void setDeformationScale(float scale);
@@ -112,26 +206,140 @@ namespace tresta {
          */
         float getDeformationScale() const;
 
+        /**
+         * Sets the colors, transparency and scalar coloring chosen in the color dialog.
+         * @details May be called before `initialize`; the settings are then applied on initialization.
+         * @param settings ColorSettings. Current state of the color dialog.
+         */
+        void setColorSettings(const ColorSettings &settings);
+
+        /**
+         * Returns the statistics of the job's scalar field. Computed on construction.
+         */
+        const ScalarStatistics &getScalarStatistics() const;
+
+        /**
+         * Shares the job and the transforms of the original mesh and copies those of the deformed mesh. While a
+         * displacement sequence or mode shapes are shown the deformed mesh is rebuilt from the frame on screen.
+         * @return snapshot SceneSnapshot.
+         */
+        SceneSnapshot getSnapshot();
+
+        /**
+         * Whether occlusion culling is available. Only valid after `initialize`.
+         */
+        bool isCullingSupported() const;
+
+        /**
+         * Selects how the opaque meshes are shaded.
+         * @param mode ShadingMode. Deferred shading allocates its G-buffer on the next rendered frame.
+         */
+        void setShadingMode(ShadingMode mode);
+
+        /**
+         * Returns the current shading mode.
+         * @return Shading mode
+         */
+        ShadingMode getShadingMode() const;
+
+        /**
+         * Selects the attribute encoding and re-uploads the vertex and instance buffers.
+         * @details The compact encoding stores instances as two endpoints quantized to 16 bits over the mesh bounds,
+         * user colors as normalized RGBA8, shape positions as normalized 16-bit integers and normals as octahedral
+         * encoded 16-bit pairs. The full encoding uses 32-bit floats and a 4x4 matrix per instance.
+         * The choice is remembered for the next loaded job.
+         * @param compact bool. Whether to use the compact encoding.
+         */
+        void setCompactAttributes(bool compact);
+
+        /**
+         * Whether the compact attribute encoding is used.
+         */
+        bool getCompactAttributes() const;
+
+        /**
+         * Video memory of the instance attributes per instance in the current encoding, of the shape vertices and
+         * of the displacement textures, one line each. Must be called with the context current.
+         */
+        std::string gpuMemorySummary();
+
+        /**
+         * CPU and GPU costs of the rendered frames. Disabled until enabled; only used on the render thread.
+         */
+        FrameProfiler &getProfiler();
+
     private:
+        friend class TrussSceneBenchmark;/**<Times the geometry builders without a context, see `tresta_bench`.*/
+
+        /**
+         * Instanced meshes drawn by the scene. The deformed mesh is drawn first.
+         */
+        enum MeshId {
+            DEFORMED_MESH,
+            ORIGINAL_MESH,
+            NUM_MESHES
+        };
+
+        /**
+         * Which instances of a mesh are drawn by `drawMesh`.
+         */
+        enum DrawPass {
+            ALL_INSTANCES,/**<Every instance, without culling.*/
+            CULL_FIRST_PASS,/**<Clusters that were visible last frame.*/
+            CULL_SECOND_PASS,/**<Clusters that became visible this frame.*/
+            CULL_VISIBLE/**<All clusters found visible by this frame's culling.*/
+        };
+
+        /**
+         * Maps the 16-bit endpoints of the compact instance encoding back to scene coordinates.
+         */
+        struct InstanceQuantization {
+            QVector3D boundsMin;
+            QVector3D boundsExtent;
+        };
+
         QOpenGLFunctions_3_3_Core *mGLFunc;
 
-        QOpenGLShaderProgram mSphereShader;
-        QOpenGLShaderProgram mCylinderShader;
+        std::shared_ptr<ScenePrograms> programs;
+        QOpenGLShaderProgram &mSphereShader;
+        QOpenGLShaderProgram &mCylinderShader;
+        QOpenGLShaderProgram &mDepthShader;
+        QOpenGLShaderProgram &mGBufferShader;
+        QOpenGLShaderProgram &mLightingShader;
 
         QMatrix4x4 modelview;
         QMatrix4x4 modelview_inv;
         QMatrix4x4 modelnormal;
         QMatrix4x4 projection;
-        std::vector<QMatrix4x4> vertexViewVector;
+        std::shared_ptr<const std::vector<QMatrix4x4>> vertexViewVector;/**<Built once, shared with snapshots.*/
         std::vector<QMatrix4x4> deformedVertexViewVector;
 
         std::vector<QOpenGLBuffer> vertexViewColBuffers;
         std::vector<QOpenGLBuffer> defVertexViewColBuffers;
         std::vector<std::string> vertexViewColNames = {"vertexViewCol1", "vertexViewCol2", "vertexViewCol3", "vertexViewCol4"};
 
-        QOpenGLBuffer origColorBuffer;
-        QOpenGLBuffer defColorBuffer;
         QOpenGLBuffer userColorBuffer;
+        QOpenGLBuffer defUserColorBuffer;
+        QOpenGLBuffer endpointBuffer;/**<Compact instance encoding of the original mesh.*/
+        QOpenGLBuffer defEndpointBuffer;/**<Compact instance encoding of the deformed mesh.*/
+        InstanceQuantization quantization[NUM_MESHES];
+        QOpenGLBuffer scalarBuffer;
+        QOpenGLBuffer defScalarBuffer;
+        QOpenGLBuffer animatedElementBuffer;/**<Undeformed endpoints, normal and nodes of every element when animated.*/
+        DisplacementPlayback playback;
+        ModalBasis modalBasis;
+        GLuint colormapTexture;/**<One row per built-in colormap, selected through the `colormapRow` uniform.*/
+
+        std::vector<unsigned int> elementOrder;/**<Spatial element order shared by all instance buffers.*/
+        unsigned int deformedSegmentsPerElement;
+        bool userColorsOpaque;
+        OcclusionCuller culler;
+        GBuffer gbuffer;
+        FrameProfiler profiler;
+        QOpenGLVertexArrayObject fullscreenVAO;
+        ShadingMode shadingMode;
+        int viewportWidth;
+        int viewportHeight;
 
         QVector3D camera_rot;
         QVector3D camera_trans;
@@ -143,12 +351,14 @@ namespace tresta {
         Node global_max_pos;
         Node global_centering_shift;
 
-        Job job;
+        std::shared_ptr<const Job> job;/**<Shared with snapshots; its node strips are moved to `node_strips`.*/
+        std::vector<std::vector<Node>> node_strips;/**<Deformed nodes of the current deformation scale.*/
 
         Sphere sphere;
         Cylinder cylinder;
 
-        ColorDialog colorDialog;
+        ScalarStatistics scalarStatistics;
+        ColorSettings colorSettings;
 
         float time;
         float camera_z0;
@@ -158,6 +368,15 @@ namespace tresta {
         bool renderOriginal;
         bool renderDeformed;
         bool displacementsProvided;
+        bool cullingEnabled;
+        bool compactAttributes;
+
+        GpuBufferAccount gpuBuffers;/**<Counts the instance, element and attribute buffers.*/
+        TrackedBytes trackedJob;
+        TrackedBytes trackedNodeStrips;
+        TrackedBytes trackedVertexView;
+        TrackedBytes trackedDeformedVertexView;
+        TrackedBytes trackedDisplacementTextures;
 
         void setCamera(float tx, float ty, float tz, float rx, float ry, float rz);
 
@@ -167,19 +386,54 @@ namespace tresta {
                                                         float x_scale_multiplier,
                                                         float z_scale_multiplier);
         void buildDeformedVertexViewVector();
+        std::vector<QMatrix4x4> buildStripMatrixVector(const std::vector<std::vector<Node>> &node_strips);
         void rebuildNodeStrips();
         void calcCenteringShift();
-        void exportJob();
         void prepareShaders();
-        void createVertexViewBuffers(const std::vector<QMatrix4x4>& viewVector, std::vector<QOpenGLBuffer>& viewBuffers);
+        void setRenderState();
+        void packVertexViewColumn(const std::vector<QMatrix4x4>& viewVector,
+                                  size_t column,
+                                  unsigned int instancesPerElement,
+                                  std::vector<float>& viewColVector) const;
+        void createVertexViewBuffers(const std::vector<QMatrix4x4>& viewVector,
+                                     std::vector<QOpenGLBuffer>& viewBuffers,
+                                     unsigned int instancesPerElement);
+        void createEndpointBuffer(const std::vector<QMatrix4x4>& viewVector,
+                                  QOpenGLBuffer &buffer,
+                                  unsigned int instancesPerElement,
+                                  InstanceQuantization &instanceQuantization);
+        void uploadInstanceTransforms(MeshId mesh);
+        void uploadDeformedInstances();
+        void createElementBuffer();
+        void uploadColorBuffers();
+        void setShapeAttributes();
+        void updateCompactUniforms();
+        bool isAnimated() const;
+        void updateAnimationUniforms();
         void setColorBuffer(const std::vector<QColor> &colors, QOpenGLBuffer &buffer);
-        void setVertexColor(QOpenGLBuffer &colorBuffer, GLuint divisor);
+        void setUserColorBuffer(unsigned int instancesPerElement, QOpenGLBuffer &buffer);
+        void setVertexColor(const QColor &color, QOpenGLBuffer &userBuffer);
+        void setScalarBuffer(unsigned int instancesPerElement, QOpenGLBuffer &buffer);
+        void setVertexScalar(QOpenGLBuffer &buffer);
+        void prepareColormapTexture();
+        bool usesUserColors() const;
+        bool isRendered(MeshId mesh) const;
+        bool isOpaque(MeshId mesh) const;
+        bool isCulled(MeshId mesh) const;
+        void drawMesh(QOpenGLShaderProgram &shader, MeshId mesh, DrawPass pass);
+        void drawOpaqueMeshes(QOpenGLShaderProgram &shader, bool reuseVisibility);
+        void drawTransparentMeshes();
+        void drawDeferred(GLint targetFramebuffer);
+        void bindInstanceTransforms(QOpenGLShaderProgram &shader, MeshId mesh);
+        void bindElementRecords(bool enable);
         void bindColBuffer(std::vector<QOpenGLBuffer> &colBuffer);
-        void releaseColBuffer(std::vector<QOpenGLBuffer> &colBuffer);
         void prepareVertexBuffers();
         void updateModelMatrices(QOpenGLShaderProgram &shader);
-        void updateProjectionUniforms(int w, int h, QOpenGLShaderProgram &shader);
+        void updateProjectionUniforms(const QRect &tile, const QSize &imageSize, QOpenGLShaderProgram &shader);
         void setAlphaCutoff(float cutoff, QOpenGLShaderProgram &shader);
+        void updateTransparencyEnabled(bool state);
+        void updateAlphaCutoff(float cutoff);
+        void updateScalarColoring();
     };
 
 } // namespace tresta
@@ -3,21 +3,25 @@
 
 #include <QWindow>
 
-#include "truss_scene.h"
+#include "color_dialog.h"
 #include "containers.h"
+#include "cylinder.h"
 #include "demo_dialog.h"
+#include "interaction_session.h"
 
 class QMouseEvent;
-class QOpenGLContext;
 
 namespace tresta {
 
+    class RenderThread;
+    class TrussScene;
+
     class Window : public QWindow
     {
         Q_OBJECT
     public:
         explicit Window(Job &job, QScreen *screen = 0);
-        ~Window() {};
+        ~Window();
 
     public slots:
         void handleKeyEvent(QKeyEvent *e);
@@ -31,20 +35,28 @@ namespace tresta {
 
     protected slots:
         void resizeGl();
-        void paintGl();
+        void updateColorSettings();
 
-        void demo();
-        void updateScene();
+        void exposeEvent(QExposeEvent *e);
         void mousePressEvent(QMouseEvent * e);
         void mouseMoveEvent(QMouseEvent *e);
         void mouseReleaseEvent(QMouseEvent *e);
         void keyPressEvent(QKeyEvent *);
 
+        /**
+         * Reports a failure of the render thread. Demo mode has been left; if nothing can be drawn the application
+         * quits.
+         */
+        void showRenderError(const QString &message, bool fatal);
+
     private:
-        QOpenGLContext *mContext;
-        QScopedPointer<TrussScene> mScene;
+        TrussScene *mScene;/**<Owned by the render thread. Only accessed through enqueued commands once it runs.*/
+        RenderThread *renderThread;
         QString demoSaveDirectory;
         DemoDialog demoDialog;
+        ColorDialog colorDialog;
+        Cylinder exportCylinder;/**<Shape used by the exporter, so exporting never reads the scene's shape.*/
+        InteractionSession session;/**<Records the commands posted to the scene while recording is on.*/
 
         bool rotatePressed;
         bool keyboardRotate;
@@ -54,12 +66,18 @@ namespace tresta {
         bool keyboardZoom;
         bool keyboardOverride;
         bool demoMode;
+        bool statsOverlay;
+        bool displacementsProvided;
+        float deformationScale;
 
         int currX, currY;
-        int currDemoFrame;
 
-        void printContextInfos();
-        void initializeGl();
+        void chooseDeformationScale();
+        void enqueueKeyEvent(int key);
+        void exportJob();
+        void exportFrameStatistics();
+        void showMemoryReport();
+        void toggleSessionRecording();
     };
 
 } // namespace tresta
@@ -0,0 +1,330 @@
+#include <QApplication>
+#include <QDateTime>
+#include <QTemporaryDir>
+#include <QThread>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "csv_parser.h"
+#include "cylinder.h"
+#include "lattice_generator.h"
+#include "ply_exporter.h"
+#include "setup.h"
+#include "truss_scene.h"
+
+namespace tresta {
+
+    /**
+     * Runs the private geometry builders of a scene, which are only reachable through a `TrussScene` otherwise.
+     */
+    class TrussSceneBenchmark {
+    public:
+        static std::vector<QMatrix4x4> buildVertexMatrixVector(TrussScene &scene) {
+            return scene.buildVertexMatrixVector(scene.job->nodes, scene.job->elems, 1.0f, 1.0f);
+        }
+
+        static void packVertexViewColumns(const TrussScene &scene, std::vector<float> &viewColVector) {
+            for (size_t k = 0; k < 4; ++k)
+                scene.packVertexViewColumn(*scene.vertexViewVector, k, 1, viewColVector);
+        }
+
+        static const std::vector<QMatrix4x4> &vertexViewVector(const TrussScene &scene) {
+            return *scene.vertexViewVector;
+        }
+    };
+
+} // namespace tresta
+
+namespace {
+    /**
+     * Sizes, repetitions and output shared by every benchmark of a run.
+     */
+    struct BenchOptions {
+        BenchOptions() :
+                sizes({1000, 100000, 10000000}),
+                minSeconds(1.0),
+                maxRepetitions(100),
+                output("tresta_bench.json") {}
+
+        std::vector<size_t> sizes;/**<Numbers of elements of the generated lattices.*/
+        double minSeconds;/**<A benchmark is repeated until it has run for this long in total.*/
+        int maxRepetitions;
+        std::string filter;/**<Only benchmarks whose name contains this are run.*/
+        std::string output;/**<JSON file, `-` for standard output.*/
+    };
+
+    /**
+     * Wall times of the repetitions of one benchmark at one size.
+     */
+    struct BenchResult {
+        std::string name;
+        size_t elements;
+        std::vector<double> seconds;
+    };
+
+    void printUsage(const char *program) {
+        std::cerr << "usage: " << program << " [options]" << std::endl
+                  << "  -s  comma separated numbers of elements (default 1000,100000,10000000)" << std::endl
+                  << "  -t  minimum time in seconds spent on each benchmark and size (default 1)" << std::endl
+                  << "  -n  maximum number of repetitions (default 100)" << std::endl
+                  << "  -f  only run the benchmarks whose name contains this text" << std::endl
+                  << "  -o  JSON file of the results, - for standard output (default tresta_bench.json)" << std::endl;
+    }
+
+    bool parseOption(const char *flag, const char *value, BenchOptions &options) {
+        if (std::strcmp(flag, "-s") == 0) {
+            options.sizes.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                const double size = std::atof(item.c_str());
+                if (size < 1.0)
+                    return false;
+                options.sizes.push_back((size_t) size);
+            }
+            return !options.sizes.empty();
+        }
+        else if (std::strcmp(flag, "-t") == 0) {
+            options.minSeconds = std::atof(value);
+            return options.minSeconds >= 0.0;
+        }
+        else if (std::strcmp(flag, "-n") == 0) {
+            options.maxRepetitions = std::atoi(value);
+            return options.maxRepetitions > 0;
+        }
+        else if (std::strcmp(flag, "-f") == 0) {
+            options.filter = value;
+        }
+        else if (std::strcmp(flag, "-o") == 0) {
+            options.output = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Repeats `body` until it has run for the minimum time and appends the wall time of every repetition.
+     */
+    void measure(const std::string &name, size_t elements, const BenchOptions &options,
+                 const std::function<void()> &body, std::vector<BenchResult> &results) {
+        if (name.find(options.filter) == std::string::npos)
+            return;
+
+        BenchResult result;
+        result.name = name;
+        result.elements = elements;
+        double total = 0.0;
+        while (result.seconds.empty() ||
+               (total < options.minSeconds && (int) result.seconds.size() < options.maxRepetitions)) {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            body();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.seconds.push_back(seconds);
+            total += seconds;
+        }
+
+        std::vector<double> sorted(result.seconds);
+        std::sort(sorted.begin(), sorted.end());
+        const double median = sorted[sorted.size() / 2];
+        std::clog << std::left << std::setw(40) << name << std::right << std::setw(10) << elements
+                  << std::setw(12) << std::fixed << std::setprecision(3) << 1000.0 * median << " ms"
+                  << std::setw(10) << std::setprecision(2) << elements / median / 1.0e6 << " M/s"
+                  << std::setw(6) << result.seconds.size() << "x" << std::endl;
+        results.push_back(result);
+    }
+
+    /**
+     * Runs every benchmark on a simple cubic lattice of at least `size` elements, bent like a cantilever.
+     */
+    void runBenchmarks(size_t size, const BenchOptions &options, std::vector<BenchResult> &results) {
+        tresta::LatticeGenerator generator;
+        generator.setRepetitions(tresta::LatticeGenerator::repetitionsFor(tresta::LatticeGenerator::SIMPLE_CUBIC,
+                                                                          size));
+        generator.setDisplacementField(tresta::LatticeGenerator::BENDING, 0.05f);
+
+        QTemporaryDir directory;
+        if (!directory.isValid())
+            throw std::runtime_error("A temporary directory could not be created.");
+        const std::string configFile = (directory.path() + "/lattice.json").toStdString();
+        generator.writeConfig(configFile, false);
+        const rapidjson::Document config = tresta::parseJSONConfig(configFile);
+
+        tresta::Job job = generator.generate();
+        const size_t numElems = job.elems.size();
+
+        measure("CSVParser::parseToVector", numElems, options, [&]() {
+            std::vector<std::vector<float>> props;
+            tresta::CSVParser csv;
+            csv.parseToVector(config["props"].GetString(), props);
+        }, results);
+
+        measure("createNodeVecFromJSON", numElems, options, [&]() {
+            tresta::createNodeVecFromJSON(config);
+        }, results);
+
+        measure("createElemVecFromJSON", numElems, options, [&]() {
+            tresta::createElemVecFromJSON(config);
+        }, results);
+
+        measure("createNodeStrips", numElems, options, [&]() {
+            tresta::createNodeStrips(job.nodes, job.elems, job.displacements, 1.0f);
+        }, results);
+
+        // the undeformed scene keeps the instance transforms of one mesh; the deformed one is just more of them
+        job.displacements.clear();
+        job.node_strips.clear();
+        tresta::TrussScene scene(job);
+        job = tresta::Job();
+
+        measure("TrussScene::buildVertexMatrixVector", numElems, options, [&]() {
+            tresta::TrussSceneBenchmark::buildVertexMatrixVector(scene);
+        }, results);
+
+        std::vector<float> viewColVector(4 * numElems);
+        measure("TrussScene::createVertexViewBuffers", numElems, options, [&]() {
+            tresta::TrussSceneBenchmark::packVertexViewColumns(scene, viewColVector);
+        }, results);
+        std::vector<float>().swap(viewColVector);
+
+        // the file is discarded so the disk does not dominate the time
+        tresta::Cylinder cylinder;
+        cylinder.initialize();
+        tresta::Job plyJob;
+        tresta::PlyExporter exporter;
+        exporter.setFormat(tresta::PlyExporter::BINARY_LITTLE_ENDIAN);
+        // keeps the dialog and its event processing out of the timed region
+        exporter.setShowProgress(false);
+        measure("PlyExporter::exportPly", numElems, options, [&]() {
+            exporter.exportPly("/dev/null", "Benchmark", &cylinder, plyJob,
+                               tresta::TrussSceneBenchmark::vertexViewVector(scene));
+        }, results);
+    }
+
+    std::string writeResults(const std::vector<BenchResult> &results) {
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+        writer.StartObject();
+        writer.Key("context");
+        writer.StartObject();
+        writer.Key("date");
+        writer.String(QDateTime::currentDateTimeUtc().toString(Qt::ISODate).toStdString().c_str());
+        writer.Key("threads");
+        writer.Int(QThread::idealThreadCount());
+        writer.Key("qt_version");
+        writer.String(qVersion());
+#ifdef __VERSION__
+        writer.Key("compiler");
+        writer.String(__VERSION__);
+#endif
+#ifdef NDEBUG
+        writer.Key("assertions");
+        writer.Bool(false);
+#else
+        writer.Key("assertions");
+        writer.Bool(true);
+#endif
+        writer.EndObject();
+
+        writer.Key("benchmarks");
+        writer.StartArray();
+        for (size_t i = 0; i < results.size(); ++i) {
+            std::vector<double> sorted(results[i].seconds);
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0.0;
+            for (size_t j = 0; j < sorted.size(); ++j)
+                total += sorted[j];
+            const double median = sorted[sorted.size() / 2];
+
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(results[i].name.c_str());
+            writer.Key("elements");
+            writer.Uint64(results[i].elements);
+            writer.Key("repetitions");
+            writer.Uint64(sorted.size());
+            writer.Key("min_seconds");
+            writer.Double(sorted.front());
+            writer.Key("median_seconds");
+            writer.Double(median);
+            writer.Key("mean_seconds");
+            writer.Double(total / sorted.size());
+            writer.Key("max_seconds");
+            writer.Double(sorted.back());
+            writer.Key("elements_per_second");
+            writer.Double(results[i].elements / median);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+
+        return std::string(buffer.GetString(), buffer.GetSize());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!parseOption(argv[arg], argv[arg + 1], options)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (arg != argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // the exporter is a widget, but nothing is ever shown on a display
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    int appArgc = 1;
+    QApplication app(appArgc, argv);
+    app.setOrganizationName("Latture");
+    app.setApplicationName("Tresta");
+
+    std::vector<BenchResult> results;
+    try {
+        for (size_t i = 0; i < options.sizes.size(); ++i)
+            runBenchmarks(options.sizes[i], options, results);
+    }
+    catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string json = writeResults(results);
+    if (options.output == "-") {
+        std::cout << json << std::endl;
+    }
+    else {
+        std::ofstream file(options.output.c_str());
+        file << json << std::endl;
+        if (!file) {
+            std::cerr << "error: " << options.output << " could not be written" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::clog << "Saved " << results.size() << " results to " << options.output << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tresta {
+
+    namespace {
+        const char *kindNames[CameraPath::NUM_KINDS] = {"orbit", "zoom", "fly"};
+
+        const float zoomRatio = 0.1f;/**<End distance of the zoom relative to its start.*/
+        const float flyStart = 1.2f;/**<Start of the fly-through relative to the starting distance.*/
+        const float flyEnd = 0.05f;/**<End of the fly-through, just off the center of the truss.*/
+    }
+
+    CameraPath::CameraPath(Kind _kind, const QVector3D &rotation, float distance) :
+            kind(_kind),
+            startRotation(rotation),
+            startDistance(distance) {
+    }
+
+    CameraPath::Pose CameraPath::poseAt(float fraction) const {
+        const float f = std::max(0.0f, std::min(1.0f, fraction));
+        Pose pose;
+        pose.rotation = startRotation;
+        pose.distance = startDistance;
+
+        switch (kind) {
+            case ORBIT:
+                pose.rotation.setY(startRotation.y() + 360.0f * f);
+                break;
+
+            case ZOOM_IN:
+                pose.distance = startDistance * std::pow(zoomRatio, f);
+                break;
+
+            case FLY_THROUGH:
+                pose.rotation.setX(startRotation.x() * (1.0f - f));
+                pose.rotation.setY(startRotation.y() + 90.0f * f);
+                pose.distance = startDistance * (flyStart + (flyEnd - flyStart) * f);
+                break;
+
+            default:
+                break;
+        }
+        return pose;
+    }
+
+    CameraPath::Kind CameraPath::getKind() const {
+        return kind;
+    }
+
+    std::string CameraPath::kindName(Kind kind) {
+        return kindNames[kind];
+    }
+
+    bool CameraPath::parseKind(const std::string &name, Kind &kind) {
+        for (int i = 0; i < NUM_KINDS; ++i) {
+            if (name == kindNames[i]) {
+                kind = (Kind) i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // namespace tresta
@@ -2,11 +2,25 @@
 #include "color_dialog.h"
 
 namespace tresta {
-    ColorDialog::ColorDialog(bool userColorsProvided, bool displacementsProvided, QWidget *parent)
+    namespace {
+        enum ScalarRangeMode {
+            FULL_RANGE,
+            PERCENTILE_RANGE,
+            CUSTOM_RANGE
+        };
+    }
+
+    ColorDialog::ColorDialog(bool userColorsProvided, bool displacementsProvided,
+                             const ScalarStatistics &_scalarStatistics, QWidget *parent)
             : QDialog(parent),
               useUserColors(false),
               transparencyEnabled(true),
               alphaCutoff(0.0f),
+              useScalars(false),
+              colormap(0),
+              scalarMin(_scalarStatistics.lowPercentile),
+              scalarMax(_scalarStatistics.highPercentile),
+              scalarStatistics(_scalarStatistics),
               origColor(QColor::fromRgbF(0.0824f, 0.3961f, 0.7529f, 1.0f)),
               defColor(QColor::fromRgbF(0.7176f, 0.1098f, 0.1098f, 1.0f)) {
         if (displacementsProvided)
@@ -19,10 +33,12 @@ namespace tresta {
         createCheckBox(userColorsProvided);
         createChooseGroupBox(displacementsProvided);
         createSpinBoxLayout();
+        createScalarGroupBox();
         createCloseButton();
 
         layout->addWidget(useUserColorsCheckBox);
         layout->addWidget(chooseGroupBox);
+        layout->addWidget(scalarGroupBox);
         layout->addWidget(transparencyEnabledCheckBox);
         layout->addLayout(alphaCutoffLayout);
         layout->addWidget(closeButton);
@@ -50,6 +66,36 @@ namespace tresta {
         origColor.setAlphaF(alpha);
     }
 
+    ColorSettings ColorDialog::getSettings() const {
+        ColorSettings settings;
+        settings.origColor = origColor;
+        settings.defColor = defColor;
+        settings.useUserColors = useUserColors;
+        settings.transparencyEnabled = transparencyEnabled;
+        settings.alphaCutoff = alphaCutoff;
+        settings.useScalars = useScalars;
+        settings.colormap = colormap;
+        settings.scalarMin = scalarMin;
+        settings.scalarMax = scalarMax;
+        return settings;
+    }
+
+    const bool ColorDialog::getUseScalars() const {
+        return useScalars;
+    }
+
+    int ColorDialog::getColormap() const {
+        return colormap;
+    }
+
+    float ColorDialog::getScalarMin() const {
+        return scalarMin;
+    }
+
+    float ColorDialog::getScalarMax() const {
+        return scalarMax;
+    }
+
     void ColorDialog::pickOrigColor() {
         if (transparencyEnabled)
             origColor = QColorDialog::getColor(origColor, this, "Choose Original Color", QColorDialog::ShowAlphaChannel);
@@ -70,6 +116,7 @@ namespace tresta {
         if (useUserColors != state) {
             useUserColors = state;
             chooseGroupBox->setEnabled(!useUserColors);
+            emit useUserColorsChanged(state);
         }
     }
 
@@ -85,6 +132,40 @@ namespace tresta {
         emit alphaCutoffChanged(alphaCutoff);
     }
 
+    void ColorDialog::setUseScalars(bool state) {
+        if (useScalars != state) {
+            useScalars = state;
+            emit scalarColoringChanged();
+        }
+    }
+
+    void ColorDialog::setColormap(int index) {
+        colormap = index;
+        emit scalarColoringChanged();
+    }
+
+    void ColorDialog::setScalarRangeMode(int index) {
+        const bool custom = index == CUSTOM_RANGE;
+        scalarMinSpinBox->setEnabled(custom);
+        scalarMaxSpinBox->setEnabled(custom);
+
+        if (!custom) {
+            // the spin box slots update the range and notify listeners
+            scalarMinSpinBox->setValue(index == FULL_RANGE ? scalarStatistics.min : scalarStatistics.lowPercentile);
+            scalarMaxSpinBox->setValue(index == FULL_RANGE ? scalarStatistics.max : scalarStatistics.highPercentile);
+        }
+    }
+
+    void ColorDialog::setScalarMin(double value) {
+        scalarMin = (float) value;
+        emit scalarColoringChanged();
+    }
+
+    void ColorDialog::setScalarMax(double value) {
+        scalarMax = (float) value;
+        emit scalarColoringChanged();
+    }
+
     void ColorDialog::createCheckBox(bool userColorsProvided) {
         useUserColorsCheckBox = new QCheckBox(tr("Use user defined colors"), this);
         useUserColorsCheckBox->setChecked(false);
@@ -130,6 +211,48 @@ namespace tresta {
         alphaCutoffLayout->addWidget(alphaCutoffSpinBox);
     }
 
+    void ColorDialog::createScalarGroupBox() {
+        scalarGroupBox = new QGroupBox(tr("Color by scalar field"), this);
+        scalarGroupBox->setCheckable(true);
+        scalarGroupBox->setChecked(false);
+        scalarGroupBox->setEnabled(scalarStatistics.count > 0);
+        connect(scalarGroupBox, SIGNAL(toggled(bool)), this, SLOT(setUseScalars(bool)));
+
+        colormapComboBox = new QComboBox(this);
+        const std::vector<std::string> &names = colormapNames();
+        for (size_t i = 0; i < names.size(); ++i) {
+            colormapComboBox->addItem(QString::fromStdString(names[i]));
+        }
+        connect(colormapComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(setColormap(int)));
+
+        scalarRangeComboBox = new QComboBox(this);
+        scalarRangeComboBox->addItem(tr("Minimum to maximum"));
+        scalarRangeComboBox->addItem(tr("2nd to 98th percentile"));
+        scalarRangeComboBox->addItem(tr("Custom"));
+        scalarRangeComboBox->setCurrentIndex(PERCENTILE_RANGE);
+        connect(scalarRangeComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(setScalarRangeMode(int)));
+
+        scalarMinSpinBox = new QDoubleSpinBox(this);
+        scalarMaxSpinBox = new QDoubleSpinBox(this);
+        QDoubleSpinBox *spinBoxes[] = {scalarMinSpinBox, scalarMaxSpinBox};
+        for (int i = 0; i < 2; ++i) {
+            spinBoxes[i]->setRange(-1.0e12, 1.0e12);
+            spinBoxes[i]->setDecimals(6);
+            spinBoxes[i]->setEnabled(false);
+        }
+        scalarMinSpinBox->setValue(scalarMin);
+        scalarMaxSpinBox->setValue(scalarMax);
+        connect(scalarMinSpinBox, SIGNAL(valueChanged(double)), this, SLOT(setScalarMin(double)));
+        connect(scalarMaxSpinBox, SIGNAL(valueChanged(double)), this, SLOT(setScalarMax(double)));
+
+        QFormLayout *formLayout = new QFormLayout();
+        formLayout->addRow(tr("Colormap:"), colormapComboBox);
+        formLayout->addRow(tr("Range:"), scalarRangeComboBox);
+        formLayout->addRow(tr("Minimum:"), scalarMinSpinBox);
+        formLayout->addRow(tr("Maximum:"), scalarMaxSpinBox);
+        scalarGroupBox->setLayout(formLayout);
+    }
+
     void ColorDialog::createCloseButton() {
         closeButton = new QPushButton("Close", this);
         connect(closeButton, SIGNAL(clicked()), this, SLOT(close()));
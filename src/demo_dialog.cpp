@@ -40,9 +40,58 @@ namespace tresta {
             return defaultFilePrefix;
     }
 
+    QSize DemoDialog::getFrameSize() const {
+        return QSize(widthSpinBox->value(), heightSpinBox->value());
+    }
+
+    DemoSettings DemoDialog::getSettings() const {
+        DemoSettings settings;
+        settings.directory = getDirectory();
+        settings.prefix = getFilenamePrefix();
+        settings.frameSize = getFrameSize();
+        settings.format = (ImageEncoderPool::Format) formatComboBox->currentIndex();
+        settings.compressionLevel = compressionSpinBox->value();
+        settings.output = (DemoSettings::Output) outputComboBox->currentIndex();
+        settings.framesPerSecond = fpsSpinBox->value();
+
+        // streams default to a single file next to where the images would go
+        settings.streamTarget = streamLineEdit->displayText();
+        if (settings.output != DemoSettings::IMAGE_FILES && settings.streamTarget.isEmpty()) {
+            FrameStream::Format streamFormat = settings.output == DemoSettings::PPM_STREAM ? FrameStream::PPM
+                                                                                            : FrameStream::Y4M;
+            settings.streamTarget = settings.directory + "/" + settings.prefix + FrameStream::extension(streamFormat);
+        }
+        return settings;
+    }
+
+    void DemoDialog::setImageFormat(int index) {
+        compressionSpinBox->setEnabled(outputComboBox->currentIndex() == DemoSettings::IMAGE_FILES &&
+                                       index == ImageEncoderPool::PNG);
+    }
+
+    void DemoDialog::setOutput(int index) {
+        const bool images = index == DemoSettings::IMAGE_FILES;
+        formatComboBox->setEnabled(images);
+        setImageFormat(formatComboBox->currentIndex());
+        fpsSpinBox->setEnabled(index == DemoSettings::Y4M_STREAM);
+        streamLineEdit->setEnabled(!images);
+    }
+
     void DemoDialog::createLabel() {
         prefixLabel = new QLabel("File prefix", this);
         prefixLabel->setAlignment(Qt::AlignmentFlag::AlignRight | Qt::AlignmentFlag::AlignVCenter);
+
+        sizeLabel = new QLabel("Frame size", this);
+        sizeLabel->setAlignment(Qt::AlignmentFlag::AlignRight | Qt::AlignmentFlag::AlignVCenter);
+
+        formatLabel = new QLabel("Image format", this);
+        formatLabel->setAlignment(Qt::AlignmentFlag::AlignRight | Qt::AlignmentFlag::AlignVCenter);
+
+        outputLabel = new QLabel("Output", this);
+        outputLabel->setAlignment(Qt::AlignmentFlag::AlignRight | Qt::AlignmentFlag::AlignVCenter);
+
+        streamLabel = new QLabel("Stream to", this);
+        streamLabel->setAlignment(Qt::AlignmentFlag::AlignRight | Qt::AlignmentFlag::AlignVCenter);
     }
 
     void DemoDialog::createButtons() {
@@ -65,6 +114,47 @@ namespace tresta {
 
         saveDirLineEdit = new QLineEdit(this);
         saveDirLineEdit->setText(saveDirectory);
+
+        widthSpinBox = new QSpinBox(this);
+        widthSpinBox->setRange(16, 8192);
+        widthSpinBox->setValue(1920);
+        widthSpinBox->setSuffix(" px");
+
+        heightSpinBox = new QSpinBox(this);
+        heightSpinBox->setRange(16, 8192);
+        heightSpinBox->setValue(1080);
+        heightSpinBox->setSuffix(" px");
+
+        // entries follow the order of ImageEncoderPool::Format
+        formatComboBox = new QComboBox(this);
+        formatComboBox->addItem("PNG");
+        formatComboBox->addItem("TGA (uncompressed)");
+        formatComboBox->addItem("PPM (uncompressed)");
+        connect(formatComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(setImageFormat(int)));
+
+        compressionSpinBox = new QSpinBox(this);
+        compressionSpinBox->setRange(0, 9);
+        compressionSpinBox->setValue(1);
+        compressionSpinBox->setPrefix("compression ");
+        compressionSpinBox->setStatusTip("PNG compression level, from 0 (fastest) to 9 (smallest files)");
+
+        // entries follow the order of DemoSettings::Output
+        outputComboBox = new QComboBox(this);
+        outputComboBox->addItem("Image files");
+        outputComboBox->addItem("Y4M video stream");
+        outputComboBox->addItem("PPM image stream");
+        connect(outputComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(setOutput(int)));
+
+        fpsSpinBox = new QSpinBox(this);
+        fpsSpinBox->setRange(1, 240);
+        fpsSpinBox->setValue(30);
+        fpsSpinBox->setSuffix(" fps");
+
+        streamLineEdit = new QLineEdit(this);
+        streamLineEdit->setPlaceholderText("File or named pipe, - for standard output, default prefix.y4m");
+        streamLineEdit->setStatusTip("Streams every frame into one file an encoder can read, e.g. ffmpeg -i frames.y4m");
+
+        setOutput(outputComboBox->currentIndex());
     }
 
     void DemoDialog::createGroupBox() {
@@ -80,10 +170,32 @@ namespace tresta {
         glayout->addWidget(prefixLabel, 1, 0);
         glayout->addWidget(prefixLineEdit, 1, 1);
 
+        QHBoxLayout *sizeLayout = new QHBoxLayout();
+        sizeLayout->addWidget(widthSpinBox);
+        sizeLayout->addWidget(new QLabel("x", this));
+        sizeLayout->addWidget(heightSpinBox);
+        glayout->addWidget(sizeLabel, 2, 0);
+        glayout->addLayout(sizeLayout, 2, 1);
+
+        QHBoxLayout *formatLayout = new QHBoxLayout();
+        formatLayout->addWidget(formatComboBox);
+        formatLayout->addWidget(compressionSpinBox);
+        glayout->addWidget(formatLabel, 3, 0);
+        glayout->addLayout(formatLayout, 3, 1);
+
+        QHBoxLayout *outputLayout = new QHBoxLayout();
+        outputLayout->addWidget(outputComboBox);
+        outputLayout->addWidget(fpsSpinBox);
+        glayout->addWidget(outputLabel, 4, 0);
+        glayout->addLayout(outputLayout, 4, 1);
+
+        glayout->addWidget(streamLabel, 5, 0);
+        glayout->addWidget(streamLineEdit, 5, 1);
+
         QHBoxLayout *hlayout = new QHBoxLayout();
         hlayout->addWidget(startButton);
         hlayout->addWidget(closeButton);
-        glayout->addLayout(hlayout, 2, 0, 1, 2);
+        glayout->addLayout(hlayout, 6, 0, 1, 2);
 
         groupBox->setLayout(glayout);
     }
@@ -0,0 +1,408 @@
+#include "displacement_container.h"
+
+#include <QFuture>
+#include <QMutexLocker>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QtEndian>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+#include "csv_parser.h"
+#include "displacement_sequence.h"
+
+namespace tresta {
+
+    namespace {
+        const char magic[4] = {'T', 'D', 'C', '1'};
+        const quint32 formatVersion = 1;
+        const size_t headerBytes = 4 + 5 * sizeof(quint32);
+        const size_t indexEntryBytes = sizeof(quint64) + sizeof(quint32);
+        const size_t rangeBytes = 2 * sizeof(float);/**<Minimum and step of one column of one frame.*/
+        const size_t cachedBlocks = 2;
+        const float maxCode = 65535.0f;
+
+        struct EncodedBlock {
+            QByteArray data;
+            std::string error;/**<Exceptions do not cross QtConcurrent::run, so failures are passed back here.*/
+        };
+
+        void appendU32(std::string &out, quint32 value) {
+            value = qToLittleEndian(value);
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        void appendU64(std::string &out, quint64 value) {
+            value = qToLittleEndian(value);
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        void appendFloat(std::string &out, float value) {
+            quint32 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            appendU32(out, bits);
+        }
+
+        quint32 readU32(const char *data) {
+            quint32 value;
+            std::memcpy(&value, data, sizeof(value));
+            return qFromLittleEndian(value);
+        }
+
+        quint64 readU64(const char *data) {
+            quint64 value;
+            std::memcpy(&value, data, sizeof(value));
+            return qFromLittleEndian(value);
+        }
+
+        float readFloat(const char *data) {
+            const quint32 bits = readU32(data);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        // maps small differences of either sign to small codes so their high bytes are zero
+        quint16 zigzag(quint16 difference) {
+            const qint16 d = (qint16) difference;
+            return (quint16) ((d << 1) ^ (d >> 15));
+        }
+
+        quint16 unzigzag(quint16 code) {
+            return (quint16) ((code >> 1) ^ (quint16) -(qint16) (code & 1));
+        }
+
+        EncodedBlock encodeBlock(const DisplacementSequence *frames, size_t first, size_t count, int level) {
+            EncodedBlock encoded;
+            try {
+                const size_t frameValues = frames->nodeCount() * DisplacementSequence::valuesPerNode;
+                std::vector<quint16> previous(frameValues, 0);
+                std::vector<quint16> codes(frameValues);
+                std::vector<quint16> differences(count * frameValues);
+                std::vector<float> values;
+                std::string payload;
+                payload.reserve(count * DisplacementSequence::valuesPerNode * rangeBytes + 2 * differences.size());
+
+                for (size_t f = 0; f < count; ++f) {
+                    frames->readFrame(first + f, values);
+
+                    for (unsigned int j = 0; j < DisplacementSequence::valuesPerNode; ++j) {
+                        float low = std::numeric_limits<float>::max();
+                        float high = std::numeric_limits<float>::lowest();
+                        for (size_t i = j; i < frameValues; i += DisplacementSequence::valuesPerNode) {
+                            low = std::min(low, values[i]);
+                            high = std::max(high, values[i]);
+                        }
+
+                        const float step = high > low ? (high - low) / maxCode : 0.0f;
+                        appendFloat(payload, low);
+                        appendFloat(payload, step);
+
+                        for (size_t i = j; i < frameValues; i += DisplacementSequence::valuesPerNode) {
+                            const float code = step > 0.0f ? std::floor((values[i] - low) / step + 0.5f) : 0.0f;
+                            codes[i] = (quint16) std::min(code, maxCode);
+                        }
+                    }
+
+                    for (size_t i = 0; i < frameValues; ++i)
+                        differences[f * frameValues + i] = zigzag((quint16) (codes[i] - previous[i]));
+                    previous.swap(codes);
+                }
+
+                for (size_t i = 0; i < differences.size(); ++i)
+                    payload.push_back((char) (differences[i] & 0xff));
+                for (size_t i = 0; i < differences.size(); ++i)
+                    payload.push_back((char) (differences[i] >> 8));
+
+                if (payload.size() > (size_t) INT_MAX)
+                    throw std::runtime_error("A block exceeds 2 GiB; use fewer frames per block.");
+
+                encoded.data = qCompress(reinterpret_cast<const uchar *>(payload.data()), (int) payload.size(), level);
+            }
+            catch (const std::exception &e) {
+                encoded.error = e.what();
+            }
+            return encoded;
+        }
+    }
+
+    const unsigned int DisplacementContainer::defaultFramesPerBlock = 16;
+
+    DisplacementContainer::DisplacementContainer(const std::string &_filename) :
+            filename(_filename),
+            numNodes(0),
+            numFrames(0),
+            blockFrames(0) {
+        std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error(
+                (boost::format("Cannot open displacement container %s.") % filename).str()
+            );
+        }
+        const unsigned long long fileBytes = (unsigned long long) file.tellg();
+        file.seekg(0);
+
+        char header[headerBytes];
+        if (!file.read(header, headerBytes) || std::memcmp(header, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error(
+                (boost::format("%s is not a displacement container.") % filename).str()
+            );
+        }
+        if (readU32(header + 4) != formatVersion) {
+            throw std::runtime_error(
+                (boost::format("Version %d of %s is not supported.") % readU32(header + 4) % filename).str()
+            );
+        }
+
+        numNodes = readU32(header + 8);
+        numFrames = readU32(header + 12);
+        blockFrames = readU32(header + 16);
+        const size_t numBlocks = readU32(header + 20);
+        if (blockFrames == 0 || numBlocks != (numFrames + blockFrames - 1) / blockFrames) {
+            throw std::runtime_error(
+                (boost::format("The block index of %s is corrupt.") % filename).str()
+            );
+        }
+
+        std::vector<char> entries(numBlocks * indexEntryBytes);
+        if (numBlocks > 0 && !file.read(&entries[0], entries.size())) {
+            throw std::runtime_error(
+                (boost::format("The block index of %s is truncated.") % filename).str()
+            );
+        }
+
+        index.resize(numBlocks);
+        for (size_t i = 0; i < numBlocks; ++i) {
+            index[i].offset = readU64(&entries[i * indexEntryBytes]);
+            index[i].bytes = readU32(&entries[i * indexEntryBytes + sizeof(quint64)]);
+            if (index[i].offset + index[i].bytes > fileBytes) {
+                throw std::runtime_error(
+                    (boost::format("Block %d of %s lies past the end of the file.") % i % filename).str()
+                );
+            }
+        }
+    }
+
+    size_t DisplacementContainer::frameCount() const {
+        return numFrames;
+    }
+
+    size_t DisplacementContainer::nodeCount() const {
+        return numNodes;
+    }
+
+    unsigned int DisplacementContainer::framesPerBlock() const {
+        return blockFrames;
+    }
+
+    void DisplacementContainer::readFrame(size_t frame, std::vector<float> &values) const {
+        if (frame >= numFrames) {
+            throw std::runtime_error(
+                (boost::format("Displacement frame %d is out of range [0, %d).") % frame % numFrames).str()
+            );
+        }
+
+        const size_t frameValues = numNodes * DisplacementSequence::valuesPerNode;
+        const BlockPtr block = getBlock(frame / blockFrames);
+        const std::vector<float>::const_iterator first = block->begin() + (frame % blockFrames) * frameValues;
+        values.assign(first, first + frameValues);
+    }
+
+    void DisplacementContainer::readFrames(const std::vector<size_t> &frames,
+                                           std::vector<std::vector<float>> &values) const {
+        struct DecodedBlock {
+            BlockPtr values;
+            std::string error;
+        };
+
+        std::map<size_t, QFuture<DecodedBlock>> blocks;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i] >= numFrames) {
+                throw std::runtime_error(
+                    (boost::format("Displacement frame %d is out of range [0, %d).") % frames[i] % numFrames).str()
+                );
+            }
+
+            const size_t block = frames[i] / blockFrames;
+            if (blocks.count(block) == 0) {
+                blocks[block] = QtConcurrent::run([this, block]() {
+                    DecodedBlock decoded;
+                    try {
+                        decoded.values = getBlock(block);
+                    }
+                    catch (const std::exception &e) {
+                        decoded.error = e.what();
+                    }
+                    return decoded;
+                });
+            }
+        }
+
+        std::map<size_t, BlockPtr> decoded;
+        for (std::map<size_t, QFuture<DecodedBlock>>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+            const DecodedBlock result = it->second.result();
+            if (!result.error.empty())
+                throw std::runtime_error(result.error);
+            decoded[it->first] = result.values;
+        }
+
+        const size_t frameValues = numNodes * DisplacementSequence::valuesPerNode;
+        values.resize(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            const BlockPtr &block = decoded[frames[i] / blockFrames];
+            const std::vector<float>::const_iterator first = block->begin() + (frames[i] % blockFrames) * frameValues;
+            values[i].assign(first, first + frameValues);
+        }
+    }
+
+    void DisplacementContainer::pack(const std::vector<std::string> &csvFrames,
+                                     const std::string &filename,
+                                     unsigned int framesPerBlock,
+                                     int compressionLevel) {
+        if (csvFrames.empty())
+            throw std::runtime_error("No displacement frames were given to pack.");
+        if (framesPerBlock == 0)
+            throw std::runtime_error("A block must hold at least one frame.");
+
+        // every frame must have as many rows as the first
+        std::vector<std::vector<float>> rows;
+        CSVParser csv;
+        csv.parseToVector(csvFrames[0], rows);
+        if (rows.empty()) {
+            throw std::runtime_error(
+                (boost::format("Displacement frame %s holds no nodes.") % csvFrames[0]).str()
+            );
+        }
+        const DisplacementSequence frames(csvFrames, rows.size());
+
+        const size_t numBlocks = (frames.frameCount() + framesPerBlock - 1) / framesPerBlock;
+        std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error(
+                (boost::format("Cannot create displacement container %s.") % filename).str()
+            );
+        }
+
+        std::string header(magic, sizeof(magic));
+        appendU32(header, formatVersion);
+        appendU32(header, (quint32) frames.nodeCount());
+        appendU32(header, (quint32) frames.frameCount());
+        appendU32(header, framesPerBlock);
+        appendU32(header, (quint32) numBlocks);
+        header.append(numBlocks * indexEntryBytes, '\0');
+        file.write(header.data(), header.size());
+
+        // blocks are encoded a batch at a time so only one batch of decoded frames is in memory
+        const size_t batchSize = (size_t) std::max(1, QThread::idealThreadCount());
+        std::vector<BlockEntry> entries(numBlocks);
+        unsigned long long offset = header.size();
+
+        for (size_t firstBlock = 0; firstBlock < numBlocks; firstBlock += batchSize) {
+            std::vector<QFuture<EncodedBlock>> futures;
+            for (size_t b = firstBlock; b < std::min(firstBlock + batchSize, numBlocks); ++b) {
+                const size_t firstFrame = b * framesPerBlock;
+                const size_t count = std::min((size_t) framesPerBlock, frames.frameCount() - firstFrame);
+                futures.push_back(QtConcurrent::run(encodeBlock, &frames, firstFrame, count, compressionLevel));
+            }
+
+            for (size_t i = 0; i < futures.size(); ++i) {
+                const EncodedBlock encoded = futures[i].result();
+                if (!encoded.error.empty())
+                    throw std::runtime_error(encoded.error);
+
+                file.write(encoded.data.constData(), encoded.data.size());
+                entries[firstBlock + i].offset = offset;
+                entries[firstBlock + i].bytes = (unsigned int) encoded.data.size();
+                offset += encoded.data.size();
+            }
+        }
+
+        std::string blockIndex;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            appendU64(blockIndex, entries[i].offset);
+            appendU32(blockIndex, entries[i].bytes);
+        }
+        file.seekp(headerBytes);
+        file.write(blockIndex.data(), blockIndex.size());
+
+        if (!file) {
+            throw std::runtime_error(
+                (boost::format("Could not write displacement container %s.") % filename).str()
+            );
+        }
+    }
+
+    DisplacementContainer::BlockPtr DisplacementContainer::getBlock(size_t block) const {
+        {
+            QMutexLocker locker(&cacheMutex);
+            for (std::list<std::pair<size_t, BlockPtr>>::iterator it = cache.begin(); it != cache.end(); ++it) {
+                if (it->first == block) {
+                    cache.splice(cache.begin(), cache, it);
+                    return cache.front().second;
+                }
+            }
+        }
+
+        // decoding happens outside the lock so other blocks can be decoded at the same time
+        const BlockPtr decoded = decodeBlock(block);
+
+        QMutexLocker locker(&cacheMutex);
+        cache.push_front(std::make_pair(block, decoded));
+        if (cache.size() > cachedBlocks)
+            cache.pop_back();
+        return decoded;
+    }
+
+    DisplacementContainer::BlockPtr DisplacementContainer::decodeBlock(size_t block) const {
+        const BlockEntry &entry = index[block];
+        std::vector<char> compressed(entry.bytes);
+
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        file.seekg((std::streamoff) entry.offset);
+        if (entry.bytes == 0 || !file.read(&compressed[0], compressed.size())) {
+            throw std::runtime_error(
+                (boost::format("Could not read block %d of %s.") % block % filename).str()
+            );
+        }
+
+        const QByteArray payload = qUncompress(reinterpret_cast<const uchar *>(&compressed[0]), (int) entry.bytes);
+        const size_t count = std::min((size_t) blockFrames, numFrames - block * blockFrames);
+        const size_t frameValues = numNodes * DisplacementSequence::valuesPerNode;
+        const size_t rangesSize = count * DisplacementSequence::valuesPerNode * rangeBytes;
+        if ((size_t) payload.size() != rangesSize + 2 * count * frameValues) {
+            throw std::runtime_error(
+                (boost::format("Block %d of %s is corrupt.") % block % filename).str()
+            );
+        }
+
+        const char *ranges = payload.constData();
+        const uchar *lowBytes = reinterpret_cast<const uchar *>(ranges + rangesSize);
+        const uchar *highBytes = lowBytes + count * frameValues;
+
+        std::shared_ptr<std::vector<float>> values = std::make_shared<std::vector<float>>(count * frameValues);
+        std::vector<quint16> codes(frameValues, 0);
+
+        for (size_t f = 0; f < count; ++f) {
+            const size_t first = f * frameValues;
+            for (size_t i = 0; i < frameValues; ++i)
+                codes[i] = (quint16) (codes[i] + unzigzag((quint16) (lowBytes[first + i] | (highBytes[first + i] << 8))));
+
+            for (unsigned int j = 0; j < DisplacementSequence::valuesPerNode; ++j) {
+                const char *range = ranges + (f * DisplacementSequence::valuesPerNode + j) * rangeBytes;
+                const float low = readFloat(range);
+                const float step = readFloat(range + sizeof(float));
+                for (size_t i = j; i < frameValues; i += DisplacementSequence::valuesPerNode)
+                    (*values)[first + i] = low + step * codes[i];
+            }
+        }
+        return values;
+    }
+
+} // namespace tresta
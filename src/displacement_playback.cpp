@@ -0,0 +1,312 @@
+#include "displacement_playback.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QOpenGLFunctions_3_3_Core>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "glassert.h"
+
+namespace tresta {
+
+    FramePrefetcher::FramePrefetcher(const DisplacementSequence &_sequence) :
+            sequence(_sequence),
+            stopping(false) {}
+
+    FramePrefetcher::~FramePrefetcher() {
+        stop();
+    }
+
+    void FramePrefetcher::setWanted(const std::vector<size_t> &frames) {
+        QMutexLocker locker(&mutex);
+        wanted = frames;
+
+        // frames that fell out of the window are not worth keeping
+        for (std::map<size_t, std::vector<float>>::iterator it = ready.begin(); it != ready.end();) {
+            if (std::find(wanted.begin(), wanted.end(), it->first) == wanted.end())
+                it = ready.erase(it);
+            else
+                ++it;
+        }
+        wantedChanged.wakeOne();
+    }
+
+    bool FramePrefetcher::takeFrame(size_t &frame, std::vector<float> &values) {
+        QMutexLocker locker(&mutex);
+        for (size_t i = 0; i < wanted.size(); ++i) {
+            std::map<size_t, std::vector<float>>::iterator it = ready.find(wanted[i]);
+            if (it != ready.end()) {
+                frame = it->first;
+                values.swap(it->second);
+                ready.erase(it);
+                wanted.erase(wanted.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void FramePrefetcher::stop() {
+        {
+            QMutexLocker locker(&mutex);
+            stopping = true;
+            wantedChanged.wakeOne();
+        }
+        wait();
+    }
+
+    void FramePrefetcher::run() {
+        QMutexLocker locker(&mutex);
+        std::vector<std::vector<float>> values;
+
+        while (!stopping) {
+            std::vector<size_t> batch;
+            for (size_t i = 0; i < wanted.size(); ++i) {
+                if (ready.count(wanted[i]) == 0)
+                    batch.push_back(wanted[i]);
+            }
+
+            if (batch.empty()) {
+                wantedChanged.wait(&mutex);
+                continue;
+            }
+
+            bool loaded = true;
+
+            // the lock is only held to pick and publish frames, never while reading; the batch is decoded concurrently
+            locker.unlock();
+            try {
+                sequence.readFrames(batch, values);
+            }
+            catch (const std::exception &e) {
+                qWarning() << "Could not prefetch displacement frames:" << e.what();
+                loaded = false;
+            }
+            locker.relock();
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                std::vector<size_t>::iterator it = std::find(wanted.begin(), wanted.end(), batch[i]);
+                if (it == wanted.end())
+                    continue;
+
+                if (loaded)
+                    ready[batch[i]].swap(values[i]);
+                else
+                    wanted.erase(it);
+            }
+        }
+    }
+
+    const unsigned int DisplacementPlayback::ringSize = 6;
+
+    DisplacementPlayback::DisplacementPlayback() :
+            mGLFunc(0),
+            prefetcher(0),
+            playhead(0.0f),
+            frameRate(24.0f),
+            blend(0.0f),
+            currentSlot(-1),
+            nextSlot(-1),
+            playing(false) {}
+
+    DisplacementPlayback::~DisplacementPlayback() {
+        delete prefetcher;
+
+        if (mGLFunc) {
+            for (size_t i = 0; i < ring.size(); ++i) {
+                mGLFunc->glDeleteTextures(1, &ring[i].texture);
+                mGLFunc->glDeleteBuffers(1, &ring[i].buffer);
+            }
+        }
+    }
+
+    void DisplacementPlayback::setSequence(const DisplacementSequence &_sequence, float _frameRate) {
+        sequence = _sequence;
+        frameRate = _frameRate;
+    }
+
+    bool DisplacementPlayback::isActive() const {
+        return !sequence.isEmpty();
+    }
+
+    void DisplacementPlayback::initialize(QOpenGLFunctions_3_3_Core *glFunc) {
+        if (!isActive())
+            return;
+
+        GLint maxTexels = 0;
+        glFunc->glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        const size_t frameTexels = 2 * sequence.nodeCount();
+        if (frameTexels > (size_t) maxTexels) {
+            throw std::runtime_error(
+                (boost::format("A displacement frame of %d nodes needs %d texels, but texture buffers hold at most %d.")
+                 % sequence.nodeCount() % frameTexels % maxTexels).str()
+            );
+        }
+
+        mGLFunc = glFunc;
+        const GLsizeiptr frameBytes = sequence.nodeCount() * DisplacementSequence::valuesPerNode * sizeof(float);
+
+        ring.resize(std::min((size_t) ringSize, sequence.frameCount()));
+        for (size_t i = 0; i < ring.size(); ++i) {
+            mGLFunc->glGenBuffers(1, &ring[i].buffer);
+            mGLFunc->glBindBuffer(GL_TEXTURE_BUFFER, ring[i].buffer);
+            mGLFunc->glBufferData(GL_TEXTURE_BUFFER, frameBytes, 0, GL_STREAM_DRAW);
+
+            // translations and rotations of a node are two consecutive RGB texels
+            mGLFunc->glGenTextures(1, &ring[i].texture);
+            mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, ring[i].texture);
+            mGLFunc->glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, ring[i].buffer);
+        }
+        mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+        // the first frame is loaded up front so the deformed shape is never drawn without displacements
+        sequence.readFrame(0, frameValues);
+        mGLFunc->glBufferSubData(GL_TEXTURE_BUFFER, 0, frameBytes, &frameValues[0]);
+        mGLFunc->glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        ring.back().frame = 0;
+        currentSlot = nextSlot = (int) ring.size() - 1;
+        glCheckError();
+
+        prefetcher = new FramePrefetcher(sequence);
+        prefetcher->start();
+        requestFrames();
+    }
+
+    void DisplacementPlayback::update(float dt) {
+        if (!prefetcher)
+            return;
+
+        uploadReadyFrames();
+
+        const size_t numFrames = sequence.frameCount();
+        if (playing) {
+            const float candidate = std::fmod(playhead + dt * frameRate, (float) numFrames);
+            const size_t frame = wrapFrame((long) std::floor(candidate));
+
+            // hold while the frames around the new position are still loading
+            if (findSlot(frame) >= 0 && findSlot(wrapFrame(frame + 1)) >= 0)
+                playhead = candidate;
+        }
+
+        const size_t frame = wrapFrame((long) std::floor(playhead));
+        const int slot = findSlot(frame);
+        const int next = findSlot(wrapFrame(frame + 1));
+
+        // keep showing the last frame when scrubbing to one that has not been loaded yet
+        if (slot >= 0) {
+            currentSlot = slot;
+            nextSlot = next >= 0 ? next : slot;
+            blend = next >= 0 ? playhead - std::floor(playhead) : 0.0f;
+        }
+
+        requestFrames();
+    }
+
+    void DisplacementPlayback::bindFrames(int firstUnit) {
+        mGLFunc->glActiveTexture(GL_TEXTURE0 + firstUnit);
+        mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, ring[currentSlot].texture);
+        mGLFunc->glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, ring[nextSlot].texture);
+        mGLFunc->glActiveTexture(GL_TEXTURE0);
+    }
+
+    float DisplacementPlayback::getBlend() const {
+        return blend;
+    }
+
+    void DisplacementPlayback::setPlaying(bool isPlaying) {
+        playing = isPlaying && isActive();
+    }
+
+    bool DisplacementPlayback::isPlaying() const {
+        return playing;
+    }
+
+    void DisplacementPlayback::seek(float frame) {
+        if (!isActive())
+            return;
+
+        const float numFrames = (float) sequence.frameCount();
+        playhead = std::fmod(frame, numFrames);
+        if (playhead < 0.0f)
+            playhead += numFrames;
+    }
+
+    void DisplacementPlayback::step(int frames) {
+        seek((float) ((long) getDisplayedFrame() + frames));
+    }
+
+    size_t DisplacementPlayback::getDisplayedFrame() const {
+        return currentSlot >= 0 ? (size_t) ring[currentSlot].frame : 0;
+    }
+
+    size_t DisplacementPlayback::frameCount() const {
+        return sequence.frameCount();
+    }
+
+    size_t DisplacementPlayback::gpuBytes() const {
+        return ring.size() * sequence.nodeCount() * DisplacementSequence::valuesPerNode * sizeof(float);
+    }
+
+    const DisplacementSequence &DisplacementPlayback::getSequence() const {
+        return sequence;
+    }
+
+    int DisplacementPlayback::findSlot(size_t frame) const {
+        for (size_t i = 0; i < ring.size(); ++i) {
+            if (ring[i].frame == (long) frame)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    size_t DisplacementPlayback::wrapFrame(long frame) const {
+        const long numFrames = (long) sequence.frameCount();
+        return (size_t) (((frame % numFrames) + numFrames) % numFrames);
+    }
+
+    void DisplacementPlayback::uploadReadyFrames() {
+        const size_t numFrames = sequence.frameCount();
+        const size_t first = wrapFrame((long) std::floor(playhead));
+        size_t frame;
+
+        while (prefetcher->takeFrame(frame, frameValues)) {
+            if (findSlot(frame) >= 0)
+                continue;
+
+            // reuse a slot holding a frame behind the playhead; the frames being shown are never replaced
+            int freeSlot = -1;
+            for (size_t i = 0; i < ring.size() && freeSlot < 0; ++i) {
+                const long held = ring[i].frame;
+                const bool shown = (int) i == currentSlot || (int) i == nextSlot;
+                if (!shown && (held < 0 || (held - (long) first + (long) numFrames) % (long) numFrames >= (long) ring.size()))
+                    freeSlot = (int) i;
+            }
+            if (freeSlot < 0)
+                continue;
+
+            // orphan the old storage so a draw still reading it does not stall the upload
+            mGLFunc->glBindBuffer(GL_TEXTURE_BUFFER, ring[freeSlot].buffer);
+            mGLFunc->glBufferData(GL_TEXTURE_BUFFER, frameValues.size() * sizeof(float), 0, GL_STREAM_DRAW);
+            mGLFunc->glBufferSubData(GL_TEXTURE_BUFFER, 0, frameValues.size() * sizeof(float), &frameValues[0]);
+            mGLFunc->glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            ring[freeSlot].frame = (long) frame;
+        }
+    }
+
+    void DisplacementPlayback::requestFrames() {
+        // the ring covers the frame at the playhead and the ones following it
+        const size_t first = wrapFrame((long) std::floor(playhead));
+        std::vector<size_t> frames;
+        for (size_t i = 0; i < ring.size(); ++i) {
+            const size_t frame = wrapFrame((long) (first + i));
+            if (findSlot(frame) < 0)
+                frames.push_back(frame);
+        }
+        prefetcher->setWanted(frames);
+    }
+
+} // namespace tresta
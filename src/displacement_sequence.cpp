@@ -0,0 +1,185 @@
+#include "displacement_sequence.h"
+
+#include <QFuture>
+#include <QtConcurrentRun>
+#include <QtGlobal>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "csv_parser.h"
+#include "displacement_container.h"
+
+namespace tresta {
+
+    namespace {
+        bool hasExtension(const std::string &filename, const std::string &extension) {
+            if (filename.size() < extension.size())
+                return false;
+
+            std::string tail = filename.substr(filename.size() - extension.size());
+            std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+            return tail == extension;
+        }
+
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        void swapFloatBytes(std::vector<float> &values) {
+            char *bytes = reinterpret_cast<char *>(&values[0]);
+            for (size_t i = 0; i < values.size(); ++i) {
+                std::swap(bytes[4 * i + 0], bytes[4 * i + 3]);
+                std::swap(bytes[4 * i + 1], bytes[4 * i + 2]);
+            }
+        }
+#endif
+    }
+
+    const unsigned int DisplacementSequence::valuesPerNode = 6;
+
+    DisplacementSequence::DisplacementSequence() : numNodes(0), numFrames(0), stacked(false) {}
+
+    DisplacementSequence::DisplacementSequence(const std::vector<std::string> &_files, size_t num_nodes) :
+            files(_files),
+            numNodes(num_nodes),
+            numFrames(_files.size()),
+            stacked(_files.size() == 1 && hasExtension(_files[0], ".bin")) {
+        if (_files.size() == 1 && hasExtension(_files[0], ".tdc")) {
+            container = std::make_shared<DisplacementContainer>(files[0]);
+            if (container->nodeCount() != numNodes) {
+                throw std::runtime_error(
+                    (boost::format("Container %s holds %d nodes, but the structure has %d.")
+                     % files[0] % container->nodeCount() % numNodes).str()
+                );
+            }
+            numFrames = container->frameCount();
+            return;
+        }
+
+        if (!stacked)
+            return;
+
+        std::ifstream file(files[0].c_str(), std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error(
+                (boost::format("Cannot open displacement sequence %s.") % files[0]).str()
+            );
+        }
+
+        const size_t frameBytes = numNodes * valuesPerNode * sizeof(float);
+        const size_t fileBytes = (size_t) file.tellg();
+        if (frameBytes == 0 || fileBytes % frameBytes != 0) {
+            throw std::runtime_error(
+                (boost::format("Size of %s (%d bytes) is not a multiple of one frame of %d nodes (%d bytes).")
+                 % files[0] % fileBytes % numNodes % frameBytes).str()
+            );
+        }
+        numFrames = fileBytes / frameBytes;
+    }
+
+    size_t DisplacementSequence::frameCount() const {
+        return numFrames;
+    }
+
+    size_t DisplacementSequence::nodeCount() const {
+        return numNodes;
+    }
+
+    bool DisplacementSequence::isEmpty() const {
+        return numFrames == 0;
+    }
+
+    void DisplacementSequence::readFrame(size_t frame, std::vector<float> &values) const {
+        if (frame >= numFrames) {
+            throw std::runtime_error(
+                (boost::format("Displacement frame %d is out of range [0, %d).") % frame % numFrames).str()
+            );
+        }
+
+        if (container) {
+            container->readFrame(frame, values);
+            return;
+        }
+
+        values.resize(numNodes * valuesPerNode);
+
+        if (stacked) {
+            const size_t frameBytes = values.size() * sizeof(float);
+            std::ifstream file(files[0].c_str(), std::ios::binary);
+            file.seekg((std::streamoff) (frame * frameBytes));
+            if (!file.read(reinterpret_cast<char *>(&values[0]), frameBytes)) {
+                throw std::runtime_error(
+                    (boost::format("Could not read frame %d of %s.") % frame % files[0]).str()
+                );
+            }
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+            swapFloatBytes(values);
+#endif
+            return;
+        }
+
+        std::vector<std::vector<float>> rows;
+        CSVParser csv;
+        csv.parseToVector(files[frame], rows);
+
+        if (rows.size() != numNodes) {
+            throw std::runtime_error(
+                (boost::format("Number of rows in %s (%d) do not match the number of nodes (%d).")
+                 % files[frame] % rows.size() % numNodes).str()
+            );
+        }
+
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (rows[i].size() != valuesPerNode) {
+                throw std::runtime_error(
+                    (boost::format("Row %d in %s does not specify x, y and z translations and rotations.")
+                     % i % files[frame]).str()
+                );
+            }
+            std::copy(rows[i].begin(), rows[i].end(), values.begin() + valuesPerNode * i);
+        }
+    }
+
+    void DisplacementSequence::readFrames(const std::vector<size_t> &frames,
+                                          std::vector<std::vector<float>> &values) const {
+        if (container) {
+            container->readFrames(frames, values);
+            return;
+        }
+
+        // exceptions do not cross QtConcurrent::run, so every task reports its failure as a message
+        values.resize(frames.size());
+        std::vector<QFuture<std::string>> futures;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            std::vector<float> *frameValues = &values[i];
+            const size_t frame = frames[i];
+            futures.push_back(QtConcurrent::run([this, frame, frameValues]() {
+                try {
+                    readFrame(frame, *frameValues);
+                }
+                catch (const std::exception &e) {
+                    return std::string(e.what());
+                }
+                return std::string();
+            }));
+        }
+
+        for (size_t i = 0; i < futures.size(); ++i) {
+            const std::string error = futures[i].result();
+            if (!error.empty())
+                throw std::runtime_error(error);
+        }
+    }
+
+    std::vector<Displacement> DisplacementSequence::readDisplacements(size_t frame) const {
+        std::vector<float> values;
+        readFrame(frame, values);
+
+        std::vector<Displacement> disp_out(numNodes);
+        for (size_t i = 0; i < numNodes; ++i) {
+            for (unsigned int j = 0; j < valuesPerNode; ++j)
+                disp_out[i](j) = values[valuesPerNode * i + j];
+        }
+        return disp_out;
+    }
+
+} // namespace tresta
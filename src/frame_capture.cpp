@@ -0,0 +1,190 @@
+#include "frame_capture.h"
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_3_3_Core>
+#include <cstring>
+#include <stdexcept>
+#include "glassert.h"
+
+namespace tresta {
+
+    namespace {
+        const GLuint64 fenceTimeoutNs = 100000000;/**<Wait for a readback in slices of 100 ms.*/
+    }
+
+    const unsigned int FrameCapture::ringSize;
+
+    FrameCapture::FrameCapture() :
+            mGLFunc(nullptr),
+            framebuffer(0),
+            colorRenderbuffer(0),
+            depthRenderbuffer(0),
+            trackedPixelBuffers(MemoryTracker::GPU_READBACK_BUFFERS),
+            nextBuffer(0),
+            width(0),
+            height(0) {
+        std::memset(pixelBuffers, 0, sizeof(pixelBuffers));
+    }
+
+    FrameCapture::~FrameCapture() {
+        if (QOpenGLContext::currentContext())
+            release();
+    }
+
+    void FrameCapture::resize(int _width, int _height) {
+        if (isAllocated() && width == _width && height == _height)
+            return;
+
+        if (!mGLFunc) {
+            mGLFunc = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+            mGLFunc->initializeOpenGLFunctions();
+        }
+
+        release();
+        width = _width;
+        height = _height;
+
+        mGLFunc->glGenRenderbuffers(1, &colorRenderbuffer);
+        mGLFunc->glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+        mGLFunc->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        mGLFunc->glGenRenderbuffers(1, &depthRenderbuffer);
+        mGLFunc->glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+        mGLFunc->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        mGLFunc->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        mGLFunc->glGenFramebuffers(1, &framebuffer);
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        mGLFunc->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+        mGLFunc->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                           depthRenderbuffer);
+        GLenum status = mGLFunc->glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        mGLFunc->glGenBuffers(ringSize, pixelBuffers);
+        for (unsigned int i = 0; i < ringSize; ++i) {
+            mGLFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+            mGLFunc->glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, nullptr, GL_STREAM_READ);
+        }
+        mGLFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glCheckError();
+        trackedPixelBuffers.set((size_t) ringSize * 4 * width * height);
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            release();
+            throw std::runtime_error("The frame capture framebuffer is incomplete.");
+        }
+    }
+
+    void FrameCapture::bind() {
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        mGLFunc->glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        mGLFunc->glViewport(0, 0, width, height);
+    }
+
+    void FrameCapture::read(int frameNumber) {
+        if (isFull())
+            throw std::runtime_error("All frame capture buffers are in use.");
+
+        // with a pixel pack buffer bound the read only queues the transfer
+        Pending frame;
+        frame.buffer = nextBuffer;
+        frame.frameNumber = frameNumber;
+        mGLFunc->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        mGLFunc->glReadBuffer(GL_COLOR_ATTACHMENT0);
+        mGLFunc->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        mGLFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[frame.buffer]);
+        glAssert(mGLFunc->glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+        mGLFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        frame.fence = mGLFunc->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mGLFunc->glFlush();
+
+        pending.push_back(frame);
+        nextBuffer = (nextBuffer + 1) % ringSize;
+    }
+
+    bool FrameCapture::takeFrame(QImage &image, int &frameNumber, bool wait) {
+        if (pending.empty())
+            return false;
+
+        Pending &frame = pending.front();
+        GLenum status;
+        do {
+            status = mGLFunc->glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? fenceTimeoutNs : 0);
+        } while (wait && status == GL_TIMEOUT_EXPIRED);
+
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+        if (status == GL_WAIT_FAILED)
+            throw std::runtime_error("Waiting for a captured frame failed.");
+
+        QImage bottomUp(width, height, QImage::Format_RGBA8888);
+        mGLFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[frame.buffer]);
+        const void *pixels = mGLFunc->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * width * height, GL_MAP_READ_BIT);
+        if (pixels)
+            std::memcpy(bottomUp.bits(), pixels, 4 * width * height);
+        mGLFunc->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        mGLFunc->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        mGLFunc->glDeleteSync(frame.fence);
+        frameNumber = frame.frameNumber;
+        pending.pop_front();
+
+        if (!pixels)
+            throw std::runtime_error("A captured frame could not be mapped.");
+        image = bottomUp.mirrored();
+        return true;
+    }
+
+    void FrameCapture::blit(GLuint targetFramebuffer, int targetWidth, int targetHeight) {
+        // keep the aspect ratio of the frame and center it
+        int w = targetWidth;
+        int h = (int) ((long long) targetWidth * height / width);
+        if (h > targetHeight) {
+            h = targetHeight;
+            w = (int) ((long long) targetHeight * width / height);
+        }
+        const int x = (targetWidth - w) / 2;
+        const int y = (targetHeight - h) / 2;
+
+        mGLFunc->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        mGLFunc->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFramebuffer);
+        mGLFunc->glViewport(0, 0, targetWidth, targetHeight);
+        mGLFunc->glClear(GL_COLOR_BUFFER_BIT);
+        mGLFunc->glBlitFramebuffer(0, 0, width, height, x, y, x + w, y + h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    }
+
+    bool FrameCapture::isFull() const {
+        return pending.size() >= ringSize;
+    }
+
+    bool FrameCapture::isAllocated() const {
+        return framebuffer != 0;
+    }
+
+    void FrameCapture::release() {
+        if (!mGLFunc)
+            return;
+
+        for (size_t i = 0; i < pending.size(); ++i)
+            mGLFunc->glDeleteSync(pending[i].fence);
+        pending.clear();
+        nextBuffer = 0;
+
+        mGLFunc->glDeleteBuffers(ringSize, pixelBuffers);
+        trackedPixelBuffers.set(0);
+        mGLFunc->glDeleteRenderbuffers(1, &colorRenderbuffer);
+        mGLFunc->glDeleteRenderbuffers(1, &depthRenderbuffer);
+        mGLFunc->glDeleteFramebuffers(1, &framebuffer);
+        std::memset(pixelBuffers, 0, sizeof(pixelBuffers));
+        framebuffer = colorRenderbuffer = depthRenderbuffer = 0;
+    }
+
+    int FrameCapture::getWidth() const {
+        return width;
+    }
+
+    int FrameCapture::getHeight() const {
+        return height;
+    }
+
+} // namespace tresta
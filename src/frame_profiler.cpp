@@ -0,0 +1,354 @@
+#include "frame_profiler.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_3_3_Core>
+#include <boost/format.hpp>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace tresta {
+
+    namespace {
+        const char *passNames[] = {"original", "deformed", "culling", "composite"};
+
+        /**
+         * Writes the sum, the mean, the median, the 95th and 99th percentiles and the largest of `values` as an object.
+         */
+        void writeSummary(rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer, const char *name,
+                          const std::vector<double> &values) {
+            double total = 0.0;
+            for (size_t i = 0; i < values.size(); ++i)
+                total += values[i];
+
+            writer.Key(name);
+            writer.StartObject();
+            writer.Key("total");
+            writer.Double(total);
+            writer.Key("mean");
+            writer.Double(values.empty() ? 0.0 : total / values.size());
+            writer.Key("p50");
+            writer.Double(FrameProfiler::Statistics::percentile(values, 0.50));
+            writer.Key("p95");
+            writer.Double(FrameProfiler::Statistics::percentile(values, 0.95));
+            writer.Key("p99");
+            writer.Double(FrameProfiler::Statistics::percentile(values, 0.99));
+            writer.Key("max");
+            writer.Double(values.empty() ? 0.0 : *std::max_element(values.begin(), values.end()));
+            writer.EndObject();
+        }
+
+        void writeFile(const std::string &fileName, const std::string &contents) {
+            std::ofstream file(fileName.c_str(), std::ios::trunc);
+            file << contents;
+            if (!file)
+                throw std::runtime_error((boost::format("%s could not be written.") % fileName).str());
+        }
+    }
+
+    const size_t FrameProfiler::historySize = 600;
+    const size_t FrameProfiler::framesInFlight = 4;
+
+    FrameProfiler::Sample::Sample() :
+            frameMs(0.0),
+            cpuMs(0.0),
+            instances(0),
+            triangles(0),
+            drawCalls(0) {
+        std::fill(gpuMs, gpuMs + NUM_PASSES, 0.0);
+    }
+
+    double FrameProfiler::Sample::gpuTotalMs() const {
+        double total = 0.0;
+        for (int i = 0; i < NUM_PASSES; ++i)
+            total += gpuMs[i];
+        return total;
+    }
+
+    double FrameProfiler::Statistics::percentile(std::vector<double> values, double fraction) {
+        if (values.empty())
+            return 0.0;
+
+        const size_t rank = std::min(std::max((size_t) std::ceil(fraction * values.size()), (size_t) 1),
+                                     values.size());
+        std::nth_element(values.begin(), values.begin() + (rank - 1), values.end());
+        return values[rank - 1];
+    }
+
+    void FrameProfiler::Statistics::saveCsv(const std::string &fileName) const {
+        std::string csv("frame,frame_ms,cpu_ms");
+        for (int i = 0; i < NUM_PASSES; ++i)
+            csv += std::string(",gpu_") + passNames[i] + "_ms";
+        csv += ",gpu_total_ms,instances,triangles,draw_calls\n";
+
+        for (size_t i = 0; i < samples.size(); ++i) {
+            const Sample &sample = samples[i];
+            csv += (boost::format("%d,%.4f,%.4f") % i % sample.frameMs % sample.cpuMs).str();
+            for (int j = 0; j < NUM_PASSES; ++j)
+                csv += (boost::format(",%.4f") % sample.gpuMs[j]).str();
+            csv += (boost::format(",%.4f,%d,%d,%d\n") % sample.gpuTotalMs() % sample.instances % sample.triangles
+                    % sample.drawCalls).str();
+        }
+        writeFile(fileName, csv);
+    }
+
+    void FrameProfiler::Statistics::saveJson(const std::string &fileName) const {
+        // the first frame has no predecessor to measure its frame time against
+        std::vector<double> frameMs, cpuMs, gpuTotalMs;
+        std::vector<std::vector<double>> gpuMs(NUM_PASSES);
+        for (size_t i = 0; i < samples.size(); ++i) {
+            if (samples[i].frameMs > 0.0)
+                frameMs.push_back(samples[i].frameMs);
+            cpuMs.push_back(samples[i].cpuMs);
+            gpuTotalMs.push_back(samples[i].gpuTotalMs());
+            for (int j = 0; j < NUM_PASSES; ++j)
+                gpuMs[j].push_back(samples[i].gpuMs[j]);
+        }
+
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+        writer.StartObject();
+        writer.Key("renderer");
+        writer.String(renderer.c_str());
+        writer.Key("frames");
+        writer.Uint64(samples.size());
+
+        writer.Key("summary");
+        writer.StartObject();
+        writeSummary(writer, "frame_ms", frameMs);
+        writeSummary(writer, "cpu_ms", cpuMs);
+        writeSummary(writer, "gpu_total_ms", gpuTotalMs);
+        writer.Key("gpu_ms");
+        writer.StartObject();
+        for (int i = 0; i < NUM_PASSES; ++i)
+            writeSummary(writer, passNames[i], gpuMs[i]);
+        writer.EndObject();
+        writer.EndObject();
+
+        writer.Key("samples");
+        writer.StartArray();
+        for (size_t i = 0; i < samples.size(); ++i) {
+            const Sample &sample = samples[i];
+            writer.StartObject();
+            writer.Key("frame_ms");
+            writer.Double(sample.frameMs);
+            writer.Key("cpu_ms");
+            writer.Double(sample.cpuMs);
+            writer.Key("gpu_ms");
+            writer.StartObject();
+            for (int j = 0; j < NUM_PASSES; ++j) {
+                writer.Key(passNames[j]);
+                writer.Double(sample.gpuMs[j]);
+            }
+            writer.EndObject();
+            writer.Key("instances");
+            writer.Uint64(sample.instances);
+            writer.Key("triangles");
+            writer.Uint64(sample.triangles);
+            writer.Key("draw_calls");
+            writer.Uint(sample.drawCalls);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+
+        writeFile(fileName, std::string(buffer.GetString(), buffer.GetSize()) + "\n");
+    }
+
+    FrameProfiler::FrameProfiler() :
+            mGLFunc(nullptr),
+            frames(framesInFlight),
+            currentFrame(0),
+            historyLimit(historySize),
+            enabled(false),
+            inPass(false) {
+    }
+
+    FrameProfiler::~FrameProfiler() {
+        if (QOpenGLContext::currentContext())
+            release();
+    }
+
+    void FrameProfiler::setEnabled(bool _enabled) {
+        if (_enabled == enabled)
+            return;
+
+        if (_enabled) {
+            if (!mGLFunc) {
+                mGLFunc = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+                mGLFunc->initializeOpenGLFunctions();
+                renderer = reinterpret_cast<const char *>(mGLFunc->glGetString(GL_RENDERER));
+            }
+            history.clear();
+            frameTimer.invalidate();
+        }
+        else {
+            release();
+        }
+        enabled = _enabled;
+    }
+
+    bool FrameProfiler::isEnabled() const {
+        return enabled;
+    }
+
+    void FrameProfiler::beginFrame() {
+        if (!enabled)
+            return;
+
+        // the GPU finishes frames in order, so the oldest unfinished frame ends the search
+        for (size_t i = 0; i < framesInFlight; ++i) {
+            PendingFrame &frame = frames[(currentFrame + i) % framesInFlight];
+            if (!frame.pending || !isAvailable(frame))
+                break;
+            collect(frame);
+        }
+
+        // the slot of the oldest frame is reused now; only waits if the GPU is that many frames behind
+        PendingFrame &frame = frames[currentFrame];
+        if (frame.pending)
+            collect(frame);
+
+        frame.numPasses = 0;
+        frame.sample = Sample();
+        if (frameTimer.isValid())
+            frame.sample.frameMs = frameTimer.nsecsElapsed() / 1.0e6;
+        frameTimer.start();
+        cpuTimer.start();
+    }
+
+    void FrameProfiler::endFrame() {
+        if (!enabled)
+            return;
+
+        assert(!inPass);
+        PendingFrame &frame = frames[currentFrame];
+        frame.sample.cpuMs = cpuTimer.nsecsElapsed() / 1.0e6;
+        frame.pending = true;
+        currentFrame = (currentFrame + 1) % framesInFlight;
+    }
+
+    void FrameProfiler::finish() {
+        if (!enabled)
+            return;
+
+        assert(!inPass);
+        for (size_t i = 0; i < framesInFlight; ++i) {
+            PendingFrame &frame = frames[(currentFrame + i) % framesInFlight];
+            if (frame.pending)
+                collect(frame);
+        }
+    }
+
+    void FrameProfiler::beginPass(Pass pass, unsigned int trianglesPerInstance) {
+        if (!enabled)
+            return;
+
+        assert(!inPass);
+        PendingFrame &frame = frames[currentFrame];
+        if (frame.numPasses == frame.queries.size()) {
+            PassQueries queries;
+            mGLFunc->glGenQueries(1, &queries.timeQuery);
+            mGLFunc->glGenQueries(1, &queries.primitiveQuery);
+            frame.queries.push_back(queries);
+        }
+
+        PassQueries &queries = frame.queries[frame.numPasses++];
+        queries.pass = pass;
+        queries.trianglesPerInstance = trianglesPerInstance;
+        mGLFunc->glBeginQuery(GL_TIME_ELAPSED, queries.timeQuery);
+        if (trianglesPerInstance > 0)
+            mGLFunc->glBeginQuery(GL_PRIMITIVES_GENERATED, queries.primitiveQuery);
+        inPass = true;
+    }
+
+    void FrameProfiler::endPass() {
+        if (!enabled)
+            return;
+
+        assert(inPass);
+        const PendingFrame &frame = frames[currentFrame];
+        if (frame.queries[frame.numPasses - 1].trianglesPerInstance > 0)
+            mGLFunc->glEndQuery(GL_PRIMITIVES_GENERATED);
+        mGLFunc->glEndQuery(GL_TIME_ELAPSED);
+        inPass = false;
+    }
+
+    void FrameProfiler::countDrawCalls(unsigned int calls) {
+        if (enabled)
+            frames[currentFrame].sample.drawCalls += calls;
+    }
+
+    FrameProfiler::Statistics FrameProfiler::getStatistics() const {
+        Statistics statistics;
+        statistics.renderer = renderer;
+        statistics.samples.assign(history.begin(), history.end());
+        return statistics;
+    }
+
+    void FrameProfiler::setHistoryLimit(size_t frames) {
+        historyLimit = frames;
+        while (history.size() > historyLimit)
+            history.pop_front();
+    }
+
+    std::string FrameProfiler::passName(Pass pass) {
+        return passNames[pass];
+    }
+
+    bool FrameProfiler::isAvailable(const PendingFrame &frame) {
+        if (frame.numPasses == 0)
+            return true;
+
+        const PassQueries &last = frame.queries[frame.numPasses - 1];
+        GLint timeAvailable = 0;
+        GLint primitivesAvailable = 1;
+        mGLFunc->glGetQueryObjectiv(last.timeQuery, GL_QUERY_RESULT_AVAILABLE, &timeAvailable);
+        if (last.trianglesPerInstance > 0)
+            mGLFunc->glGetQueryObjectiv(last.primitiveQuery, GL_QUERY_RESULT_AVAILABLE, &primitivesAvailable);
+        return timeAvailable && primitivesAvailable;
+    }
+
+    void FrameProfiler::collect(PendingFrame &frame) {
+        Sample &sample = frame.sample;
+        for (size_t i = 0; i < frame.numPasses; ++i) {
+            const PassQueries &queries = frame.queries[i];
+            GLuint64 nanoseconds = 0;
+            mGLFunc->glGetQueryObjectui64v(queries.timeQuery, GL_QUERY_RESULT, &nanoseconds);
+            sample.gpuMs[queries.pass] += nanoseconds / 1.0e6;
+
+            // depth-only, culling and fullscreen draws cost time but add no shaded geometry
+            if (queries.trianglesPerInstance > 0) {
+                GLuint64 primitives = 0;
+                mGLFunc->glGetQueryObjectui64v(queries.primitiveQuery, GL_QUERY_RESULT, &primitives);
+                sample.triangles += primitives;
+                sample.instances += primitives / queries.trianglesPerInstance;
+            }
+        }
+
+        history.push_back(sample);
+        while (history.size() > historyLimit)
+            history.pop_front();
+        frame.pending = false;
+    }
+
+    void FrameProfiler::release() {
+        if (mGLFunc) {
+            for (size_t i = 0; i < frames.size(); ++i) {
+                for (size_t j = 0; j < frames[i].queries.size(); ++j) {
+                    mGLFunc->glDeleteQueries(1, &frames[i].queries[j].timeQuery);
+                    mGLFunc->glDeleteQueries(1, &frames[i].queries[j].primitiveQuery);
+                }
+            }
+        }
+        frames.assign(framesInFlight, PendingFrame());
+        currentFrame = 0;
+        inPass = false;
+    }
+
+} // namespace tresta
@@ -0,0 +1,365 @@
+#include "frame_stream.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QThread>
+#include <algorithm>
+#include <boost/format.hpp>
+#include <cstdio>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRESTA_STREAM_SSE2
+#endif
+
+namespace tresta {
+
+    namespace {
+        const size_t queuedFrames = 4;/**<Frames waiting to be written before `submit` waits.*/
+        const unsigned long readerPollMs = 50;/**<Milliseconds between attempts to open a named pipe without a reader.*/
+
+        // BT.601 limited range in 8-bit fixed point; chroma is offset by 128 << 8 so the shift never sees a
+        // negative value and rounds the same way as the arithmetic shift of the vector path
+        inline unsigned char luma(int r, int g, int b) {
+            return (unsigned char) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        }
+
+        inline unsigned char chromaU(int r, int g, int b) {
+            return (unsigned char) ((-38 * r - 74 * g + 112 * b + 32896) >> 8);
+        }
+
+        inline unsigned char chromaV(int r, int g, int b) {
+            return (unsigned char) ((112 * r - 94 * g - 18 * b + 32896) >> 8);
+        }
+
+#ifdef TRESTA_STREAM_SSE2
+        /**
+         * Splits 8 RGBA pixels into one 16-bit lane per pixel and channel.
+         */
+        inline void loadRgb(const unsigned char *pixels, __m128i &r, __m128i &g, __m128i &b) {
+            const __m128i mask = _mm_set1_epi32(0xFF);
+            const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+            const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 16));
+            r = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+            g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+            b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask),
+                                _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+        }
+
+        /**
+         * Converts 8 pixels of a row to luma. The weighted sum stays below 2^16, so unsigned 16-bit lanes suffice.
+         */
+        inline void luma8(const unsigned char *pixels, unsigned char *y) {
+            __m128i r, g, b;
+            loadRgb(pixels, r, g, b);
+            __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+            sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+            sum = _mm_add_epi16(sum, _mm_set1_epi16(16));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(y), _mm_packus_epi16(sum, sum));
+        }
+
+        /**
+         * Sums the 2x2 blocks of 8 pixels on two rows into 4 lanes and averages them.
+         */
+        inline __m128i average2x2(__m128i top, __m128i bottom) {
+            __m128i sum = _mm_madd_epi16(_mm_add_epi16(top, bottom), _mm_set1_epi16(1));
+            sum = _mm_packs_epi32(sum, sum);
+            return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+        }
+
+        inline void storeChroma4(__m128i sum, unsigned char *out) {
+            sum = _mm_srai_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+            sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+            const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+            std::memcpy(out, &packed, 4);
+        }
+
+        /**
+         * Converts 8 pixels on each of two rows to 4 chroma samples. The signed sums stay within 16 bits.
+         */
+        inline void chroma4(const unsigned char *top, const unsigned char *bottom, unsigned char *u,
+                            unsigned char *v) {
+            __m128i r0, g0, b0, r1, g1, b1;
+            loadRgb(top, r0, g0, b0);
+            loadRgb(bottom, r1, g1, b1);
+            const __m128i r = average2x2(r0, r1);
+            const __m128i g = average2x2(g0, g1);
+            const __m128i b = average2x2(b0, b1);
+
+            __m128i sumU = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(-38)), _mm_mullo_epi16(g, _mm_set1_epi16(-74)));
+            sumU = _mm_add_epi16(sumU, _mm_mullo_epi16(b, _mm_set1_epi16(112)));
+            __m128i sumV = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_mullo_epi16(g, _mm_set1_epi16(-94)));
+            sumV = _mm_add_epi16(sumV, _mm_mullo_epi16(b, _mm_set1_epi16(-18)));
+            storeChroma4(sumU, u);
+            storeChroma4(sumV, v);
+        }
+#endif
+
+        /**
+         * Converts RGBA pixels to planar 4:2:0 YUV. Each chroma sample averages a 2x2 block of pixels; the last
+         * column and row are repeated if the size is odd.
+         * @param pixels Top row of `height` rows of `width` RGBA pixels, `stride` bytes apart.
+         * @param yPlane `width * height` luma samples.
+         * @param uPlane `((width + 1) / 2) * ((height + 1) / 2)` blue difference samples.
+         * @param vPlane Red difference samples, same size as `uPlane`.
+         */
+        void rgbaToYuv420(const unsigned char *pixels, int stride, int width, int height,
+                          unsigned char *yPlane, unsigned char *uPlane, unsigned char *vPlane) {
+            const int chromaWidth = (width + 1) / 2;
+
+            for (int row = 0; row < height; ++row) {
+                const unsigned char *in = pixels + (size_t) row * stride;
+                unsigned char *y = yPlane + (size_t) row * width;
+                int x = 0;
+#ifdef TRESTA_STREAM_SSE2
+                for (; x + 8 <= width; x += 8)
+                    luma8(in + 4 * x, y + x);
+#endif
+                for (; x < width; ++x)
+                    y[x] = luma(in[4 * x], in[4 * x + 1], in[4 * x + 2]);
+            }
+
+            for (int row = 0; row < height; row += 2) {
+                const unsigned char *top = pixels + (size_t) row * stride;
+                const unsigned char *bottom = pixels + (size_t) std::min(row + 1, height - 1) * stride;
+                unsigned char *u = uPlane + (size_t) (row / 2) * chromaWidth;
+                unsigned char *v = vPlane + (size_t) (row / 2) * chromaWidth;
+                int cx = 0;
+#ifdef TRESTA_STREAM_SSE2
+                for (; 2 * cx + 8 <= width; cx += 4)
+                    chroma4(top + 8 * cx, bottom + 8 * cx, u + cx, v + cx);
+#endif
+                for (; cx < chromaWidth; ++cx) {
+                    const int x0 = 4 * (2 * cx);
+                    const int x1 = 4 * std::min(2 * cx + 1, width - 1);
+                    int rgb[3];
+                    for (int c = 0; c < 3; ++c)
+                        rgb[c] = (top[x0 + c] + top[x1 + c] + bottom[x0 + c] + bottom[x1 + c] + 2) >> 2;
+                    u[cx] = chromaU(rgb[0], rgb[1], rgb[2]);
+                    v[cx] = chromaV(rgb[0], rgb[1], rgb[2]);
+                }
+            }
+        }
+    }
+
+    /**
+     * Opens the target, then converts and writes queued frames until the stream is closed and drained.
+     */
+    class FrameStream::Writer : public QThread {
+    public:
+        Writer(FrameStream &_stream) : stream(_stream) {}
+
+    protected:
+        void run() {
+            QFile file;
+            bool writable = stream.openTarget(file);
+
+            // frames are still taken after an error so `submit` never waits forever
+            QImage frame;
+            while (stream.pop(frame)) {
+                if (writable)
+                    writable = stream.write(file, frame);
+            }
+            file.close();
+        }
+
+    private:
+        FrameStream &stream;
+    };
+
+    FrameStream::FrameStream() :
+            closed(false),
+            format(Y4M),
+            width(0),
+            height(0),
+            framesPerSecond(30) {}
+
+    FrameStream::~FrameStream() {
+        close();
+    }
+
+    void FrameStream::open(const QString &_target, Format _format, int _width, int _height, int _framesPerSecond) {
+        close();
+
+        target = _target;
+        format = _format;
+        width = _width;
+        height = _height;
+        framesPerSecond = _framesPerSecond;
+        {
+            QMutexLocker locker(&mutex);
+            closed = false;
+            errorMessage.clear();
+        }
+
+        writer.reset(new Writer(*this));
+        writer->start();
+    }
+
+    void FrameStream::submit(const QImage &frame) {
+        QMutexLocker locker(&mutex);
+        while (frames.size() >= queuedFrames)
+            notFull.wait(&mutex);
+        frames.push_back(frame);
+        notEmpty.wakeOne();
+    }
+
+    void FrameStream::close() {
+        {
+            QMutexLocker locker(&mutex);
+            closed = true;
+            notEmpty.wakeAll();
+        }
+        if (writer) {
+            writer->wait();
+            writer.reset();
+        }
+        buffer.clear();
+    }
+
+    bool FrameStream::isOpen() const {
+        return writer != nullptr;
+    }
+
+    QString FrameStream::takeError() {
+        QMutexLocker locker(&mutex);
+        QString message = errorMessage;
+        errorMessage.clear();
+        return message;
+    }
+
+    QString FrameStream::extension(Format format) {
+        return format == PPM ? QString(".ppm") : QString(".y4m");
+    }
+
+    bool FrameStream::pop(QImage &frame) {
+        QMutexLocker locker(&mutex);
+        while (frames.empty() && !closed)
+            notEmpty.wait(&mutex);
+        if (frames.empty())
+            return false;
+
+        frame = frames.front();
+        frames.pop_front();
+        notFull.wakeOne();
+        return true;
+    }
+
+    bool FrameStream::openTarget(QFile &file) {
+        bool opened;
+        if (target == "-") {
+            opened = file.open(stdout, QIODevice::WriteOnly);
+        }
+#ifdef Q_OS_UNIX
+        else if (isNamedPipe()) {
+            opened = openNamedPipe(file);
+        }
+#endif
+        else {
+            file.setFileName(target);
+            opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        }
+        if (!opened) {
+            reportError(QString("%1 could not be opened for the frame stream.").arg(target));
+            return false;
+        }
+
+        if (format == Y4M) {
+            const std::string header = (boost::format("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n")
+                                        % width % height % framesPerSecond).str();
+            if (file.write(header.data(), (qint64) header.size()) != (qint64) header.size()) {
+                reportError(QString("Writing to %1 failed.").arg(target));
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef Q_OS_UNIX
+    bool FrameStream::isNamedPipe() const {
+        struct stat status;
+        return ::stat(QFile::encodeName(target).constData(), &status) == 0 && S_ISFIFO(status.st_mode);
+    }
+
+    bool FrameStream::openNamedPipe(QFile &file) {
+        // a blocking open would wait for a reader that may never come, and close would wait for it; without a
+        // reader the non-blocking open fails with ENXIO, so it is retried until a reader appears or the stream closes
+        const QByteArray path = QFile::encodeName(target);
+        int fd;
+        while ((fd = ::open(path.constData(), O_WRONLY | O_NONBLOCK)) < 0 && errno == ENXIO) {
+            bool isClosed;
+            {
+                QMutexLocker locker(&mutex);
+                isClosed = closed;
+            }
+            if (isClosed) {
+                reportError(QString("No reader opened %1 before the frame stream was closed.").arg(target));
+                return false;
+            }
+            QThread::msleep(readerPollMs);
+        }
+        if (fd < 0)
+            return false;
+
+        // once connected, writes wait for the reader again, so rendering keeps its pace
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        if (!file.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+            ::close(fd);
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    bool FrameStream::write(QFile &file, const QImage &frame) {
+        if (frame.width() != width || frame.height() != height) {
+            reportError(QString("A %1x%2 frame does not fit the %3x%4 stream.")
+                                .arg(frame.width()).arg(frame.height()).arg(width).arg(height));
+            return false;
+        }
+
+        if (format == Y4M) {
+            const QImage rgba = frame.convertToFormat(QImage::Format_RGBA8888);
+            const int chromaSize = ((width + 1) / 2) * ((height + 1) / 2);
+            const int headerSize = 6;
+            buffer.resize(headerSize + width * height + 2 * chromaSize);
+            unsigned char *out = reinterpret_cast<unsigned char *>(buffer.data());
+            std::memcpy(out, "FRAME\n", headerSize);
+            out += headerSize;
+            rgbaToYuv420(rgba.constBits(), rgba.bytesPerLine(), width, height,
+                         out, out + width * height, out + width * height + chromaSize);
+        }
+        else {
+            const QImage rgb = frame.convertToFormat(QImage::Format_RGB888);
+            const std::string header = (boost::format("P6\n%d %d\n255\n") % width % height).str();
+            buffer.resize((int) header.size() + 3 * width * height);
+            char *out = buffer.data();
+            std::memcpy(out, header.data(), header.size());
+            out += header.size();
+            for (int row = 0; row < height; ++row, out += 3 * width)
+                std::memcpy(out, rgb.constScanLine(row), (size_t) 3 * width);
+        }
+
+        if (file.write(buffer) != buffer.size()) {
+            reportError(QString("Writing to %1 failed.").arg(target));
+            return false;
+        }
+        return true;
+    }
+
+    void FrameStream::reportError(const QString &message) {
+        QMutexLocker locker(&mutex);
+        if (errorMessage.isEmpty())
+            errorMessage = message;
+    }
+
+} // namespace tresta
@@ -0,0 +1,99 @@
+#include "gbuffer.h"
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_3_3_Core>
+#include <stdexcept>
+#include "glassert.h"
+
+namespace tresta {
+
+    GBuffer::GBuffer() :
+            mGLFunc(nullptr),
+            framebuffer(0),
+            colorTexture(0),
+            normalTexture(0),
+            depthTexture(0),
+            width(0),
+            height(0) {
+    }
+
+    GBuffer::~GBuffer() {
+        if (QOpenGLContext::currentContext())
+            release();
+    }
+
+    void GBuffer::resize(int _width, int _height) {
+        if (isAllocated() && width == _width && height == _height)
+            return;
+
+        if (!mGLFunc) {
+            mGLFunc = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+            mGLFunc->initializeOpenGLFunctions();
+        }
+
+        release();
+        width = _width;
+        height = _height;
+
+        colorTexture = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        normalTexture = createTexture(GL_RG16F, GL_RG, GL_FLOAT);
+        depthTexture = createTexture(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+
+        mGLFunc->glGenFramebuffers(1, &framebuffer);
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        mGLFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        mGLFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+        mGLFunc->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+        GLenum status = mGLFunc->glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glCheckError();
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            release();
+            throw std::runtime_error("The deferred shading framebuffer is incomplete.");
+        }
+    }
+
+    void GBuffer::bind() {
+        const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        mGLFunc->glDrawBuffers(2, drawBuffers);
+    }
+
+    void GBuffer::bindTextures(int firstUnit) {
+        const GLuint textures[] = {colorTexture, normalTexture, depthTexture};
+        for (int i = 0; i < 3; ++i) {
+            mGLFunc->glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            mGLFunc->glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        mGLFunc->glActiveTexture(GL_TEXTURE0);
+    }
+
+    bool GBuffer::isAllocated() const {
+        return framebuffer != 0;
+    }
+
+    void GBuffer::release() {
+        if (!mGLFunc)
+            return;
+
+        const GLuint textures[] = {colorTexture, normalTexture, depthTexture};
+        mGLFunc->glDeleteTextures(3, textures);
+        mGLFunc->glDeleteFramebuffers(1, &framebuffer);
+        framebuffer = colorTexture = normalTexture = depthTexture = 0;
+    }
+
+    GLuint GBuffer::createTexture(GLenum internalFormat, GLenum format, GLenum type) {
+        GLuint texture;
+        mGLFunc->glGenTextures(1, &texture);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, texture);
+        mGLFunc->glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+} // namespace tresta
@@ -0,0 +1,407 @@
+#include "gltf_exporter.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <boost/format.hpp>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace tresta {
+
+    namespace {
+        const quint32 glbMagic = 0x46546C67;/**<"glTF"*/
+        const quint32 glbVersion = 2;
+        const quint32 jsonChunkType = 0x4E4F534A;/**<"JSON"*/
+        const quint32 binChunkType = 0x004E4942;/**<"BIN\0"*/
+
+        const int floatComponent = 5126;
+        const int unsignedShortComponent = 5123;
+        const int arrayBufferTarget = 34962;
+        const int elementArrayBufferTarget = 34963;
+
+        const size_t instancesPerBlock = 65536;/**<Instances converted and written at a time.*/
+
+        /**
+         * One attribute stored in the binary chunk, in the order of the chunk.
+         */
+        struct Section {
+            const char *type;/**<Accessor type, e.g. "VEC3".*/
+            int componentType;
+            size_t count;
+            size_t bytes;
+            int target;/**<Buffer view target, 0 for instance attributes.*/
+        };
+
+        inline size_t padded(size_t bytes) {
+            return (bytes + 3) & ~(size_t) 3;
+        }
+
+        inline void putFloat(char *&out, float value) {
+            quint32 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = qToLittleEndian(bits);
+            std::memcpy(out, &bits, sizeof(bits));
+            out += sizeof(bits);
+        }
+
+        inline void putUInt32(QByteArray &out, quint32 value) {
+            value = qToLittleEndian(value);
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        /**
+         * Splits an instance transform into translation, unit quaternion `(x, y, z, w)` and scale. The columns of
+         * the linear part must be orthogonal; a mirroring transform gets a negative z scale.
+         */
+        void decomposeTransform(const QMatrix4x4 &matrix, float translation[3], float rotation[4], float scale[3]) {
+            const float *m = matrix.constData();// column-major
+            float r[3][3];
+            for (int c = 0; c < 3; ++c) {
+                scale[c] = std::sqrt(m[4 * c] * m[4 * c] + m[4 * c + 1] * m[4 * c + 1] + m[4 * c + 2] * m[4 * c + 2]);
+                const float inv = scale[c] > 0.0f ? 1.0f / scale[c] : 0.0f;
+                for (int row = 0; row < 3; ++row)
+                    r[row][c] = m[4 * c + row] * inv;
+                translation[c] = m[12 + c];
+            }
+
+            const float det = r[0][0] * (r[1][1] * r[2][2] - r[1][2] * r[2][1])
+                              - r[0][1] * (r[1][0] * r[2][2] - r[1][2] * r[2][0])
+                              + r[0][2] * (r[1][0] * r[2][1] - r[1][1] * r[2][0]);
+            if (det < 0.0f) {
+                scale[2] = -scale[2];
+                for (int row = 0; row < 3; ++row)
+                    r[row][2] = -r[row][2];
+            }
+
+            float x, y, z, w;
+            const float trace = r[0][0] + r[1][1] + r[2][2];
+            if (trace > 0.0f) {
+                const float s = 2.0f * std::sqrt(trace + 1.0f);
+                w = 0.25f * s;
+                x = (r[2][1] - r[1][2]) / s;
+                y = (r[0][2] - r[2][0]) / s;
+                z = (r[1][0] - r[0][1]) / s;
+            }
+            else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+                const float s = 2.0f * std::sqrt(1.0f + r[0][0] - r[1][1] - r[2][2]);
+                w = (r[2][1] - r[1][2]) / s;
+                x = 0.25f * s;
+                y = (r[0][1] + r[1][0]) / s;
+                z = (r[0][2] + r[2][0]) / s;
+            }
+            else if (r[1][1] > r[2][2]) {
+                const float s = 2.0f * std::sqrt(1.0f + r[1][1] - r[0][0] - r[2][2]);
+                w = (r[0][2] - r[2][0]) / s;
+                x = (r[0][1] + r[1][0]) / s;
+                y = 0.25f * s;
+                z = (r[1][2] + r[2][1]) / s;
+            }
+            else {
+                const float s = 2.0f * std::sqrt(1.0f + r[2][2] - r[0][0] - r[1][1]);
+                w = (r[1][0] - r[0][1]) / s;
+                x = (r[0][2] + r[2][0]) / s;
+                y = (r[1][2] + r[2][1]) / s;
+                z = 0.25f * s;
+            }
+
+            const float norm = std::sqrt(x * x + y * y + z * z + w * w);
+            rotation[0] = x / norm;
+            rotation[1] = y / norm;
+            rotation[2] = z / norm;
+            rotation[3] = w / norm;
+        }
+
+        void writeBytes(QFile &file, const QByteArray &bytes) {
+            if (file.write(bytes) != bytes.size()) {
+                throw std::runtime_error(
+                    (boost::format("Could not write %s") % file.fileName().toStdString()).str()
+                );
+            }
+        }
+
+        QByteArray buildJson(const std::vector<Section> &sections, size_t binBytes, const Shape *shape,
+                             bool colors) {
+            float lower[3], upper[3];
+            for (int k = 0; k < 3; ++k) {
+                lower[k] = upper[k] = shape->vertices.empty() ? 0.0f : shape->vertices[k];
+                for (size_t j = k; j < shape->vertices.size(); j += 3) {
+                    lower[k] = std::min(lower[k], shape->vertices[j]);
+                    upper[k] = std::max(upper[k], shape->vertices[j]);
+                }
+            }
+
+            rapidjson::StringBuffer buffer;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+            writer.StartObject();
+
+            writer.Key("asset");
+            writer.StartObject();
+            writer.Key("version");
+            writer.String("2.0");
+            writer.Key("generator");
+            writer.String("tresta");
+            writer.EndObject();
+
+            writer.Key("extensionsUsed");
+            writer.StartArray();
+            writer.String("EXT_mesh_gpu_instancing");
+            writer.EndArray();
+            writer.Key("extensionsRequired");
+            writer.StartArray();
+            writer.String("EXT_mesh_gpu_instancing");
+            writer.EndArray();
+
+            writer.Key("scene");
+            writer.Int(0);
+            writer.Key("scenes");
+            writer.StartArray();
+            writer.StartObject();
+            writer.Key("nodes");
+            writer.StartArray();
+            writer.Int(0);
+            writer.EndArray();
+            writer.EndObject();
+            writer.EndArray();
+
+            writer.Key("nodes");
+            writer.StartArray();
+            writer.StartObject();
+            writer.Key("mesh");
+            writer.Int(0);
+            writer.Key("extensions");
+            writer.StartObject();
+            writer.Key("EXT_mesh_gpu_instancing");
+            writer.StartObject();
+            writer.Key("attributes");
+            writer.StartObject();
+            writer.Key("TRANSLATION");
+            writer.Int(3);
+            writer.Key("ROTATION");
+            writer.Int(4);
+            writer.Key("SCALE");
+            writer.Int(5);
+            if (colors) {
+                writer.Key("_COLOR_0");
+                writer.Int(6);
+            }
+            writer.EndObject();
+            writer.EndObject();
+            writer.EndObject();
+            writer.EndObject();
+            writer.EndArray();
+
+            writer.Key("meshes");
+            writer.StartArray();
+            writer.StartObject();
+            writer.Key("primitives");
+            writer.StartArray();
+            writer.StartObject();
+            writer.Key("attributes");
+            writer.StartObject();
+            writer.Key("POSITION");
+            writer.Int(0);
+            writer.Key("NORMAL");
+            writer.Int(1);
+            writer.EndObject();
+            writer.Key("indices");
+            writer.Int(2);
+            writer.Key("material");
+            writer.Int(0);
+            writer.EndObject();
+            writer.EndArray();
+            writer.EndObject();
+            writer.EndArray();
+
+            writer.Key("materials");
+            writer.StartArray();
+            writer.StartObject();
+            writer.Key("pbrMetallicRoughness");
+            writer.StartObject();
+            writer.Key("metallicFactor");
+            writer.Double(0.0);
+            writer.Key("roughnessFactor");
+            writer.Double(0.5);
+            writer.EndObject();
+            writer.EndObject();
+            writer.EndArray();
+
+            writer.Key("buffers");
+            writer.StartArray();
+            writer.StartObject();
+            writer.Key("byteLength");
+            writer.Uint64(binBytes);
+            writer.EndObject();
+            writer.EndArray();
+
+            writer.Key("bufferViews");
+            writer.StartArray();
+            size_t offset = 0;
+            for (size_t i = 0; i < sections.size(); ++i) {
+                writer.StartObject();
+                writer.Key("buffer");
+                writer.Int(0);
+                writer.Key("byteOffset");
+                writer.Uint64(offset);
+                writer.Key("byteLength");
+                writer.Uint64(sections[i].bytes);
+                if (sections[i].target) {
+                    writer.Key("target");
+                    writer.Int(sections[i].target);
+                }
+                writer.EndObject();
+                offset += padded(sections[i].bytes);
+            }
+            writer.EndArray();
+
+            writer.Key("accessors");
+            writer.StartArray();
+            for (size_t i = 0; i < sections.size(); ++i) {
+                writer.StartObject();
+                writer.Key("bufferView");
+                writer.Uint64(i);
+                writer.Key("componentType");
+                writer.Int(sections[i].componentType);
+                writer.Key("count");
+                writer.Uint64(sections[i].count);
+                writer.Key("type");
+                writer.String(sections[i].type);
+                if (i == 0) {
+                    // required for positions
+                    writer.Key("min");
+                    writer.StartArray();
+                    for (int k = 0; k < 3; ++k)
+                        writer.Double(lower[k]);
+                    writer.EndArray();
+                    writer.Key("max");
+                    writer.StartArray();
+                    for (int k = 0; k < 3; ++k)
+                        writer.Double(upper[k]);
+                    writer.EndArray();
+                }
+                writer.EndObject();
+            }
+            writer.EndArray();
+
+            writer.EndObject();
+
+            QByteArray json(buffer.GetString(), (int) buffer.GetSize());
+            // the binary chunk must start on a 4 byte boundary
+            while (json.size() % 4)
+                json.append(' ');
+            return json;
+        }
+    }
+
+    GltfExporter::GltfExporter() : includeColors(false) {}
+
+    void GltfExporter::setIncludeColors(bool include) {
+        includeColors = include;
+    }
+
+    void GltfExporter::exportGlb(const QString& fileName, const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector) {
+        if (fileName.isEmpty())
+            return;
+        if (vertexViewVector.empty())
+            throw std::runtime_error("The mesh has no elements to export.");
+
+        const size_t numVertices = shape->vertices.size() / 3;
+        const size_t numInstances = vertexViewVector.size();
+        const bool colors = includeColors && !job.colors.empty() && !job.elems.empty();
+        // deformed meshes split every element into several instances
+        const size_t instancesPerElement = colors ? std::max((size_t) 1, numInstances / job.elems.size()) : 1;
+
+        std::vector<Section> sections;
+        const Section position = {"VEC3", floatComponent, numVertices, 12 * numVertices, arrayBufferTarget};
+        const Section normal = {"VEC3", floatComponent, numVertices, 12 * numVertices, arrayBufferTarget};
+        const Section index = {"SCALAR", unsignedShortComponent, shape->indices.size(), 2 * shape->indices.size(),
+                               elementArrayBufferTarget};
+        const Section translation = {"VEC3", floatComponent, numInstances, 12 * numInstances, 0};
+        const Section rotation = {"VEC4", floatComponent, numInstances, 16 * numInstances, 0};
+        const Section scale = {"VEC3", floatComponent, numInstances, 12 * numInstances, 0};
+        const Section color = {"VEC3", floatComponent, numInstances, 12 * numInstances, 0};
+        sections.push_back(position);
+        sections.push_back(normal);
+        sections.push_back(index);
+        sections.push_back(translation);
+        sections.push_back(rotation);
+        sections.push_back(scale);
+        if (colors)
+            sections.push_back(color);
+
+        size_t binBytes = 0;
+        for (size_t i = 0; i < sections.size(); ++i)
+            binBytes += padded(sections[i].bytes);
+
+        const QByteArray json = buildJson(sections, binBytes, shape, colors);
+        const size_t totalBytes = 12 + 8 + json.size() + 8 + binBytes;
+        if (totalBytes > 0xFFFFFFFFull)
+            throw std::runtime_error("The mesh is too large for a single glTF binary file.");
+
+        QFile outputFile(fileName);
+        if (!outputFile.open(QIODevice::WriteOnly)) {
+            throw std::runtime_error(
+                (boost::format("Unable to open file %s") % fileName.toStdString()).str()
+            );
+        }
+
+        QByteArray block;
+        putUInt32(block, glbMagic);
+        putUInt32(block, glbVersion);
+        putUInt32(block, (quint32) totalBytes);
+        putUInt32(block, (quint32) json.size());
+        putUInt32(block, jsonChunkType);
+        block.append(json);
+        putUInt32(block, (quint32) binBytes);
+        putUInt32(block, binChunkType);
+        writeBytes(outputFile, block);
+
+        // the shape, stored once
+        block.resize((int) (padded(position.bytes) + padded(normal.bytes) + padded(index.bytes)));
+        block.fill(0);
+        char *out = block.data();
+        for (size_t j = 0; j < shape->vertices.size(); ++j)
+            putFloat(out, shape->vertices[j]);
+        for (size_t j = 0; j < shape->normals.size(); ++j)
+            putFloat(out, shape->normals[j]);
+        for (size_t j = 0; j < shape->indices.size(); ++j) {
+            const quint16 value = qToLittleEndian((quint16) shape->indices[j]);
+            std::memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        }
+        writeBytes(outputFile, block);
+
+        // instance attributes are not interleaved, so the transforms are decomposed once per attribute
+        float t[3], q[4], s[3];
+        const int numAttributes = colors ? 4 : 3;
+        for (int attribute = 0; attribute < numAttributes; ++attribute) {
+            for (size_t first = 0; first < numInstances; first += instancesPerBlock) {
+                const size_t last = std::min(first + instancesPerBlock, numInstances);
+                block.resize((int) ((last - first) * sections[3 + attribute].bytes / numInstances));
+                out = block.data();
+
+                for (size_t i = first; i < last; ++i) {
+                    if (attribute == 3) {
+                        const QColor &c = job.colors[std::min(i / instancesPerElement, job.colors.size() - 1)];
+                        putFloat(out, (float) c.redF());
+                        putFloat(out, (float) c.greenF());
+                        putFloat(out, (float) c.blueF());
+                        continue;
+                    }
+
+                    decomposeTransform(vertexViewVector[i], t, q, s);
+                    const float *values = attribute == 0 ? t : attribute == 1 ? q : s;
+                    for (int k = 0; k < (attribute == 1 ? 4 : 3); ++k)
+                        putFloat(out, values[k]);
+                }
+                writeBytes(outputFile, block);
+            }
+        }
+
+        outputFile.close();
+    }
+
+} // namespace tresta
@@ -0,0 +1,175 @@
+#include "image_encoder_pool.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QThread>
+#include <algorithm>
+
+namespace tresta {
+
+    namespace {
+        const size_t jobsPerWorker = 2;/**<Queued images per worker before `submit` waits.*/
+
+        /**
+         * Writes an uncompressed, top-left origin, 32-bit TGA file.
+         */
+        bool saveTga(const QImage &image, const QString &fileName) {
+            const QImage rgba = image.convertToFormat(QImage::Format_RGBA8888);
+            const int width = rgba.width();
+            const int height = rgba.height();
+
+            QByteArray data(18 + 4 * width * height, '\0');
+            unsigned char *out = reinterpret_cast<unsigned char *>(data.data());
+            out[2] = 2;// uncompressed true color
+            out[12] = (unsigned char) (width & 0xFF);
+            out[13] = (unsigned char) (width >> 8);
+            out[14] = (unsigned char) (height & 0xFF);
+            out[15] = (unsigned char) (height >> 8);
+            out[16] = 32;
+            out[17] = 0x28;// 8 alpha bits, first row at the top
+            out += 18;
+
+            for (int y = 0; y < height; ++y) {
+                const unsigned char *in = rgba.constScanLine(y);
+                for (int x = 0; x < width; ++x, in += 4, out += 4) {
+                    out[0] = in[2];
+                    out[1] = in[1];
+                    out[2] = in[0];
+                    out[3] = in[3];
+                }
+            }
+
+            QFile file(fileName);
+            return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+        }
+    }
+
+    /**
+     * Saves queued images until the queue is closed and drained.
+     */
+    class ImageEncoderPool::Worker : public QThread {
+    public:
+        Worker(ImageEncoderPool &_pool) : pool(_pool) {}
+
+    protected:
+        void run() {
+            Job job;
+            while (pool.pop(job))
+                pool.encode(job);
+        }
+
+    private:
+        ImageEncoderPool &pool;
+    };
+
+    ImageEncoderPool::ImageEncoderPool() :
+            capacity(1),
+            closed(false),
+            format(PNG),
+            compressionLevel(-1) {}
+
+    ImageEncoderPool::~ImageEncoderPool() {
+        finish();
+    }
+
+    void ImageEncoderPool::start(Format _format, int _compressionLevel, unsigned int threads) {
+        finish();
+
+        format = _format;
+        compressionLevel = _compressionLevel;
+        if (threads == 0)
+            threads = (unsigned int) std::max(1, QThread::idealThreadCount());
+        capacity = jobsPerWorker * threads;
+        closed = false;
+
+        for (unsigned int i = 0; i < threads; ++i) {
+            workers.emplace_back(new Worker(*this));
+            workers.back()->start();
+        }
+    }
+
+    void ImageEncoderPool::submit(const QImage &image, const QString &fileName) {
+        Job job;
+        job.image = image;
+        job.fileName = fileName + extension(format);
+
+        QMutexLocker locker(&mutex);
+        while (jobs.size() >= capacity)
+            notFull.wait(&mutex);
+        jobs.push_back(job);
+        notEmpty.wakeOne();
+    }
+
+    void ImageEncoderPool::finish() {
+        {
+            QMutexLocker locker(&mutex);
+            closed = true;
+            notEmpty.wakeAll();
+        }
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i]->wait();
+        workers.clear();
+    }
+
+    bool ImageEncoderPool::isRunning() const {
+        return !workers.empty();
+    }
+
+    QString ImageEncoderPool::takeError() {
+        QMutexLocker locker(&mutex);
+        QString message = errorMessage;
+        errorMessage.clear();
+        return message;
+    }
+
+    QString ImageEncoderPool::extension(Format format) {
+        switch (format) {
+            case TGA:
+                return QString(".tga");
+            case PPM:
+                return QString(".ppm");
+            default:
+                return QString(".png");
+        }
+    }
+
+    bool ImageEncoderPool::pop(Job &job) {
+        QMutexLocker locker(&mutex);
+        while (jobs.empty() && !closed)
+            notEmpty.wait(&mutex);
+        if (jobs.empty())
+            return false;
+
+        job = jobs.front();
+        jobs.pop_front();
+        notFull.wakeOne();
+        return true;
+    }
+
+    void ImageEncoderPool::encode(const Job &job) {
+        bool saved;
+        switch (format) {
+            case TGA:
+                saved = saveTga(job.image, job.fileName);
+                break;
+            case PPM:
+                saved = job.image.save(job.fileName, "PPM");
+                break;
+            default:
+                // Qt uses zlib level (100 - quality) * 9 / 91
+                saved = job.image.save(job.fileName, "PNG",
+                                       compressionLevel < 0 ? -1 : 100 - (std::min(compressionLevel, 9) * 91 + 8) / 9);
+                break;
+        }
+
+        if (!saved)
+            reportError(QString("%1 could not be saved.").arg(job.fileName));
+    }
+
+    void ImageEncoderPool::reportError(const QString &message) {
+        QMutexLocker locker(&mutex);
+        if (errorMessage.isEmpty())
+            errorMessage = message;
+    }
+
+} // namespace tresta
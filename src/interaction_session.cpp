@@ -0,0 +1,348 @@
+#include "interaction_session.h"
+
+#include <boost/format.hpp>
+#include <rapidjson/document.h>
+#include <rapidjson/filereadstream.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace tresta {
+
+    namespace {
+        const char *eventTypeNames[InteractionSession::NUM_EVENT_TYPES] = {"rotate", "translate", "zoom", "key",
+                                                                           "scale"};
+        const char *shadingModeNames[TrussScene::NUM_SHADING_MODES] = {"forward", "prepass", "deferred"};
+
+        bool parseEventType(const std::string &name, InteractionSession::EventType &type) {
+            for (int i = 0; i < InteractionSession::NUM_EVENT_TYPES; ++i) {
+                if (name == eventTypeNames[i]) {
+                    type = (InteractionSession::EventType) i;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int readInt(const rapidjson::Value &value, const char *member, size_t event) {
+            if (!value.HasMember(member) || !value[member].IsInt()) {
+                throw std::runtime_error(
+                    (boost::format("Event %d of the session has no integer %s.") % event % member).str()
+                );
+            }
+            return value[member].GetInt();
+        }
+
+        double readNumber(const rapidjson::Value &value, const char *member, size_t event) {
+            if (!value.HasMember(member) || !value[member].IsNumber()) {
+                throw std::runtime_error(
+                    (boost::format("Event %d of the session has no number %s.") % event % member).str()
+                );
+            }
+            return value[member].GetDouble();
+        }
+
+        void writeVector(rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer, const char *name,
+                         const QVector3D &vector) {
+            writer.Key(name);
+            writer.StartArray();
+            writer.Double(vector.x());
+            writer.Double(vector.y());
+            writer.Double(vector.z());
+            writer.EndArray();
+        }
+
+        QVector3D readVector(const rapidjson::Value &value, const char *member) {
+            if (!value.HasMember(member) || !value[member].IsArray() || value[member].Size() != 3 ||
+                !value[member][0].IsNumber() || !value[member][1].IsNumber() || !value[member][2].IsNumber()) {
+                throw std::runtime_error(
+                    (boost::format("The start of the session has no vector of three numbers %s.") % member).str()
+                );
+            }
+            const rapidjson::Value &array = value[member];
+            return QVector3D((float) array[0].GetDouble(), (float) array[1].GetDouble(), (float) array[2].GetDouble());
+        }
+
+        bool readBool(const rapidjson::Value &value, const char *member) {
+            if (!value.HasMember(member) || !value[member].IsBool())
+                throw std::runtime_error((boost::format("The start of the session has no boolean %s.") % member).str());
+            return value[member].GetBool();
+        }
+
+        TrussScene::ViewState readStart(const rapidjson::Value &value) {
+            if (!value.IsObject())
+                throw std::runtime_error("The start of the session is not an object.");
+
+            TrussScene::ViewState state;
+            state.translation = readVector(value, "translation");
+            state.rotation = readVector(value, "rotation");
+            if (!value.HasMember("deformation_scale") || !value["deformation_scale"].IsNumber())
+                throw std::runtime_error("The start of the session has no number deformation_scale.");
+            state.deformationScale = (float) value["deformation_scale"].GetDouble();
+
+            const std::string mode = value.HasMember("shading_mode") && value["shading_mode"].IsString() ?
+                                     value["shading_mode"].GetString() : "";
+            int m = 0;
+            while (m < TrussScene::NUM_SHADING_MODES && mode != shadingModeNames[m])
+                ++m;
+            if (m == TrussScene::NUM_SHADING_MODES)
+                throw std::runtime_error((boost::format("Unknown shading mode %s at the start of the session.")
+                                          % mode).str());
+            state.shadingMode = (TrussScene::ShadingMode) m;
+
+            state.renderOriginal = readBool(value, "show_original");
+            state.renderDeformed = readBool(value, "show_deformed");
+            state.cullingEnabled = readBool(value, "culling");
+            state.compactAttributes = readBool(value, "compact_attributes");
+            return state;
+        }
+    }
+
+    InteractionSession::InteractionSession() :
+            durationMs(0.0),
+            width(0),
+            height(0),
+            startRecorded(false),
+            recording(false) {
+    }
+
+    void InteractionSession::startRecording(int _width, int _height, const TrussScene::ViewState &_start) {
+        events.clear();
+        durationMs = 0.0;
+        width = _width;
+        height = _height;
+        start = _start;
+        startRecorded = true;
+        recording = true;
+        clock.start();
+    }
+
+    void InteractionSession::stopRecording() {
+        if (!recording)
+            return;
+
+        durationMs = clock.nsecsElapsed() / 1.0e6;
+        recording = false;
+    }
+
+    bool InteractionSession::isRecording() const {
+        return recording;
+    }
+
+    void InteractionSession::recordMouse(EventType type, int dx, int dy) {
+        Event event;
+        event.type = type;
+        event.dx = dx;
+        event.dy = dy;
+        record(event);
+    }
+
+    void InteractionSession::recordKey(int key) {
+        Event event;
+        event.type = KEY_EVENT;
+        event.key = key;
+        record(event);
+    }
+
+    void InteractionSession::recordScale(float scale) {
+        Event event;
+        event.type = SCALE_EVENT;
+        event.scale = scale;
+        record(event);
+    }
+
+    void InteractionSession::record(const Event &event) {
+        if (!recording)
+            return;
+
+        events.push_back(event);
+        events.back().timeMs = clock.nsecsElapsed() / 1.0e6;
+    }
+
+    void InteractionSession::save(const std::string &fileName) const {
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+        writer.StartObject();
+        writer.Key("width");
+        writer.Int(width);
+        writer.Key("height");
+        writer.Int(height);
+        writer.Key("duration_ms");
+        writer.Double(durationMs);
+        if (startRecorded) {
+            writer.Key("start");
+            writer.StartObject();
+            writeVector(writer, "translation", start.translation);
+            writeVector(writer, "rotation", start.rotation);
+            writer.Key("deformation_scale");
+            writer.Double(start.deformationScale);
+            writer.Key("shading_mode");
+            writer.String(shadingModeNames[start.shadingMode]);
+            writer.Key("show_original");
+            writer.Bool(start.renderOriginal);
+            writer.Key("show_deformed");
+            writer.Bool(start.renderDeformed);
+            writer.Key("culling");
+            writer.Bool(start.cullingEnabled);
+            writer.Key("compact_attributes");
+            writer.Bool(start.compactAttributes);
+            writer.EndObject();
+        }
+        writer.Key("events");
+        writer.StartArray();
+        for (size_t i = 0; i < events.size(); ++i) {
+            const Event &event = events[i];
+            writer.StartObject();
+            writer.Key("time_ms");
+            writer.Double(event.timeMs);
+            writer.Key("type");
+            writer.String(eventTypeNames[event.type]);
+            if (event.type == KEY_EVENT) {
+                writer.Key("key");
+                writer.Int(event.key);
+            }
+            else if (event.type == SCALE_EVENT) {
+                writer.Key("scale");
+                writer.Double(event.scale);
+            }
+            else {
+                writer.Key("dx");
+                writer.Int(event.dx);
+                writer.Key("dy");
+                writer.Int(event.dy);
+            }
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+
+        std::ofstream file(fileName.c_str(), std::ios::trunc);
+        file << std::string(buffer.GetString(), buffer.GetSize()) << "\n";
+        if (!file)
+            throw std::runtime_error((boost::format("Session %s could not be written.") % fileName).str());
+    }
+
+    InteractionSession InteractionSession::load(const std::string &fileName) {
+        FILE *file = fopen(fileName.c_str(), "r");
+        if (!file)
+            throw std::runtime_error((boost::format("Cannot open session file %s.") % fileName).str());
+
+        char readBuffer[65536];
+        rapidjson::FileReadStream stream(file, readBuffer, sizeof(readBuffer));
+        rapidjson::Document doc;
+        doc.ParseStream(stream);
+        fclose(file);
+
+        if (!doc.IsObject() || !doc.HasMember("events") || !doc["events"].IsArray())
+            throw std::runtime_error((boost::format("Invalid session file: %s") % fileName).str());
+
+        InteractionSession session;
+        session.width = doc.HasMember("width") && doc["width"].IsInt() ? doc["width"].GetInt() : 0;
+        session.height = doc.HasMember("height") && doc["height"].IsInt() ? doc["height"].GetInt() : 0;
+        if (doc.HasMember("start")) {
+            session.start = readStart(doc["start"]);
+            session.startRecorded = true;
+        }
+
+        const rapidjson::Value &events = doc["events"];
+        for (rapidjson::SizeType i = 0; i < events.Size(); ++i) {
+            const rapidjson::Value &value = events[i];
+            if (!value.IsObject() || !value.HasMember("type") || !value["type"].IsString())
+                throw std::runtime_error((boost::format("Event %d of the session has no type.") % i).str());
+
+            Event event;
+            if (!parseEventType(value["type"].GetString(), event.type)) {
+                throw std::runtime_error(
+                    (boost::format("Event %d of the session has the unknown type %s.") % i
+                     % value["type"].GetString()).str()
+                );
+            }
+            event.timeMs = readNumber(value, "time_ms", i);
+            if (event.type == KEY_EVENT) {
+                event.key = readInt(value, "key", i);
+            }
+            else if (event.type == SCALE_EVENT) {
+                event.scale = (float) readNumber(value, "scale", i);
+            }
+            else {
+                event.dx = readInt(value, "dx", i);
+                event.dy = readInt(value, "dy", i);
+            }
+
+            if (!session.events.empty() && event.timeMs < session.events.back().timeMs)
+                throw std::runtime_error((boost::format("Event %d of the session is out of order.") % i).str());
+            session.events.push_back(event);
+        }
+
+        session.durationMs = doc.HasMember("duration_ms") && doc["duration_ms"].IsNumber() ?
+                             doc["duration_ms"].GetDouble() : 0.0;
+        if (!session.events.empty())
+            session.durationMs = std::max(session.durationMs, session.events.back().timeMs);
+        return session;
+    }
+
+    const std::vector<InteractionSession::Event> &InteractionSession::getEvents() const {
+        return events;
+    }
+
+    double InteractionSession::getDurationMs() const {
+        return durationMs;
+    }
+
+    int InteractionSession::getWidth() const {
+        return width;
+    }
+
+    int InteractionSession::getHeight() const {
+        return height;
+    }
+
+    bool InteractionSession::hasStartState() const {
+        return startRecorded;
+    }
+
+    const TrussScene::ViewState &InteractionSession::getStartState() const {
+        return start;
+    }
+
+    void InteractionSession::applyStartState(TrussScene &scene) const {
+        if (startRecorded)
+            scene.setViewState(start);
+    }
+
+    void InteractionSession::apply(const Event &event, TrussScene &scene) {
+        switch (event.type) {
+            case ROTATE_EVENT:
+                scene.setRotate(event.dx, event.dy);
+                break;
+
+            case TRANSLATE_EVENT:
+                scene.setTranslate(event.dx, event.dy);
+                break;
+
+            case ZOOM_EVENT:
+                scene.setZoom(event.dx, event.dy);
+                break;
+
+            case KEY_EVENT:
+                scene.handleKeyEvent(event.key);
+                break;
+
+            case SCALE_EVENT:
+                scene.setDeformationScale(event.scale);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    std::string InteractionSession::eventTypeName(EventType type) {
+        return eventTypeNames[type];
+    }
+
+} // namespace tresta
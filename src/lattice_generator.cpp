@@ -0,0 +1,584 @@
+#include "lattice_generator.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QtEndian>
+#include <Eigen/Geometry>
+#include <boost/format.hpp>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+
+#include "setup.h"
+
+namespace tresta {
+
+    namespace {
+        const float pi = 3.14159265358979323846f;
+        const float siteTolerance = 1.0e-4f;/**<Sites and strut lengths are compared in fractions of the cell size.*/
+        const size_t rowsPerChunk = 65536;/**<Rows of a file formatted by one task.*/
+
+        /**
+         * Mixes the bits of a 64-bit value (SplitMix64), so every node gets independent random offsets.
+         */
+        inline quint64 mixBits(quint64 x) {
+            x += 0x9E3779B97F4A7C15ull;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+
+        /**
+         * Uniform random value on `[-1, 1]` determined by the seed, a node and an axis.
+         */
+        inline float randomOffset(unsigned int seed, quint64 node, int axis) {
+            const quint64 bits = mixBits(mixBits(((quint64) seed << 32) ^ node) + (quint64) axis);
+            return (float) ((bits >> 40) * (2.0 / 16777215.0) - 1.0);
+        }
+
+        /**
+         * Runs `task(first, last)` on ranges of `count` slabs on the global thread pool and waits for all of them.
+         */
+        void forEachSlab(int count, const std::function<void(int, int)> &task) {
+            const int tasks = std::max(1, std::min(count, 4 * QThread::idealThreadCount()));
+            std::vector<QFuture<void>> futures;
+            for (int i = 0; i < tasks; ++i) {
+                const int first = (int) ((long long) count * i / tasks);
+                const int last = (int) ((long long) count * (i + 1) / tasks);
+                futures.push_back(QtConcurrent::run([&task, first, last]() {
+                    task(first, last);
+                }));
+            }
+            for (size_t i = 0; i < futures.size(); ++i)
+                futures[i].waitForFinished();
+        }
+
+        /**
+         * Writes `rows` rows to a file. Chunks of rows are encoded concurrently on the global thread pool and
+         * written in order, with at most one chunk per core in flight.
+         */
+        void writeRows(const std::string &fileName, size_t rows,
+                       const std::function<QByteArray(size_t, size_t)> &encodeRows) {
+            QFile file(QString::fromStdString(fileName));
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                throw std::runtime_error((boost::format("%s could not be created.") % fileName).str());
+            }
+
+            const size_t maxPending = (size_t) std::max(1, QThread::idealThreadCount());
+            std::deque<QFuture<QByteArray>> pending;
+            bool written = true;
+            for (size_t first = 0; first < rows || !pending.empty(); first += rowsPerChunk) {
+                if (first < rows) {
+                    const size_t last = std::min(first + rowsPerChunk, rows);
+                    pending.push_back(QtConcurrent::run([&encodeRows, first, last]() {
+                        return encodeRows(first, last);
+                    }));
+                }
+                if (pending.size() >= maxPending || first >= rows) {
+                    // the tasks reference the caller's data, so all of them finish before an error is thrown
+                    const QByteArray chunk = pending.front().result();
+                    pending.pop_front();
+                    if (written && file.write(chunk) != chunk.size())
+                        written = false;
+                }
+            }
+
+            if (!written) {
+                throw std::runtime_error((boost::format("Writing to %s failed.") % fileName).str());
+            }
+        }
+
+        /**
+         * Encodes rows of a CSV file; `formatRow` prints one row into a buffer of `maxRowBytes` bytes.
+         */
+        QByteArray encodeCsvRows(size_t first, size_t last, int maxRowBytes,
+                                 const std::function<int(size_t, char *)> &formatRow) {
+            QByteArray chunk;
+            chunk.reserve((int) ((last - first) * maxRowBytes));
+            std::vector<char> row(maxRowBytes);
+            for (size_t i = first; i < last; ++i)
+                chunk.append(&row[0], formatRow(i, &row[0]));
+            return chunk;
+        }
+    }
+
+    LatticeGenerator::LatticeGenerator() :
+            cellType(SIMPLE_CUBIC),
+            repetitions(10),
+            cellSize(1.0f),
+            perturbation(0.0f),
+            seed(0),
+            displacementField(NO_DISPLACEMENTS),
+            amplitude(0.05f),
+            mode(1),
+            colorScheme(NO_COLORS) {
+        buildCell();
+    }
+
+    void LatticeGenerator::setCellType(CellType _cellType) {
+        cellType = _cellType;
+        buildCell();
+    }
+
+    void LatticeGenerator::setRepetitions(int _repetitions) {
+        repetitions = std::max(1, _repetitions);
+    }
+
+    void LatticeGenerator::setCellSize(float _cellSize) {
+        cellSize = _cellSize;
+    }
+
+    void LatticeGenerator::setPerturbation(float fraction, unsigned int _seed) {
+        perturbation = fraction;
+        seed = _seed;
+    }
+
+    void LatticeGenerator::setDisplacementField(DisplacementField field, float _amplitude, int _mode) {
+        displacementField = field;
+        amplitude = _amplitude;
+        mode = std::max(1, _mode);
+    }
+
+    void LatticeGenerator::setColorScheme(ColorScheme scheme) {
+        colorScheme = scheme;
+    }
+
+    size_t LatticeGenerator::elemCount() const {
+        // whether a strut lies inside the lattice is decided axis by axis, so the cells holding it are a box
+        const int n = repetitions;
+        size_t count = 0;
+        for (size_t s = 0; s < struts.size(); ++s) {
+            size_t cells = 1;
+            for (int a = 0; a < 3; ++a) {
+                const bool fromOnFace = sites[struts[s].from].position[a] < siteTolerance;
+                const bool toOnFace = sites[struts[s].to].position[a] < siteTolerance;
+                size_t valid = 0;
+                for (int c = 0; c <= n; ++c) {
+                    const int q = c + struts[s].offset[a];
+                    if ((c < n || fromOnFace) && q >= 0 && (q < n || (q == n && toOnFace)))
+                        ++valid;
+                }
+                cells *= valid;
+            }
+            count += cells;
+        }
+        return count;
+    }
+
+    int LatticeGenerator::repetitionsFor(CellType cellType, size_t numElems) {
+        LatticeGenerator generator;
+        generator.setCellType(cellType);
+        int n = std::max(1, (int) std::cbrt((double) numElems / generator.struts.size()) - 1);
+        generator.setRepetitions(n);
+        while (generator.elemCount() < numElems)
+            generator.setRepetitions(++n);
+        return n;
+    }
+
+    std::string LatticeGenerator::cellTypeName(CellType cellType) {
+        switch (cellType) {
+            case SIMPLE_CUBIC:
+                return "sc";
+            case BODY_CENTERED_CUBIC:
+                return "bcc";
+            case OCTET:
+                return "octet";
+            case KELVIN:
+                return "kelvin";
+            default:
+                return "";
+        }
+    }
+
+    Job LatticeGenerator::generate() const {
+        Geometry geometry;
+        buildGeometry(geometry);
+
+        // the job takes over the vectors, so a large lattice is only held once
+        Job job;
+        job.nodes = std::move(geometry.nodes);
+        job.elems = std::move(geometry.elems);
+        job.displacements = std::move(geometry.displacements);
+        job.colors = std::move(geometry.colors);
+        if (!job.displacements.empty()) {
+            // the strips of every element are independent, so they are interpolated in slices of elements
+            const size_t numElems = job.elems.size();
+            const int slices = std::max(1, std::min((int) (numElems / 4096), 4 * QThread::idealThreadCount()));
+            job.node_strips.resize(numElems);
+            forEachSlab(slices, [&](int first, int last) {
+                for (int i = first; i < last; ++i) {
+                    const size_t begin = numElems * i / slices;
+                    const size_t end = numElems * (i + 1) / slices;
+                    const std::vector<Elem> elems(job.elems.begin() + begin, job.elems.begin() + end);
+                    std::vector<std::vector<Node>> strips = createNodeStrips(job.nodes, elems, job.displacements,
+                                                                             1.0f);
+                    std::move(strips.begin(), strips.end(), job.node_strips.begin() + begin);
+                }
+            });
+        }
+        return job;
+    }
+
+    void LatticeGenerator::writeConfig(const std::string &configFileName, bool binaryDisplacements) const {
+        Geometry geometry;
+        buildGeometry(geometry);
+
+        // absolute paths let the config be opened from any directory
+        const QFileInfo configInfo(QString::fromStdString(configFileName));
+        const std::string base = (configInfo.absolutePath() + "/" + configInfo.completeBaseName()).toStdString();
+        const std::string nodesFile = base + "_nodes.csv";
+        const std::string elemsFile = base + "_elems.csv";
+        const std::string propsFile = base + "_props.csv";
+        const std::string colorsFile = base + "_colors.csv";
+        const std::string displacementsFile = base + (binaryDisplacements ? "_displacements.bin" :
+                                                                            "_displacements.csv");
+
+        const std::vector<Node> &nodes = geometry.nodes;
+        writeRows(nodesFile, nodes.size(), [&](size_t first, size_t last) {
+            return encodeCsvRows(first, last, 64, [&](size_t i, char *row) {
+                return std::snprintf(row, 64, "%.7g,%.7g,%.7g\n", nodes[i].x(), nodes[i].y(), nodes[i].z());
+            });
+        });
+
+        const std::vector<Elem> &elems = geometry.elems;
+        writeRows(elemsFile, elems.size(), [&](size_t first, size_t last) {
+            return encodeCsvRows(first, last, 32, [&](size_t i, char *row) {
+                return std::snprintf(row, 32, "%d,%d\n", elems[i].node_numbers[0], elems[i].node_numbers[1]);
+            });
+        });
+        writeRows(propsFile, elems.size(), [&](size_t first, size_t last) {
+            return encodeCsvRows(first, last, 64, [&](size_t i, char *row) {
+                const Eigen::Vector3f &normal = elems[i].props.normal_vec;
+                return std::snprintf(row, 64, "%.6f,%.6f,%.6f\n", normal.x(), normal.y(), normal.z());
+            });
+        });
+
+        const std::vector<QColor> &colors = geometry.colors;
+        if (!colors.empty()) {
+            writeRows(colorsFile, colors.size(), [&](size_t first, size_t last) {
+                return encodeCsvRows(first, last, 64, [&](size_t i, char *row) {
+                    return std::snprintf(row, 64, "%.4f,%.4f,%.4f,%.4f\n", colors[i].redF(), colors[i].greenF(),
+                                         colors[i].blueF(), colors[i].alphaF());
+                });
+            });
+        }
+
+        const std::vector<Displacement> &displacements = geometry.displacements;
+        if (!displacements.empty() && binaryDisplacements) {
+            writeRows(displacementsFile, displacements.size(), [&](size_t first, size_t last) {
+                QByteArray chunk((int) ((last - first) * 6 * sizeof(float)), '\0');
+                char *out = chunk.data();
+                quint32 bits;
+                for (size_t i = first; i < last; ++i) {
+                    for (int j = 0; j < 6; ++j) {
+                        std::memcpy(&bits, &displacements[i](j), sizeof(bits));
+                        bits = qToLittleEndian(bits);
+                        std::memcpy(out, &bits, sizeof(bits));
+                        out += sizeof(bits);
+                    }
+                }
+                return chunk;
+            });
+        }
+        else if (!displacements.empty()) {
+            writeRows(displacementsFile, displacements.size(), [&](size_t first, size_t last) {
+                return encodeCsvRows(first, last, 128, [&](size_t i, char *row) {
+                    const Displacement &d = displacements[i];
+                    return std::snprintf(row, 128, "%.7g,%.7g,%.7g,%.7g,%.7g,%.7g\n", d(0), d(1), d(2), d(3),
+                                         d(4), d(5));
+                });
+            });
+        }
+
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("nodes");
+        writer.String(nodesFile.c_str());
+        writer.Key("elems");
+        writer.String(elemsFile.c_str());
+        writer.Key("props");
+        writer.String(propsFile.c_str());
+        if (!colors.empty()) {
+            writer.Key("colors");
+            writer.String(colorsFile.c_str());
+        }
+        if (!displacements.empty()) {
+            writer.Key("displacements");
+            writer.String(displacementsFile.c_str());
+        }
+        writer.EndObject();
+
+        QFile config(configInfo.absoluteFilePath());
+        if (!config.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text) ||
+            config.write(buffer.GetString(), (qint64) buffer.GetSize()) != (qint64) buffer.GetSize()) {
+            throw std::runtime_error((boost::format("%s could not be written.") % configFileName).str());
+        }
+    }
+
+    void LatticeGenerator::buildCell() {
+        sites.clear();
+        struts.clear();
+
+        std::vector<Eigen::Vector3f> positions;
+        float strutLength = 1.0f;
+        switch (cellType) {
+            case SIMPLE_CUBIC:
+                positions.push_back(Eigen::Vector3f(0.0f, 0.0f, 0.0f));
+                strutLength = 1.0f;
+                break;
+
+            case BODY_CENTERED_CUBIC:
+                positions.push_back(Eigen::Vector3f(0.0f, 0.0f, 0.0f));
+                positions.push_back(Eigen::Vector3f(0.5f, 0.5f, 0.5f));
+                strutLength = 0.5f * std::sqrt(3.0f);
+                break;
+
+            case OCTET:
+                positions.push_back(Eigen::Vector3f(0.0f, 0.0f, 0.0f));
+                positions.push_back(Eigen::Vector3f(0.5f, 0.5f, 0.0f));
+                positions.push_back(Eigen::Vector3f(0.5f, 0.0f, 0.5f));
+                positions.push_back(Eigen::Vector3f(0.0f, 0.5f, 0.5f));
+                strutLength = 0.5f * std::sqrt(2.0f);
+                break;
+
+            case KELVIN:
+            default: {
+                // vertices of the truncated octahedra at the corner and the center, permutations of (0, ±1, ±2)/4
+                const int permutations[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+                for (int center = 0; center < 2; ++center) {
+                    for (int p = 0; p < 6; ++p) {
+                        for (int signs = 0; signs < 8; ++signs) {
+                            Eigen::Vector3f position;
+                            for (int a = 0; a < 3; ++a) {
+                                const int sign = (signs >> a) & 1 ? -1 : 1;
+                                position[a] = ((2 * center + sign * permutations[p][a] + 4) % 4) / 4.0f;
+                            }
+                            bool known = false;
+                            for (size_t i = 0; i < positions.size() && !known; ++i)
+                                known = (positions[i] - position).norm() < siteTolerance;
+                            if (!known)
+                                positions.push_back(position);
+                        }
+                    }
+                }
+                strutLength = 0.25f * std::sqrt(2.0f);
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < positions.size(); ++i) {
+            Site site;
+            for (int a = 0; a < 3; ++a)
+                site.position[a] = positions[i][a];
+            sites.push_back(site);
+        }
+
+        // every pair of sites at the strut length is joined once, from the site the strut points away from
+        for (size_t from = 0; from < positions.size(); ++from) {
+            for (size_t to = 0; to < positions.size(); ++to) {
+                for (int offset = 0; offset < 27; ++offset) {
+                    const Eigen::Vector3f cell(offset % 3 - 1.0f, offset / 3 % 3 - 1.0f, offset / 9 - 1.0f);
+                    const Eigen::Vector3f direction = positions[to] + cell - positions[from];
+                    if (std::abs(direction.norm() - strutLength) > siteTolerance)
+                        continue;
+
+                    int a = 0;
+                    while (std::abs(direction[a]) < siteTolerance)
+                        ++a;
+                    if (direction[a] < 0.0f)
+                        continue;
+
+                    Strut strut;
+                    strut.from = (int) from;
+                    strut.to = (int) to;
+                    for (int b = 0; b < 3; ++b)
+                        strut.offset[b] = (int) cell[b];
+                    struts.push_back(strut);
+                }
+            }
+        }
+    }
+
+    bool LatticeGenerator::isInside(const int cell[3], int site) const {
+        // sites on the lower faces of a cell also close the lattice at its upper faces
+        for (int a = 0; a < 3; ++a) {
+            if (cell[a] < 0 || cell[a] > repetitions ||
+                (cell[a] == repetitions && sites[site].position[a] >= siteTolerance))
+                return false;
+        }
+        return true;
+    }
+
+    void LatticeGenerator::buildGeometry(Geometry &geometry) const {
+        const int n = repetitions;
+        const int side = n + 1;
+        const int numSites = (int) sites.size();
+        const size_t numSlots = (size_t) side * side * side * numSites;
+        if (numSlots > (size_t) INT_MAX || elemCount() > (size_t) INT_MAX) {
+            throw std::runtime_error(
+                (boost::format("A lattice of %d^3 cells exceeds the number of nodes and elements a job can index.")
+                 % n).str()
+            );
+        }
+
+        // neighbors of every site in both directions, to leave out nodes without a strut inside the lattice
+        std::vector<std::vector<Strut>> neighbors(numSites);
+        for (size_t s = 0; s < struts.size(); ++s) {
+            Strut reverse = struts[s];
+            std::swap(reverse.from, reverse.to);
+            for (int a = 0; a < 3; ++a)
+                reverse.offset[a] = -reverse.offset[a];
+            neighbors[struts[s].from].push_back(struts[s]);
+            neighbors[struts[s].to].push_back(reverse);
+        }
+
+        // slots are numbered by cell, then site; each slab of cells along z counts and then numbers its nodes
+        std::vector<int> nodeIndex(numSlots, -1);
+        std::vector<size_t> slabNodes(side + 1, 0);
+        forEachSlab(side, [&](int first, int last) {
+            int cell[3], other[3];
+            for (cell[2] = first; cell[2] < last; ++cell[2]) {
+                for (cell[1] = 0; cell[1] < side; ++cell[1]) {
+                    for (cell[0] = 0; cell[0] < side; ++cell[0]) {
+                        const size_t slot = (((size_t) cell[2] * side + cell[1]) * side + cell[0]) * numSites;
+                        for (int s = 0; s < numSites; ++s) {
+                            if (!isInside(cell, s))
+                                continue;
+                            for (size_t k = 0; k < neighbors[s].size(); ++k) {
+                                for (int a = 0; a < 3; ++a)
+                                    other[a] = cell[a] + neighbors[s][k].offset[a];
+                                if (isInside(other, neighbors[s][k].to)) {
+                                    nodeIndex[slot + s] = 0;
+                                    ++slabNodes[cell[2] + 1];
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        for (int k = 0; k < side; ++k)
+            slabNodes[k + 1] += slabNodes[k];
+
+        const float width = n * cellSize;
+        geometry.nodes.resize(slabNodes[side]);
+        if (displacementField != NO_DISPLACEMENTS)
+            geometry.displacements.resize(slabNodes[side]);
+        forEachSlab(side, [&](int first, int last) {
+            size_t next = slabNodes[first];
+            for (int k = first; k < last; ++k) {
+                for (int j = 0; j < side; ++j) {
+                    for (int i = 0; i < side; ++i) {
+                        const size_t slot = (((size_t) k * side + j) * side + i) * numSites;
+                        for (int s = 0; s < numSites; ++s) {
+                            if (nodeIndex[slot + s] < 0)
+                                continue;
+
+                            nodeIndex[slot + s] = (int) next;
+                            Node &node = geometry.nodes[next];
+                            node << i + sites[s].position[0], j + sites[s].position[1], k + sites[s].position[2];
+                            node *= cellSize;
+                            if (perturbation > 0.0f) {
+                                for (int a = 0; a < 3; ++a)
+                                    node[a] += perturbation * cellSize * randomOffset(seed, slot + s, a);
+                            }
+
+                            if (displacementField == BENDING) {
+                                // cantilever with a tip deflection of `amplitude` times its length
+                                const float x = node.x() / width;
+                                geometry.displacements[next] << 0.0f, 0.5f * amplitude * width * x * x * (3.0f - x),
+                                        0.0f, 0.0f, 0.0f, amplitude * (3.0f * x - 1.5f * x * x);
+                            }
+                            else if (displacementField == BUCKLING) {
+                                const float y = node.y() / width;
+                                geometry.displacements[next] << amplitude * width * std::sin(mode * pi * y),
+                                        0.0f, 0.0f, 0.0f, 0.0f, -amplitude * mode * pi * std::cos(mode * pi * y);
+                            }
+                            ++next;
+                        }
+                    }
+                }
+            }
+        });
+
+        // struts belong to the cell of their first node
+        std::vector<size_t> slabElems(side + 1, 0);
+        forEachSlab(side, [&](int first, int last) {
+            int cell[3], other[3];
+            for (cell[2] = first; cell[2] < last; ++cell[2]) {
+                for (cell[1] = 0; cell[1] < side; ++cell[1]) {
+                    for (cell[0] = 0; cell[0] < side; ++cell[0]) {
+                        for (size_t s = 0; s < struts.size(); ++s) {
+                            for (int a = 0; a < 3; ++a)
+                                other[a] = cell[a] + struts[s].offset[a];
+                            if (isInside(cell, struts[s].from) && isInside(other, struts[s].to))
+                                ++slabElems[cell[2] + 1];
+                        }
+                    }
+                }
+            }
+        });
+        for (int k = 0; k < side; ++k)
+            slabElems[k + 1] += slabElems[k];
+        assert(slabElems[side] == elemCount());
+
+        geometry.elems.resize(slabElems[side]);
+        if (colorScheme != NO_COLORS)
+            geometry.colors.resize(slabElems[side]);
+        forEachSlab(side, [&](int first, int last) {
+            int cell[3], other[3];
+            size_t next = slabElems[first];
+            for (cell[2] = first; cell[2] < last; ++cell[2]) {
+                for (cell[1] = 0; cell[1] < side; ++cell[1]) {
+                    for (cell[0] = 0; cell[0] < side; ++cell[0]) {
+                        const size_t slot = (((size_t) cell[2] * side + cell[1]) * side + cell[0]) * numSites;
+                        for (size_t s = 0; s < struts.size(); ++s) {
+                            for (int a = 0; a < 3; ++a)
+                                other[a] = cell[a] + struts[s].offset[a];
+                            if (!isInside(cell, struts[s].from) || !isInside(other, struts[s].to))
+                                continue;
+
+                            const size_t otherSlot = (((size_t) other[2] * side + other[1]) * side + other[0]) *
+                                                     numSites;
+                            const int nn1 = nodeIndex[slot + struts[s].from];
+                            const int nn2 = nodeIndex[otherSlot + struts[s].to];
+
+                            // the normal is any direction across the strut, taken from the axis it is least along
+                            const Node direction = geometry.nodes[nn2] - geometry.nodes[nn1];
+                            Node across = Node::Zero();
+                            int axis;
+                            direction.cwiseAbs().minCoeff(&axis);
+                            across[axis] = 1.0f;
+                            const Node normal = direction.cross(across);
+                            geometry.elems[next] = Elem(nn1, nn2, Props(normal.x(), normal.y(), normal.z()));
+
+                            if (colorScheme == ORIENTATION_COLORS) {
+                                geometry.colors[next] = QColor::fromHsvF((float) s / struts.size(), 0.65, 0.9);
+                            }
+                            else if (colorScheme == HEIGHT_COLORS) {
+                                const float height = 0.5f * (geometry.nodes[nn1].y() + geometry.nodes[nn2].y());
+                                const float t = std::max(0.0f, std::min(1.0f, height / width));
+                                geometry.colors[next] = QColor::fromHsvF((1.0f - t) * 2.0f / 3.0f, 0.8, 0.9);
+                            }
+                            ++next;
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+} // namespace tresta
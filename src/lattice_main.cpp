@@ -0,0 +1,168 @@
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "lattice_generator.h"
+
+namespace {
+    /**
+     * Lattice and output of a run.
+     */
+    struct LatticeOptions {
+        LatticeOptions() :
+                cellType(tresta::LatticeGenerator::SIMPLE_CUBIC),
+                repetitions(10),
+                elements(0),
+                cellSize(1.0f),
+                perturbation(0.0f),
+                seed(0),
+                displacementField(tresta::LatticeGenerator::NO_DISPLACEMENTS),
+                amplitude(0.05f),
+                mode(1),
+                colorScheme(tresta::LatticeGenerator::NO_COLORS),
+                binaryDisplacements(false) {}
+
+        tresta::LatticeGenerator::CellType cellType;
+        int repetitions;
+        size_t elements;/**<0 to use `repetitions`.*/
+        float cellSize;
+        float perturbation;
+        unsigned int seed;
+        tresta::LatticeGenerator::DisplacementField displacementField;
+        float amplitude;
+        int mode;
+        tresta::LatticeGenerator::ColorScheme colorScheme;
+        bool binaryDisplacements;
+    };
+
+    void printUsage(const char *program) {
+        std::cerr << "usage: " << program << " [options] lattice.json" << std::endl
+                  << "  -c  unit cell: sc, bcc, octet or kelvin (default sc)" << std::endl
+                  << "  -n  cells along each axis (default 10)" << std::endl
+                  << "  -e  choose the cells along each axis for at least this many elements, e.g. 1e8" << std::endl
+                  << "  -s  edge length of the unit cell (default 1)" << std::endl
+                  << "  -p  random offset of the nodes as a fraction of the cell size (default 0)" << std::endl
+                  << "  -r  seed of the random offsets (default 0)" << std::endl
+                  << "  -d  displacements: none, bending or buckling (default none)" << std::endl
+                  << "  -a  largest displacement as a fraction of the lattice size (default 0.05)" << std::endl
+                  << "  -m  half waves of the buckling mode shape (default 1)" << std::endl
+                  << "  -l  element colors: none, orientation or height (default none)" << std::endl
+                  << "  -f  displacement file format: csv or bin (default csv)" << std::endl
+                  << "The CSV files are written next to the config and named after it." << std::endl;
+    }
+
+    bool parseOption(const char *flag, const char *value, LatticeOptions &options) {
+        if (std::strcmp(flag, "-c") == 0) {
+            for (int i = 0; i < tresta::LatticeGenerator::NUM_CELL_TYPES; ++i) {
+                const tresta::LatticeGenerator::CellType cellType = (tresta::LatticeGenerator::CellType) i;
+                if (tresta::LatticeGenerator::cellTypeName(cellType) == value) {
+                    options.cellType = cellType;
+                    return true;
+                }
+            }
+            return false;
+        }
+        else if (std::strcmp(flag, "-n") == 0) {
+            options.repetitions = std::atoi(value);
+            return options.repetitions > 0;
+        }
+        else if (std::strcmp(flag, "-e") == 0) {
+            const double elements = std::atof(value);
+            options.elements = (size_t) elements;
+            return elements >= 1.0;
+        }
+        else if (std::strcmp(flag, "-s") == 0) {
+            options.cellSize = (float) std::atof(value);
+            return options.cellSize > 0.0f;
+        }
+        else if (std::strcmp(flag, "-p") == 0) {
+            options.perturbation = (float) std::atof(value);
+            return options.perturbation >= 0.0f;
+        }
+        else if (std::strcmp(flag, "-r") == 0) {
+            options.seed = (unsigned int) std::strtoul(value, 0, 10);
+        }
+        else if (std::strcmp(flag, "-d") == 0) {
+            if (std::strcmp(value, "none") == 0)
+                options.displacementField = tresta::LatticeGenerator::NO_DISPLACEMENTS;
+            else if (std::strcmp(value, "bending") == 0)
+                options.displacementField = tresta::LatticeGenerator::BENDING;
+            else if (std::strcmp(value, "buckling") == 0)
+                options.displacementField = tresta::LatticeGenerator::BUCKLING;
+            else
+                return false;
+        }
+        else if (std::strcmp(flag, "-a") == 0) {
+            options.amplitude = (float) std::atof(value);
+        }
+        else if (std::strcmp(flag, "-m") == 0) {
+            options.mode = std::atoi(value);
+            return options.mode > 0;
+        }
+        else if (std::strcmp(flag, "-l") == 0) {
+            if (std::strcmp(value, "none") == 0)
+                options.colorScheme = tresta::LatticeGenerator::NO_COLORS;
+            else if (std::strcmp(value, "orientation") == 0)
+                options.colorScheme = tresta::LatticeGenerator::ORIENTATION_COLORS;
+            else if (std::strcmp(value, "height") == 0)
+                options.colorScheme = tresta::LatticeGenerator::HEIGHT_COLORS;
+            else
+                return false;
+        }
+        else if (std::strcmp(flag, "-f") == 0) {
+            if (std::strcmp(value, "csv") == 0)
+                options.binaryDisplacements = false;
+            else if (std::strcmp(value, "bin") == 0)
+                options.binaryDisplacements = true;
+            else
+                return false;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    LatticeOptions options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!parseOption(argv[arg], argv[arg + 1], options)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - arg != 1) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::string config(argv[arg]);
+    tresta::LatticeGenerator generator;
+    generator.setCellType(options.cellType);
+    const int repetitions = options.elements > 0 ?
+                            tresta::LatticeGenerator::repetitionsFor(options.cellType, options.elements) :
+                            options.repetitions;
+    generator.setRepetitions(repetitions);
+    generator.setCellSize(options.cellSize);
+    generator.setPerturbation(options.perturbation, options.seed);
+    generator.setDisplacementField(options.displacementField, options.amplitude, options.mode);
+    generator.setColorScheme(options.colorScheme);
+
+    try {
+        generator.writeConfig(config, options.binaryDisplacements);
+        std::cout << "Generated " << generator.elemCount() << " elements in " << repetitions << "^3 "
+                  << tresta::LatticeGenerator::cellTypeName(options.cellType) << " cells into " << config << std::endl;
+    }
+    catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,10 +1,15 @@
 #include <QApplication>
 #include <QSurfaceFormat>
+#include <exception>
+#include <iostream>
 
 #include "mainwindow.h"
+#include "trace.h"
 
 int main(int argc, char *argv[])
 {
+    tresta::Tracer::startFromEnvironment();
+
     QApplication app(argc, argv);
     app.setOrganizationName("Latture");
     app.setApplicationName("Tresta");
@@ -19,5 +24,14 @@ int main(int argc, char *argv[])
     tresta::MainWindow w;
     w.show();
 
-    return app.exec();
+    const int status = app.exec();
+
+    // covers every config opened during the session
+    try {
+        tresta::Tracer::stop();
+    }
+    catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+    return status;
 }
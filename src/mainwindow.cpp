@@ -81,6 +81,10 @@ namespace tresta {
         sendKey(Qt::Key_C);
     }
 
+    void MainWindow::memoryUsagePressed() {
+        sendKey(Qt::Key_U);
+    }
+
     void MainWindow::zoomChanged(bool isEnabled) {
         zoomButton->setChecked(isEnabled);
     }
@@ -116,8 +120,21 @@ namespace tresta {
                                  "Key R:\ttoggle rotate (left mouse)\r\n"
                                  "Key S:\tscale deformation\r\n"
                                  "Key C:\tchoose colors\r\n"
+                                 "Key H:\ttoggle occlusion culling\r\n"
+                                 "Key M:\tcycle shading mode (forward, depth pre-pass, deferred)\r\n"
+                                 "Key Q:\ttoggle compact vertex attributes\r\n"
+                                 "Space:\tplay/pause displacement sequence\r\n"
+                                 "Left/Right:\tstep one frame back/forward\r\n"
+                                 "PgUp/PgDn:\tskip a tenth of the sequence\r\n"
+                                 "Home:\trewind to the first frame\r\n"
+                                 "Keys 1-9:\tshow a single mode shape\r\n"
+                                 "Key 0:\tsuperpose all mode shapes\r\n"
                                  "Key F:\ttoggle demo mode\r\n"
-                                 "Key E:\tExport current mesh to PLY file\r\n"
+                                 "Key E:\tExport current mesh to PLY or glTF file\r\n"
+                                 "Key T:\ttoggle frame timings overlay\r\n"
+                                 "Key X:\texport frame timings to CSV or JSON file\r\n"
+                                 "Key U:\tshow memory usage\r\n"
+                                 "Key K:\tstart/stop recording an interaction session\r\n"
        );
         QMessageBox::about(this, tr("About Tresta"), aboutText);
     }
@@ -170,7 +187,7 @@ namespace tresta {
         demoAct->setStatusTip(tr("Enter demo mode"));
         connect(demoAct, &QAction::triggered, this, &MainWindow::demoPressed);
 
-        exportAct = new QAction(QIcon(":/assets/export.png"), tr("&Export current mesh to PLY file"), this);
+        exportAct = new QAction(QIcon(":/assets/export.png"), tr("&Export current mesh to PLY or glTF file"), this);
         exportAct->setStatusTip(tr("Export current mesh"));
         connect(exportAct, &QAction::triggered, this, &MainWindow::exportPressed);
 
@@ -178,6 +195,10 @@ namespace tresta {
         setColorAct->setStatusTip(tr("Choose colors for current scene"));
         connect(setColorAct, &QAction::triggered, this, &MainWindow::setColorPressed);
 
+        memoryUsageAct = new QAction(tr("Show &memory usage"), this);
+        memoryUsageAct->setStatusTip(tr("Show the memory held by the current scene"));
+        connect(memoryUsageAct, &QAction::triggered, this, &MainWindow::memoryUsagePressed);
+
         exitAct = new QAction(QIcon(":/assets/window-close.png"), tr("E&xit"), this);
         exitAct->setShortcuts(QKeySequence::Quit);
         exitAct->setStatusTip(tr("Exit the application"));
@@ -207,6 +228,7 @@ namespace tresta {
         editMenu->addAction(demoAct);
         editMenu->addAction(exportAct);
         editMenu->addAction(setColorAct);
+        editMenu->addAction(memoryUsageAct);
 
         menuBar()->addSeparator();
 
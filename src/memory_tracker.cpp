@@ -0,0 +1,130 @@
+#include "memory_tracker.h"
+
+#include <QOpenGLBuffer>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <atomic>
+
+namespace tresta {
+
+    namespace {
+        const char *subsystemNames[] = {"parse temporaries", "job data", "node strips", "vertex views",
+                                        "deformed vertex views", "upload staging", "GPU shape buffers",
+                                        "GPU instance buffers", "GPU deformed instance buffers",
+                                        "GPU attribute buffers", "GPU displacement textures",
+                                        "GPU culling buffers", "GPU readback buffers"};
+
+        std::atomic<long long> currentBytes[MemoryTracker::NUM_SUBSYSTEMS];
+        std::atomic<long long> peakBytes[MemoryTracker::NUM_SUBSYSTEMS];
+        std::atomic<long long> currentTotals[2];/**<CPU and GPU.*/
+        std::atomic<long long> peakTotals[2];
+
+        void raisePeak(std::atomic<long long> &peak, long long value) {
+            long long seen = peak.load(std::memory_order_relaxed);
+            while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+        }
+
+        MemoryTracker::Usage makeUsage(const std::atomic<long long> &current, const std::atomic<long long> &peak) {
+            MemoryTracker::Usage usage;
+            usage.current = (size_t) std::max(current.load(std::memory_order_relaxed), 0LL);
+            usage.peak = (size_t) std::max(peak.load(std::memory_order_relaxed), 0LL);
+            return usage;
+        }
+
+        std::string formatRow(const std::string &name, const MemoryTracker::Usage &usage) {
+            return (boost::format("%-30s %12.1f %12.1f\n") % name % (usage.current / 1048576.0)
+                    % (usage.peak / 1048576.0)).str();
+        }
+    }
+
+    void MemoryTracker::add(Subsystem subsystem, long long bytes) {
+        if (bytes == 0)
+            return;
+
+        const long long current = currentBytes[subsystem].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        raisePeak(peakBytes[subsystem], current);
+
+        const int side = isGpu(subsystem) ? 1 : 0;
+        const long long total = currentTotals[side].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        raisePeak(peakTotals[side], total);
+    }
+
+    MemoryTracker::Usage MemoryTracker::usage(Subsystem subsystem) {
+        return makeUsage(currentBytes[subsystem], peakBytes[subsystem]);
+    }
+
+    MemoryTracker::Usage MemoryTracker::total(bool gpu) {
+        return makeUsage(currentTotals[gpu ? 1 : 0], peakTotals[gpu ? 1 : 0]);
+    }
+
+    void MemoryTracker::resetPeaks() {
+        for (int i = 0; i < NUM_SUBSYSTEMS; ++i)
+            peakBytes[i].store(currentBytes[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (int i = 0; i < 2; ++i)
+            peakTotals[i].store(currentTotals[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    std::string MemoryTracker::subsystemName(Subsystem subsystem) {
+        return subsystemNames[subsystem];
+    }
+
+    bool MemoryTracker::isGpu(Subsystem subsystem) {
+        return subsystem >= GPU_SHAPE_BUFFERS;
+    }
+
+    std::string MemoryTracker::report() {
+        std::string table = (boost::format("%-30s %12s %12s\n") % "subsystem" % "current MiB" % "peak MiB").str();
+        for (int i = 0; i < NUM_SUBSYSTEMS; ++i)
+            table += formatRow(subsystemNames[i], usage((Subsystem) i));
+        table += formatRow("CPU total", total(false));
+        table += formatRow("GPU total", total(true));
+        return table;
+    }
+
+    TrackedBytes::TrackedBytes(MemoryTracker::Subsystem _subsystem, size_t bytes) :
+            subsystem(_subsystem),
+            count(0) {
+        set(bytes);
+    }
+
+    TrackedBytes::~TrackedBytes() {
+        set(0);
+    }
+
+    void TrackedBytes::set(size_t bytes) {
+        MemoryTracker::add(subsystem, (long long) bytes - (long long) count);
+        count = bytes;
+    }
+
+    size_t TrackedBytes::bytes() const {
+        return count;
+    }
+
+    GpuBufferAccount::~GpuBufferAccount() {
+        for (BufferMap::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+            MemoryTracker::add(it->second.first, -(long long) it->second.second);
+    }
+
+    void GpuBufferAccount::allocate(QOpenGLBuffer &buffer, const void *data, size_t bytes,
+                                    MemoryTracker::Subsystem subsystem) {
+        buffer.allocate(data, (int) bytes);
+        release(buffer);
+        buffers[&buffer] = std::make_pair(subsystem, bytes);
+        MemoryTracker::add(subsystem, (long long) bytes);
+    }
+
+    void GpuBufferAccount::destroy(QOpenGLBuffer &buffer) {
+        buffer.destroy();
+        release(buffer);
+    }
+
+    void GpuBufferAccount::release(const QOpenGLBuffer &buffer) {
+        BufferMap::iterator it = buffers.find(&buffer);
+        if (it == buffers.end())
+            return;
+
+        MemoryTracker::add(it->second.first, -(long long) it->second.second);
+        buffers.erase(it);
+    }
+
+} // namespace tresta
@@ -0,0 +1,187 @@
+#include "modal_basis.h"
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "glassert.h"
+
+namespace tresta {
+
+    namespace {
+        const float twoPi = 6.28318530718f;
+        const float halfPi = 1.57079632679f;
+    }
+
+    const unsigned int ModalBasis::maxModes = 32;
+
+    ModalBasis::ModalBasis() :
+            mGLFunc(0),
+            buffer(0),
+            texture(0),
+            playing(true) {}
+
+    ModalBasis::~ModalBasis() {
+        if (mGLFunc) {
+            mGLFunc->glDeleteTextures(1, &texture);
+            mGLFunc->glDeleteBuffers(1, &buffer);
+        }
+    }
+
+    void ModalBasis::setModes(const DisplacementSequence &_modes, const std::vector<float> &_frequencies) {
+        if (_modes.frameCount() > maxModes) {
+            throw std::runtime_error(
+                (boost::format("%d mode shapes were given, but at most %d can be superposed.")
+                 % _modes.frameCount() % maxModes).str()
+            );
+        }
+        if (_frequencies.size() != _modes.frameCount()) {
+            throw std::runtime_error(
+                (boost::format("Number of mode frequencies (%d) does not match the number of mode shapes (%d).")
+                 % _frequencies.size() % _modes.frameCount()).str()
+            );
+        }
+
+        modes = _modes;
+        frequencies = _frequencies;
+        // a quarter period in, so the weights are at their peak before the first update
+        phases.assign(modes.frameCount(), halfPi);
+        weights.assign(modes.frameCount(), 0.0f);
+        soloMode(0);
+    }
+
+    bool ModalBasis::isActive() const {
+        return !modes.isEmpty();
+    }
+
+    void ModalBasis::initialize(QOpenGLFunctions_3_3_Core *glFunc) {
+        if (!isActive())
+            return;
+
+        // the shaders fetch the whole basis through one samplerBuffer, so it has to fit in a single texture
+        GLint maxTexels = 0;
+        glFunc->glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        if (modes.frameCount() * modeStride() > (size_t) maxTexels) {
+            throw std::runtime_error(
+                (boost::format("%d mode shapes of %d nodes need %d texels, but texture buffers hold at most %d. "
+                               "Pass fewer modes or a smaller model.")
+                 % modes.frameCount() % modes.nodeCount() % (modes.frameCount() * modeStride()) % maxTexels).str()
+            );
+        }
+
+        mGLFunc = glFunc;
+        const size_t modeValues = modes.nodeCount() * DisplacementSequence::valuesPerNode;
+        std::vector<float> basis(modes.frameCount() * modeValues);
+        std::vector<size_t> frames(modes.frameCount());
+        std::vector<std::vector<float>> values;
+
+        for (size_t k = 0; k < frames.size(); ++k)
+            frames[k] = k;
+        modes.readFrames(frames, values);
+
+        for (size_t k = 0; k < values.size(); ++k)
+            std::copy(values[k].begin(), values[k].end(), basis.begin() + k * modeValues);
+
+        mGLFunc->glGenBuffers(1, &buffer);
+        mGLFunc->glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        mGLFunc->glBufferData(GL_TEXTURE_BUFFER, basis.size() * sizeof(float), &basis[0], GL_STATIC_DRAW);
+        mGLFunc->glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        mGLFunc->glGenTextures(1, &texture);
+        mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, texture);
+        mGLFunc->glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, buffer);
+        mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glCheckError();
+    }
+
+    void ModalBasis::update(float dt) {
+        if (!isActive())
+            return;
+
+        if (playing) {
+            for (size_t k = 0; k < phases.size(); ++k)
+                phases[k] = std::fmod(phases[k] + twoPi * frequencies[k] * dt, twoPi);
+        }
+        updateWeights();
+    }
+
+    void ModalBasis::bindBasis(int unit) {
+        mGLFunc->glActiveTexture(GL_TEXTURE0 + unit);
+        mGLFunc->glBindTexture(GL_TEXTURE_BUFFER, texture);
+        mGLFunc->glActiveTexture(GL_TEXTURE0);
+    }
+
+    const std::vector<float> &ModalBasis::getWeights() const {
+        return weights;
+    }
+
+    void ModalBasis::setAmplitudes(const std::vector<float> &_amplitudes) {
+        if (_amplitudes.size() != modes.frameCount()) {
+            throw std::runtime_error(
+                (boost::format("Number of amplitudes (%d) does not match the number of mode shapes (%d).")
+                 % _amplitudes.size() % modes.frameCount()).str()
+            );
+        }
+        amplitudes = _amplitudes;
+        updateWeights();
+    }
+
+    void ModalBasis::soloMode(size_t mode) {
+        if (mode >= modes.frameCount())
+            return;
+
+        amplitudes.assign(modes.frameCount(), 0.0f);
+        amplitudes[mode] = 1.0f;
+        updateWeights();
+    }
+
+    void ModalBasis::superposeAll() {
+        amplitudes.assign(modes.frameCount(), 1.0f);
+        updateWeights();
+    }
+
+    void ModalBasis::setPlaying(bool isPlaying) {
+        playing = isPlaying;
+    }
+
+    bool ModalBasis::isPlaying() const {
+        return playing;
+    }
+
+    size_t ModalBasis::modeCount() const {
+        return modes.frameCount();
+    }
+
+    size_t ModalBasis::modeStride() const {
+        return 2 * modes.nodeCount();
+    }
+
+    size_t ModalBasis::gpuBytes() const {
+        return modes.frameCount() * modes.nodeCount() * DisplacementSequence::valuesPerNode * sizeof(float);
+    }
+
+    std::vector<Displacement> ModalBasis::getDisplacements() const {
+        std::vector<Displacement> disp_out(modes.nodeCount(), Displacement::Zero());
+        std::vector<float> values;
+
+        for (size_t k = 0; k < modes.frameCount(); ++k) {
+            if (weights[k] == 0.0f)
+                continue;
+
+            modes.readFrame(k, values);
+            for (size_t i = 0; i < disp_out.size(); ++i) {
+                for (unsigned int j = 0; j < DisplacementSequence::valuesPerNode; ++j)
+                    disp_out[i](j) += weights[k] * values[DisplacementSequence::valuesPerNode * i + j];
+            }
+        }
+        return disp_out;
+    }
+
+    void ModalBasis::updateWeights() {
+        for (size_t k = 0; k < weights.size(); ++k)
+            weights[k] = amplitudes[k] * std::sin(phases[k]);
+    }
+
+} // namespace tresta
@@ -0,0 +1,327 @@
+#include "occlusion_culler.h"
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_4_3_Core>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "glassert.h"
+#include "trace.h"
+
+namespace tresta {
+
+    namespace {
+        struct DrawElementsIndirectCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLuint baseVertex;
+            GLuint baseInstance;
+        };
+
+        // spreads the lower 10 bits of v so that there are two zero bits between each original bit
+        unsigned int expandBits(unsigned int v) {
+            v = (v * 0x00010001u) & 0xFF0000FFu;
+            v = (v * 0x00000101u) & 0x0F00F00Fu;
+            v = (v * 0x00000011u) & 0xC30C30C3u;
+            v = (v * 0x00000005u) & 0x49249249u;
+            return v;
+        }
+
+        unsigned int mortonCode(float x, float y, float z) {
+            const float scale = 1023.0f;
+            unsigned int xi = (unsigned int) std::min(std::max(x * scale, 0.0f), scale);
+            unsigned int yi = (unsigned int) std::min(std::max(y * scale, 0.0f), scale);
+            unsigned int zi = (unsigned int) std::min(std::max(z * scale, 0.0f), scale);
+            return (expandBits(xi) << 2) | (expandBits(yi) << 1) | expandBits(zi);
+        }
+    }
+
+    const unsigned int OcclusionCuller::elementsPerCluster = 32;
+
+    std::vector<unsigned int> computeSpatialElementOrder(const std::vector<Node> &nodes,
+                                                         const std::vector<Elem> &elems) {
+        TRESTA_TRACE_SCOPE("computeSpatialElementOrder");
+        std::vector<Node> midpoints(elems.size());
+        Node lo, hi;
+        lo.setConstant(std::numeric_limits<float>::max());
+        hi.setConstant(std::numeric_limits<float>::lowest());
+
+        for (size_t i = 0; i < elems.size(); ++i) {
+            midpoints[i] = 0.5f * (nodes[elems[i].node_numbers[0]] + nodes[elems[i].node_numbers[1]]);
+            lo = lo.cwiseMin(midpoints[i]);
+            hi = hi.cwiseMax(midpoints[i]);
+        }
+
+        Node extent = (hi - lo).cwiseMax(Node::Constant(1.0e-12f));
+        std::vector<unsigned int> codes(elems.size());
+        for (size_t i = 0; i < elems.size(); ++i) {
+            Node unit = (midpoints[i] - lo).cwiseQuotient(extent);
+            codes[i] = mortonCode(unit.x(), unit.y(), unit.z());
+        }
+
+        std::vector<unsigned int> order(elems.size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&codes](unsigned int a, unsigned int b) {
+            return codes[a] < codes[b];
+        });
+        return order;
+    }
+
+    OcclusionCuller::OcclusionCuller(unsigned int numMeshes) :
+            mGLFunc(nullptr),
+            clusterSets(numMeshes),
+            trackedBuffers(MemoryTracker::GPU_CULLING_BUFFERS),
+            depthTexture(0),
+            pyramidTexture(0),
+            viewportWidth(0),
+            viewportHeight(0),
+            pyramidLevels(0),
+            supported(false) {
+    }
+
+    OcclusionCuller::~OcclusionCuller() {
+        if (!supported || !QOpenGLContext::currentContext())
+            return;
+
+        for (size_t i = 0; i < clusterSets.size(); ++i) {
+            GLuint buffers[] = {clusterSets[i].boundsBuffer,
+                                clusterSets[i].firstPassBuffer,
+                                clusterSets[i].secondPassBuffer};
+            mGLFunc->glDeleteBuffers(3, buffers);
+        }
+        mGLFunc->glDeleteTextures(1, &depthTexture);
+        mGLFunc->glDeleteTextures(1, &pyramidTexture);
+    }
+
+    bool OcclusionCuller::initialize() {
+        TRESTA_TRACE_SCOPE("OcclusionCuller::initialize");
+        QOpenGLContext *context = QOpenGLContext::currentContext();
+        if (!context || context->format().version() < qMakePair(4, 3))
+            return false;
+
+        mGLFunc = context->versionFunctions<QOpenGLFunctions_4_3_Core>();
+        if (!mGLFunc || !mGLFunc->initializeOpenGLFunctions())
+            return false;
+
+        if (!mPyramidShader.addShaderFromSourceFile(QOpenGLShader::Compute, ":assets/shaders/hiz_build.comp")
+            || !mPyramidShader.link()) {
+            qCritical() << "Error building depth pyramid shader.";
+            return false;
+        }
+        if (!mCullShader.addShaderFromSourceFile(QOpenGLShader::Compute, ":assets/shaders/cluster_cull.comp")
+            || !mCullShader.link()) {
+            qCritical() << "Error building cluster culling shader.";
+            return false;
+        }
+
+        for (size_t i = 0; i < clusterSets.size(); ++i) {
+            mGLFunc->glGenBuffers(1, &clusterSets[i].boundsBuffer);
+            mGLFunc->glGenBuffers(1, &clusterSets[i].firstPassBuffer);
+            mGLFunc->glGenBuffers(1, &clusterSets[i].secondPassBuffer);
+        }
+        mGLFunc->glGenTextures(1, &depthTexture);
+        mGLFunc->glGenTextures(1, &pyramidTexture);
+        glCheckError();
+
+        supported = true;
+        return supported;
+    }
+
+    bool OcclusionCuller::isSupported() const {
+        return supported;
+    }
+
+    void OcclusionCuller::resize(int width, int height) {
+        if (!supported || width <= 0 || height <= 0)
+            return;
+
+        viewportWidth = width;
+        viewportHeight = height;
+        pyramidLevels = 1 + (int) std::floor(std::log2((float) std::max(width, height)));
+
+        // immutable storage cannot be resized, so replace both textures
+        mGLFunc->glDeleteTextures(1, &depthTexture);
+        mGLFunc->glDeleteTextures(1, &pyramidTexture);
+        mGLFunc->glGenTextures(1, &depthTexture);
+        mGLFunc->glGenTextures(1, &pyramidTexture);
+
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, depthTexture);
+        mGLFunc->glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+        mGLFunc->glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, 0);
+        glCheckError();
+    }
+
+    void OcclusionCuller::setInstances(unsigned int mesh,
+                                       const Shape &shape,
+                                       const std::vector<QMatrix4x4> &matrices,
+                                       const std::vector<unsigned int> &elementOrder,
+                                       unsigned int instancesPerElement) {
+        TRESTA_TRACE_SCOPE("OcclusionCuller::setInstances");
+        if (!supported)
+            return;
+
+        ClusterSet &clusters = clusterSets[mesh];
+        const size_t instancesPerCluster = elementsPerCluster * instancesPerElement;
+        const size_t numInstances = elementOrder.size() * instancesPerElement;
+        clusters.numClusters = (GLsizei) ((numInstances + instancesPerCluster - 1) / instancesPerCluster);
+
+        // local bounding box of the shape
+        float localMin[3], localMax[3], localCenter[3], localExtent[3];
+        std::fill(localMin, localMin + 3, std::numeric_limits<float>::max());
+        std::fill(localMax, localMax + 3, std::numeric_limits<float>::lowest());
+        for (size_t i = 0; i < shape.vertices.size(); ++i) {
+            localMin[i % 3] = std::min(localMin[i % 3], shape.vertices[i]);
+            localMax[i % 3] = std::max(localMax[i % 3], shape.vertices[i]);
+        }
+        for (size_t j = 0; j < 3; ++j) {
+            localCenter[j] = 0.5f * (localMax[j] + localMin[j]);
+            localExtent[j] = 0.5f * (localMax[j] - localMin[j]);
+        }
+
+        std::vector<float> bounds(8 * clusters.numClusters);
+        std::vector<DrawElementsIndirectCommand> commands(clusters.numClusters);
+        const GLuint indexCount = (GLuint) shape.indices.size();
+
+        for (GLsizei c = 0; c < clusters.numClusters; ++c) {
+            const size_t first = c * instancesPerCluster;
+            const size_t last = std::min(first + instancesPerCluster, numInstances);
+            float lo[3], hi[3];
+            std::fill(lo, lo + 3, std::numeric_limits<float>::max());
+            std::fill(hi, hi + 3, std::numeric_limits<float>::lowest());
+
+            for (size_t k = first; k < last; ++k) {
+                const QMatrix4x4 &m = matrices[elementOrder[k / instancesPerElement] * instancesPerElement
+                                               + k % instancesPerElement];
+                // transform the local box: center goes through the full matrix, extents through |M|
+                for (int i = 0; i < 3; ++i) {
+                    float center = m(i, 3);
+                    float extent = 0.0f;
+                    for (int j = 0; j < 3; ++j) {
+                        center += m(i, j) * localCenter[j];
+                        extent += std::fabs(m(i, j)) * localExtent[j];
+                    }
+                    lo[i] = std::min(lo[i], center - extent);
+                    hi[i] = std::max(hi[i], center + extent);
+                }
+            }
+
+            for (int i = 0; i < 3; ++i) {
+                bounds[8 * c + i] = lo[i];
+                bounds[8 * c + 4 + i] = hi[i];
+            }
+            bounds[8 * c + 3] = (float) (last - first);
+            bounds[8 * c + 7] = 0.0f;
+
+            commands[c].count = indexCount;
+            commands[c].instanceCount = 0;
+            commands[c].firstIndex = 0;
+            commands[c].baseVertex = 0;
+            commands[c].baseInstance = (GLuint) first;
+        }
+
+        mGLFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusters.boundsBuffer);
+        mGLFunc->glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(float), bounds.data(), GL_STATIC_DRAW);
+        mGLFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusters.firstPassBuffer);
+        mGLFunc->glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+                              commands.data(), GL_DYNAMIC_DRAW);
+        mGLFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusters.secondPassBuffer);
+        mGLFunc->glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+                              commands.data(), GL_DYNAMIC_DRAW);
+        mGLFunc->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glCheckError();
+
+        clusters.gpuBytes = bounds.size() * sizeof(float) + 2 * commands.size() * sizeof(DrawElementsIndirectCommand);
+        size_t totalBytes = 0;
+        for (size_t i = 0; i < clusterSets.size(); ++i)
+            totalBytes += clusterSets[i].gpuBytes;
+        trackedBuffers.set(totalBytes);
+    }
+
+    void OcclusionCuller::drawFirstPass(unsigned int mesh) {
+        drawCommands(clusterSets[mesh], clusterSets[mesh].firstPassBuffer);
+    }
+
+    void OcclusionCuller::drawSecondPass(unsigned int mesh) {
+        drawCommands(clusterSets[mesh], clusterSets[mesh].secondPassBuffer);
+    }
+
+    void OcclusionCuller::drawVisible(unsigned int mesh) {
+        drawCommands(clusterSets[mesh], clusterSets[mesh].firstPassBuffer);
+    }
+
+    void OcclusionCuller::drawCommands(const ClusterSet &clusters, GLuint commandBuffer) {
+        if (clusters.numClusters == 0)
+            return;
+
+        mGLFunc->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        mGLFunc->glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, 0, clusters.numClusters, 0);
+        mGLFunc->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void OcclusionCuller::buildDepthPyramid() {
+        if (pyramidLevels == 0)
+            return;
+
+        mGLFunc->glActiveTexture(GL_TEXTURE0);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, depthTexture);
+        mGLFunc->glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, viewportWidth, viewportHeight);
+
+        mPyramidShader.bind();
+        mPyramidShader.setUniformValue("src", 0);
+
+        int srcWidth = viewportWidth;
+        int srcHeight = viewportHeight;
+        for (int level = 0; level < pyramidLevels; ++level) {
+            const int dstWidth = std::max(1, viewportWidth >> level);
+            const int dstHeight = std::max(1, viewportHeight >> level);
+
+            // level 0 is a copy of the depth buffer, every other level reduces the one above it
+            mGLFunc->glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+            mPyramidShader.setUniformValue("srcLevel", level - 1);
+            mPyramidShader.setUniformValue("srcSize", (GLfloat) srcWidth, (GLfloat) srcHeight);
+            mGLFunc->glBindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            mGLFunc->glDispatchCompute((dstWidth + 7) / 8, (dstHeight + 7) / 8, 1);
+            mGLFunc->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+            srcWidth = dstWidth;
+            srcHeight = dstHeight;
+        }
+
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, 0);
+        glCheckError();
+    }
+
+    void OcclusionCuller::cull(unsigned int mesh, const QMatrix4x4 &viewProjection) {
+        const ClusterSet &clusters = clusterSets[mesh];
+        if (clusters.numClusters == 0 || pyramidLevels == 0)
+            return;
+
+        mCullShader.bind();
+        mCullShader.setUniformValue("viewProjection", viewProjection);
+        mCullShader.setUniformValue("viewportSize", (GLfloat) viewportWidth, (GLfloat) viewportHeight);
+        mCullShader.setUniformValue("pyramidLevels", pyramidLevels);
+        mCullShader.setUniformValue("numClusters", (GLuint) clusters.numClusters);
+        mCullShader.setUniformValue("pyramid", 0);
+
+        mGLFunc->glActiveTexture(GL_TEXTURE0);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+        mGLFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clusters.boundsBuffer);
+        mGLFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clusters.firstPassBuffer);
+        mGLFunc->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusters.secondPassBuffer);
+
+        mGLFunc->glDispatchCompute((clusters.numClusters + 63) / 64, 1, 1);
+        mGLFunc->glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, 0);
+        glCheckError();
+    }
+
+} // namespace tresta
@@ -0,0 +1,96 @@
+#include "offscreen.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QSurfaceFormat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace tresta {
+
+    bool isViewOption(const char *flag) {
+        return std::strcmp(flag, "-r") == 0 || std::strcmp(flag, "-c") == 0 || std::strcmp(flag, "-z") == 0 ||
+               std::strcmp(flag, "-m") == 0;
+    }
+
+    bool parseViewOption(const char *flag, const char *value, ViewOptions &view) {
+        int width, height;
+        float x, y, z;
+
+        if (std::strcmp(flag, "-r") == 0) {
+            if (std::sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                return false;
+            view.size = QSize(width, height);
+            view.sizeSet = true;
+        }
+        else if (std::strcmp(flag, "-c") == 0) {
+            if (std::sscanf(value, "%f,%f,%f", &x, &y, &z) != 3)
+                return false;
+            view.rotation = QVector3D(x, y, z);
+        }
+        else if (std::strcmp(flag, "-z") == 0) {
+            view.distance = (float) std::atof(value);
+            return view.distance > 0.0f;
+        }
+        else if (std::strcmp(flag, "-m") == 0) {
+            if (!parseShadingMode(value, view.shadingMode))
+                return false;
+            view.shadingModeSet = true;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    bool parseShadingMode(const char *name, TrussScene::ShadingMode &mode) {
+        if (std::strcmp(name, "forward") == 0)
+            mode = TrussScene::FORWARD_SHADING;
+        else if (std::strcmp(name, "prepass") == 0)
+            mode = TrussScene::DEPTH_PREPASS_SHADING;
+        else if (std::strcmp(name, "deferred") == 0)
+            mode = TrussScene::DEFERRED_SHADING;
+        else
+            return false;
+        return true;
+    }
+
+    ColorSettings defaultColorSettings(const Job &job, const ScalarStatistics &statistics) {
+        ColorSettings settings;
+        settings.origColor = QColor::fromRgbF(0.0824f, 0.3961f, 0.7529f, job.displacements.empty() ? 1.0f : 0.5f);
+        settings.defColor = QColor::fromRgbF(0.7176f, 0.1098f, 0.1098f, 1.0f);
+        settings.useUserColors = !job.colors.empty();
+        settings.useScalars = !job.scalars.empty();
+        settings.scalarMin = statistics.lowPercentile;
+        settings.scalarMax = statistics.highPercentile;
+        return settings;
+    }
+
+    void useOffscreenPlatform() {
+        if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    bool createOffscreenContext(QOffscreenSurface &surface, QOpenGLContext &context) {
+        QSurfaceFormat format;
+        format.setVersion(4, 1);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+        format.setDepthBufferSize(24);
+        format.setStencilBufferSize(8);
+        QSurfaceFormat::setDefaultFormat(format);
+
+        surface.setFormat(format);
+        surface.create();
+
+        context.setFormat(format);
+        if (!context.create() || !context.makeCurrent(&surface)) {
+            std::cerr << "error: could not create an OpenGL " << format.majorVersion() << "." << format.minorVersion()
+                      << " core context" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+} // namespace tresta
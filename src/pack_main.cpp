@@ -0,0 +1,58 @@
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "displacement_container.h"
+
+namespace {
+    void printUsage(const char *program) {
+        std::cerr << "usage: " << program << " [-b frames_per_block] [-l level] output.tdc frame_0.csv frame_1.csv ..."
+                  << std::endl
+                  << "  -b  frames compressed together (default "
+                  << tresta::DisplacementContainer::defaultFramesPerBlock << ")" << std::endl
+                  << "  -l  zlib compression level from 0 to 9 (default 6)" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int framesPerBlock = tresta::DisplacementContainer::defaultFramesPerBlock;
+    int level = -1;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (std::strcmp(argv[arg], "-b") == 0) {
+            framesPerBlock = (unsigned int) std::atoi(argv[arg + 1]);
+        }
+        else if (std::strcmp(argv[arg], "-l") == 0) {
+            level = std::atoi(argv[arg + 1]);
+        }
+        else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - arg < 2) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::string output(argv[arg]);
+    const std::vector<std::string> frames(argv + arg + 1, argv + argc);
+
+    try {
+        tresta::DisplacementContainer::pack(frames, output, framesPerBlock, level);
+        tresta::DisplacementContainer container(output);
+        std::cout << "Packed " << container.frameCount() << " frames of " << container.nodeCount()
+                  << " nodes into " << output << std::endl;
+    }
+    catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,19 +1,736 @@
 #include "ply_exporter.h"
 #include <QApplication>
+#include <QFile>
 #include <QFileDialog>
 #include <QMutexLocker>
 #include <QMessageBox>
 #include <QPushButton>
+#include <QTextStream>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <unordered_map>
 #include <QtConcurrentRun>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TRESTA_PLY_SSE
+#endif
+
 namespace tresta {
 
+    namespace {
+        const size_t verticesPerChunk = 65536;/**<Approximate number of vertices or faces encoded per chunk.*/
+        const size_t chunksInFlight = 4;/**<Chunks the producer may run ahead of the writer.*/
+        const unsigned long progressInterval = 50;/**<Milliseconds between progress updates of the GUI thread.*/
+
+        QString plyHeader(PlyExporter::Format format, size_t numVertices, size_t numFaces, bool colors) {
+            QString header = QString("ply\n"
+                                     "format %1 1.0\n"
+                                     "comment Made by tresta\n"
+                                     "element vertex %2\n"
+                                     "property float x\n"
+                                     "property float y\n"
+                                     "property float z\n"
+                                     "property float nx\n"
+                                     "property float ny\n"
+                                     "property float nz\n")
+                    .arg(format == PlyExporter::ASCII ? QString("ascii") : QString("binary_little_endian"),
+                         QString::number(numVertices));
+            if (colors) {
+                header += QString("property uchar red\n"
+                                  "property uchar green\n"
+                                  "property uchar blue\n"
+                                  "property uchar alpha\n");
+            }
+            header += QString("element face %1\n"
+                              "property list uchar int vertex_indices\n"
+                              "end_header\n").arg(QString::number(numFaces));
+            return header;
+        }
+
+        inline void putFloat(char *&out, float value) {
+            quint32 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = qToLittleEndian(bits);
+            std::memcpy(out, &bits, sizeof(bits));
+            out += sizeof(bits);
+        }
+
+        inline void putInt(char *&out, quint32 value) {
+            value = qToLittleEndian(value);
+            std::memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        }
+
+        /**
+         * Vertices and normals of a shape as separate coordinate arrays, padded with zeros to a multiple of 4 so
+         * that every instance transforms in whole SIMD lanes.
+         */
+        struct ShapeSoA {
+            size_t count;
+            size_t padded;
+            std::vector<float> coords;/**<px, py, pz, nx, ny, nz, each `padded` long.*/
+
+            explicit ShapeSoA(const Shape *shape) :
+                    count(shape->vertices.size() / 3),
+                    padded((count + 3) & ~(size_t) 3),
+                    coords(6 * padded, 0.0f) {
+                for (size_t j = 0; j < count; ++j) {
+                    for (size_t k = 0; k < 3; ++k) {
+                        coords[k * padded + j] = shape->vertices[3 * j + k];
+                        coords[(k + 3) * padded + j] = shape->normals[3 * j + k];
+                    }
+                }
+            }
+
+            const float *operator[](size_t k) const {
+                return &coords[k * padded];
+            }
+        };
+
+        /**
+         * Transforms every vertex of `soa` by an instance matrix. `out` receives six arrays of `soa.padded`
+         * floats laid out like `ShapeSoA::coords`: transformed positions, then unit normals.
+         */
+        void transformShape(const QMatrix4x4 &matrix, const ShapeSoA &soa, float *out) {
+            const float *m = matrix.constData();// column-major
+            const size_t n = soa.padded;
+            const float *px = soa[0], *py = soa[1], *pz = soa[2];
+            const float *nx = soa[3], *ny = soa[4], *nz = soa[5];
+#ifdef TRESTA_PLY_SSE
+            __m128 c[16];
+            for (int k = 0; k < 16; ++k)
+                c[k] = _mm_set1_ps(m[k]);
+            const __m128 tiny = _mm_set1_ps(1e-30f);
+
+            for (size_t j = 0; j < n; j += 4) {
+                const __m128 x = _mm_loadu_ps(px + j), y = _mm_loadu_ps(py + j), z = _mm_loadu_ps(pz + j);
+                for (int r = 0; r < 3; ++r) {
+                    const __m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r], x), _mm_mul_ps(c[4 + r], y)),
+                                                _mm_add_ps(_mm_mul_ps(c[8 + r], z), c[12 + r]));
+                    _mm_storeu_ps(out + r * n + j, p);
+                }
+
+                const __m128 a = _mm_loadu_ps(nx + j), b = _mm_loadu_ps(ny + j), d = _mm_loadu_ps(nz + j);
+                __m128 t[3];
+                for (int r = 0; r < 3; ++r)
+                    t[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r], a), _mm_mul_ps(c[4 + r], b)), _mm_mul_ps(c[8 + r], d));
+                const __m128 length = _mm_max_ps(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t[0], t[0]),
+                                                                                   _mm_mul_ps(t[1], t[1])),
+                                                                        _mm_mul_ps(t[2], t[2]))), tiny);
+                for (int r = 0; r < 3; ++r)
+                    _mm_storeu_ps(out + (r + 3) * n + j, _mm_div_ps(t[r], length));
+            }
+#else
+            for (size_t j = 0; j < n; ++j) {
+                float t[3];
+                for (int r = 0; r < 3; ++r) {
+                    out[r * n + j] = m[r] * px[j] + m[4 + r] * py[j] + m[8 + r] * pz[j] + m[12 + r];
+                    t[r] = m[r] * nx[j] + m[4 + r] * ny[j] + m[8 + r] * nz[j];
+                }
+                const float length = std::max(std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]), 1e-30f);
+                for (int r = 0; r < 3; ++r)
+                    out[(r + 3) * n + j] = t[r] / length;
+            }
+#endif
+        }
+
+        enum FaceKind {
+            SIDE_FACE,
+            BOTTOM_CAP_FACE,
+            TOP_CAP_FACE
+        };
+
+        /**
+         * What welded exports need to know about the shape and the elements: which vertices and faces of the shape
+         * belong to its end caps, and which element ends are free rather than joints.
+         */
+        struct WeldInfo {
+            std::vector<bool> capVertex;/**<Whether each shape vertex belongs to a cap.*/
+            std::vector<FaceKind> faceKind;/**<Kind of each shape face.*/
+            std::vector<bool> freeEnd;/**<Per element, whether its first and its second node join no other element.*/
+            float tolerance;/**<Distance within which ring vertices of one element are merged.*/
+
+            WeldInfo(const Shape *shape, const std::vector<Elem> &elems, size_t numNodes, float relativeTolerance) {
+                const size_t count = shape->vertices.size() / 3;
+                float radius = 0.0f;
+                capVertex.resize(count);
+                for (size_t j = 0; j < count; ++j) {
+                    // cap normals point along the axis, side normals have a unit radial part
+                    const float nx = shape->normals[3 * j], nz = shape->normals[3 * j + 2];
+                    capVertex[j] = nx * nx + nz * nz < 0.25f;
+                    const float x = shape->vertices[3 * j], z = shape->vertices[3 * j + 2];
+                    radius = std::max(radius, std::sqrt(x * x + z * z));
+                }
+                tolerance = std::max(relativeTolerance * radius, 1e-12f);
+
+                faceKind.resize(shape->indices.size() / 3, SIDE_FACE);
+                for (size_t f = 0; f < faceKind.size(); ++f) {
+                    const unsigned short *face = &shape->indices[3 * f];
+                    if (capVertex[face[0]] && capVertex[face[1]] && capVertex[face[2]])
+                        faceKind[f] = shape->vertices[3 * face[0] + 1] > 0.5f ? TOP_CAP_FACE : BOTTOM_CAP_FACE;
+                }
+
+                std::vector<unsigned int> degree(numNodes, 0);
+                for (size_t e = 0; e < elems.size(); ++e) {
+                    for (int k = 0; k < 2; ++k) {
+                        if ((size_t) elems[e].node_numbers[k] < numNodes)
+                            ++degree[elems[e].node_numbers[k]];
+                    }
+                }
+                freeEnd.resize(2 * elems.size());
+                for (size_t e = 0; e < elems.size(); ++e) {
+                    for (int k = 0; k < 2; ++k) {
+                        const size_t node = (size_t) elems[e].node_numbers[k];
+                        freeEnd[2 * e + k] = node >= numNodes || degree[node] < 2;
+                    }
+                }
+            }
+
+            bool isFreeEnd(size_t element, int end) const {
+                // without element data every end keeps its cap
+                return element >= freeEnd.size() / 2 || freeEnd[2 * element + end];
+            }
+        };
+
+        /**
+         * Everything needed to encode the vertices or faces of a range of instances on a pool thread.
+         */
+        struct ChunkJob {
+            int pass;/**<0 for vertices, 1 for faces.*/
+            size_t first;
+            size_t last;
+            const Shape *shape;
+            const ShapeSoA *soa;
+            const std::vector<QMatrix4x4> *matrices;
+            PlyExporter::Format format;
+            const unsigned char *colors;/**<RGBA per element, or null.*/
+            size_t instancesPerElement;
+            const WeldInfo *weld;/**<Null unless the mesh is welded.*/
+            size_t vertexOffset;/**<Index of the first vertex of the chunk in the file, for welded meshes.*/
+            std::atomic<bool> *cancel;
+            std::atomic<size_t> *done;
+        };
+
+        /**
+         * Welded vertices and faces of a range of whole elements, indexed from the first vertex of the range.
+         */
+        struct WeldedMesh {
+            std::vector<float> positions;
+            std::vector<float> normals;
+            std::vector<float> weights;/**<Number of shape vertices merged into every vertex.*/
+            std::vector<size_t> elements;/**<Element of every vertex, for its color.*/
+            std::vector<quint32> faces;
+        };
+
+        inline quint64 cellKey(long long x, long long y, long long z) {
+            return ((quint64) (x & 0x1FFFFF) << 42) | ((quint64) (y & 0x1FFFFF) << 21) | (quint64) (z & 0x1FFFFF);
+        }
+
+        quint32 addVertex(WeldedMesh &mesh, const float *vertices, size_t n, size_t j, size_t element) {
+            for (int k = 0; k < 3; ++k) {
+                mesh.positions.push_back(vertices[k * n + j]);
+                mesh.normals.push_back(vertices[(k + 3) * n + j]);
+            }
+            mesh.weights.push_back(1.0f);
+            mesh.elements.push_back(element);
+            return (quint32) mesh.weights.size() - 1;
+        }
+
+        /**
+         * Builds the welded tubes of the elements in `[job.first, job.last)`: the segments of every element share
+         * the vertices that coincide within the tolerance and have similar normals, found through a spatial hash
+         * that is cleared for every element, caps only remain at free ends and faces that collapse are dropped.
+         */
+        void weldChunk(const ChunkJob &job, WeldedMesh &mesh) {
+            const ShapeSoA &soa = *job.soa;
+            const WeldInfo &weld = *job.weld;
+            const size_t n = soa.padded;
+            const float tolerance2 = weld.tolerance * weld.tolerance;
+            const float cellInv = 1.0f / weld.tolerance;
+            std::vector<float> vertices(6 * n);
+            std::vector<quint32> welded(soa.count);
+            std::unordered_map<quint64, std::vector<quint32>> cells;
+
+            for (size_t i = job.first; i < job.last; ++i) {
+                if (job.cancel->load(std::memory_order_relaxed))
+                    return;
+
+                const size_t element = i / job.instancesPerElement;
+                const size_t segment = i % job.instancesPerElement;
+                // welds never cross elements
+                if (segment == 0)
+                    cells.clear();
+                const bool bottomCap = segment == 0 && weld.isFreeEnd(element, 0);
+                const bool topCap = segment + 1 == job.instancesPerElement && weld.isFreeEnd(element, 1);
+
+                transformShape((*job.matrices)[i], soa, &vertices[0]);
+                for (size_t j = 0; j < soa.count; ++j) {
+                    if (weld.capVertex[j] && !(soa[1][j] > 0.5f ? topCap : bottomCap))
+                        continue;
+
+                    const float p[3] = {vertices[j], vertices[n + j], vertices[2 * n + j]};
+                    const long long c[3] = {(long long) std::floor(p[0] * cellInv), (long long) std::floor(p[1] * cellInv),
+                                            (long long) std::floor(p[2] * cellInv)};
+                    bool found = false;
+                    for (int dx = -1; dx <= 1 && !found; ++dx) {
+                        for (int dy = -1; dy <= 1 && !found; ++dy) {
+                            for (int dz = -1; dz <= 1 && !found; ++dz) {
+                                std::unordered_map<quint64, std::vector<quint32>>::const_iterator cell =
+                                        cells.find(cellKey(c[0] + dx, c[1] + dy, c[2] + dz));
+                                if (cell == cells.end())
+                                    continue;
+
+                                for (size_t k = 0; k < cell->second.size() && !found; ++k) {
+                                    const quint32 v = cell->second[k];
+                                    float d2 = 0.0f, cosine = 0.0f;
+                                    for (int r = 0; r < 3; ++r) {
+                                        const float d = mesh.positions[3 * v + r] / mesh.weights[v] - p[r];
+                                        d2 += d * d;
+                                        cosine += mesh.normals[3 * v + r] * vertices[(r + 3) * n + j];
+                                    }
+                                    // the rims of caps and sides coincide but keep their own normals
+                                    if (d2 <= tolerance2 && cosine > 0.5f * mesh.weights[v]) {
+                                        for (int r = 0; r < 3; ++r) {
+                                            mesh.positions[3 * v + r] += p[r];
+                                            mesh.normals[3 * v + r] += vertices[(r + 3) * n + j];
+                                        }
+                                        mesh.weights[v] += 1.0f;
+                                        welded[j] = v;
+                                        found = true;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    if (!found) {
+                        welded[j] = addVertex(mesh, &vertices[0], n, j, element);
+                        cells[cellKey(c[0], c[1], c[2])].push_back(welded[j]);
+                    }
+                }
+
+                const std::vector<unsigned short> &indices = job.shape->indices;
+                for (size_t f = 0; f < weld.faceKind.size(); ++f) {
+                    if ((weld.faceKind[f] == BOTTOM_CAP_FACE && !bottomCap) || (weld.faceKind[f] == TOP_CAP_FACE && !topCap))
+                        continue;
+
+                    const quint32 a = welded[indices[3 * f]], b = welded[indices[3 * f + 1]], d = welded[indices[3 * f + 2]];
+                    if (a == b || b == d || a == d)
+                        continue;
+                    mesh.faces.push_back(a);
+                    mesh.faces.push_back(b);
+                    mesh.faces.push_back(d);
+                }
+            }
+
+            for (size_t v = 0; v < mesh.weights.size(); ++v) {
+                const float *normal = &mesh.normals[3 * v];
+                const float length = std::max(std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]), 1e-30f);
+                for (int r = 0; r < 3; ++r) {
+                    mesh.positions[3 * v + r] /= mesh.weights[v];
+                    mesh.normals[3 * v + r] /= length;
+                }
+            }
+        }
+
+        /**
+         * Number of vertices and faces of a welded chunk, so the header and the index offsets of all chunks are
+         * known before any chunk is encoded.
+         */
+        std::pair<size_t, size_t> countWelded(ChunkJob job) {
+            WeldedMesh mesh;
+            weldChunk(job, mesh);
+            job.done->fetch_add(job.last - job.first, std::memory_order_relaxed);
+            return std::make_pair(mesh.weights.size(), mesh.faces.size() / 3);
+        }
+
+        /**
+         * Welds the chunk again and encodes its vertices or faces. The weld is deterministic, so every pass sees the
+         * vertices and faces that were counted.
+         */
+        void encodeWelded(const ChunkJob &job, QByteArray &chunk) {
+            WeldedMesh mesh;
+            weldChunk(job, mesh);
+            if (job.cancel->load(std::memory_order_relaxed))
+                return;
+
+            if (job.pass == 0) {
+                const size_t numVertices = mesh.weights.size();
+                if (job.format == PlyExporter::BINARY_LITTLE_ENDIAN) {
+                    chunk.resize((int) (numVertices * (6 * sizeof(float) + (job.colors ? 4 : 0))));
+                    char *out = chunk.data();
+                    for (size_t v = 0; v < numVertices; ++v) {
+                        for (int k = 0; k < 3; ++k)
+                            putFloat(out, mesh.positions[3 * v + k]);
+                        for (int k = 0; k < 3; ++k)
+                            putFloat(out, mesh.normals[3 * v + k]);
+                        if (job.colors) {
+                            std::memcpy(out, job.colors + 4 * mesh.elements[v], 4);
+                            out += 4;
+                        }
+                    }
+                    return;
+                }
+
+                QTextStream outStream(&chunk, QIODevice::WriteOnly);
+                for (size_t v = 0; v < numVertices; ++v) {
+                    outStream << mesh.positions[3 * v] << " " << mesh.positions[3 * v + 1] << " "
+                              << mesh.positions[3 * v + 2] << " " << mesh.normals[3 * v] << " "
+                              << mesh.normals[3 * v + 1] << " " << mesh.normals[3 * v + 2];
+                    if (job.colors) {
+                        const unsigned char *color = job.colors + 4 * mesh.elements[v];
+                        outStream << " " << (int) color[0] << " " << (int) color[1] << " " << (int) color[2] << " "
+                                  << (int) color[3];
+                    }
+                    outStream << "\n";
+                }
+                return;
+            }
+
+            const size_t numFaces = mesh.faces.size() / 3;
+            if (job.format == PlyExporter::BINARY_LITTLE_ENDIAN) {
+                chunk.resize((int) (numFaces * (1 + 3 * sizeof(quint32))));
+                char *out = chunk.data();
+                for (size_t f = 0; f < numFaces; ++f) {
+                    *out++ = (char) 3;
+                    for (size_t k = 0; k < 3; ++k)
+                        putInt(out, (quint32) (job.vertexOffset + mesh.faces[3 * f + k]));
+                }
+                return;
+            }
+
+            QTextStream outStream(&chunk, QIODevice::WriteOnly);
+            for (size_t f = 0; f < numFaces; ++f) {
+                outStream << 3;
+                for (size_t k = 0; k < 3; ++k)
+                    outStream << " " << job.vertexOffset + mesh.faces[3 * f + k];
+                outStream << "\n";
+            }
+        }
+
+        void encodeVertices(const ChunkJob &job, QByteArray &chunk) {
+            const ShapeSoA &soa = *job.soa;
+            const size_t n = soa.padded;
+            std::vector<float> vertices(6 * n);
+
+            QTextStream outStream(&chunk, QIODevice::WriteOnly);
+            char *out = 0;
+            if (job.format == PlyExporter::BINARY_LITTLE_ENDIAN) {
+                const size_t vertexBytes = 6 * sizeof(float) + (job.colors ? 4 : 0);
+                chunk.resize((int) ((job.last - job.first) * soa.count * vertexBytes));
+                out = chunk.data();
+            }
+
+            for (size_t i = job.first; i < job.last; ++i) {
+                if (job.cancel->load(std::memory_order_relaxed))
+                    return;
+
+                transformShape((*job.matrices)[i], soa, &vertices[0]);
+                const unsigned char *color = job.colors ? job.colors + 4 * (i / job.instancesPerElement) : 0;
+                for (size_t j = 0; j < soa.count; ++j) {
+                    if (out) {
+                        for (size_t k = 0; k < 6; ++k)
+                            putFloat(out, vertices[k * n + j]);
+                        if (color) {
+                            std::memcpy(out, color, 4);
+                            out += 4;
+                        }
+                        continue;
+                    }
+
+                    outStream << vertices[j] << " " << vertices[n + j] << " " << vertices[2 * n + j] << " "
+                              << vertices[3 * n + j] << " " << vertices[4 * n + j] << " " << vertices[5 * n + j];
+                    if (color) {
+                        outStream << " " << (int) color[0] << " " << (int) color[1] << " " << (int) color[2] << " "
+                                  << (int) color[3];
+                    }
+                    outStream << "\n";
+                }
+            }
+        }
+
+        void encodeFaces(const ChunkJob &job, QByteArray &chunk) {
+            const unsigned int ind_per_face = 3;
+            const std::vector<unsigned short> &indices = job.shape->indices;
+            const size_t faces_per_shape = indices.size() / ind_per_face;
+            const size_t pts_per_shape = job.soa->count;
+
+            if (job.format == PlyExporter::BINARY_LITTLE_ENDIAN) {
+                chunk.resize((int) ((job.last - job.first) * faces_per_shape * (1 + ind_per_face * sizeof(quint32))));
+                char *out = chunk.data();
+
+                for (size_t i = job.first; i < job.last; ++i) {
+                    if (job.cancel->load(std::memory_order_relaxed))
+                        return;
+                    for (size_t j = 0; j < faces_per_shape; ++j) {
+                        *out++ = (char) ind_per_face;
+                        // transform index into global space
+                        for (size_t k = 0; k < ind_per_face; ++k)
+                            putInt(out, (quint32) (pts_per_shape * i + indices[ind_per_face * j + k]));
+                    }
+                }
+                return;
+            }
+
+            QTextStream outStream(&chunk, QIODevice::WriteOnly);
+            for (size_t i = job.first; i < job.last; ++i) {
+                if (job.cancel->load(std::memory_order_relaxed))
+                    return;
+                for (size_t j = 0; j < faces_per_shape; ++j) {
+                    outStream << ind_per_face;
+                    for (size_t k = 0; k < ind_per_face; ++k)
+                        outStream << " " << pts_per_shape * i + indices[ind_per_face * j + k];
+                    outStream << "\n";
+                }
+            }
+        }
+
+        QByteArray encodeChunk(ChunkJob job) {
+            QByteArray chunk;
+            if (job.weld)
+                encodeWelded(job, chunk);
+            else if (job.pass == 0)
+                encodeVertices(job, chunk);
+            else
+                encodeFaces(job, chunk);
+            job.done->fetch_add(job.last - job.first, std::memory_order_relaxed);
+            return chunk;
+        }
+    }
+
+    /**
+     * @brief Bounded queue of encoded chunks between the producer and the writer of an export.
+     */
+    class PlyChunkQueue {
+    public:
+        PlyChunkQueue(size_t _capacity) : capacity(_capacity), closed(false), aborted(false) {}
+
+        /**
+         * Appends a chunk, waiting while the queue is full. Returns `false` if the writer gave up.
+         */
+        bool push(const QByteArray &chunk) {
+            QMutexLocker locker(&mutex);
+            while (chunks.size() >= capacity && !aborted)
+                notFull.wait(&mutex);
+            if (aborted)
+                return false;
+
+            chunks.push_back(chunk);
+            notEmpty.wakeOne();
+            return true;
+        }
+
+        /**
+         * Removes the oldest chunk, waiting while the queue is empty. Returns `false` once closed and drained.
+         */
+        bool pop(QByteArray &chunk) {
+            QMutexLocker locker(&mutex);
+            while (chunks.empty() && !closed)
+                notEmpty.wait(&mutex);
+            if (chunks.empty())
+                return false;
+
+            chunk = chunks.front();
+            chunks.pop_front();
+            notFull.wakeOne();
+            return true;
+        }
+
+        /**
+         * Called by the producer after its last chunk.
+         */
+        void close() {
+            QMutexLocker locker(&mutex);
+            closed = true;
+            notEmpty.wakeAll();
+        }
+
+        /**
+         * Called by the writer when it cannot write any more chunks.
+         */
+        void abort() {
+            QMutexLocker locker(&mutex);
+            aborted = true;
+            notFull.wakeAll();
+        }
+
+    private:
+        QMutex mutex;
+        QWaitCondition notEmpty;
+        QWaitCondition notFull;
+        std::deque<QByteArray> chunks;
+        size_t capacity;
+        bool closed;
+        bool aborted;
+    };
+
+    namespace {
+        /**
+         * Writes every chunk of the queue, the header first. Runs on its own thread so it can never be starved by
+         * the producer's tasks in the global thread pool.
+         */
+        class PlyWriter : public QThread {
+        public:
+            PlyWriter(const QString &_fileName, PlyChunkQueue &_queue, bool _text) :
+                    fileName(_fileName),
+                    queue(_queue),
+                    text(_text) {}
+
+            QString error() const {
+                return errorMessage;
+            }
+
+        protected:
+            void run() {
+                QFile outputFile(fileName);
+                outputFile.open(text ? QIODevice::WriteOnly | QIODevice::Text : QIODevice::WriteOnly);
+                if (!outputFile.isOpen()) {
+                    errorMessage = QString("Unable to open file %1").arg(fileName);
+                    queue.abort();
+                    return;
+                }
+
+                QByteArray chunk;
+                while (queue.pop(chunk)) {
+                    if (outputFile.write(chunk) != chunk.size()) {
+                        errorMessage = QString("Could not write %1").arg(fileName);
+                        queue.abort();
+                        return;
+                    }
+                }
+
+                outputFile.close();
+            }
+
+        private:
+            QString fileName;
+            PlyChunkQueue &queue;
+            bool text;
+            QString errorMessage;
+        };
+
+        /**
+         * Splits the instances into chunks, encodes up to one chunk per core concurrently on the global thread pool
+         * and pushes the results to the queue in file order: the header, all vertices, then all faces. Runs on its
+         * own thread and only blocks on leaf tasks, so the pool cannot deadlock.
+         *
+         * The counts of a plain mesh follow from the instance and shape sizes. A welded mesh is counted chunk by
+         * chunk first, which also gives the index of the first vertex of every chunk. Every chunk is then welded
+         * again for its vertices and once more for its faces, three times in all: keeping the welded chunks between
+         * the passes would hold the whole welded mesh in memory, while welding is cheap next to encoding and writing.
+         */
+        class PlyProducer : public QThread {
+        public:
+            PlyProducer(const ChunkJob &_prototype, size_t _numInstances, size_t _instancesPerChunk, PlyChunkQueue &_queue) :
+                    prototype(_prototype),
+                    numInstances(_numInstances),
+                    instancesPerChunk(_instancesPerChunk),
+                    queue(_queue) {}
+
+        protected:
+            void run() {
+                const size_t maxPending = (size_t) std::max(1, QThread::idealThreadCount());
+                std::deque<QFuture<QByteArray>> pending;
+                std::vector<size_t> vertexOffsets;
+                size_t numVertices = numInstances * prototype.soa->count;
+                size_t numFaces = numInstances * (prototype.shape->indices.size() / 3);
+
+                if (prototype.weld) {
+                    std::vector<QFuture<std::pair<size_t, size_t>>> counts;
+                    for (size_t first = 0; first < numInstances; first += instancesPerChunk) {
+                        ChunkJob job = prototype;
+                        job.first = first;
+                        job.last = std::min(first + instancesPerChunk, numInstances);
+                        counts.push_back(QtConcurrent::run(countWelded, job));
+                    }
+
+                    numVertices = numFaces = 0;
+                    for (size_t k = 0; k < counts.size(); ++k) {
+                        const std::pair<size_t, size_t> count = counts[k].result();
+                        vertexOffsets.push_back(numVertices);
+                        numVertices += count.first;
+                        numFaces += count.second;
+                    }
+                }
+
+                bool writing = !prototype.cancel->load() &&
+                               queue.push(plyHeader(prototype.format, numVertices, numFaces, prototype.colors != 0).toLatin1());
+
+                for (int pass = 0; pass < 2; ++pass) {
+                    for (size_t first = 0; first < numInstances; first += instancesPerChunk) {
+                        if (!writing || prototype.cancel->load())
+                            break;
+
+                        ChunkJob job = prototype;
+                        job.pass = pass;
+                        job.first = first;
+                        job.last = std::min(first + instancesPerChunk, numInstances);
+                        if (prototype.weld)
+                            job.vertexOffset = vertexOffsets[first / instancesPerChunk];
+                        pending.push_back(QtConcurrent::run(encodeChunk, job));
+
+                        if (pending.size() >= maxPending) {
+                            // the writer failed and reports why
+                            writing = queue.push(pending.front().result());
+                            pending.pop_front();
+                        }
+                    }
+                }
+
+                // the tasks reference the exporter's data, so all of them finish before the export returns
+                while (!pending.empty()) {
+                    const QByteArray chunk = pending.front().result();
+                    if (writing && !prototype.cancel->load())
+                        writing = queue.push(chunk);
+                    pending.pop_front();
+                }
+                queue.close();
+            }
+
+        private:
+            ChunkJob prototype;
+            size_t numInstances;
+            size_t instancesPerChunk;
+            PlyChunkQueue &queue;
+        };
+    }
+
     PlyExporter::PlyExporter(QWidget* parent) : QWidget(parent),
-                                                progressMutex()
+                                                format(ASCII),
+                                                includeColors(false),
+                                                welded(false),
+                                                weldTolerance(0.25f),
+                                                showProgress(true),
+                                                progress(0),
+                                                workDone(0),
+                                                cancelRequested(false)
     {
     }
 
+    void PlyExporter::setFormat(Format _format) {
+        format = _format;
+    }
+
+    void PlyExporter::setIncludeColors(bool include) {
+        includeColors = include;
+    }
+
+    void PlyExporter::setWelded(bool weld, float tolerance) {
+        welded = weld;
+        weldTolerance = tolerance;
+    }
+
+    void PlyExporter::setShowProgress(bool show) {
+        showProgress = show;
+    }
+
     void PlyExporter::operator()(const QString &fileName, const QString& description,
                                  const Shape *shape, const Job &job,
                                  const std::vector<QMatrix4x4> &vertexViewVector) {
@@ -21,176 +738,132 @@ namespace tresta {
     }
 
     void PlyExporter::exportPly(const QString& fileName, const QString& description, const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector) {
+        std::vector<Mesh> meshes(1);
+        meshes[0].fileName = fileName;
+        meshes[0].vertexViewVector = &vertexViewVector;
+        exportMeshes(meshes, description, shape, job);
+    }
 
-        if (!fileName.isEmpty()) {
+    void PlyExporter::exportMeshes(const std::vector<Mesh>& meshes, const QString& description, const Shape* shape, const Job& job) {
+        std::vector<Mesh> files;
+        for (size_t m = 0; m < meshes.size(); ++m) {
+            if (!meshes[m].fileName.isEmpty())
+                files.push_back(meshes[m]);
+        }
+        if (files.empty())
+            return;
+
+        if (showProgress) {
             progress = new QProgressDialog(this);
             progress->setModal(true);
             progress->setMaximum(100);
-            QString labelText = description + QString("\nStep 1 of 3: Building vertices...");
+            QString labelText = description + QString("\nWriting vertices and faces...");
             progress->setLabelText(tr(labelText.toStdString().c_str()));
             progress->show();
+        }
 
-            QFuture<bool> t1 = QtConcurrent::run(this, &PlyExporter::createPlyVertices, shape, job, vertexViewVector);
-            if (!t1.result()) {
-                handleCancelledExport();
-                return;
-            }
-            labelText = description + QString("\nStep 2 of 3: Building faces...");
-            progress->setLabelText(tr(labelText.toStdString().c_str()));
-            QFuture<bool> t2 = QtConcurrent::run(this, &PlyExporter::createPlyFaces, shape, job, vertexViewVector);
-            if (!t2.result()) {
-                handleCancelledExport();
-                return;
+        elementColors.clear();
+        if (includeColors && !job.colors.empty() && !job.elems.empty()) {
+            elementColors.resize(4 * job.colors.size());
+            for (size_t i = 0; i < job.colors.size(); ++i) {
+                elementColors[4 * i + 0] = (unsigned char) job.colors[i].red();
+                elementColors[4 * i + 1] = (unsigned char) job.colors[i].green();
+                elementColors[4 * i + 2] = (unsigned char) job.colors[i].blue();
+                elementColors[4 * i + 3] = (unsigned char) job.colors[i].alpha();
             }
+        }
 
-            progress->setValue(0);
-            progress->setMaximum(0);
-            labelText = description + QString("\nStep 3 of 3: Saving file...");
-            progress->setLabelText(tr(labelText.toStdString().c_str()));
-            QList<QPushButton *> L = progress->findChildren<QPushButton *>();
-            L.at(0)->hide();
-            L.at(0)->show();
-            qApp->processEvents();
+        const ShapeSoA soa(shape);
+        const size_t instances_per_chunk = std::max((size_t) 1, verticesPerChunk / std::max((size_t) 1, soa.count));
+        std::unique_ptr<WeldInfo> weld;
+        if (welded)
+            weld.reset(new WeldInfo(shape, job.elems, job.nodes.size(), weldTolerance));
 
-            QFuture<void> t3 = QtConcurrent::run(this, &PlyExporter::saveFile, fileName);
-            t3.waitForFinished();
+        workDone = 0;
+        cancelRequested = false;
+        ChunkJob prototype;
+        prototype.pass = 0;
+        prototype.first = 0;
+        prototype.last = 0;
+        prototype.shape = shape;
+        prototype.soa = &soa;
+        prototype.format = format;
+        prototype.colors = elementColors.empty() ? 0 : &elementColors[0];
+        prototype.weld = weld.get();
+        prototype.vertexOffset = 0;
+        prototype.cancel = &cancelRequested;
+        prototype.done = &workDone;
 
-            progress->close();
+        // every file gets its own writer and producer, and all of them share the thread pool and the counters
+        std::vector<std::unique_ptr<PlyChunkQueue>> queues;
+        std::vector<std::unique_ptr<PlyWriter>> writers;
+        std::vector<std::unique_ptr<PlyProducer>> producers;
+        size_t total_work = 0;
+        for (size_t m = 0; m < files.size(); ++m) {
+            const std::vector<QMatrix4x4> &vertexViewVector = *files[m].vertexViewVector;
+            const size_t num_instances = vertexViewVector.size();
+
+            prototype.matrices = &vertexViewVector;
+            // deformed meshes split every element into several instances
+            prototype.instancesPerElement = job.elems.empty() ? 1 : std::max((size_t) 1, num_instances / job.elems.size());
+            // welded chunks hold whole elements
+            const size_t chunk_instances = welded ?
+                                           std::max((size_t) 1, instances_per_chunk / prototype.instancesPerElement) *
+                                           prototype.instancesPerElement :
+                                           instances_per_chunk;
+
+            queues.emplace_back(new PlyChunkQueue(chunksInFlight));
+            writers.emplace_back(new PlyWriter(files[m].fileName, *queues.back(), format == ASCII));
+            producers.emplace_back(new PlyProducer(prototype, num_instances, chunk_instances, *queues.back()));
+            total_work += (welded ? 3 : 2) * num_instances;
         }
-    }
 
-    bool PlyExporter::createPlyVertices(const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector) {
-        const size_t vals_per_pt = 3;
-        const size_t pts_per_shape = shape->vertices.size() / vals_per_pt;
-        std::vector< std::vector< float > > tmp_vertices(vertexViewVector.size() * pts_per_shape, std::vector<float>(2 * vals_per_pt));
-        QVector4D originalPoint, transformedPoint, originalNormal, transformedNormal;
-        originalPoint.setW(1.0f);
-        originalNormal.setW(0.0f);
-        int new_value, current_value = 0;
-        float value_divisor_inv = 1.0f / ((float) (vertexViewVector.size())) * 100.0f;
-
-        // for each instanced shape
-        for (size_t i = 0; i < vertexViewVector.size(); ++i) {
-            // for each vertex in the shape
-            for (size_t j = 0; j < pts_per_shape; ++j) {
-                // copy original shape vertex and normal
-                for (size_t k = 0; k < vals_per_pt; ++k) {
-                    originalPoint[k] = shape->vertices[vals_per_pt * j + k];
-                    originalNormal[k] = shape->normals[vals_per_pt * j + k];
-                }
-
-                // transform into global position
-                transformedPoint = vertexViewVector[i] * originalPoint;
-                transformedNormal = vertexViewVector[i] * originalNormal;
-                transformedNormal.normalize();
-
-                // store result in output vector
-                for (size_t k = 0; k < vals_per_pt; ++k) {
-                    tmp_vertices[i * pts_per_shape + j][k] = transformedPoint[k];
-                    tmp_vertices[i * pts_per_shape + j][k + vals_per_pt] = transformedNormal[k];
-                }
-            }
-
-            QMutexLocker ml(&progressMutex);
-            new_value = (int) ((float) (i) * value_divisor_inv);
-            if (new_value > current_value) {
-                current_value = new_value;
-                progress->setValue(current_value);
-            }
-            qApp->processEvents();
-            if (progress->wasCanceled()) {
-                return false;
-            }
+        for (size_t m = 0; m < files.size(); ++m) {
+            writers[m]->start();
+            producers[m]->start();
         }
-        tmp_vertices.swap(vertices);
-        return true;
-    }
 
-    bool PlyExporter::createPlyFaces(const Shape* shape, const Job& job, const std::vector<QMatrix4x4>& vertexViewVector) {
-        const unsigned int ind_per_face = 3;
-        const unsigned int pts_per_vert = 3;
-        const size_t indices_per_shape = shape->indices.size();
-        const size_t faces_per_shape = indices_per_shape / ind_per_face;
-        const size_t pts_per_shape = shape->vertices.size() / pts_per_vert;
-        std::vector< std::vector< unsigned int > > tmp_faces(vertexViewVector.size() * faces_per_shape, std::vector<unsigned int>(1 + ind_per_face));
-        int new_value, current_value = 0;
-        float value_divisor_inv = 1.0f / ((float) (vertexViewVector.size())) * 100.0f;
-
-        // for each instanced shape
-        for (size_t i = 0; i < vertexViewVector.size(); ++i) {
-            // for each face in the shape
-            for (int j = 0; j < faces_per_shape; ++j) {
-                // set the number of indices on the face
-                tmp_faces[faces_per_shape * i + j][0] = ind_per_face;
-
-                // transform index into global space
-                for (size_t k = 0; k < ind_per_face; ++k) {
-                    tmp_faces[faces_per_shape * i + j][k + 1] = pts_per_shape * i + shape->indices[ind_per_face * j + k];
-                }
-            }
-
-            QMutexLocker ml(&progressMutex);
-            new_value = (int) ((float) (i) * value_divisor_inv);
-            if (new_value > current_value) {
-                current_value = new_value;
-                progress->setValue(current_value);
-            }
-            qApp->processEvents();
-            if (progress->wasCanceled()) {
-                return false;
+        // only the GUI thread touches the dialog; the workers just count what they have encoded
+        const float value_divisor_inv = 100.0f / (float) std::max((size_t) 1, total_work);
+        int current_value = 0;
+        for (size_t m = 0; m < files.size(); ++m) {
+            if (!progress) {
+                producers[m]->wait();
+                continue;
+            }
+            while (!producers[m]->wait(progressInterval)) {
+                const int new_value = (int) ((float) workDone.load() * value_divisor_inv);
+                if (new_value > current_value) {
+                    current_value = new_value;
+                    progress->setValue(current_value);
+                }
+                qApp->processEvents();
+                if (progress->wasCanceled())
+                    cancelRequested = true;
             }
         }
-        tmp_faces.swap(faces);
-        return true;
-    }
+        for (size_t m = 0; m < files.size(); ++m)
+            writers[m]->wait();
+        if (progress) {
+            progress->close();
+            progress->deleteLater();
+            progress = 0;
+        }
 
-    void PlyExporter::saveFile(const QString &fileName) {
-        QFile outputFile(fileName);
-        outputFile.open(QIODevice::WriteOnly | QIODevice::Text);
-
-        if (!outputFile.isOpen()) {
-            QString err_what = QString("Unable to open file %1").arg(fileName);
-            throw std::runtime_error(err_what.toStdString().c_str());
-        }
-
-        QTextStream outStream(&outputFile);
-        QString header = QString("ply\n"
-                                 "format ascii 1.0\n"
-                                 "comment Made by tresta\n"
-                                 "element vertex %1\n"
-                                 "property float x\n"
-                                 "property float y\n"
-                                 "property float z\n"
-                                 "property float nx\n"
-                                 "property float ny\n"
-                                 "property float nz\n"
-                                 "element face %2\n"
-                                 "property list uchar int vertex_indices\n"
-                                 "end_header\n").arg(QString::number(vertices.size()), QString::number(faces.size()));
-
-        outStream << header;
-        write2DVector(outStream, vertices);
-        write2DVector(outStream, faces);
-
-        outputFile.close();
+        for (size_t m = 0; m < files.size(); ++m) {
+            if (!writers[m]->error().isEmpty())
+                throw std::runtime_error(writers[m]->error().toStdString());
+        }
+
+        if (cancelRequested) {
+            for (size_t m = 0; m < files.size(); ++m)
+                QFile::remove(files[m].fileName);
+            handleCancelledExport();
+        }
     }
 
     void PlyExporter::handleCancelledExport() {
-        progress->close();
         QMessageBox::warning(0, QString("Ply exporter"), QString("Mesh exported cancelled."));
 
     }
-
-    template <typename T>
-    void PlyExporter::write2DVector(QTextStream & outStream, const std::vector<T> &data) {
-        for (size_t i = 0; i < data.size(); ++i) {
-            for (size_t j = 0; j < data[i].size(); ++j) {
-                outStream << data[i][j];
-                if (j < data[i].size() - 1)
-                    outStream << " ";
-                else
-                    outStream << "\n";
-            }
-        }
-    }
 } // namespace tresta
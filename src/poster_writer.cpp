@@ -0,0 +1,290 @@
+#include "poster_writer.h"
+
+#include <QMutexLocker>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QtEndian>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace tresta {
+
+    namespace {
+        const size_t queuedBands = 1;/**<Bands waiting to be encoded before `submit` waits.*/
+        const quint32 maxFileBytes = 0xFFFFFFFFu;/**<Offsets of a classic TIFF file are 32 bits.*/
+
+        // TIFF field types and tags, see the TIFF 6.0 specification
+        const quint16 tiffShort = 3;
+        const quint16 tiffLong = 4;
+        const quint16 tiffRational = 5;
+
+        enum TiffTag {
+            IMAGE_WIDTH = 256,
+            IMAGE_LENGTH = 257,
+            BITS_PER_SAMPLE = 258,
+            COMPRESSION = 259,
+            PHOTOMETRIC_INTERPRETATION = 262,
+            STRIP_OFFSETS = 273,
+            SAMPLES_PER_PIXEL = 277,
+            ROWS_PER_STRIP = 278,
+            STRIP_BYTE_COUNTS = 279,
+            X_RESOLUTION = 282,
+            Y_RESOLUTION = 283,
+            PLANAR_CONFIGURATION = 284,
+            RESOLUTION_UNIT = 296,
+            PREDICTOR = 317
+        };
+
+        const quint16 deflateCompression = 8;
+        const quint16 rgbPhotometric = 2;
+        const quint16 horizontalPredictor = 2;
+        const quint32 posterDpi = 300;
+
+        inline void putUInt16(QByteArray &out, quint16 value) {
+            value = qToLittleEndian(value);
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        inline void putUInt32(QByteArray &out, quint32 value) {
+            value = qToLittleEndian(value);
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        /**
+         * Appends a directory entry. Values that fit into 4 bytes are stored in the entry itself.
+         */
+        void putEntry(QByteArray &out, quint16 tag, quint16 type, quint32 count, quint32 valueOrOffset) {
+            putUInt16(out, tag);
+            putUInt16(out, type);
+            putUInt32(out, count);
+            if (type == tiffShort && count == 1) {
+                putUInt16(out, (quint16) valueOrOffset);
+                putUInt16(out, 0);
+            }
+            else {
+                putUInt32(out, valueOrOffset);
+            }
+        }
+
+        /**
+         * Compresses rows of a band into one strip: each sample is replaced by its difference to the sample of the
+         * same channel on its left, which turns the smooth gradients of shaded struts into runs Deflate compresses
+         * well.
+         */
+        QByteArray encodeStrip(const QImage &band, int firstRow, int rows, int compressionLevel) {
+            const int rowBytes = 3 * band.width();
+            QByteArray raw(rows * rowBytes, '\0');
+            for (int y = 0; y < rows; ++y) {
+                const uchar *in = band.constScanLine(firstRow + y);
+                uchar *out = reinterpret_cast<uchar *>(raw.data()) + (size_t) y * rowBytes;
+                std::copy(in, in + 3, out);
+                for (int x = 3; x < rowBytes; ++x)
+                    out[x] = (uchar) (in[x] - in[x - 3]);
+            }
+
+            // qCompress prepends the uncompressed size to the zlib stream TIFF expects
+            return qCompress(reinterpret_cast<const uchar *>(raw.constData()), raw.size(), compressionLevel).mid(4);
+        }
+    }
+
+    const int PosterWriter::rowsPerStrip;
+
+    /**
+     * Encodes and appends queued bands until the writer is closed and drained.
+     */
+    class PosterWriter::Writer : public QThread {
+    public:
+        Writer(PosterWriter &_poster) : poster(_poster) {}
+
+    protected:
+        void run() {
+            // bands are still taken after an error so `submit` never waits forever
+            QImage band;
+            while (poster.pop(band)) {
+                if (!poster.failed)
+                    poster.writeBand(band);
+            }
+            if (!poster.failed)
+                poster.writeDirectory();
+            poster.file.close();
+        }
+
+    private:
+        PosterWriter &poster;
+    };
+
+    PosterWriter::PosterWriter() :
+            closed(false),
+            width(0),
+            height(0),
+            compressionLevel(-1),
+            rowsSubmitted(0),
+            failed(false) {}
+
+    PosterWriter::~PosterWriter() {
+        close();
+    }
+
+    void PosterWriter::open(const QString &fileName, int _width, int _height, int _compressionLevel) {
+        close();
+
+        file.setFileName(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            throw std::runtime_error((boost::format("%s could not be created.") % fileName.toStdString()).str());
+
+        // little endian header; the directory offset is filled in once every strip has been written
+        QByteArray header("II");
+        putUInt16(header, 42);
+        putUInt32(header, 0);
+        file.write(header);
+
+        width = _width;
+        height = _height;
+        compressionLevel = _compressionLevel;
+        rowsSubmitted = 0;
+        failed = false;
+        closed = false;
+        stripOffsets.clear();
+        stripByteCounts.clear();
+
+        writer.reset(new Writer(*this));
+        writer->start();
+    }
+
+    void PosterWriter::submit(const QImage &band) {
+        if (band.width() != width || (band.height() % rowsPerStrip != 0 && rowsSubmitted + band.height() != height))
+            throw std::runtime_error("Poster bands must span the image and be a multiple of the strip height.");
+        rowsSubmitted += band.height();
+
+        QMutexLocker locker(&mutex);
+        while (bands.size() >= queuedBands)
+            notFull.wait(&mutex);
+        bands.push_back(band);
+        notEmpty.wakeOne();
+    }
+
+    void PosterWriter::close() {
+        {
+            QMutexLocker locker(&mutex);
+            closed = true;
+            notEmpty.wakeAll();
+        }
+        if (writer) {
+            writer->wait();
+            writer.reset();
+            if (rowsSubmitted != height)
+                reportError(QString("%1 is incomplete.").arg(file.fileName()));
+        }
+    }
+
+    QString PosterWriter::takeError() {
+        QMutexLocker locker(&mutex);
+        QString message = errorMessage;
+        errorMessage.clear();
+        return message;
+    }
+
+    bool PosterWriter::pop(QImage &band) {
+        QMutexLocker locker(&mutex);
+        while (bands.empty() && !closed)
+            notEmpty.wait(&mutex);
+        if (bands.empty())
+            return false;
+
+        band = bands.front();
+        bands.pop_front();
+        notFull.wakeOne();
+        return true;
+    }
+
+    void PosterWriter::writeBand(const QImage &band) {
+        // strips are compressed on every core and appended in order as they finish
+        std::vector<QFuture<QByteArray>> strips;
+        for (int row = 0; row < band.height(); row += rowsPerStrip) {
+            const int rows = std::min(rowsPerStrip, band.height() - row);
+            strips.push_back(QtConcurrent::run(encodeStrip, band, row, rows, compressionLevel));
+        }
+
+        for (size_t i = 0; i < strips.size(); ++i) {
+            const QByteArray strip = strips[i].result();
+            if (failed)
+                continue;
+
+            if ((quint64) file.pos() + strip.size() > maxFileBytes) {
+                reportError(QString("%1 exceeds the 4 GiB limit of TIFF files.").arg(file.fileName()));
+                failed = true;
+            }
+            else if (file.write(strip) != strip.size()) {
+                reportError(QString("Writing to %1 failed.").arg(file.fileName()));
+                failed = true;
+            }
+            else {
+                stripOffsets.push_back((quint32) (file.pos() - strip.size()));
+                stripByteCounts.push_back((quint32) strip.size());
+            }
+        }
+    }
+
+    void PosterWriter::writeDirectory() {
+        const quint16 numEntries = 14;
+        const quint32 stripCount = (quint32) stripOffsets.size();
+
+        // the directory starts on a word boundary and is followed by the values that do not fit into an entry
+        if (file.pos() % 2 != 0)
+            file.write(QByteArray(1, '\0'));
+        const quint32 directoryOffset = (quint32) file.pos();
+        const quint32 bitsOffset = directoryOffset + 2 + 12 * numEntries + 4;
+        const quint32 resolutionOffset = bitsOffset + 3 * 2;
+        const quint32 offsetsOffset = resolutionOffset + 8;
+        const quint32 byteCountsOffset = offsetsOffset + 4 * stripCount;
+
+        QByteArray directory;
+        putUInt16(directory, numEntries);
+        putEntry(directory, IMAGE_WIDTH, tiffLong, 1, (quint32) width);
+        putEntry(directory, IMAGE_LENGTH, tiffLong, 1, (quint32) height);
+        putEntry(directory, BITS_PER_SAMPLE, tiffShort, 3, bitsOffset);
+        putEntry(directory, COMPRESSION, tiffShort, 1, deflateCompression);
+        putEntry(directory, PHOTOMETRIC_INTERPRETATION, tiffShort, 1, rgbPhotometric);
+        putEntry(directory, STRIP_OFFSETS, tiffLong, stripCount, stripCount == 1 ? stripOffsets[0] : offsetsOffset);
+        putEntry(directory, SAMPLES_PER_PIXEL, tiffShort, 1, 3);
+        putEntry(directory, ROWS_PER_STRIP, tiffLong, 1, (quint32) rowsPerStrip);
+        putEntry(directory, STRIP_BYTE_COUNTS, tiffLong, stripCount,
+                 stripCount == 1 ? stripByteCounts[0] : byteCountsOffset);
+        putEntry(directory, X_RESOLUTION, tiffRational, 1, resolutionOffset);
+        putEntry(directory, Y_RESOLUTION, tiffRational, 1, resolutionOffset);
+        putEntry(directory, PLANAR_CONFIGURATION, tiffShort, 1, 1);
+        putEntry(directory, RESOLUTION_UNIT, tiffShort, 1, 2);
+        putEntry(directory, PREDICTOR, tiffShort, 1, horizontalPredictor);
+        putUInt32(directory, 0);
+
+        for (int i = 0; i < 3; ++i)
+            putUInt16(directory, 8);
+        putUInt32(directory, posterDpi);
+        putUInt32(directory, 1);
+        if (stripCount > 1) {
+            for (size_t i = 0; i < stripCount; ++i)
+                putUInt32(directory, stripOffsets[i]);
+            for (size_t i = 0; i < stripCount; ++i)
+                putUInt32(directory, stripByteCounts[i]);
+        }
+
+        if ((quint64) directoryOffset + directory.size() > maxFileBytes) {
+            reportError(QString("%1 exceeds the 4 GiB limit of TIFF files.").arg(file.fileName()));
+            return;
+        }
+
+        QByteArray offset;
+        putUInt32(offset, directoryOffset);
+        if (file.write(directory) != directory.size() || !file.seek(4) || file.write(offset) != offset.size())
+            reportError(QString("Writing to %1 failed.").arg(file.fileName()));
+    }
+
+    void PosterWriter::reportError(const QString &message) {
+        QMutexLocker locker(&mutex);
+        if (errorMessage.isEmpty())
+            errorMessage = message;
+    }
+
+} // namespace tresta
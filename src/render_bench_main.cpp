@@ -0,0 +1,387 @@
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <boost/format.hpp>
+#include <rapidjson/document.h>
+#include <rapidjson/filereadstream.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "camera_path.h"
+#include "frame_capture.h"
+#include "frame_profiler.h"
+#include "interaction_session.h"
+#include "offscreen.h"
+#include "setup.h"
+#include "truss_scene.h"
+
+namespace {
+    /**
+     * What is replayed and how the results are judged.
+     */
+    struct BenchOptions {
+        BenchOptions() :
+                view(QSize(1280, 720)),
+                path(tresta::CameraPath::ORBIT),
+                frames(600),
+                warmupFrames(30),
+                tolerance(10.0) {}
+
+        /**
+         * Start of a scripted path. An explicit size or shading mode overrides the one a session was recorded with.
+         */
+        tresta::ViewOptions view;
+        tresta::CameraPath::Kind path;
+        int frames;/**<Frames of a scripted path.*/
+        int warmupFrames;/**<Frames rendered before measuring, e.g. while shaders are compiled lazily.*/
+        std::string session;/**<Recorded session replayed instead of a scripted path.*/
+        std::string output;/**<JSON file of the results.*/
+        std::string baseline;/**<Results of an earlier run to compare with.*/
+        double tolerance;/**<Percentage a time may exceed its baseline by.*/
+    };
+
+    /**
+     * Sessions are replayed at a fixed rate, so every run renders the same frames with the same input.
+     */
+    const double replayFrameMs = 1000.0 / 60.0;
+
+    /**
+     * Frames rendered after the last event of a session, so the camera comes to rest as it did on screen.
+     */
+    const int settleFrames = 60;
+
+    /**
+     * Times compared with a baseline. Totals of the passes are added by `summarize`.
+     */
+    const char *comparedMetrics[] = {"frame_ms.p50", "frame_ms.p95", "frame_ms.p99", "cpu_ms.p50",
+                                     "gpu_total_ms.total"};
+
+    void printUsage(const char *program) {
+        std::cerr << "usage: " << program << " [options] config.json" << std::endl
+                  << "  -p  camera path: orbit, zoom or fly (default orbit)" << std::endl
+                  << "  -s  replay a session recorded in tresta with key K instead of a camera path" << std::endl
+                  << "  -n  frames of the camera path (default 600)" << std::endl
+                  << "  -w  warm-up frames rendered before measuring (default 30)" << std::endl
+                  << "  -r  resolution WIDTHxHEIGHT (default 1280x720, or the window size of the session)"
+                  << std::endl
+                  << "  -c  camera rotation RX,RY,RZ in degrees at the start of the path (default 30,-30,0)"
+                  << std::endl
+                  << "  -z  camera distance at the start of the path, relative to the one that fits (default 1)"
+                  << std::endl
+                  << "  -m  shading mode: forward, prepass or deferred (default forward, or the one of the session)"
+                  << std::endl
+                  << "  -o  JSON file of the frame timings, usable as a baseline" << std::endl
+                  << "  -b  compare with the results of an earlier run and fail on regressions" << std::endl
+                  << "  -t  percentage a time may exceed its baseline by (default 10)" << std::endl;
+    }
+
+    bool parseOption(const char *flag, const char *value, BenchOptions &options) {
+        if (tresta::isViewOption(flag)) {
+            return tresta::parseViewOption(flag, value, options.view);
+        }
+        else if (std::strcmp(flag, "-p") == 0) {
+            return tresta::CameraPath::parseKind(value, options.path);
+        }
+        else if (std::strcmp(flag, "-s") == 0) {
+            options.session = value;
+        }
+        else if (std::strcmp(flag, "-n") == 0) {
+            options.frames = std::atoi(value);
+            return options.frames > 1;
+        }
+        else if (std::strcmp(flag, "-w") == 0) {
+            options.warmupFrames = std::atoi(value);
+            return options.warmupFrames >= 0;
+        }
+        else if (std::strcmp(flag, "-o") == 0) {
+            options.output = value;
+        }
+        else if (std::strcmp(flag, "-b") == 0) {
+            options.baseline = value;
+        }
+        else if (std::strcmp(flag, "-t") == 0) {
+            options.tolerance = std::atof(value);
+            return options.tolerance >= 0.0;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    void renderFrame(tresta::TrussScene &scene, tresta::FrameCapture &capture) {
+        scene.update((float) (replayFrameMs / 1000.0));
+        capture.bind();
+        scene.render();
+    }
+
+    void runPath(tresta::TrussScene &scene, tresta::FrameCapture &capture, const BenchOptions &options) {
+        const tresta::CameraPath path(options.path, options.view.rotation, options.view.distance);
+        tresta::CameraPath::Pose pose = path.poseAt(0.0f);
+        scene.setCameraView(pose.rotation, pose.distance);
+        for (int i = 0; i < options.warmupFrames; ++i)
+            renderFrame(scene, capture);
+
+        scene.getProfiler().setEnabled(true);
+        for (int i = 0; i < options.frames; ++i) {
+            pose = path.poseAt((float) i / (options.frames - 1));
+            scene.setCameraView(pose.rotation, pose.distance);
+            renderFrame(scene, capture);
+        }
+    }
+
+    void runSession(tresta::TrussScene &scene, tresta::FrameCapture &capture, const tresta::Job &job,
+                    const tresta::InteractionSession &session, const BenchOptions &options) {
+        // the camera and toggles start as they were when recording started; older sessions start where a freshly
+        // opened window leaves the camera
+        session.applyStartState(scene);
+        if (options.view.shadingModeSet)
+            scene.setShadingMode(options.view.shadingMode);
+        for (int i = 0; i < options.warmupFrames; ++i)
+            renderFrame(scene, capture);
+
+        const std::vector<tresta::InteractionSession::Event> &events = session.getEvents();
+        const int frames = (int) std::ceil(session.getDurationMs() / replayFrameMs) + settleFrames;
+        size_t next = 0;
+
+        scene.getProfiler().setEnabled(true);
+        for (int i = 0; i < frames; ++i) {
+            while (next < events.size() && events[next].timeMs <= i * replayFrameMs) {
+                // a session recorded with another config may change a scale this one has no use for
+                if (events[next].type != tresta::InteractionSession::SCALE_EVENT || !job.displacements.empty())
+                    tresta::InteractionSession::apply(events[next], scene);
+                ++next;
+            }
+            renderFrame(scene, capture);
+        }
+    }
+
+    /**
+     * Times of a run by the names used in the files written by `FrameProfiler::Statistics::saveJson`,
+     * e.g. `frame_ms.p95` or `gpu_ms.deformed.total`.
+     */
+    std::map<std::string, double> summarize(const tresta::FrameProfiler::Statistics &statistics) {
+        typedef tresta::FrameProfiler::Statistics Statistics;
+        std::vector<double> frameMs, cpuMs, gpuTotalMs;
+        std::vector<std::vector<double>> gpuMs(tresta::FrameProfiler::NUM_PASSES);
+        for (size_t i = 0; i < statistics.samples.size(); ++i) {
+            const tresta::FrameProfiler::Sample &sample = statistics.samples[i];
+            if (sample.frameMs > 0.0)
+                frameMs.push_back(sample.frameMs);
+            cpuMs.push_back(sample.cpuMs);
+            gpuTotalMs.push_back(sample.gpuTotalMs());
+            for (int j = 0; j < tresta::FrameProfiler::NUM_PASSES; ++j)
+                gpuMs[j].push_back(sample.gpuMs[j]);
+        }
+
+        std::map<std::string, double> metrics;
+        metrics["frame_ms.p50"] = Statistics::percentile(frameMs, 0.50);
+        metrics["frame_ms.p95"] = Statistics::percentile(frameMs, 0.95);
+        metrics["frame_ms.p99"] = Statistics::percentile(frameMs, 0.99);
+        metrics["cpu_ms.p50"] = Statistics::percentile(cpuMs, 0.50);
+        metrics["gpu_total_ms.total"] = 0.0;
+        for (int j = 0; j < tresta::FrameProfiler::NUM_PASSES; ++j) {
+            double total = 0.0;
+            for (size_t i = 0; i < gpuMs[j].size(); ++i)
+                total += gpuMs[j][i];
+            metrics["gpu_ms." + tresta::FrameProfiler::passName((tresta::FrameProfiler::Pass) j) + ".total"] = total;
+            metrics["gpu_total_ms.total"] += total;
+        }
+        return metrics;
+    }
+
+    void printSummary(const tresta::FrameProfiler::Statistics &statistics,
+                      const std::map<std::string, double> &metrics) {
+        std::cout << "Renderer: " << statistics.renderer << std::endl
+                  << "Frames: " << statistics.samples.size() << std::endl
+                  << boost::format("Frame time: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms")
+                     % metrics.at("frame_ms.p50") % metrics.at("frame_ms.p95") % metrics.at("frame_ms.p99")
+                  << std::endl
+                  << boost::format("CPU time: p50 %.3f ms") % metrics.at("cpu_ms.p50") << std::endl
+                  << "GPU time per pass:" << std::endl;
+        for (int j = 0; j < tresta::FrameProfiler::NUM_PASSES; ++j) {
+            const std::string pass = tresta::FrameProfiler::passName((tresta::FrameProfiler::Pass) j);
+            std::cout << boost::format("  %-10s %10.3f ms") % pass % metrics.at("gpu_ms." + pass + ".total")
+                      << std::endl;
+        }
+        std::cout << boost::format("  %-10s %10.3f ms") % "total" % metrics.at("gpu_total_ms.total") << std::endl;
+    }
+
+    /**
+     * Reads the times of an earlier run from a file written with `-o`.
+     */
+    std::map<std::string, double> readBaseline(const std::string &fileName, std::string &renderer) {
+        FILE *file = fopen(fileName.c_str(), "r");
+        if (!file)
+            throw std::runtime_error((boost::format("Cannot open baseline %s.") % fileName).str());
+
+        char readBuffer[65536];
+        rapidjson::FileReadStream stream(file, readBuffer, sizeof(readBuffer));
+        rapidjson::Document doc;
+        doc.ParseStream(stream);
+        fclose(file);
+
+        if (!doc.IsObject() || !doc.HasMember("summary") || !doc["summary"].IsObject())
+            throw std::runtime_error((boost::format("Invalid baseline: %s") % fileName).str());
+        if (doc.HasMember("renderer") && doc["renderer"].IsString())
+            renderer = doc["renderer"].GetString();
+
+        // names are paths into the summary, e.g. gpu_ms.deformed.total
+        std::map<std::string, double> metrics;
+        std::vector<std::string> names(comparedMetrics, comparedMetrics + sizeof(comparedMetrics) / sizeof(char *));
+        for (int j = 0; j < tresta::FrameProfiler::NUM_PASSES; ++j)
+            names.push_back("gpu_ms." + tresta::FrameProfiler::passName((tresta::FrameProfiler::Pass) j) + ".total");
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            const rapidjson::Value *value = &doc["summary"];
+            size_t start = 0;
+            while (value && start <= names[i].size()) {
+                const size_t end = std::min(names[i].find('.', start), names[i].size());
+                const std::string key = names[i].substr(start, end - start);
+                value = value->IsObject() && value->HasMember(key.c_str()) ? &(*value)[key.c_str()] : nullptr;
+                start = end + 1;
+            }
+            if (value && value->IsNumber())
+                metrics[names[i]] = value->GetDouble();
+        }
+        return metrics;
+    }
+
+    /**
+     * Prints every time next to its baseline.
+     * @return Number of times that exceed their baseline by more than the tolerance.
+     */
+    int compareWithBaseline(const std::map<std::string, double> &metrics, const std::string &renderer,
+                            const BenchOptions &options) {
+        std::string baselineRenderer;
+        const std::map<std::string, double> baseline = readBaseline(options.baseline, baselineRenderer);
+        if (baselineRenderer != renderer)
+            std::clog << "Warning: the baseline was measured with " << baselineRenderer << std::endl;
+
+        // times this short are dominated by timer resolution
+        const double noiseMs = 0.01;
+        int regressions = 0;
+        std::cout << boost::format("%-26s %12s %12s %9s") % "time" % "baseline" % "current" % "change" << std::endl;
+        for (std::map<std::string, double>::const_iterator it = metrics.begin(); it != metrics.end(); ++it) {
+            std::map<std::string, double>::const_iterator base = baseline.find(it->first);
+            if (base == baseline.end())
+                continue;
+
+            const double change = base->second > 0.0 ? 100.0 * (it->second - base->second) / base->second : 0.0;
+            const bool regressed = it->second > noiseMs && it->second > base->second * (1.0 + options.tolerance / 100.0);
+            if (regressed)
+                ++regressions;
+            std::cout << boost::format("%-26s %12.3f %12.3f %+8.1f%%%s") % it->first % base->second % it->second
+                         % change % (regressed ? "  REGRESSION" : "") << std::endl;
+        }
+        return regressions;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!parseOption(argv[arg], argv[arg + 1], options)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (arg + 1 != argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::string config(argv[arg]);
+    tresta::InteractionSession session;
+    if (!options.session.empty()) {
+        try {
+            session = tresta::InteractionSession::load(options.session);
+        }
+        catch (std::exception &e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!options.view.sizeSet && session.getWidth() > 0 && session.getHeight() > 0)
+            options.view.size = QSize(session.getWidth(), session.getHeight());
+    }
+
+    // no display is needed unless a platform plugin is chosen explicitly
+    tresta::useOffscreenPlatform();
+
+    int appArgc = 1;
+    QGuiApplication app(appArgc, argv);
+    app.setOrganizationName("Latture");
+    app.setApplicationName("Tresta");
+
+    QOffscreenSurface surface;
+    QOpenGLContext context;
+    if (!tresta::createOffscreenContext(surface, context))
+        return EXIT_FAILURE;
+
+    int regressions = 0;
+    try {
+        tresta::FrameCapture capture;
+        capture.resize(options.view.size.width(), options.view.size.height());
+
+        const tresta::Job job = tresta::loadJobFromFilename(config);
+        std::unique_ptr<tresta::TrussScene> scene(new tresta::TrussScene(job));
+        scene->setContext(&context);
+        scene->setColorSettings(tresta::defaultColorSettings(job, scene->getScalarStatistics()));
+        scene->initialize();
+        scene->setShadingMode(options.view.shadingMode);
+        capture.bind();
+        scene->resize(options.view.size.width(), options.view.size.height());
+
+        std::clog << "Replaying " << (options.session.empty() ? tresta::CameraPath::kindName(options.path) :
+                                      options.session) << " at " << options.view.size.width() << "x"
+                  << options.view.size.height() << std::endl;
+
+        // every measured frame is kept, however long the session
+        scene->getProfiler().setHistoryLimit((size_t) -1);
+        if (options.session.empty())
+            runPath(*scene, capture, options);
+        else
+            runSession(*scene, capture, job, session, options);
+        scene->getProfiler().finish();
+
+        const tresta::FrameProfiler::Statistics statistics = scene->getProfiler().getStatistics();
+        const std::map<std::string, double> metrics = summarize(statistics);
+        printSummary(statistics, metrics);
+
+        if (!options.output.empty()) {
+            statistics.saveJson(options.output);
+            std::clog << "Saved the frame timings to " << options.output << std::endl;
+        }
+        if (!options.baseline.empty())
+            regressions = compareWithBaseline(metrics, statistics.renderer, options);
+
+        // GL resources of the scene are released here, while the context is current
+        scene.reset();
+        capture.release();
+    }
+    catch (std::exception &e) {
+        std::cerr << "error: " << config << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    context.doneCurrent();
+
+    if (regressions > 0) {
+        std::cerr << regressions << " times regressed by more than " << options.tolerance << "%" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
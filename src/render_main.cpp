@@ -0,0 +1,398 @@
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "frame_capture.h"
+#include "image_encoder_pool.h"
+#include "memory_tracker.h"
+#include "offscreen.h"
+#include "poster_writer.h"
+#include "setup.h"
+#include "trace.h"
+#include "truss_scene.h"
+
+namespace {
+    /**
+     * View and output shared by every config of a run.
+     */
+    struct RenderOptions {
+        RenderOptions() :
+                view(QSize(1024, 768)),
+                deformationScale(1.0f),
+                turntableFrames(0),
+                frameTime(1.0f / 30.0f),
+                tileSize(0),
+                directory("."),
+                format(tresta::ImageEncoderPool::PNG) {}
+
+        tresta::ViewOptions view;
+        float deformationScale;
+        int turntableFrames;/**<0 for a single image per config.*/
+        float frameTime;/**<Seconds displacement sequences and mode shapes advance between turntable frames.*/
+        int tileSize;/**<0 to render each image in one piece, otherwise the edge of the tiles of a poster.*/
+        QString directory;
+        tresta::ImageEncoderPool::Format format;
+        std::string memoryReport;/**<File the memory usage of every config is written to, `-` for standard error.*/
+    };
+
+    void printUsage(const char *program) {
+        std::cerr << "usage: " << program << " [options] config.json ..." << std::endl
+                  << "  -r  resolution WIDTHxHEIGHT (default 1024x768)" << std::endl
+                  << "  -c  camera rotation RX,RY,RZ in degrees (default 30,-30,0)" << std::endl
+                  << "  -z  camera distance relative to the one that fits the truss (default 1)" << std::endl
+                  << "  -d  deformation scale (default 1)" << std::endl
+                  << "  -t  render a turntable of this many frames about the y axis instead of one image" << std::endl
+                  << "  -a  seconds animations advance between turntable frames (default 0.0333)" << std::endl
+                  << "  -m  shading mode: forward, prepass or deferred (default forward)" << std::endl
+                  << "  -p  render posters in tiles of this many pixels, saved as TIFF (automatic beyond the GPU limits)"
+                  << std::endl
+                  << "  -f  image format: png, tga or ppm (default png)" << std::endl
+                  << "  -o  output directory (default .)" << std::endl
+                  << "  -u  write the memory usage of every config to this file, - for standard error" << std::endl
+                  << "Images are named after the config, e.g. truss.png or truss_0.png ... for a turntable." << std::endl;
+    }
+
+    bool parseOption(const char *flag, const char *value, RenderOptions &options) {
+        if (tresta::isViewOption(flag)) {
+            return tresta::parseViewOption(flag, value, options.view);
+        }
+        else if (std::strcmp(flag, "-d") == 0) {
+            options.deformationScale = (float) std::atof(value);
+            return options.deformationScale > 0.0f;
+        }
+        else if (std::strcmp(flag, "-t") == 0) {
+            options.turntableFrames = std::atoi(value);
+            return options.turntableFrames > 0;
+        }
+        else if (std::strcmp(flag, "-a") == 0) {
+            options.frameTime = (float) std::atof(value);
+            return options.frameTime >= 0.0f;
+        }
+        else if (std::strcmp(flag, "-p") == 0) {
+            // tiles are stacked into bands of whole TIFF strips
+            const int strip = tresta::PosterWriter::rowsPerStrip;
+            options.tileSize = (std::atoi(value) + strip - 1) / strip * strip;
+            return options.tileSize > 0;
+        }
+        else if (std::strcmp(flag, "-f") == 0) {
+            if (std::strcmp(value, "png") == 0)
+                options.format = tresta::ImageEncoderPool::PNG;
+            else if (std::strcmp(value, "tga") == 0)
+                options.format = tresta::ImageEncoderPool::TGA;
+            else if (std::strcmp(value, "ppm") == 0)
+                options.format = tresta::ImageEncoderPool::PPM;
+            else
+                return false;
+        }
+        else if (std::strcmp(flag, "-o") == 0) {
+            options.directory = QString::fromLocal8Bit(value);
+        }
+        else if (std::strcmp(flag, "-u") == 0) {
+            options.memoryReport = value;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Hands the oldest finished readback to the encoders, see `RenderThread::saveDemoFrame`.
+     */
+    bool saveFrame(tresta::FrameCapture &capture, tresta::ImageEncoderPool &encoders, const QString &fileName,
+                   bool numbered, bool wait) {
+        QImage frame;
+        int frameNumber;
+        if (!capture.takeFrame(frame, frameNumber, wait))
+            return false;
+
+        encoders.submit(frame, numbered ? fileName + "_" + QString::number(frameNumber) : fileName);
+        return true;
+    }
+
+    /**
+     * Size of the framebuffer: the whole image, or one tile of a poster.
+     */
+    QSize captureSize(const RenderOptions &options) {
+        return options.tileSize > 0 ? QSize(options.tileSize, options.tileSize) : options.view.size;
+    }
+
+    /**
+     * Copies the oldest finished tile into the band of its row and hands the band to the writer once its last tile
+     * is in. Tiles on the right and bottom edge are cropped to the poster.
+     */
+    bool assembleTile(tresta::FrameCapture &capture, tresta::PosterWriter &writer, QImage &band,
+                      const RenderOptions &options, bool wait) {
+        QImage frame;
+        int tileNumber;
+        if (!capture.takeFrame(frame, tileNumber, wait))
+            return false;
+
+        const int tile = options.tileSize;
+        const int columns = (options.view.size.width() + tile - 1) / tile;
+        const int column = tileNumber % columns;
+        const int row = tileNumber / columns;
+        if (column == 0)
+            band = QImage(options.view.size.width(), std::min(tile, options.view.size.height() - row * tile),
+                          QImage::Format_RGB888);
+
+        const int left = column * tile;
+        const int width = std::min(tile, options.view.size.width() - left);
+        for (int y = 0; y < band.height(); ++y) {
+            const uchar *in = frame.constScanLine(y);
+            uchar *out = band.scanLine(y) + 3 * left;
+            for (int x = 0; x < width; ++x) {
+                out[3 * x] = in[4 * x];
+                out[3 * x + 1] = in[4 * x + 1];
+                out[3 * x + 2] = in[4 * x + 2];
+            }
+        }
+
+        if (column == columns - 1)
+            writer.submit(band);
+        return true;
+    }
+
+    /**
+     * Renders the current view as a poster of tiles with off-axis frusta, written as a TIFF file band by band.
+     * @details The readback of a tile overlaps the rendering of the next ones, and the strips of a finished band are
+     * compressed while the following band is rendered, so only about three bands are held in memory.
+     */
+    void renderPoster(tresta::TrussScene &scene, tresta::FrameCapture &capture, const QString &fileName,
+                      const RenderOptions &options) {
+        const int tile = options.tileSize;
+        const int columns = (options.view.size.width() + tile - 1) / tile;
+        const int rows = (options.view.size.height() + tile - 1) / tile;
+
+        tresta::PosterWriter writer;
+        writer.open(fileName + ".tif", options.view.size.width(), options.view.size.height(), 6);
+        QImage band;
+
+        for (int i = 0; i < columns * rows; ++i) {
+            if (capture.isFull())
+                assembleTile(capture, writer, band, options, true);
+
+            scene.resizeTile(QRect((i % columns) * tile, (i / columns) * tile, tile, tile), options.view.size);
+            capture.bind();
+            scene.render();
+            capture.read(i);
+
+            while (assembleTile(capture, writer, band, options, false));
+        }
+        while (assembleTile(capture, writer, band, options, true));
+
+        writer.close();
+        const QString error = writer.takeError();
+        if (!error.isEmpty())
+            throw std::runtime_error(error.toStdString());
+    }
+
+    /**
+     * Renders one config with the shared context, capture and programs.
+     * @param memoryReport std::ostream. Receives the memory usage while the scene is alive, may be `nullptr`.
+     * @return Number of images queued for saving.
+     */
+    int renderConfig(const std::string &config, const QString &fileName, const RenderOptions &options,
+                     QOpenGLContext &context, tresta::FrameCapture &capture, tresta::ImageEncoderPool &encoders,
+                     const std::shared_ptr<tresta::ScenePrograms> &programs, std::ostream *memoryReport) {
+        const tresta::Job job = tresta::loadJobFromFilename(config);
+        std::unique_ptr<tresta::TrussScene> scene(new tresta::TrussScene(job, programs));
+        scene->setContext(&context);
+        scene->setColorSettings(tresta::defaultColorSettings(job, scene->getScalarStatistics()));
+        scene->initialize();
+        scene->setShadingMode(options.view.shadingMode);
+        if (!job.displacements.empty() && options.deformationScale != scene->getDeformationScale())
+            scene->setDeformationScale(options.deformationScale);
+
+        // render targets of the scene never exceed the framebuffer, even for a poster
+        capture.bind();
+        scene->resizeTile(QRect(QPoint(0, 0), captureSize(options)), options.view.size);
+        scene->update(0.0f);
+
+        const bool turntable = options.turntableFrames > 0;
+        const int frames = turntable ? options.turntableFrames : 1;
+        for (int i = 0; i < frames; ++i) {
+            const float turn = 360.0f * i / frames;
+            // the first frame shows mode shapes at their peak and sequences at their first frame
+            if (i > 0)
+                scene->update(options.frameTime);
+
+            if (options.tileSize > 0) {
+                scene->setCameraView(options.view.rotation + QVector3D(0.0f, turn, 0.0f), options.view.distance);
+                renderPoster(*scene, capture, turntable ? fileName + "_" + QString::number(i) : fileName, options);
+                continue;
+            }
+
+            // the readback of a frame overlaps the rendering of the next ones
+            if (capture.isFull())
+                saveFrame(capture, encoders, fileName, turntable, true);
+
+            scene->setCameraView(options.view.rotation + QVector3D(0.0f, turn, 0.0f), options.view.distance);
+            capture.bind();
+            scene->render();
+            capture.read(i);
+
+            while (saveFrame(capture, encoders, fileName, turntable, false));
+        }
+        while (saveFrame(capture, encoders, fileName, turntable, true));
+
+        if (memoryReport)
+            *memoryReport << "Memory usage of " << config << ":" << std::endl << tresta::MemoryTracker::report()
+                          << std::endl << scene->gpuMemorySummary();
+
+        // GL resources of the scene are released here, while the context is current
+        scene.reset();
+        return frames;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    RenderOptions options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (!parseOption(argv[arg], argv[arg + 1], options)) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (arg >= argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<std::string> configs(argv + arg, argv + argc);
+    tresta::Tracer::startFromEnvironment();
+
+    // no display is needed unless a platform plugin is chosen explicitly
+    tresta::useOffscreenPlatform();
+
+    int appArgc = 1;
+    QGuiApplication app(appArgc, argv);
+    app.setOrganizationName("Latture");
+    app.setApplicationName("Tresta");
+
+    QOffscreenSurface surface;
+    QOpenGLContext context;
+    if (!tresta::createOffscreenContext(surface, context))
+        return EXIT_FAILURE;
+
+    // images beyond the largest framebuffer or viewport are only possible as posters
+    GLint maxRenderbufferSize = 0;
+    GLint maxViewportDims[2] = {0, 0};
+    context.functions()->glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
+    context.functions()->glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewportDims);
+    const int maxWidth = std::min<int>(maxRenderbufferSize, maxViewportDims[0]);
+    const int maxHeight = std::min<int>(maxRenderbufferSize, maxViewportDims[1]);
+    if (options.tileSize == 0 && (options.view.size.width() > maxWidth || options.view.size.height() > maxHeight)) {
+        options.tileSize = 1024;
+        std::clog << "Rendering " << options.view.size.width() << "x" << options.view.size.height() << " exceeds the "
+                  << maxWidth << "x" << maxHeight << " limit of the GPU, rendering posters in tiles of "
+                  << options.tileSize << " pixels" << std::endl;
+    }
+
+    int failures = 0;
+    int rendered = 0;
+    int images = 0;
+    {
+        // one context, framebuffer and set of shader programs serve every config
+        tresta::FrameCapture capture;
+        tresta::ImageEncoderPool encoders;
+        std::shared_ptr<tresta::ScenePrograms> programs = std::make_shared<tresta::ScenePrograms>();
+        std::map<QString, int> fileNames;
+
+        std::ofstream memoryFile;
+        std::ostream *memoryReport = nullptr;
+        if (options.memoryReport == "-") {
+            memoryReport = &std::clog;
+        }
+        else if (!options.memoryReport.empty()) {
+            memoryFile.open(options.memoryReport.c_str(), std::ios::trunc);
+            if (!memoryFile) {
+                std::cerr << "error: cannot open " << options.memoryReport << std::endl;
+                return EXIT_FAILURE;
+            }
+            memoryReport = &memoryFile;
+        }
+
+        try {
+            capture.resize(captureSize(options).width(), captureSize(options).height());
+        }
+        catch (std::exception &e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        encoders.start(options.format, 6);
+
+        for (size_t i = 0; i < configs.size(); ++i) {
+            // configs sharing a name, e.g. results/*/config.json, are told apart by a count
+            const QString baseName = QFileInfo(QString::fromLocal8Bit(configs[i].c_str())).completeBaseName();
+            const int uses = ++fileNames[baseName];
+            const QString fileName = options.directory + "/" + baseName +
+                                     (uses > 1 ? "_" + QString::number(uses) : QString());
+
+            // peaks are reported per config
+            tresta::MemoryTracker::resetPeaks();
+
+            try {
+                images += renderConfig(configs[i], fileName, options, context, capture, encoders, programs,
+                                       memoryReport);
+                ++rendered;
+                std::cout << "Rendered " << configs[i] << std::endl;
+            }
+            catch (std::exception &e) {
+                std::cerr << "error: " << configs[i] << ": " << e.what() << std::endl;
+                ++failures;
+
+                // drop the readbacks of the failed config
+                try {
+                    capture.release();
+                    capture.resize(captureSize(options).width(), captureSize(options).height());
+                }
+                catch (std::exception &e) {
+                    std::cerr << "error: " << e.what() << std::endl;
+                    failures += (int) (configs.size() - i - 1);
+                    break;
+                }
+            }
+        }
+
+        encoders.finish();
+        const QString error = encoders.takeError();
+        if (!error.isEmpty()) {
+            std::cerr << "error: " << error.toStdString() << std::endl;
+            ++failures;
+        }
+
+        programs.reset();
+        capture.release();
+    }
+    context.doneCurrent();
+
+    try {
+        tresta::Tracer::stop();
+    }
+    catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        ++failures;
+    }
+
+    std::cout << "Saved " << images << " images of " << rendered << " configs to "
+              << options.directory.toStdString() << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,364 @@
+#include "render_thread.h"
+
+#include <QElapsedTimer>
+#include <QFontDatabase>
+#include <QImage>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLPaintDevice>
+#include <QPainter>
+#include <QStringList>
+#include <QWindow>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "glassert.h"
+#include "trace.h"
+#include "truss_scene.h"
+
+namespace tresta {
+
+    namespace {
+        static void infoGL() {
+            glCheckError();
+            const GLubyte *str;
+            std::clog << "OpenGL infos with gl functions" << std::endl;
+            str = glGetString(GL_RENDERER);
+            std::clog << "Renderer : " << str << std::endl;
+            str = glGetString(GL_VENDOR);
+            std::clog << "Vendor : " << str << std::endl;
+            str = glGetString(GL_VERSION);
+            std::clog << "OpenGL Version : " << str << std::endl;
+            str = glGetString(GL_SHADING_LANGUAGE_VERSION);
+            std::clog << "GLSL Version : " << str << std::endl;
+            glCheckError();
+        }
+
+        const size_t commandQueueCapacity = 1024;
+        const size_t overlayAveragedFrames = 30;/**<Times in the overlay are averaged so they can be read.*/
+        const int histogramBins = 48;
+
+        /**
+         * Draws the recorded timings and a histogram of the frame times into the top left corner.
+         */
+        void paintStats(QPainter &painter, const FrameProfiler::Statistics &statistics) {
+            const std::vector<FrameProfiler::Sample> &samples = statistics.samples;
+            const size_t first = samples.size() - std::min(samples.size(), overlayAveragedFrames);
+            const double count = (double) (samples.size() - first);
+            double cpuMs = 0.0;
+            double frameMs = 0.0;
+            double gpuMs[FrameProfiler::NUM_PASSES] = {};
+            for (size_t i = first; i < samples.size(); ++i) {
+                cpuMs += samples[i].cpuMs / count;
+                frameMs += samples[i].frameMs / count;
+                for (int j = 0; j < FrameProfiler::NUM_PASSES; ++j)
+                    gpuMs[j] += samples[i].gpuMs[j] / count;
+            }
+
+            std::vector<double> frameTimes;
+            for (size_t i = 0; i < samples.size(); ++i) {
+                if (samples[i].frameMs > 0.0)
+                    frameTimes.push_back(samples[i].frameMs);
+            }
+            const double p50 = FrameProfiler::Statistics::percentile(frameTimes, 0.50);
+            const double p95 = FrameProfiler::Statistics::percentile(frameTimes, 0.95);
+            const double p99 = FrameProfiler::Statistics::percentile(frameTimes, 0.99);
+
+            double gpuTotalMs = 0.0;
+            QString gpuLine;
+            for (int i = 0; i < FrameProfiler::NUM_PASSES; ++i) {
+                gpuTotalMs += gpuMs[i];
+                gpuLine += QString("  %1 %2").arg(QString::fromStdString(FrameProfiler::passName((FrameProfiler::Pass) i)))
+                                             .arg(gpuMs[i], 0, 'f', 2);
+            }
+
+            const FrameProfiler::Sample &last = samples.back();
+            QStringList lines;
+            lines << QString("CPU %1 ms   frame %2 ms").arg(cpuMs, 0, 'f', 2).arg(frameMs, 0, 'f', 2)
+                  << QString("GPU %1 ms ").arg(gpuTotalMs, 0, 'f', 2) + gpuLine
+                  << QString("%L1 instances  %L2 triangles  %3 draw calls").arg(last.instances).arg(last.triangles)
+                                                                             .arg(last.drawCalls)
+                  << QString("frame time p50 %1  p95 %2  p99 %3 ms").arg(p50, 0, 'f', 1).arg(p95, 0, 'f', 1)
+                                                                     .arg(p99, 0, 'f', 1);
+
+            painter.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+            const QFontMetrics metrics(painter.font());
+            int textWidth = 0;
+            for (int i = 0; i < lines.size(); ++i)
+                textWidth = std::max(textWidth, metrics.width(lines[i]));
+
+            const int margin = 8;
+            const QRect histogram(2 * margin, 2 * margin + lines.size() * metrics.height() + margin,
+                                  std::max(textWidth, 240), 64);
+            painter.fillRect(QRect(QPoint(margin, margin), histogram.bottomRight() + QPoint(margin, margin)),
+                             QColor(0, 0, 0, 160));
+
+            painter.setPen(Qt::white);
+            for (int i = 0; i < lines.size(); ++i)
+                painter.drawText(2 * margin, 2 * margin + i * metrics.height() + metrics.ascent(), lines[i]);
+
+            // the range ends a bit past the 99th percentile, so outliers pile up in the last bin
+            const double rangeMs = std::max(1.25 * p99, 1.0);
+            std::vector<int> counts(histogramBins, 0);
+            for (size_t i = 0; i < frameTimes.size(); ++i)
+                ++counts[std::min((int) (frameTimes[i] / rangeMs * histogramBins), histogramBins - 1)];
+            const int maxCount = std::max(*std::max_element(counts.begin(), counts.end()), 1);
+
+            for (int i = 0; i < histogramBins; ++i) {
+                const int left = histogram.left() + i * histogram.width() / histogramBins;
+                const int right = histogram.left() + (i + 1) * histogram.width() / histogramBins;
+                const int height = counts[i] * histogram.height() / maxCount;
+                painter.fillRect(QRect(left, histogram.bottom() - height + 1, std::max(right - left - 1, 1), height),
+                                 QColor(200, 200, 200));
+            }
+
+            const double percentiles[] = {p50, p95, p99};
+            const QColor colors[] = {QColor(80, 220, 80), QColor(240, 200, 40), QColor(240, 60, 60)};
+            for (int i = 0; i < 3; ++i) {
+                const int x = histogram.left() + (int) (percentiles[i] / rangeMs * histogram.width());
+                painter.setPen(colors[i]);
+                painter.drawLine(x, histogram.top(), x, histogram.bottom());
+            }
+
+            painter.setPen(Qt::white);
+            painter.drawText(histogram, Qt::AlignRight | Qt::AlignTop, QString("%1 ms").arg(rangeMs, 0, 'f', 1));
+        }
+    }
+
+    const int RenderThread::frameIntervalMs = 16;
+
+    RenderThread::RenderThread(QWindow *surface, TrussScene *scene) :
+            mSurface(surface),
+            mContext(new QOpenGLContext()),
+            mScene(scene),
+            commands(commandQueueCapacity),
+            running(true),
+            exposed(false),
+            cullingSupported(false),
+            demoMode(false),
+            currDemoFrame(0),
+            windowWidth(0),
+            windowHeight(0),
+            statsOverlay(false) {
+        mContext->create();
+        mContext->moveToThread(this);
+        mScene->setContext(mContext);
+    }
+
+    RenderThread::~RenderThread() {
+        delete mContext;
+    }
+
+    void RenderThread::enqueue(Command command) {
+        while (!commands.push(std::move(command)))
+            QThread::yieldCurrentThread();
+    }
+
+    void RenderThread::resize(int width, int height) {
+        enqueue([this, width, height]() {
+            windowWidth = width;
+            windowHeight = height;
+            if (!demoMode)
+                mScene->resize(width, height);
+        });
+    }
+
+    void RenderThread::setDemo(bool enabled, const DemoSettings &settings) {
+        enqueue([this, enabled, settings]() {
+            if (enabled) {
+                const QSize size = settings.frameSize.isValid() ? settings.frameSize : QSize(windowWidth, windowHeight);
+                capture.resize(size.width(), size.height());
+                mScene->resize(size.width(), size.height());
+                if (settings.output == DemoSettings::IMAGE_FILES) {
+                    encoders.start(settings.format, settings.compressionLevel);
+                }
+                else {
+                    FrameStream::Format format = settings.output == DemoSettings::PPM_STREAM ? FrameStream::PPM
+                                                                                             : FrameStream::Y4M;
+                    stream.open(settings.streamTarget, format, size.width(), size.height(), settings.framesPerSecond);
+                }
+            }
+            else if (demoMode) {
+                while (saveDemoFrame(true));
+                capture.release();
+                encoders.finish();
+                stream.close();
+                mScene->resize(windowWidth, windowHeight);
+            }
+
+            demoMode = enabled;
+            demoSettings = settings;
+            if (!enabled)
+                currDemoFrame = 0;
+        });
+    }
+
+    void RenderThread::setStatsOverlay(bool enabled) {
+        enqueue([this, enabled]() {
+            statsOverlay = enabled;
+            mScene->getProfiler().setEnabled(enabled);
+        });
+    }
+
+    void RenderThread::setExposed(bool isExposed) {
+        exposed = isExposed;
+    }
+
+    bool RenderThread::isCullingSupported() const {
+        return cullingSupported;
+    }
+
+    void RenderThread::stop() {
+        running = false;
+    }
+
+    void RenderThread::run() {
+        Tracer::nameThread("render");
+        try {
+            printContextInfos();
+            mScene->initialize();
+            cullingSupported = mScene->isCullingSupported();
+        }
+        catch (const std::exception &e) {
+            emit renderFailed(QString::fromStdString(e.what()), true);
+            running = false;
+        }
+
+        QElapsedTimer frameTimer;
+        QElapsedTimer clock;
+        clock.start();
+        while (running) {
+            frameTimer.start();
+            drainCommands();
+            mScene->update(clock.restart() / 1000.0f);
+
+            if (exposed) {
+                mContext->makeCurrent(mSurface);
+                if (demoMode) {
+                    try {
+                        captureDemoFrame();
+                    }
+                    catch (const std::exception &e) {
+                        reportFailure(e);
+                    }
+                }
+                else {
+                    mScene->render();
+                    if (statsOverlay)
+                        drawStatsOverlay();
+                }
+                mContext->swapBuffers(mSurface);
+            }
+
+            // demo frames are captured as fast as they render
+            const qint64 remaining = frameIntervalMs - frameTimer.elapsed();
+            if (remaining > 0 && !demoMode)
+                QThread::msleep((unsigned long) remaining);
+        }
+
+        // GL resources of the scene must be released with its context current
+        mContext->makeCurrent(mSurface);
+        capture.release();
+        encoders.finish();
+        stream.close();
+        delete mScene;
+        mScene = 0;
+        mContext->doneCurrent();
+    }
+
+    void RenderThread::drainCommands() {
+        Command command;
+        while (commands.pop(command)) {
+            mContext->makeCurrent(mSurface);
+            try {
+                command();
+            }
+            catch (const std::exception &e) {
+                reportFailure(e);
+            }
+        }
+    }
+
+    void RenderThread::reportFailure(const std::exception &e) {
+        abortDemo();
+        emit renderFailed(QString::fromStdString(e.what()), false);
+    }
+
+    void RenderThread::abortDemo() {
+        // the frames still in flight are dropped; the output they would go to has failed
+        capture.release();
+        encoders.finish();
+        stream.close();
+        encoders.takeError();
+        stream.takeError();
+        if (demoMode)
+            mScene->resize(windowWidth, windowHeight);
+
+        demoMode = false;
+        currDemoFrame = 0;
+    }
+
+    void RenderThread::captureDemoFrame() {
+        // the oldest readback only blocks once every buffer of the ring is in flight
+        if (capture.isFull())
+            saveDemoFrame(true);
+
+        currDemoFrame %= 360;
+        capture.bind();
+        mScene->demo(currDemoFrame);
+        capture.read(currDemoFrame);
+        capture.blit(mContext->defaultFramebufferObject(), windowWidth, windowHeight);
+        ++currDemoFrame;
+
+        while (saveDemoFrame(false));
+    }
+
+    bool RenderThread::saveDemoFrame(bool wait) {
+        QImage frame;
+        int frameNumber;
+        if (!capture.takeFrame(frame, frameNumber, wait))
+            return false;
+
+        // waits while the encoders or the stream are busy, so at most a few frames are held in memory
+        if (stream.isOpen())
+            stream.submit(frame);
+        else
+            encoders.submit(frame, demoSettings.directory + "/" + demoSettings.prefix + "_" + QString::number(frameNumber));
+
+        QString error = encoders.takeError();
+        if (error.isEmpty())
+            error = stream.takeError();
+        if (!error.isEmpty())
+            throw std::runtime_error(error.toStdString());
+        return true;
+    }
+
+    void RenderThread::drawStatsOverlay() {
+        const FrameProfiler::Statistics statistics = mScene->getProfiler().getStatistics();
+        if (statistics.samples.empty())
+            return;
+
+        // Qt's paint engine changes the GL state; the scene sets its own again at the start of the next frame
+        QOpenGLPaintDevice device(windowWidth, windowHeight);
+        QPainter painter(&device);
+        paintStats(painter, statistics);
+    }
+
+    void RenderThread::printContextInfos() {
+        if (!mContext->isValid())
+            throw std::runtime_error("The OpenGL context is invalid!");
+
+        mContext->makeCurrent(mSurface);
+
+        std::clog << "Window format version is: "
+        << mSurface->format().majorVersion() << "."
+        << mSurface->format().minorVersion() << std::endl;
+
+        std::clog << "Context format version is: "
+        << mContext->format().majorVersion()
+        << "." << mContext->format().minorVersion() << std::endl;
+        infoGL();
+    }
+
+} // namespace tresta
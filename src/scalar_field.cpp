@@ -0,0 +1,165 @@
+#include "scalar_field.h"
+#include <QThread>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace tresta {
+
+    namespace {
+        const unsigned int numHistogramBins = 4096;
+
+        struct ColormapPoint {
+            float position;
+            float rgb[3];
+        };
+
+        struct Range {
+            float min;
+            float max;
+            size_t count;
+        };
+
+        Range reduceRange(const float *first, const float *last) {
+            Range range = {std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0};
+            for (const float *v = first; v != last; ++v) {
+                if (!std::isfinite(*v))
+                    continue;
+                range.min = std::min(range.min, *v);
+                range.max = std::max(range.max, *v);
+                ++range.count;
+            }
+            return range;
+        }
+
+        std::vector<size_t> reduceHistogram(const float *first, const float *last, float min, float binScale) {
+            std::vector<size_t> histogram(numHistogramBins, 0);
+            size_t bin;
+            for (const float *v = first; v != last; ++v) {
+                if (!std::isfinite(*v))
+                    continue;
+                bin = (size_t) ((*v - min) * binScale);
+                ++histogram[std::min(bin, (size_t) numHistogramBins - 1)];
+            }
+            return histogram;
+        }
+
+        float findPercentile(const std::vector<size_t> &histogram, size_t count, float fraction, float min, float binWidth) {
+            const double target = std::max(0.0f, std::min(1.0f, fraction)) * count;
+            size_t accumulated = 0;
+            for (size_t i = 0; i < histogram.size(); ++i) {
+                if (histogram[i] > 0 && accumulated + histogram[i] >= target) {
+                    // interpolate linearly within the bin
+                    const double within = (target - accumulated) / histogram[i];
+                    return min + binWidth * (float) (i + within);
+                }
+                accumulated += histogram[i];
+            }
+            return min + binWidth * histogram.size();
+        }
+
+        const std::vector<std::vector<ColormapPoint>> &colormapPoints() {
+            static const std::vector<std::vector<ColormapPoint>> points = {
+                // viridis
+                {{0.0f, {0.267f, 0.004f, 0.329f}}, {0.1f, {0.282f, 0.141f, 0.459f}}, {0.2f, {0.255f, 0.267f, 0.529f}},
+                 {0.3f, {0.208f, 0.373f, 0.553f}}, {0.4f, {0.165f, 0.471f, 0.557f}}, {0.5f, {0.129f, 0.569f, 0.549f}},
+                 {0.6f, {0.133f, 0.659f, 0.518f}}, {0.7f, {0.267f, 0.749f, 0.439f}}, {0.8f, {0.478f, 0.820f, 0.318f}},
+                 {0.9f, {0.741f, 0.875f, 0.149f}}, {1.0f, {0.992f, 0.906f, 0.145f}}},
+                // jet
+                {{0.0f, {0.0f, 0.0f, 0.5f}}, {0.125f, {0.0f, 0.0f, 1.0f}}, {0.375f, {0.0f, 1.0f, 1.0f}},
+                 {0.625f, {1.0f, 1.0f, 0.0f}}, {0.875f, {1.0f, 0.0f, 0.0f}}, {1.0f, {0.5f, 0.0f, 0.0f}}},
+                // cool to warm (diverging)
+                {{0.0f, {0.230f, 0.299f, 0.754f}}, {0.25f, {0.552f, 0.690f, 0.996f}}, {0.5f, {0.865f, 0.865f, 0.865f}},
+                 {0.75f, {0.958f, 0.604f, 0.482f}}, {1.0f, {0.706f, 0.016f, 0.150f}}},
+                // grayscale
+                {{0.0f, {0.0f, 0.0f, 0.0f}}, {1.0f, {1.0f, 1.0f, 1.0f}}}
+            };
+            return points;
+        }
+    }
+
+    ScalarStatistics computeScalarStatistics(const std::vector<float> &values, float lowFraction, float highFraction) {
+        ScalarStatistics statistics;
+        if (values.empty())
+            return statistics;
+
+        const size_t numChunks = std::min(values.size(), (size_t) std::max(1, QThread::idealThreadCount()));
+        const size_t chunkSize = (values.size() + numChunks - 1) / numChunks;
+        const float *data = &values[0];
+        const float *end = data + values.size();
+
+        std::vector<QFuture<Range>> rangeFutures;
+        for (const float *first = data; first < end; first += chunkSize)
+            rangeFutures.push_back(QtConcurrent::run(reduceRange, first, std::min(first + chunkSize, end)));
+
+        Range range = {std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0};
+        for (size_t i = 0; i < rangeFutures.size(); ++i) {
+            const Range chunk = rangeFutures[i].result();
+            range.min = std::min(range.min, chunk.min);
+            range.max = std::max(range.max, chunk.max);
+            range.count += chunk.count;
+        }
+
+        if (range.count == 0)
+            return statistics;
+
+        statistics.count = range.count;
+        statistics.min = range.min;
+        statistics.max = range.max;
+
+        if (range.max == range.min) {
+            statistics.lowPercentile = statistics.highPercentile = range.min;
+            return statistics;
+        }
+
+        const float binWidth = (range.max - range.min) / numHistogramBins;
+        std::vector<QFuture<std::vector<size_t>>> histogramFutures;
+        for (const float *first = data; first < end; first += chunkSize)
+            histogramFutures.push_back(QtConcurrent::run(reduceHistogram, first, std::min(first + chunkSize, end),
+                                                         range.min, 1.0f / binWidth));
+
+        std::vector<size_t> histogram(numHistogramBins, 0);
+        for (size_t i = 0; i < histogramFutures.size(); ++i) {
+            const std::vector<size_t> chunk = histogramFutures[i].result();
+            for (size_t j = 0; j < numHistogramBins; ++j)
+                histogram[j] += chunk[j];
+        }
+
+        statistics.lowPercentile = findPercentile(histogram, range.count, lowFraction, range.min, binWidth);
+        statistics.highPercentile = findPercentile(histogram, range.count, highFraction, range.min, binWidth);
+        return statistics;
+    }
+
+    const std::vector<std::string> &colormapNames() {
+        static const std::vector<std::string> names = {"Viridis", "Jet", "Cool to warm", "Grayscale"};
+        return names;
+    }
+
+    std::vector<unsigned char> buildColormapTexels(unsigned int width) {
+        const std::vector<std::vector<ColormapPoint>> &maps = colormapPoints();
+        std::vector<unsigned char> texels(4 * width * maps.size());
+        size_t k;
+        float t, w;
+
+        for (size_t row = 0; row < maps.size(); ++row) {
+            const std::vector<ColormapPoint> &points = maps[row];
+            k = 0;
+            for (unsigned int i = 0; i < width; ++i) {
+                t = width > 1 ? (float) i / (width - 1) : 0.0f;
+                while (k + 2 < points.size() && t > points[k + 1].position)
+                    ++k;
+
+                w = (t - points[k].position) / (points[k + 1].position - points[k].position);
+                w = std::max(0.0f, std::min(1.0f, w));
+                for (int c = 0; c < 3; ++c) {
+                    const float value = (1.0f - w) * points[k].rgb[c] + w * points[k + 1].rgb[c];
+                    texels[4 * (row * width + i) + c] = (unsigned char) std::lround(255.0f * value);
+                }
+                texels[4 * (row * width + i) + 3] = 255;
+            }
+        }
+        return texels;
+    }
+
+} // namespace tresta
@@ -1,7 +1,13 @@
 #include "boost/format.hpp"
 #include "csv_parser.h"
 #include <Eigen/Geometry>
+#include <QCollator>
+#include <QDir>
+#include <QFileInfo>
+#include "displacement_sequence.h"
+#include "memory_tracker.h"
 #include "setup.h"
+#include "trace.h"
 
 namespace tresta {
 
@@ -10,6 +16,7 @@ namespace tresta {
         void createVectorFromJSON(const rapidjson::Document &config_doc,
                                   const std::string &variable,
                                   std::vector<std::vector<T>> &data) {
+            TRESTA_TRACE_SCOPE("createVectorFromJSON", variable.c_str());
             if (!config_doc.HasMember(variable.c_str())) {
                 throw std::runtime_error(
                     (boost::format("Configuration file does not have requested member variable %s.") % variable).str()
@@ -31,6 +38,64 @@ namespace tresta {
             }
         }
 
+        std::vector<std::string> createFileListFromJSON(const rapidjson::Document &config_doc,
+                                                        const std::string &variable,
+                                                        bool single_file_is_list) {
+            std::vector<std::string> files;
+
+            if (!config_doc.HasMember(variable.c_str()))
+                return files;
+
+            const rapidjson::Value &value = config_doc[variable.c_str()];
+            if (value.IsArray()) {
+                for (rapidjson::SizeType i = 0; i < value.Size(); ++i) {
+                    if (!value[i].IsString()) {
+                        throw std::runtime_error(
+                            (boost::format("Entry %d of %s is not a string.") % i % variable).str()
+                        );
+                    }
+                    files.push_back(value[i].GetString());
+                }
+                if (files.empty()) {
+                    throw std::runtime_error(
+                        (boost::format("The list of files in %s is empty.") % variable).str()
+                    );
+                }
+            }
+            else if (value.IsString()) {
+                const QString pattern = QString::fromStdString(value.GetString());
+
+                if (pattern.contains('*') || pattern.contains('?')) {
+                    const QFileInfo patternInfo(pattern);
+                    QDir dir = patternInfo.dir();
+                    QStringList matches = dir.entryList(QStringList(patternInfo.fileName()), QDir::Files);
+
+                    QCollator collator;
+                    collator.setNumericMode(true);
+                    std::sort(matches.begin(), matches.end(), collator);
+
+                    for (int i = 0; i < matches.size(); ++i)
+                        files.push_back(dir.filePath(matches[i]).toStdString());
+
+                    if (files.empty()) {
+                        throw std::runtime_error(
+                            (boost::format("No files match %s of variable %s.") % value.GetString() % variable).str()
+                        );
+                    }
+                }
+                else if (single_file_is_list || pattern.endsWith(".bin", Qt::CaseInsensitive) ||
+                         pattern.endsWith(".tdc", Qt::CaseInsensitive)) {
+                    files.push_back(value.GetString());
+                }
+            }
+            else {
+                throw std::runtime_error(
+                    (boost::format("Value associated with variable %s is not a string or an array.") % variable).str()
+                );
+            }
+            return files;
+        }
+
         void updateTransforms(const Node &nx, const Node &ny,
                               Eigen::Matrix<float, 12, 12, Eigen::RowMajor> &Aelem,
                               Eigen::Matrix<float, 3, 3, Eigen::RowMajor> &transform_components) {
@@ -88,6 +153,7 @@ namespace tresta {
     }
 
     rapidjson::Document parseJSONConfig(const std::string &config_filename) {
+        TRESTA_TRACE_SCOPE("parseJSONConfig", config_filename.c_str());
         rapidjson::Document config_doc;
 
         FILE* config_file_ptr = fopen(config_filename.c_str(), "r");
@@ -119,6 +185,7 @@ namespace tresta {
         catch (std::runtime_error& e) {
             throw;
         }
+        TrackedBytes parsed(MemoryTracker::PARSE_TEMPORARIES, vectorBytes(nodes_vec));
 
         std::vector<Node> nodes_out(nodes_vec.size());
         Node n;
@@ -142,6 +209,7 @@ namespace tresta {
 
         createVectorFromJSON(config_doc, "elems", elems_vec);
         createVectorFromJSON(config_doc, "props", props_vec);
+        TrackedBytes parsed(MemoryTracker::PARSE_TEMPORARIES, vectorBytes(elems_vec) + vectorBytes(props_vec));
 
         if (elems_vec.size() != props_vec.size()) {
             throw std::runtime_error("The number of rows in elems did not match props.");
@@ -177,6 +245,7 @@ namespace tresta {
         if (config_doc.HasMember("displacements")) {
             createVectorFromJSON(config_doc, "displacements", disp_vec);
         }
+        TrackedBytes parsed(MemoryTracker::PARSE_TEMPORARIES, vectorBytes(disp_vec));
 
         std::vector<Displacement> disp_out(disp_vec.size());
 
@@ -192,12 +261,46 @@ namespace tresta {
         return disp_out;
     }
 
+    std::vector<std::string> createDisplacementFramesFromJSON(const rapidjson::Document &config_doc) {
+        return createFileListFromJSON(config_doc, "displacements", false);
+    }
+
+    std::vector<std::string> createModeShapesFromJSON(const rapidjson::Document &config_doc) {
+        return createFileListFromJSON(config_doc, "modes", true);
+    }
+
+    std::vector<float> createModeFrequenciesFromJSON(const rapidjson::Document &config_doc, size_t num_modes) {
+        // without frequencies every mode oscillates once per second
+        std::vector<float> frequencies(num_modes, 1.0f);
+
+        if (!config_doc.HasMember("mode_frequencies"))
+            return frequencies;
+
+        const rapidjson::Value &value = config_doc["mode_frequencies"];
+        if (!value.IsArray() || value.Size() != num_modes) {
+            throw std::runtime_error(
+                (boost::format("Variable mode_frequencies is not an array of %d numbers.") % num_modes).str()
+            );
+        }
+
+        for (rapidjson::SizeType i = 0; i < value.Size(); ++i) {
+            if (!value[i].IsNumber() || value[i].GetDouble() <= 0.0) {
+                throw std::runtime_error(
+                    (boost::format("Entry %d of mode_frequencies is not a positive number.") % i).str()
+                );
+            }
+            frequencies[i] = (float) value[i].GetDouble();
+        }
+        return frequencies;
+    }
+
     std::vector<QColor> createColorVecFromJSON(const rapidjson::Document &config_doc) {
         std::vector<std::vector<float> > color_vec;
 
         if (config_doc.HasMember("colors")) {
             createVectorFromJSON(config_doc, "colors", color_vec);
         }
+        TrackedBytes parsed(MemoryTracker::PARSE_TEMPORARIES, vectorBytes(color_vec));
 
         std::vector<QColor> color_out(color_vec.size());
 
@@ -212,10 +315,73 @@ namespace tresta {
         return color_out;
     }
 
+    std::vector<float> createScalarVecFromJSON(const rapidjson::Document &config_doc,
+                                               size_t num_nodes,
+                                               size_t num_elems,
+                                               ScalarLocation &location) {
+        std::vector<std::vector<float> > scalar_vec;
+        location = NO_SCALARS;
+
+        if (!config_doc.HasMember("scalars")) {
+            return std::vector<float>();
+        }
+        createVectorFromJSON(config_doc, "scalars", scalar_vec);
+        TrackedBytes parsed(MemoryTracker::PARSE_TEMPORARIES, vectorBytes(scalar_vec));
+
+        unsigned int column = 0;
+        if (config_doc.HasMember("scalar_column")) {
+            if (!config_doc["scalar_column"].IsUint()) {
+                throw std::runtime_error("Value associated with variable scalar_column is not a non-negative integer.");
+            }
+            column = config_doc["scalar_column"].GetUint();
+        }
+
+        if (config_doc.HasMember("scalar_location")) {
+            const std::string location_name = config_doc["scalar_location"].IsString() ?
+                                              config_doc["scalar_location"].GetString() : "";
+            if (location_name == "elements") {
+                location = ELEMENT_SCALARS;
+            }
+            else if (location_name == "nodes") {
+                location = NODE_SCALARS;
+            }
+            else {
+                throw std::runtime_error("Value associated with variable scalar_location must be \"elements\" or \"nodes\".");
+            }
+        }
+        else if (scalar_vec.size() == num_elems) {
+            location = ELEMENT_SCALARS;
+        }
+        else if (scalar_vec.size() == num_nodes) {
+            location = NODE_SCALARS;
+        }
+
+        const size_t expected_rows = location == NODE_SCALARS ? num_nodes : num_elems;
+        if (location == NO_SCALARS || scalar_vec.size() != expected_rows) {
+            throw std::runtime_error(
+                (boost::format("Number of rows in scalars (%d) do not match the number of elements (%d) or nodes (%d).")
+                 % scalar_vec.size() % num_elems % num_nodes).str()
+            );
+        }
+
+        std::vector<float> scalars_out(scalar_vec.size());
+
+        for (size_t i = 0; i < scalar_vec.size(); ++i) {
+            if (scalar_vec[i].size() <= column) {
+                throw std::runtime_error(
+                    (boost::format("Row %d in scalars does not have a value in column %d.") % i % column).str()
+                );
+            }
+            scalars_out[i] = scalar_vec[i][column];
+        }
+        return scalars_out;
+    }
+
     std::vector<std::vector<Node>> createNodeStrips(const std::vector<Node> &nodes,
                                                     const std::vector<Elem> &elems,
                                                     const std::vector<Displacement> &displacements,
                                                     const float scale) {
+        TRESTA_TRACE_SCOPE("createNodeStrips");
 
         if (displacements.size() != nodes.size()) {
             throw std::runtime_error(
@@ -294,21 +460,61 @@ namespace tresta {
     }
 
     Job createJobFromJSON(const rapidjson::Document &config_doc) {
+        TRESTA_TRACE_SCOPE("createJobFromJSON");
         std::vector<Node> nodes = createNodeVecFromJSON(config_doc);
         std::vector<Elem> elems = createElemVecFromJSON(config_doc);
-        std::vector<Displacement> disp = createDisplacementVecFromJSON(config_doc);
+        std::vector<std::string> frames = createDisplacementFramesFromJSON(config_doc);
+        std::vector<std::string> modes = createModeShapesFromJSON(config_doc);
+        if (!frames.empty() && !modes.empty()) {
+            throw std::runtime_error("A displacement time series and mode shapes cannot be animated together.");
+        }
+
+        std::vector<Displacement> disp;
+        size_t num_modes = 0;
+        if (!modes.empty()) {
+            // the first mode stands in for the static deformed shape, e.g. when exporting
+            DisplacementSequence mode_sequence(modes, nodes.size());
+            num_modes = mode_sequence.frameCount();
+            disp = mode_sequence.readDisplacements(0);
+        }
+        else if (frames.empty()) {
+            disp = createDisplacementVecFromJSON(config_doc);
+        }
+        else {
+            // the first frame stands in for the static deformed shape, e.g. when exporting
+            DisplacementSequence frame_sequence(frames, nodes.size());
+            disp = frame_sequence.readDisplacements(0);
+            // a single frame, e.g. a one-frame .bin written by tresta-lattice, is static
+            if (frame_sequence.frameCount() == 1)
+                frames.clear();
+        }
         std::vector<QColor> colors = createColorVecFromJSON(config_doc);
         std::vector<std::vector<Node>> node_strips;
         if (disp.size() > 0) {
             node_strips = createNodeStrips(nodes, elems, disp, 1.0f);
         }
+        // the lists are copied into the job, so they briefly exist twice
+        TrackedBytes assembled(MemoryTracker::PARSE_TEMPORARIES,
+                               vectorBytes(nodes) + vectorBytes(elems) + vectorBytes(disp) + vectorBytes(colors) +
+                               vectorBytes(node_strips));
         if (colors.size() > 0 && elems.size() != colors.size()) {
             throw std::runtime_error(
                 (boost::format("Number of rows in colors (%d) do not match the number number of elements (%d).") % colors.size() % elems.size()).str()
             );
         }
 
-        return Job(nodes, elems, disp, node_strips, colors);
+        Job job(nodes, elems, disp, node_strips, colors);
+        job.scalars = createScalarVecFromJSON(config_doc, nodes.size(), elems.size(), job.scalar_location);
+        job.displacement_frames = frames;
+        if (config_doc.HasMember("frame_rate")) {
+            if (!config_doc["frame_rate"].IsNumber() || config_doc["frame_rate"].GetDouble() <= 0.0) {
+                throw std::runtime_error("Value associated with variable frame_rate is not a positive number.");
+            }
+            job.frame_rate = (float) config_doc["frame_rate"].GetDouble();
+        }
+        job.mode_shapes = modes;
+        job.mode_frequencies = createModeFrequenciesFromJSON(config_doc, num_modes);
+        return job;
     }
 
     Job loadJobFromFilename(const std::string &config_filename) {
@@ -1,34 +1,93 @@
 #include "cylinder.h"
+#include <algorithm>
 #include <cmath>
 #include "glassert.h"
 
 namespace tresta {
 
+    namespace {
+        short packSnorm16(float value) {
+            return (short) std::lround(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f);
+        }
+
+        /**
+         * Octahedral encoding of a unit normal; must match `octDecode` in common.glsl.
+         */
+        void octEncode(const float *n, short *out) {
+            const float invL1 = 1.0f / (std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]));
+            float x = n[0] * invL1;
+            float y = n[1] * invL1;
+            if (n[2] * invL1 < 0.0f) {
+                const float wx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                const float wy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = wx;
+                y = wy;
+            }
+            out[0] = packSnorm16(x);
+            out[1] = packSnorm16(y);
+        }
+    }
+
     Shape::Shape() :
+        positionScale(1.0f),
         mVertexPositionBuffer(QOpenGLBuffer::VertexBuffer),
         mVertexNormalBuffer(QOpenGLBuffer::VertexBuffer),
         mIndexBuffer(QOpenGLBuffer::IndexBuffer)
     {
     }
 
-    void Shape::prepareVertexBuffers() {
-        mVAO.create();
+    void Shape::prepareVertexBuffers(bool compact) {
+        if (!mVAO.isCreated())
+            mVAO.create();
         mVAO.bind();
 
-        mVertexPositionBuffer.create();
-        mVertexPositionBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        if (!mVertexPositionBuffer.isCreated()) {
+            mVertexPositionBuffer.create();
+            mVertexPositionBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        }
         mVertexPositionBuffer.bind();
-        mVertexPositionBuffer.allocate(&vertices[0], vertices.size() * sizeof(float));
 
-        mVertexNormalBuffer.create();
-        mVertexNormalBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        mVertexNormalBuffer.bind();
-        mVertexNormalBuffer.allocate(&normals[0], normals.size() * sizeof(float));
+        if (!mVertexNormalBuffer.isCreated()) {
+            mVertexNormalBuffer.create();
+            mVertexNormalBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        }
+
+        if (compact) {
+            positionScale = 0.0f;
+            for (size_t i = 0; i < vertices.size(); ++i)
+                positionScale = std::max(positionScale, std::fabs(vertices[i]));
+
+            // 4 components keep every vertex 8-byte aligned
+            const size_t numVertices = vertices.size() / 3;
+            std::vector<short> packedPositions(4 * numVertices, 0);
+            std::vector<short> packedNormals(2 * numVertices);
+            for (size_t i = 0; i < numVertices; ++i) {
+                for (size_t j = 0; j < 3; ++j)
+                    packedPositions[4 * i + j] = packSnorm16(vertices[3 * i + j] / positionScale);
+                octEncode(&normals[3 * i], &packedNormals[2 * i]);
+            }
+
+            gpuBuffers.allocate(mVertexPositionBuffer, &packedPositions[0], packedPositions.size() * sizeof(short),
+                                MemoryTracker::GPU_SHAPE_BUFFERS);
+            mVertexNormalBuffer.bind();
+            gpuBuffers.allocate(mVertexNormalBuffer, &packedNormals[0], packedNormals.size() * sizeof(short),
+                                MemoryTracker::GPU_SHAPE_BUFFERS);
+        }
+        else {
+            positionScale = 1.0f;
+            gpuBuffers.allocate(mVertexPositionBuffer, &vertices[0], vertices.size() * sizeof(float),
+                                MemoryTracker::GPU_SHAPE_BUFFERS);
+            mVertexNormalBuffer.bind();
+            gpuBuffers.allocate(mVertexNormalBuffer, &normals[0], normals.size() * sizeof(float),
+                                MemoryTracker::GPU_SHAPE_BUFFERS);
+        }
 
-        mIndexBuffer.create();
-        mIndexBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        mIndexBuffer.bind();
-        mIndexBuffer.allocate(&indices[0], indices.size() * sizeof(short));
+        if (!mIndexBuffer.isCreated()) {
+            mIndexBuffer.create();
+            mIndexBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+            mIndexBuffer.bind();
+            gpuBuffers.allocate(mIndexBuffer, &indices[0], indices.size() * sizeof(short), MemoryTracker::GPU_SHAPE_BUFFERS);
+        }
 
         mVAO.release();
     }
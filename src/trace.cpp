@@ -0,0 +1,182 @@
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <boost/format.hpp>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace tresta {
+
+    namespace {
+        /**
+         * Stage that ran on one thread.
+         */
+        struct TraceEvent {
+            const char *name;
+            std::string detail;
+            long long startNs;
+            long long durationNs;
+            int thread;
+        };
+
+        QMutex traceMutex;
+        std::vector<TraceEvent> traceEvents;/**<Guarded by `traceMutex`, as are the members below.*/
+        std::string traceFileName;
+        long long traceOriginNs = 0;
+        std::map<Qt::HANDLE, int> threadIndices;
+        std::vector<std::string> threadNames;
+
+        /**
+         * Small number of the calling thread, which reads better in a trace viewer than a native id.
+         * The mutex must be held.
+         */
+        int currentThreadIndex() {
+            const Qt::HANDLE handle = QThread::currentThreadId();
+            std::map<Qt::HANDLE, int>::const_iterator it = threadIndices.find(handle);
+            if (it != threadIndices.end())
+                return it->second;
+
+            const int index = (int) threadNames.size();
+            threadIndices[handle] = index;
+            threadNames.push_back((boost::format("thread %d") % index).str());
+            return index;
+        }
+    }
+
+    std::atomic<bool> Tracer::enabled(false);
+
+    void Tracer::start(const std::string &fileName) {
+        QMutexLocker locker(&traceMutex);
+        traceEvents.clear();
+        traceFileName = fileName;
+        traceOriginNs = now();
+        threadNames[currentThreadIndex()] = "main";
+        enabled = true;
+    }
+
+    void Tracer::startFromEnvironment() {
+        const QByteArray fileName = qgetenv("TRESTA_TRACE");
+        if (fileName.isEmpty())
+            return;
+
+        start(fileName.constData());
+        std::clog << "Tracing load stages to " << fileName.constData() << std::endl;
+    }
+
+    void Tracer::stop() {
+        std::vector<TraceEvent> events;
+        std::vector<std::string> names;
+        std::string fileName;
+        long long originNs;
+        {
+            QMutexLocker locker(&traceMutex);
+            if (!enabled)
+                return;
+            enabled = false;
+            events.swap(traceEvents);
+            names = threadNames;
+            fileName = traceFileName;
+            originNs = traceOriginNs;
+        }
+
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        const qint64 pid = QCoreApplication::applicationPid();
+
+        writer.StartObject();
+        writer.Key("displayTimeUnit");
+        writer.String("ms");
+        writer.Key("traceEvents");
+        writer.StartArray();
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            writer.StartObject();
+            writer.Key("name");
+            writer.String("thread_name");
+            writer.Key("ph");
+            writer.String("M");
+            writer.Key("pid");
+            writer.Int64(pid);
+            writer.Key("tid");
+            writer.Uint64(i);
+            writer.Key("args");
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(names[i].c_str());
+            writer.EndObject();
+            writer.EndObject();
+        }
+
+        // complete events with microsecond times, as the format expects
+        for (size_t i = 0; i < events.size(); ++i) {
+            const TraceEvent &event = events[i];
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(event.name);
+            writer.Key("cat");
+            writer.String("load");
+            writer.Key("ph");
+            writer.String("X");
+            writer.Key("ts");
+            writer.Double((event.startNs - originNs) / 1000.0);
+            writer.Key("dur");
+            writer.Double(event.durationNs / 1000.0);
+            writer.Key("pid");
+            writer.Int64(pid);
+            writer.Key("tid");
+            writer.Int(event.thread);
+            if (!event.detail.empty()) {
+                writer.Key("args");
+                writer.StartObject();
+                writer.Key("detail");
+                writer.String(event.detail.c_str());
+                writer.EndObject();
+            }
+            writer.EndObject();
+        }
+
+        writer.EndArray();
+        writer.EndObject();
+
+        std::ofstream file(fileName.c_str(), std::ios::trunc);
+        file.write(buffer.GetString(), buffer.GetSize());
+        if (!file)
+            throw std::runtime_error((boost::format("Trace %s could not be written.") % fileName).str());
+        std::clog << "Saved " << events.size() << " trace events to " << fileName << std::endl;
+    }
+
+    void Tracer::nameThread(const char *name) {
+        QMutexLocker locker(&traceMutex);
+        threadNames[currentThreadIndex()] = name;
+    }
+
+    long long Tracer::now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Tracer::record(const char *name, const char *detail, long long startNs, long long endNs) {
+        QMutexLocker locker(&traceMutex);
+        if (!enabled)
+            return;
+
+        TraceEvent event;
+        event.name = name;
+        if (detail)
+            event.detail = detail;
+        event.startNs = startNs;
+        event.durationNs = endNs - startNs;
+        event.thread = currentThreadIndex();
+        traceEvents.push_back(event);
+    }
+
+} // namespace tresta
@@ -1,35 +1,139 @@
 #include "truss_scene.h"
 #include <Eigen/Geometry>
-#include <QFileDialog>
-#include <QInputDialog>
-#include <QMessageBox>
-#include "ply_exporter.h"
+#include <QFile>
+#include <QSettings>
+#include <QVector2D>
+#include <cstddef>
+#include <sstream>
 #include "glassert.h"
 #include "setup.h"
+#include "trace.h"
 
 namespace tresta {
 
+    namespace {
+        /**
+         * Adds a shader stage from a resource file. The shared lighting and decoding
+         * code of `common.glsl` is inserted right after the `#version` line.
+         */
+        bool addShaderStage(QOpenGLShaderProgram &program, QOpenGLShader::ShaderType type, const QString &path) {
+            QFile file(path);
+            QFile common(":assets/shaders/common.glsl");
+            if (!file.open(QIODevice::ReadOnly) || !common.open(QIODevice::ReadOnly))
+                return false;
+
+            QByteArray source = file.readAll();
+            source.insert(source.indexOf('\n') + 1, common.readAll());
+            return program.addShaderFromSourceCode(type, source);
+        }
+
+        int boundBufferSize(QOpenGLBuffer &buffer) {
+            if (!buffer.isCreated())
+                return 0;
+            buffer.bind();
+            return std::max(0, buffer.size());
+        }
+
+        /**
+         * Copy of a job to share with snapshots. The node strips are left out; the scene keeps them separately,
+         * since they change with the deformation scale.
+         */
+        std::shared_ptr<const Job> shareJob(const Job &job) {
+            std::shared_ptr<Job> shared = std::make_shared<Job>(job);
+            std::vector<std::vector<Node>>().swap(shared->node_strips);
+            return shared;
+        }
+
+        /**
+         * Bytes of the job's lists, except the node strips, which are counted on their own.
+         */
+        size_t jobBytes(const Job &job) {
+            return vectorBytes(job.nodes) + vectorBytes(job.elems) + vectorBytes(job.displacements) +
+                   vectorBytes(job.colors) + vectorBytes(job.scalars);
+        }
+
+        unsigned short quantize16(float value) {
+            return (unsigned short) std::lround(std::max(0.0f, std::min(1.0f, value)) * 65535.0f);
+        }
+
+        void buildProgram(QOpenGLShaderProgram &program, const QString &vertexPath, const QString &fragmentPath,
+                          const char *name) {
+            TRESTA_TRACE_SCOPE("buildProgram", name);
+            if (!addShaderStage(program, QOpenGLShader::Vertex, vertexPath)) {
+                qCritical() << "Error adding" << name << "vertex shader.";
+            }
+            if (!addShaderStage(program, QOpenGLShader::Fragment, fragmentPath)) {
+                qCritical() << "Error adding" << name << "fragment shader.";
+            }
+            if (!program.link()) {
+                qCritical() << "Error linking" << name << "shader.";
+            }
+        }
+
+        const unsigned int colormapWidth = 256;
+        const int colormapTextureUnit = 3;
+        const int displacementTextureUnit = 4;/**<First of the two units holding the frames around the playhead.*/
+        const int modeTextureUnit = 6;
+        const float deformedRadialScale = 0.99f;/**<Keeps the deformed mesh inside the original where they overlap.*/
+
+        /**
+         * Per-element record of the animated deformed mesh. Every segment instance of the element reads the same record.
+         */
+        struct ElementRecord {
+            GLfloat start[3];
+            GLfloat end[3];
+            GLfloat normal[3];
+            GLuint nodes[2];
+        };
+    }
+
     TrussScene::TrussScene(const Job &_job, QObject *parent)
+            : TrussScene(_job, std::make_shared<ScenePrograms>(), parent) {}
+
+    TrussScene::TrussScene(const Job &_job, std::shared_ptr<ScenePrograms> _programs, QObject *parent)
             : QObject(parent),
-              mSphereShader(),
-              mCylinderShader(),
-              origColorBuffer(QOpenGLBuffer::VertexBuffer),
-              defColorBuffer(QOpenGLBuffer::VertexBuffer),
+              mGLFunc(nullptr),
+              programs(_programs),
+              mSphereShader(_programs->sphere),
+              mCylinderShader(_programs->cylinder),
+              mDepthShader(_programs->depth),
+              mGBufferShader(_programs->gbuffer),
+              mLightingShader(_programs->lighting),
               userColorBuffer(QOpenGLBuffer::VertexBuffer),
-              job(_job),
-              colorDialog(_job.colors.size() > 0, _job.displacements.size() > 0),
+              defUserColorBuffer(QOpenGLBuffer::VertexBuffer),
+              scalarBuffer(QOpenGLBuffer::VertexBuffer),
+              defScalarBuffer(QOpenGLBuffer::VertexBuffer),
+              colormapTexture(0),
+              deformedSegmentsPerElement(0),
+              userColorsOpaque(true),
+              culler(NUM_MESHES),
+              shadingMode(FORWARD_SHADING),
+              viewportWidth(0),
+              viewportHeight(0),
+              job(shareJob(_job)),
+              node_strips(_job.node_strips),
+              scalarStatistics(computeScalarStatistics(_job.scalars)),
               time(0.0f),
               deformation_scale(1.0),
               camera_inertia(0.1f),
               shadersInitialized(false),
               renderOriginal(true),
               renderDeformed(true),
-              displacementsProvided(false) {
+              displacementsProvided(false),
+              cullingEnabled(true),
+              compactAttributes(QSettings("Latture", "Tresta").value("compactAttributes", false).toBool()),
+              trackedJob(MemoryTracker::JOB_DATA, jobBytes(_job)),
+              trackedNodeStrips(MemoryTracker::NODE_STRIPS, vectorBytes(_job.node_strips)),
+              trackedVertexView(MemoryTracker::VERTEX_VIEW),
+              trackedDeformedVertexView(MemoryTracker::DEFORMED_VERTEX_VIEW),
+              trackedDisplacementTextures(MemoryTracker::GPU_DISPLACEMENT_TEXTURES) {
+        TRESTA_TRACE_SCOPE("TrussScene::TrussScene");
         vertexViewColBuffers.resize(4);
 
-        if (job.displacements.size() > 0) {
+        if (job->displacements.size() > 0) {
             displacementsProvided = true;
             defVertexViewColBuffers.resize(4);
+            deformedSegmentsPerElement = node_strips[0].size() - 1;
         }
         else {
             renderDeformed = false;
@@ -51,19 +155,33 @@ namespace tresta {
         sphere.initialize();
         cylinder.initialize();
 
-        vertexViewVector = buildVertexMatrixVector(job.nodes, job.elems, 1.0f, 1.0f);
+        vertexViewVector = std::make_shared<const std::vector<QMatrix4x4>>(
+            buildVertexMatrixVector(job->nodes, job->elems, 1.0f, 1.0f)
+        );
+        trackedVertexView.set(vectorBytes(*vertexViewVector));
+        elementOrder = computeSpatialElementOrder(job->nodes, job->elems);
+
+        for (size_t i = 0; i < job->colors.size(); ++i) {
+            if (job->colors[i].alphaF() < 1.0)
+                userColorsOpaque = false;
+        }
 
         buildDeformedVertexViewVector();
-    }
 
-    void TrussScene::updateOrigColorBuffer() {
-        std::vector<QColor> colors = {colorDialog.getOrigColor()};
-        setColorBuffer(colors, origColorBuffer);
+        if (!job->displacement_frames.empty())
+            playback.setSequence(DisplacementSequence(job->displacement_frames, job->nodes.size()), job->frame_rate);
+
+        if (!job->mode_shapes.empty())
+            modalBasis.setModes(DisplacementSequence(job->mode_shapes, job->nodes.size()), job->mode_frequencies);
     }
 
-    void TrussScene::updateDefColorBuffer() {
-        std::vector<QColor> colors = {colorDialog.getDefColor()};
-        setColorBuffer(colors, defColorBuffer);
+    TrussScene::~TrussScene() {
+        if (!mGLFunc)
+            return;
+
+        if (colormapTexture)
+            mGLFunc->glDeleteTextures(1, &colormapTexture);
+        delete mGLFunc;
     }
 
     void TrussScene::updateTransparencyEnabled(bool state) {
@@ -75,35 +193,68 @@ namespace tresta {
 
     void TrussScene::updateAlphaCutoff(float cutoff) {
         setAlphaCutoff(cutoff, mCylinderShader);
+        setAlphaCutoff(cutoff, mDepthShader);
+        setAlphaCutoff(cutoff, mGBufferShader);
+    }
+
+    void TrussScene::updateScalarColoring() {
+        const int mode = !colorSettings.useScalars ? 0 : job->scalar_location == NODE_SCALARS ? 2 : 1;
+        const float row = (colorSettings.colormap + 0.5f) / colormapNames().size();
+        const QVector2D range(colorSettings.scalarMin, colorSettings.scalarMax);
+
+        // range and colormap changes only touch uniforms; the scalar buffers are uploaded once
+        QOpenGLShaderProgram *shaders[] = {&mCylinderShader, &mGBufferShader};
+        for (int i = 0; i < 2; ++i) {
+            shaders[i]->bind();
+            shaders[i]->setUniformValue("scalarMode", mode);
+            shaders[i]->setUniformValue("scalarRange", range);
+            shaders[i]->setUniformValue("colormapRow", row);
+            shaders[i]->setUniformValue("colormap", colormapTextureUnit);
+        }
     }
 
     void TrussScene::initialize() {
+        TRESTA_TRACE_SCOPE("TrussScene::initialize");
         mGLFunc = new QOpenGLFunctions_3_3_Core();
         mGLFunc->initializeOpenGLFunctions();
+        setRenderState();
+
+        prepareShaders();
+        culler.initialize();
+        playback.initialize(mGLFunc);
+        modalBasis.initialize(mGLFunc);
+        trackedDisplacementTextures.set(playback.gpuBytes() + modalBasis.gpuBytes());
+        prepareVertexBuffers();
+        prepareColormapTexture();
+        setColorSettings(colorSettings);
+        updateCompactUniforms();
+        updateAnimationUniforms();
+        fullscreenVAO.create();
+    }
+
+    void TrussScene::setRenderState() {
         mGLFunc->glEnable(GL_DEPTH_TEST);
         mGLFunc->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        updateTransparencyEnabled(colorDialog.getTransparencyEnabled());
+        updateTransparencyEnabled(colorSettings.transparencyEnabled);
 
         float red = 1.0f;
         float green = 1.0f;
         float blue = 1.0f;
 
         mGLFunc->glClearColor(red, green, blue, 1.0);
-
-        prepareShaders();
-        prepareVertexBuffers();
-
-        connect(&colorDialog, &ColorDialog::origColorChanged, this, &TrussScene::updateOrigColorBuffer);
-        connect(&colorDialog, &ColorDialog::defColorChanged, this, &TrussScene::updateDefColorBuffer);
-        connect(&colorDialog, &ColorDialog::transparencyEnabledChanged, this, &TrussScene::updateTransparencyEnabled);
-        connect(&colorDialog, &ColorDialog::alphaCutoffChanged, this, &TrussScene::updateAlphaCutoff);
+        mGLFunc->glViewport(0, 0, viewportWidth, viewportHeight);
     }
 
     void TrussScene::update(float t) {
-        Q_UNUSED(t);
+        playback.update(t);
+        modalBasis.update(t);
     }
 
     void TrussScene::render() {
+        profiler.beginFrame();
+
+        // painting on top of the frame, e.g. the timing overlay, leaves the context in Qt's default state
+        setRenderState();
         glAssert(mGLFunc->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 
         for (short c = 0; c < 3; ++c) {
@@ -122,24 +273,132 @@ namespace tresta {
         updateModelMatrices(mCylinderShader);
         cylinder.mVAO.bind();
 
-        if (renderDeformed) {
-            bindColBuffer(defVertexViewColBuffers);
-            setVertexColor(defColorBuffer, deformedVertexViewVector.size());
-            mGLFunc->glDrawElementsInstanced(GL_TRIANGLES, cylinder.indices.size(), GL_UNSIGNED_SHORT, 0, deformedVertexViewVector.size());
-            releaseColBuffer(defVertexViewColBuffers);
+        if (colormapTexture) {
+            mGLFunc->glActiveTexture(GL_TEXTURE0 + colormapTextureUnit);
+            mGLFunc->glBindTexture(GL_TEXTURE_2D, colormapTexture);
+            mGLFunc->glActiveTexture(GL_TEXTURE0);
         }
 
-        if (renderOriginal) {
-            bindColBuffer(vertexViewColBuffers);
-            setVertexColor(origColorBuffer, vertexViewVector.size());
-            mGLFunc->glDrawElementsInstanced(GL_TRIANGLES, cylinder.indices.size(), GL_UNSIGNED_SHORT, 0, vertexViewVector.size());
-            releaseColBuffer(vertexViewColBuffers);
+        switch (shadingMode) {
+            case FORWARD_SHADING:
+                drawOpaqueMeshes(mCylinderShader, false);
+                break;
+
+            case DEPTH_PREPASS_SHADING:
+                updateModelMatrices(mDepthShader);
+                mGLFunc->glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                drawOpaqueMeshes(mDepthShader, false);
+                mGLFunc->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+                // depth is final, so only the nearest surface passes and gets lit; LEQUAL rather than EQUAL
+                // tolerates the two programs computing slightly different depths, at the cost of lighting
+                // coplanar or duplicate fragments at the same depth more than once
+                mGLFunc->glDepthFunc(GL_LEQUAL);
+                mGLFunc->glDepthMask(GL_FALSE);
+                mCylinderShader.bind();
+                drawOpaqueMeshes(mCylinderShader, true);
+                mGLFunc->glDepthMask(GL_TRUE);
+                mGLFunc->glDepthFunc(GL_LESS);
+                break;
+
+            case DEFERRED_SHADING: {
+                GLint targetFramebuffer;
+                mGLFunc->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+                drawDeferred(targetFramebuffer);
+                break;
+            }
+
+            default:
+                break;
         }
 
+        mCylinderShader.bind();
+        drawTransparentMeshes();
+
         cylinder.mVAO.release();
         mCylinderShader.release();
 
         glCheckError();
+        profiler.endFrame();
+    }
+
+    void TrussScene::bindInstanceTransforms(QOpenGLShaderProgram &shader, MeshId mesh) {
+        const GLuint startLocation = mCylinderShader.attributeLocation("instanceStart");
+        const GLuint endLocation = mCylinderShader.attributeLocation("instanceEnd");
+        const bool animated = mesh == DEFORMED_MESH && isAnimated();
+
+        bindElementRecords(animated);
+        shader.setUniformValue("animatedInstances", (GLint) animated);
+
+        if (animated) {
+            for (size_t i = 0; i < vertexViewColNames.size(); ++i) {
+                mCylinderShader.disableAttributeArray(vertexViewColNames[i].c_str());
+            }
+            mGLFunc->glDisableVertexAttribArray(startLocation);
+            mGLFunc->glDisableVertexAttribArray(endLocation);
+
+            if (modalBasis.isActive()) {
+                const std::vector<float> &weights = modalBasis.getWeights();
+                modalBasis.bindBasis(modeTextureUnit);
+                shader.setUniformValueArray("modeWeights", &weights[0], (int) weights.size(), 1);
+            }
+            else {
+                playback.bindFrames(displacementTextureUnit);
+                shader.setUniformValue("frameBlend", playback.getBlend());
+            }
+        }
+        else if (compactAttributes) {
+            for (size_t i = 0; i < vertexViewColNames.size(); ++i) {
+                mCylinderShader.disableAttributeArray(vertexViewColNames[i].c_str());
+            }
+
+            (mesh == DEFORMED_MESH ? defEndpointBuffer : endpointBuffer).bind();
+            mGLFunc->glEnableVertexAttribArray(startLocation);
+            mGLFunc->glEnableVertexAttribArray(endLocation);
+            mGLFunc->glVertexAttribPointer(startLocation, 4, GL_UNSIGNED_SHORT, GL_TRUE, 8 * sizeof(GLushort), 0);
+            mGLFunc->glVertexAttribPointer(endLocation, 4, GL_UNSIGNED_SHORT, GL_TRUE, 8 * sizeof(GLushort),
+                                           (const void *) (4 * sizeof(GLushort)));
+            mGLFunc->glVertexAttribDivisor(startLocation, 1);
+            mGLFunc->glVertexAttribDivisor(endLocation, 1);
+
+            shader.setUniformValue("instanceBoundsMin", quantization[mesh].boundsMin);
+            shader.setUniformValue("instanceBoundsExtent", quantization[mesh].boundsExtent);
+        }
+        else {
+            mGLFunc->glDisableVertexAttribArray(startLocation);
+            mGLFunc->glDisableVertexAttribArray(endLocation);
+
+            for (size_t i = 0; i < vertexViewColNames.size(); ++i) {
+                mCylinderShader.enableAttributeArray(vertexViewColNames[i].c_str());
+            }
+            bindColBuffer(mesh == DEFORMED_MESH ? defVertexViewColBuffers : vertexViewColBuffers);
+        }
+    }
+
+    void TrussScene::bindElementRecords(bool enable) {
+        const char *names[] = {"elementStart", "elementEnd", "elementNormal", "elementNodes"};
+        const size_t offsets[] = {offsetof(ElementRecord, start), offsetof(ElementRecord, end),
+                                  offsetof(ElementRecord, normal), offsetof(ElementRecord, nodes)};
+
+        if (enable)
+            animatedElementBuffer.bind();
+
+        for (int i = 0; i < 4; ++i) {
+            const GLuint location = mCylinderShader.attributeLocation(names[i]);
+            if (!enable) {
+                mGLFunc->glDisableVertexAttribArray(location);
+                continue;
+            }
+
+            mGLFunc->glEnableVertexAttribArray(location);
+            if (i == 3)
+                mGLFunc->glVertexAttribIPointer(location, 2, GL_UNSIGNED_INT, sizeof(ElementRecord),
+                                                (const void *) offsets[i]);
+            else
+                mGLFunc->glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(ElementRecord),
+                                               (const void *) offsets[i]);
+            mGLFunc->glVertexAttribDivisor(location, deformedSegmentsPerElement);
+        }
     }
 
     void TrussScene::bindColBuffer(std::vector<QOpenGLBuffer> &colBuffer) {
@@ -150,23 +409,170 @@ namespace tresta {
         }
     }
 
-    void TrussScene::releaseColBuffer(std::vector<QOpenGLBuffer> &colBuffer) {
-        for (size_t i = 0; i < colBuffer.size(); ++i) {
-            colBuffer[i].release();
+    void TrussScene::setVertexColor(const QColor &color, QOpenGLBuffer &userBuffer) {
+        if (usesUserColors()) {
+            const GLuint location = mCylinderShader.attributeLocation("vertexColor");
+            userBuffer.bind();
+            mCylinderShader.enableAttributeArray("vertexColor");
+            if (compactAttributes)
+                mGLFunc->glVertexAttribPointer(location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+            else
+                mCylinderShader.setAttributeArray("vertexColor", GL_FLOAT, 0, 4);
+            mGLFunc->glVertexAttribDivisor(location, 1);
+        }
+        else {
+            // a constant attribute is unaffected by the base instance of culled draws
+            mCylinderShader.disableAttributeArray("vertexColor");
+            mCylinderShader.setAttributeValue("vertexColor", color);
         }
     }
 
-    void TrussScene::setVertexColor(QOpenGLBuffer &colorBuffer, GLuint divisor) {
-        if (colorDialog.getUseUserColors()) {
-                userColorBuffer.bind();
-                mCylinderShader.setAttributeArray("vertexColor", GL_FLOAT, 0, 4);
-                mGLFunc->glVertexAttribDivisor(mCylinderShader.attributeLocation("vertexColor"), divisor/vertexViewVector.size());
+    void TrussScene::setVertexScalar(QOpenGLBuffer &buffer) {
+        if (colorSettings.useScalars) {
+            buffer.bind();
+            mCylinderShader.enableAttributeArray("vertexScalar");
+            mCylinderShader.setAttributeArray("vertexScalar", GL_FLOAT, 0, job->scalar_location == NODE_SCALARS ? 2 : 1);
+            mGLFunc->glVertexAttribDivisor(mCylinderShader.attributeLocation("vertexScalar"), 1);
+        }
+        else {
+            mCylinderShader.disableAttributeArray("vertexScalar");
+        }
+    }
+
+    bool TrussScene::usesUserColors() const {
+        // a scalar field colormap takes precedence over user colors
+        return colorSettings.useUserColors && !colorSettings.useScalars;
+    }
+
+    bool TrussScene::isRendered(MeshId mesh) const {
+        return mesh == DEFORMED_MESH ? renderDeformed : renderOriginal;
+    }
+
+    bool TrussScene::isOpaque(MeshId mesh) const {
+        if (!colorSettings.transparencyEnabled)
+            return true;
+        if (usesUserColors())
+            return userColorsOpaque;
+
+        const QColor &color = mesh == DEFORMED_MESH ? colorSettings.defColor : colorSettings.origColor;
+        return color.alphaF() >= 1.0;
+    }
+
+    bool TrussScene::isCulled(MeshId mesh) const {
+        // with blending enabled only fully opaque meshes may act as occluders;
+        // animated instances move every frame, so their cluster bounds are unknown
+        return cullingEnabled && culler.isSupported() && isRendered(mesh) && isOpaque(mesh) &&
+               !(mesh == DEFORMED_MESH && isAnimated());
+    }
+
+    void TrussScene::drawMesh(QOpenGLShaderProgram &shader, MeshId mesh, DrawPass pass) {
+        const bool deformed = mesh == DEFORMED_MESH;
+
+        bindInstanceTransforms(shader, mesh);
+        setVertexColor(deformed ? colorSettings.defColor : colorSettings.origColor,
+                       deformed ? defUserColorBuffer : userColorBuffer);
+        setVertexScalar(deformed ? defScalarBuffer : scalarBuffer);
+
+        // a depth pre-pass draws the instances the color pass shades again, so only the latter counts them
+        const bool depthOnly = &shader == &mDepthShader;
+        profiler.beginPass(deformed ? FrameProfiler::DEFORMED_PASS : FrameProfiler::ORIGINAL_PASS,
+                           depthOnly ? 0 : (unsigned int) (cylinder.indices.size() / 3));
+        switch (pass) {
+            case ALL_INSTANCES:
+                mGLFunc->glDrawElementsInstanced(GL_TRIANGLES, cylinder.indices.size(), GL_UNSIGNED_SHORT, 0,
+                                                 deformed ? deformedVertexViewVector.size() : vertexViewVector->size());
+                break;
+
+            case CULL_FIRST_PASS:
+                culler.drawFirstPass(mesh);
+                break;
+
+            case CULL_SECOND_PASS:
+                culler.drawSecondPass(mesh);
+                break;
+
+            case CULL_VISIBLE:
+                culler.drawVisible(mesh);
+                break;
+        }
+        profiler.countDrawCalls();
+        profiler.endPass();
+
+        QOpenGLBuffer::release(QOpenGLBuffer::VertexBuffer);
+    }
+
+    void TrussScene::drawOpaqueMeshes(QOpenGLShaderProgram &shader, bool reuseVisibility) {
+        const bool culled[NUM_MESHES] = {isCulled(DEFORMED_MESH), isCulled(ORIGINAL_MESH)};
+
+        // draw last frame's visible clusters, cull the rest against their depth, draw the survivors
+        if (!reuseVisibility && (culled[DEFORMED_MESH] || culled[ORIGINAL_MESH])) {
+            for (int mesh = 0; mesh < NUM_MESHES; ++mesh) {
+                if (culled[mesh])
+                    drawMesh(shader, (MeshId) mesh, CULL_FIRST_PASS);
             }
-            else {
-                colorBuffer.bind();
-                mCylinderShader.setAttributeArray("vertexColor", GL_FLOAT, 0, 4);
-                mGLFunc->glVertexAttribDivisor(mCylinderShader.attributeLocation("vertexColor"), divisor);
+
+            profiler.beginPass(FrameProfiler::CULLING_PASS);
+            culler.buildDepthPyramid();
+            for (int mesh = 0; mesh < NUM_MESHES; ++mesh) {
+                if (culled[mesh])
+                    culler.cull(mesh, projection * modelview);
+            }
+            profiler.endPass();
+
+            shader.bind();
+            for (int mesh = 0; mesh < NUM_MESHES; ++mesh) {
+                if (culled[mesh])
+                    drawMesh(shader, (MeshId) mesh, CULL_SECOND_PASS);
+            }
+        }
+
+        for (int mesh = 0; mesh < NUM_MESHES; ++mesh) {
+            if (culled[mesh]) {
+                if (reuseVisibility)
+                    drawMesh(shader, (MeshId) mesh, CULL_VISIBLE);
             }
+            else if (isRendered((MeshId) mesh) && isOpaque((MeshId) mesh)) {
+                drawMesh(shader, (MeshId) mesh, ALL_INSTANCES);
+            }
+        }
+    }
+
+    void TrussScene::drawTransparentMeshes() {
+        // transparent meshes do not occlude and are drawn last without culling
+        for (int mesh = 0; mesh < NUM_MESHES; ++mesh) {
+            if (isRendered((MeshId) mesh) && !isOpaque((MeshId) mesh))
+                drawMesh(mCylinderShader, (MeshId) mesh, ALL_INSTANCES);
+        }
+    }
+
+    void TrussScene::drawDeferred(GLint targetFramebuffer) {
+        gbuffer.resize(viewportWidth, viewportHeight);
+        gbuffer.bind();
+        glAssert(mGLFunc->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+
+        // the normal target has no alpha to blend with; opaque meshes do not need blending anyway
+        mGLFunc->glDisable(GL_BLEND);
+        updateModelMatrices(mGBufferShader);
+        drawOpaqueMeshes(mGBufferShader, false);
+        updateTransparencyEnabled(colorSettings.transparencyEnabled);
+
+        mGLFunc->glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+        cylinder.mVAO.release();
+
+        // one lit fragment per pixel; the pass also writes the G-buffer depth so transparent meshes are occluded
+        mLightingShader.bind();
+        mLightingShader.setUniformValue("eyePosition", modelview_inv.column(3).toVector3D());
+        gbuffer.bindTextures(0);
+        fullscreenVAO.bind();
+        mGLFunc->glDepthFunc(GL_ALWAYS);
+        profiler.beginPass(FrameProfiler::COMPOSITE_PASS);
+        mGLFunc->glDrawArrays(GL_TRIANGLES, 0, 3);
+        profiler.countDrawCalls();
+        profiler.endPass();
+        mGLFunc->glDepthFunc(GL_LESS);
+        fullscreenVAO.release();
+
+        cylinder.mVAO.bind();
     }
 
     void TrussScene::demo(int frameNumber) {
@@ -183,28 +589,30 @@ namespace tresta {
     }
 
     void TrussScene::resize(int width, int height) {
-        updateProjectionUniforms(width, height, mSphereShader);
-        updateProjectionUniforms(width, height, mCylinderShader);
+        resizeTile(QRect(0, 0, width, height), QSize(width, height));
+    }
+
+    void TrussScene::resizeTile(const QRect &tile, const QSize &imageSize) {
+        const int width = tile.width();
+        const int height = tile.height();
+        updateProjectionUniforms(tile, imageSize, mSphereShader);
+        updateProjectionUniforms(tile, imageSize, mCylinderShader);
+        updateProjectionUniforms(tile, imageSize, mDepthShader);
+        updateProjectionUniforms(tile, imageSize, mGBufferShader);
+        updateProjectionUniforms(tile, imageSize, mLightingShader);
+        mLightingShader.setUniformValue("projection_inv", projection.inverted());
+        mLightingShader.setUniformValue("viewportSize", QVector2D((GLfloat) width, (GLfloat) height));
+
+        // tiles of one image share a size, so the culling targets are only rebuilt for the first
+        if (width != viewportWidth || height != viewportHeight)
+            culler.resize(width, height);
+        viewportWidth = width;
+        viewportHeight = height;
         glAssert(mGLFunc->glViewport(0, 0, width, height));
     }
 
     void TrussScene::handleKeyEvent(int key) {
         switch (key) {
-            case Qt::Key_S:
-                if (displacementsProvided) {
-                    deformation_scale = (float) QInputDialog::getDouble(0, QString("Choose deformation scale"), 0,
-                                                                        (double) deformation_scale, 1.0e-4, 1.0e8, 4);
-                    rebuildNodeStrips();
-                    buildDeformedVertexViewVector();
-                    createVertexViewBuffers(deformedVertexViewVector, defVertexViewColBuffers);
-                }
-                else {
-                    QMessageBox::warning(0, QString("Warning"),
-                                         QString("Cannot select scale.\nNo displacements provided."));
-                }
-
-                break;
-
             case Qt::Key_O:
                 renderOriginal = !renderOriginal;
                 break;
@@ -212,22 +620,62 @@ namespace tresta {
             case Qt::Key_D:
                 if (displacementsProvided)
                     renderDeformed = !renderDeformed;
-                else
-                    QMessageBox::warning(0, QString("Warning"),
-                                         QString("Cannot toggle deformed shape.\nNo displacements provided."));
                 break;
 
-            case Qt::Key_C:
-                colorDialog.show();
+            case Qt::Key_H:
+                if (culler.isSupported())
+                    cullingEnabled = !cullingEnabled;
                 break;
 
-            case Qt::Key_E:
-                try {
-                    exportJob();
-                }
-                catch (const std::exception &e) {
-                    QMessageBox::warning(0, QString("Warning"), QString(e.what()));
-                }
+            case Qt::Key_M:
+                setShadingMode((ShadingMode) ((shadingMode + 1) % NUM_SHADING_MODES));
+                break;
+
+            case Qt::Key_Q:
+                setCompactAttributes(!compactAttributes);
+                break;
+
+            case Qt::Key_Space:
+                playback.setPlaying(!playback.isPlaying());
+                modalBasis.setPlaying(!modalBasis.isPlaying());
+                break;
+
+            case Qt::Key_0:
+                modalBasis.superposeAll();
+                break;
+
+            case Qt::Key_1:
+            case Qt::Key_2:
+            case Qt::Key_3:
+            case Qt::Key_4:
+            case Qt::Key_5:
+            case Qt::Key_6:
+            case Qt::Key_7:
+            case Qt::Key_8:
+            case Qt::Key_9:
+                modalBasis.soloMode(key - Qt::Key_1);
+                break;
+
+            case Qt::Key_Left:
+                playback.setPlaying(false);
+                playback.step(-1);
+                break;
+
+            case Qt::Key_Right:
+                playback.setPlaying(false);
+                playback.step(1);
+                break;
+
+            case Qt::Key_PageUp:
+                playback.step(-std::max((int) playback.frameCount() / 10, 1));
+                break;
+
+            case Qt::Key_PageDown:
+                playback.step(std::max((int) playback.frameCount() / 10, 1));
+                break;
+
+            case Qt::Key_Home:
+                playback.seek(0.0f);
                 break;
 
             default:
@@ -250,16 +698,124 @@ namespace tresta {
         camera_trans[2] += (((float) dy) / 100.0f) * 0.5f * std::fabs(camera_trans[2]);
     }
 
+    void TrussScene::setCameraView(const QVector3D &rotation, float distance) {
+        setCamera(0.0f, 0.0f, camera_z0 * distance, rotation.x(), rotation.y(), rotation.z());
+    }
+
+    TrussScene::ViewState TrussScene::getViewState() const {
+        ViewState state;
+        state.translation = camera_trans;
+        state.rotation = camera_rot;
+        state.deformationScale = deformation_scale;
+        state.shadingMode = shadingMode;
+        state.renderOriginal = renderOriginal;
+        state.renderDeformed = renderDeformed;
+        state.cullingEnabled = cullingEnabled;
+        state.compactAttributes = compactAttributes;
+        return state;
+    }
+
+    void TrussScene::setViewState(const ViewState &state) {
+        setCamera(state.translation.x(), state.translation.y(), state.translation.z(),
+                  state.rotation.x(), state.rotation.y(), state.rotation.z());
+        setShadingMode(state.shadingMode);
+        setCompactAttributes(state.compactAttributes);
+        renderOriginal = state.renderOriginal;
+        if (displacementsProvided) {
+            renderDeformed = state.renderDeformed;
+            if (state.deformationScale != deformation_scale)
+                setDeformationScale(state.deformationScale);
+        }
+        if (culler.isSupported())
+            cullingEnabled = state.cullingEnabled;
+    }
+
     void TrussScene::setDeformationScale(float scale) {
         deformation_scale = scale;
         rebuildNodeStrips();
         buildDeformedVertexViewVector();
+
+        // animated instances scale the displacements in the vertex shader
+        if (isAnimated())
+            updateAnimationUniforms();
+        else
+            uploadDeformedInstances();
     }
 
     float TrussScene::getDeformationScale() const {
         return deformation_scale;
     }
 
+    void TrussScene::setColorSettings(const ColorSettings &settings) {
+        colorSettings = settings;
+        if (!shadersInitialized)
+            return;
+
+        updateTransparencyEnabled(colorSettings.transparencyEnabled);
+        updateAlphaCutoff(colorSettings.alphaCutoff);
+        updateScalarColoring();
+    }
+
+    const ScalarStatistics &TrussScene::getScalarStatistics() const {
+        return scalarStatistics;
+    }
+
+    SceneSnapshot TrussScene::getSnapshot() {
+        SceneSnapshot snapshot;
+        snapshot.job = job;
+        snapshot.vertexViewVector = vertexViewVector;
+
+        if (isAnimated()) {
+            // export the displacements on screen rather than the first frame or mode
+            const std::vector<Displacement> displacements = modalBasis.isActive() ?
+                    modalBasis.getDisplacements() :
+                    playback.getSequence().readDisplacements(playback.getDisplayedFrame());
+            snapshot.deformedVertexViewVector = buildStripMatrixVector(
+                createNodeStrips(job->nodes, job->elems, displacements, deformation_scale)
+            );
+        }
+        else {
+            snapshot.deformedVertexViewVector = deformedVertexViewVector;
+        }
+        return snapshot;
+    }
+
+    bool TrussScene::isCullingSupported() const {
+        return culler.isSupported();
+    }
+
+    void TrussScene::setShadingMode(ShadingMode mode) {
+        shadingMode = mode;
+    }
+
+    TrussScene::ShadingMode TrussScene::getShadingMode() const {
+        return shadingMode;
+    }
+
+    void TrussScene::setCompactAttributes(bool compact) {
+        if (compact == compactAttributes)
+            return;
+
+        compactAttributes = compact;
+        QSettings("Latture", "Tresta").setValue("compactAttributes", compactAttributes);
+
+        cylinder.prepareVertexBuffers(compactAttributes);
+        setShapeAttributes();
+        uploadInstanceTransforms(ORIGINAL_MESH);
+        if (displacementsProvided)
+            uploadInstanceTransforms(DEFORMED_MESH);
+        uploadColorBuffers();
+        updateCompactUniforms();
+    }
+
+    bool TrussScene::getCompactAttributes() const {
+        return compactAttributes;
+    }
+
+    FrameProfiler &TrussScene::getProfiler() {
+        return profiler;
+    }
+
     void TrussScene::setCamera(float tx, float ty, float tz, float rx, float ry, float rz) {
         camera_trans[0] = camera_trans_lag[0] = tx;
         camera_trans[1] = camera_trans_lag[1] = ty;
@@ -289,6 +845,7 @@ namespace tresta {
                                                                 const std::vector<Elem> &elems,
                                                                 float x_scale_multiplier,
                                                                 float z_scale_multiplier) {
+        TRESTA_TRACE_SCOPE("TrussScene::buildVertexMatrixVector");
         std::vector<QMatrix4x4> vector_out;
         vector_out.reserve(elems.size());
         int nn1, nn2;
@@ -332,41 +889,51 @@ namespace tresta {
     }
 
     void TrussScene::buildDeformedVertexViewVector() {
-        deformedVertexViewVector.clear();
+        TRESTA_TRACE_SCOPE("TrussScene::buildDeformedVertexViewVector");
+        deformedVertexViewVector = buildStripMatrixVector(node_strips);
+        trackedDeformedVertexView.set(vectorBytes(deformedVertexViewVector));
+    }
+
+    std::vector<QMatrix4x4> TrussScene::buildStripMatrixVector(const std::vector<std::vector<Node>> &node_strips) {
+        std::vector<QMatrix4x4> vector_out;
         std::vector<QMatrix4x4> strip_matrices;
-        if (job.node_strips.size() > 0) {
-            const size_t num_interp_points = job.node_strips[0].size();
-            deformedVertexViewVector.reserve(job.node_strips.size() * num_interp_points);
+        if (node_strips.size() > 0) {
+            const size_t num_interp_points = node_strips[0].size();
+            vector_out.reserve(node_strips.size() * num_interp_points);
             std::vector<Elem> def_elems(num_interp_points - 1);
 
             for (size_t i = 0; i < def_elems.size(); ++i) {
                 def_elems[i].node_numbers << i, i + 1;
             }
 
-            for (size_t i = 0; i < job.node_strips.size(); ++i) {
-                strip_matrices = buildVertexMatrixVector(job.node_strips[i], def_elems, 0.99, 0.99);
-                deformedVertexViewVector.insert(std::end(deformedVertexViewVector), std::begin(strip_matrices), std::end(strip_matrices));
+            for (size_t i = 0; i < node_strips.size(); ++i) {
+                strip_matrices = buildVertexMatrixVector(node_strips[i], def_elems, deformedRadialScale,
+                                                         deformedRadialScale);
+                vector_out.insert(std::end(vector_out), std::begin(strip_matrices), std::end(strip_matrices));
             }
         }
+        return vector_out;
     }
 
     void TrussScene::rebuildNodeStrips() {
-        if (job.displacements.size() > 0)
-            job.node_strips = createNodeStrips(job.nodes, job.elems, job.displacements, deformation_scale);
+        if (job->displacements.size() > 0)
+            node_strips = createNodeStrips(job->nodes, job->elems, job->displacements, deformation_scale);
+        trackedNodeStrips.set(vectorBytes(node_strips));
     }
 
     void TrussScene::calcCenteringShift() {
+        TRESTA_TRACE_SCOPE("TrussScene::calcCenteringShift");
         float max_val = std::numeric_limits<float>::max();
         float min_val = std::numeric_limits<float>::lowest();
         global_max_pos << min_val, min_val, min_val;
         global_min_pos << max_val, max_val, max_val;
-        for (size_t i = 0; i < job.nodes.size(); ++i) {
-            for (size_t j = 0; j < job.nodes[i].size(); ++j) {
-                if (job.nodes[i][j] > global_max_pos[j]) {
-                    global_max_pos[j] = job.nodes[i][j];
+        for (size_t i = 0; i < job->nodes.size(); ++i) {
+            for (size_t j = 0; j < job->nodes[i].size(); ++j) {
+                if (job->nodes[i][j] > global_max_pos[j]) {
+                    global_max_pos[j] = job->nodes[i][j];
                 }
-                if (job.nodes[i][j] < global_min_pos[j]) {
-                    global_min_pos[j] = job.nodes[i][j];
+                if (job->nodes[i][j] < global_min_pos[j]) {
+                    global_min_pos[j] = job->nodes[i][j];
                 }
             }
         }
@@ -374,44 +941,24 @@ namespace tresta {
         global_centering_shift /= 2.0f;
     }
 
-    void TrussScene::exportJob() {
-        QString fileName = QFileDialog::getSaveFileName(0, tr("Export the current mesh"),
-                                                        "mesh.ply", tr("PLY (*.ply)"));
-        if (!fileName.isEmpty()) {
-            PlyExporter exporter;
-            exporter.exportPly(fileName, QString("Original mesh"), &cylinder, job, vertexViewVector);
-
-            if (displacementsProvided) {
-                QStringList qsl = fileName.split('.');
-                QString defFileName("");
-                for (int i = 0; i < qsl.size() - 1; ++i)
-                    defFileName += qsl[0];
-                defFileName += QString("_deformed.") + qsl[qsl.size() - 1];
-                exporter.exportPly(defFileName, QString("Deformed mesh"), &cylinder, job, deformedVertexViewVector);
-            }
-        }
-    }
-
     void TrussScene::prepareShaders() {
-        if (!mSphereShader.addShaderFromSourceFile(QOpenGLShader::Vertex, ":assets/shaders/blinn.vert")) {
-            qCritical() << "Error adding sphere vertex shader.";
-        }
-
-        if (!mSphereShader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":assets/shaders/blinn.frag")) {
-            qCritical() << "Error adding sphere fragment shader.";
-        }
-        if (!mSphereShader.link()) {
-            qCritical() << "Error linking sphere shader.";
-        }
-
-        if (!mCylinderShader.addShaderFromSourceFile(QOpenGLShader::Vertex, ":assets/shaders/blinn.vert")) {
-            qCritical() << "Error adding cylinder vertex shader.";
-        }
-        if (!mCylinderShader.addShaderFromSourceFile(QOpenGLShader::Fragment, ":assets/shaders/blinn.frag")) {
-            qCritical() << "Error adding cylinder fragment shader.";
-        }
-        if (!mCylinderShader.link()) {
-            qCritical() << "Error linking cylinder shader.";
+        TRESTA_TRACE_SCOPE("TrussScene::prepareShaders");
+        // every uniform a scene depends on is set again on initialization, so shared programs are only built once
+        if (!programs->linked) {
+            buildProgram(mSphereShader, ":assets/shaders/blinn.vert", ":assets/shaders/blinn.frag", "sphere");
+            buildProgram(mCylinderShader, ":assets/shaders/blinn.vert", ":assets/shaders/blinn.frag", "cylinder");
+
+            // the pass programs share blinn.vert, whose explicit attribute locations let them reuse the cylinder VAO
+            buildProgram(mDepthShader, ":assets/shaders/blinn.vert", ":assets/shaders/depth_only.frag", "depth");
+            buildProgram(mGBufferShader, ":assets/shaders/blinn.vert", ":assets/shaders/gbuffer.frag", "G-buffer");
+            buildProgram(mLightingShader, ":assets/shaders/fullscreen.vert", ":assets/shaders/deferred_lighting.frag",
+                         "deferred lighting");
+
+            mLightingShader.bind();
+            mLightingShader.setUniformValue("colorTexture", 0);
+            mLightingShader.setUniformValue("normalTexture", 1);
+            mLightingShader.setUniformValue("depthTexture", 2);
+            programs->linked = true;
         }
 
         glCheckError();
@@ -419,25 +966,178 @@ namespace tresta {
         shadersInitialized = true;
     }
 
-    void TrussScene::createVertexViewBuffers(const std::vector<QMatrix4x4>& viewVector, std::vector<QOpenGLBuffer>& viewBuffers) {
+    void TrussScene::packVertexViewColumn(const std::vector<QMatrix4x4>& viewVector,
+                                          size_t column,
+                                          unsigned int instancesPerElement,
+                                          std::vector<float>& viewColVector) const {
+        size_t src;
+
+        // instances are stored in spatial element order so culling clusters are contiguous
+        for (size_t i = 0; i < viewVector.size(); ++i) {
+            src = elementOrder[i / instancesPerElement] * instancesPerElement + i % instancesPerElement;
+            for (size_t j = 0; j < 4; ++j) {
+                viewColVector[4*i + j] = viewVector[src](j, column);
+            }
+        }
+    }
+
+    void TrussScene::createVertexViewBuffers(const std::vector<QMatrix4x4>& viewVector,
+                                             std::vector<QOpenGLBuffer>& viewBuffers,
+                                             unsigned int instancesPerElement) {
         std::vector<float> viewColVector(4*viewVector.size());
+        TrackedBytes staging(MemoryTracker::UPLOAD_STAGING, vectorBytes(viewColVector));
+        const MemoryTracker::Subsystem subsystem = &viewBuffers == &defVertexViewColBuffers ?
+                                                   MemoryTracker::GPU_DEFORMED_INSTANCE_BUFFERS :
+                                                   MemoryTracker::GPU_INSTANCE_BUFFERS;
 
         for (size_t k = 0; k < viewBuffers.size(); ++k) {
-            for (size_t i = 0; i < viewVector.size(); ++i) {
-                for (size_t j = 0; j < 4; ++j) {
-                    viewColVector[4*i + j] = viewVector[i](j, k);
-                }
-            }
+            packVertexViewColumn(viewVector, k, instancesPerElement, viewColVector);
             if (!viewBuffers[k].isCreated()) {
                 viewBuffers[k].create();
                 viewBuffers[k].setUsagePattern(QOpenGLBuffer::StaticDraw);
             }
             viewBuffers[k].bind();
-            viewBuffers[k].allocate(&viewColVector[0], viewColVector.size() * sizeof(float));
+            gpuBuffers.allocate(viewBuffers[k], &viewColVector[0], viewColVector.size() * sizeof(float), subsystem);
+        }
+    }
+
+    void TrussScene::createEndpointBuffer(const std::vector<QMatrix4x4>& viewVector,
+                                          QOpenGLBuffer &buffer,
+                                          unsigned int instancesPerElement,
+                                          InstanceQuantization &instanceQuantization) {
+        // undo the z mirror of buildVertexMatrix to recover both ends of every instance
+        const QVector3D mirror(1.0f, 1.0f, -1.0f);
+        std::vector<QVector3D> starts(viewVector.size());
+        std::vector<QVector3D> ends(viewVector.size());
+        QVector3D boundsMin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                            std::numeric_limits<float>::max());
+        QVector3D boundsMax = -boundsMin;
+
+        for (size_t i = 0; i < viewVector.size(); ++i) {
+            starts[i] = mirror * viewVector[i].column(3).toVector3D();
+            ends[i] = starts[i] + mirror * viewVector[i].column(1).toVector3D();
+            for (int j = 0; j < 3; ++j) {
+                boundsMin[j] = std::min(boundsMin[j], std::min(starts[i][j], ends[i][j]));
+                boundsMax[j] = std::max(boundsMax[j], std::max(starts[i][j], ends[i][j]));
+            }
+        }
+
+        QVector3D extent = boundsMax - boundsMin;
+        for (int j = 0; j < 3; ++j) {
+            if (extent[j] <= 0.0f)
+                extent[j] = 1.0f;
+        }
+        instanceQuantization.boundsMin = boundsMin;
+        instanceQuantization.boundsExtent = extent;
+
+        // [start.xyz, radial scale], [end.xyz, unused] as normalized shorts, in cluster order
+        std::vector<GLushort> packed(8 * viewVector.size(), 0);
+        TrackedBytes staging(MemoryTracker::UPLOAD_STAGING,
+                             vectorBytes(starts) + vectorBytes(ends) + vectorBytes(packed));
+        QVector3D start, end;
+        size_t src;
+        for (size_t i = 0; i < viewVector.size(); ++i) {
+            src = elementOrder[i / instancesPerElement] * instancesPerElement + i % instancesPerElement;
+            start = starts[src] - boundsMin;
+            end = ends[src] - boundsMin;
+            for (int j = 0; j < 3; ++j) {
+                packed[8 * i + j] = quantize16(start[j] / extent[j]);
+                packed[8 * i + 4 + j] = quantize16(end[j] / extent[j]);
+            }
+            packed[8 * i + 3] = quantize16(viewVector[src].column(0).toVector3D().length());
+        }
+
+        if (!buffer.isCreated()) {
+            buffer.create();
+            buffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        }
+        buffer.bind();
+        gpuBuffers.allocate(buffer, &packed[0], packed.size() * sizeof(GLushort),
+                            &buffer == &defEndpointBuffer ? MemoryTracker::GPU_DEFORMED_INSTANCE_BUFFERS :
+                                                            MemoryTracker::GPU_INSTANCE_BUFFERS);
+    }
+
+    void TrussScene::uploadInstanceTransforms(MeshId mesh) {
+        TRESTA_TRACE_SCOPE("TrussScene::uploadInstanceTransforms");
+        const bool deformed = mesh == DEFORMED_MESH;
+        const std::vector<QMatrix4x4> &viewVector = deformed ? deformedVertexViewVector : *vertexViewVector;
+        std::vector<QOpenGLBuffer> &colBuffers = deformed ? defVertexViewColBuffers : vertexViewColBuffers;
+        QOpenGLBuffer &endpoints = deformed ? defEndpointBuffer : endpointBuffer;
+        const unsigned int instancesPerElement = deformed ? deformedSegmentsPerElement : 1;
+
+        // only one encoding is kept in video memory; animated instances need neither
+        if (deformed && isAnimated()) {
+            createElementBuffer();
+            gpuBuffers.destroy(endpoints);
+            for (size_t i = 0; i < colBuffers.size(); ++i)
+                gpuBuffers.destroy(colBuffers[i]);
+        }
+        else if (compactAttributes) {
+            createEndpointBuffer(viewVector, endpoints, instancesPerElement, quantization[mesh]);
+            for (size_t i = 0; i < colBuffers.size(); ++i)
+                gpuBuffers.destroy(colBuffers[i]);
+        }
+        else {
+            createVertexViewBuffers(viewVector, colBuffers, instancesPerElement);
+            gpuBuffers.destroy(endpoints);
         }
     }
 
+    void TrussScene::uploadDeformedInstances() {
+        TRESTA_TRACE_SCOPE("TrussScene::uploadDeformedInstances");
+        uploadInstanceTransforms(DEFORMED_MESH);
+        if (!isAnimated())
+            culler.setInstances(DEFORMED_MESH, cylinder, deformedVertexViewVector, elementOrder,
+                                deformedSegmentsPerElement);
+    }
+
+    void TrussScene::createElementBuffer() {
+        if (animatedElementBuffer.isCreated())
+            return;
+
+        std::vector<ElementRecord> records(elementOrder.size());
+        Node start, end;
+        for (size_t i = 0; i < records.size(); ++i) {
+            const Elem &elem = job->elems[elementOrder[i]];
+            start = job->nodes[elem.node_numbers[0]] - global_centering_shift;
+            end = job->nodes[elem.node_numbers[1]] - global_centering_shift;
+            for (int j = 0; j < 3; ++j) {
+                records[i].start[j] = start(j);
+                records[i].end[j] = end(j);
+                records[i].normal[j] = elem.props.normal_vec(j);
+            }
+            records[i].nodes[0] = (GLuint) elem.node_numbers[0];
+            records[i].nodes[1] = (GLuint) elem.node_numbers[1];
+        }
+
+        animatedElementBuffer.create();
+        animatedElementBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        animatedElementBuffer.bind();
+        gpuBuffers.allocate(animatedElementBuffer, &records[0], records.size() * sizeof(ElementRecord),
+                            MemoryTracker::GPU_DEFORMED_INSTANCE_BUFFERS);
+    }
+
     void TrussScene::setColorBuffer(const std::vector<QColor> &colors, QOpenGLBuffer &buffer) {
+        if (!buffer.isCreated()) {
+            buffer.create();
+            buffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+        }
+        buffer.bind();
+
+        if (compactAttributes) {
+            std::vector<GLubyte> colorVector(4 * colors.size());
+
+            for (size_t i = 0; i < colors.size(); ++i) {
+                colorVector[4 * i + 0] = (GLubyte) colors[i].red();
+                colorVector[4 * i + 1] = (GLubyte) colors[i].green();
+                colorVector[4 * i + 2] = (GLubyte) colors[i].blue();
+                colorVector[4 * i + 3] = (GLubyte) colors[i].alpha();
+            }
+            gpuBuffers.allocate(buffer, &colorVector[0], colorVector.size() * sizeof(GLubyte),
+                                MemoryTracker::GPU_ATTRIBUTE_BUFFERS);
+            return;
+        }
+
         std::vector<float> colorVector(4 * colors.size());
 
         for (size_t i = 0; i < colors.size(); ++i) {
@@ -447,49 +1147,189 @@ namespace tresta {
             colorVector[4 * i + 3] = colors[i].alphaF();
         }
 
+        gpuBuffers.allocate(buffer, &colorVector[0], colorVector.size() * sizeof(float),
+                            MemoryTracker::GPU_ATTRIBUTE_BUFFERS);
+    }
+
+    void TrussScene::setUserColorBuffer(unsigned int instancesPerElement, QOpenGLBuffer &buffer) {
+        std::vector<QColor> instanceColors(elementOrder.size() * instancesPerElement);
+
+        for (size_t i = 0; i < instanceColors.size(); ++i) {
+            instanceColors[i] = job->colors[elementOrder[i / instancesPerElement]];
+        }
+        setColorBuffer(instanceColors, buffer);
+    }
+
+    void TrussScene::setScalarBuffer(unsigned int instancesPerElement, QOpenGLBuffer &buffer) {
+        const bool perNode = job->scalar_location == NODE_SCALARS;
+        const size_t numInstances = elementOrder.size() * instancesPerElement;
+        std::vector<float> instanceScalars(perNode ? 2 * numInstances : numInstances);
+        unsigned int elem, segment;
+        float value1, value2;
+
+        for (size_t i = 0; i < numInstances; ++i) {
+            elem = elementOrder[i / instancesPerElement];
+            if (perNode) {
+                // values at both ends of the segment covered by this instance
+                segment = i % instancesPerElement;
+                value1 = job->scalars[job->elems[elem].node_numbers[0]];
+                value2 = job->scalars[job->elems[elem].node_numbers[1]];
+                instanceScalars[2 * i + 0] = value1 + (value2 - value1) * segment / instancesPerElement;
+                instanceScalars[2 * i + 1] = value1 + (value2 - value1) * (segment + 1) / instancesPerElement;
+            }
+            else {
+                instanceScalars[i] = job->scalars[elem];
+            }
+        }
+
         if (!buffer.isCreated()) {
             buffer.create();
-            buffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+            buffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
         }
 
         buffer.bind();
-        buffer.allocate(&colorVector[0], colorVector.size() * sizeof(float));
+        gpuBuffers.allocate(buffer, &instanceScalars[0], instanceScalars.size() * sizeof(float),
+                            MemoryTracker::GPU_ATTRIBUTE_BUFFERS);
     }
 
-    void TrussScene::prepareVertexBuffers() {
-
-        createVertexViewBuffers(vertexViewVector, vertexViewColBuffers);
-        std::vector<QColor> origColorVec = {colorDialog.getOrigColor()};
-        setColorBuffer(origColorVec, origColorBuffer);
-
-        if (displacementsProvided) {
-            createVertexViewBuffers(deformedVertexViewVector, defVertexViewColBuffers);
-            std::vector<QColor> defColorVec = {colorDialog.getDefColor()};
-            setColorBuffer(defColorVec, defColorBuffer);
-        }
+    void TrussScene::prepareColormapTexture() {
+        if (job->scalars.empty())
+            return;
+
+        const std::vector<unsigned char> texels = buildColormapTexels(colormapWidth);
+
+        mGLFunc->glGenTextures(1, &colormapTexture);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, colormapTexture);
+        mGLFunc->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, colormapWidth, colormapNames().size(), 0,
+                              GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        mGLFunc->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        mGLFunc->glBindTexture(GL_TEXTURE_2D, 0);
+        glCheckError();
+    }
 
-        // if user colors provided, create buffer and set data
-        if (job.colors.size() > 0) {
-            setColorBuffer(job.colors, userColorBuffer);
+    void TrussScene::uploadColorBuffers() {
+        TRESTA_TRACE_SCOPE("TrussScene::uploadColorBuffers");
+        // if user colors provided, create per-instance buffers in instance order
+        if (job->colors.size() > 0) {
+            setUserColorBuffer(1, userColorBuffer);
+            if (displacementsProvided)
+                setUserColorBuffer(deformedSegmentsPerElement, defUserColorBuffer);
         }
+    }
 
-        cylinder.prepareVertexBuffers();
-
+    void TrussScene::setShapeAttributes() {
         cylinder.mVAO.bind();
-        mCylinderShader.bind();
 
         cylinder.mVertexPositionBuffer.bind();
         mCylinderShader.enableAttributeArray("vertexPosition");
-        mCylinderShader.setAttributeBuffer("vertexPosition", GL_FLOAT, 0, 3);
+        if (compactAttributes)
+            mGLFunc->glVertexAttribPointer(mCylinderShader.attributeLocation("vertexPosition"), 4, GL_SHORT, GL_TRUE, 0, 0);
+        else
+            mCylinderShader.setAttributeBuffer("vertexPosition", GL_FLOAT, 0, 3);
 
         cylinder.mVertexNormalBuffer.bind();
         mCylinderShader.enableAttributeArray("vertexNormal");
-        mCylinderShader.setAttributeBuffer("vertexNormal", GL_FLOAT, 0, 3);
+        if (compactAttributes)
+            mGLFunc->glVertexAttribPointer(mCylinderShader.attributeLocation("vertexNormal"), 2, GL_SHORT, GL_TRUE, 0, 0);
+        else
+            mCylinderShader.setAttributeBuffer("vertexNormal", GL_FLOAT, 0, 3);
+
+        cylinder.mVAO.release();
+    }
+
+    void TrussScene::updateCompactUniforms() {
+        QOpenGLShaderProgram *shaders[] = {&mCylinderShader, &mDepthShader, &mGBufferShader};
+        for (int i = 0; i < 3; ++i) {
+            shaders[i]->bind();
+            shaders[i]->setUniformValue("compactAttributes", (GLint) compactAttributes);
+            shaders[i]->setUniformValue("vertexPositionScale", cylinder.positionScale);
+        }
+    }
+
+    bool TrussScene::isAnimated() const {
+        return playback.isActive() || modalBasis.isActive();
+    }
+
+    void TrussScene::updateAnimationUniforms() {
+        if (!isAnimated())
+            return;
+
+        QOpenGLShaderProgram *shaders[] = {&mCylinderShader, &mDepthShader, &mGBufferShader};
+        for (int i = 0; i < 3; ++i) {
+            shaders[i]->bind();
+            shaders[i]->setUniformValue("displacementFrames[0]", displacementTextureUnit);
+            shaders[i]->setUniformValue("displacementFrames[1]", displacementTextureUnit + 1);
+            shaders[i]->setUniformValue("segmentsPerElement", (GLint) deformedSegmentsPerElement);
+            shaders[i]->setUniformValue("animatedRadialScale", deformedRadialScale);
+            shaders[i]->setUniformValue("deformationScale", deformation_scale);
+            shaders[i]->setUniformValue("modalInstances", (GLint) modalBasis.isActive());
+            shaders[i]->setUniformValue("modeShapes", modeTextureUnit);
+            shaders[i]->setUniformValue("modeCount", (GLint) modalBasis.modeCount());
+            shaders[i]->setUniformValue("modeStride", (GLint) modalBasis.modeStride());
+        }
+    }
+
+    std::string TrussScene::gpuMemorySummary() {
+        QOpenGLBuffer *instanceBuffers[] = {&endpointBuffer, &defEndpointBuffer, &userColorBuffer, &defUserColorBuffer,
+                                            &scalarBuffer, &defScalarBuffer, &animatedElementBuffer};
+        size_t instanceBytes = 0;
+        for (size_t i = 0; i < sizeof(instanceBuffers) / sizeof(instanceBuffers[0]); ++i)
+            instanceBytes += boundBufferSize(*instanceBuffers[i]);
+        for (size_t i = 0; i < vertexViewColBuffers.size(); ++i)
+            instanceBytes += boundBufferSize(vertexViewColBuffers[i]);
+        for (size_t i = 0; i < defVertexViewColBuffers.size(); ++i)
+            instanceBytes += boundBufferSize(defVertexViewColBuffers[i]);
+        QOpenGLBuffer::release(QOpenGLBuffer::VertexBuffer);
+
+        const size_t shapeBytes = boundBufferSize(cylinder.mVertexPositionBuffer) +
+                                  boundBufferSize(cylinder.mVertexNormalBuffer);
+        QOpenGLBuffer::release(QOpenGLBuffer::VertexBuffer);
+
+        const size_t numInstances = vertexViewVector->size() + (displacementsProvided ? deformedVertexViewVector.size() : 0);
+        std::ostringstream summary;
+        summary << (compactAttributes ? "Compact" : "Full") << " attribute encoding: "
+                << (double) instanceBytes / std::max(numInstances, (size_t) 1) << " bytes per instance, "
+                << instanceBytes / 1048576.0 << " MiB for " << numInstances << " instances, "
+                << shapeBytes << " bytes of shape vertices" << std::endl;
+
+        if (playback.isActive())
+            summary << "Displacement frame ring: " << playback.gpuBytes() / 1048576.0 << " MiB for "
+                    << playback.frameCount() << " frames" << std::endl;
+
+        if (modalBasis.isActive())
+            summary << "Modal basis: " << modalBasis.gpuBytes() / 1048576.0 << " MiB for "
+                    << modalBasis.modeCount() << " modes" << std::endl;
+        return summary.str();
+    }
+
+    void TrussScene::prepareVertexBuffers() {
+        TRESTA_TRACE_SCOPE("TrussScene::prepareVertexBuffers");
+
+        cylinder.prepareVertexBuffers(compactAttributes);
 
-        for (size_t i = 0; i < vertexViewColNames.size(); ++i) {
-            mCylinderShader.enableAttributeArray(vertexViewColNames[i].c_str());
+        uploadInstanceTransforms(ORIGINAL_MESH);
+        culler.setInstances(ORIGINAL_MESH, cylinder, *vertexViewVector, elementOrder, 1);
+
+        if (displacementsProvided) {
+            uploadDeformedInstances();
+        }
+
+        uploadColorBuffers();
+
+        // scalar fields cost one float per instance, two when given per node
+        if (job->scalars.size() > 0) {
+            setScalarBuffer(1, scalarBuffer);
+            if (displacementsProvided)
+                setScalarBuffer(deformedSegmentsPerElement, defScalarBuffer);
         }
 
+
+        setShapeAttributes();
+
+        cylinder.mVAO.bind();
         mCylinderShader.enableAttributeArray("vertexColor");
         cylinder.mVAO.release();
         glCheckError();
@@ -500,16 +1340,26 @@ namespace tresta {
 
         shader.bind();
         shader.setUniformValue("modelview", modelview);
-        shader.setUniformValue("modelview_inv", modelview.inverted());
+        shader.setUniformValue("modelview_inv", modelview_inv);
         shader.setUniformValue("modelnormal", modelnormal);
+        shader.setUniformValue("eyePosition", modelview_inv.column(3).toVector3D());
     }
 
-    void TrussScene::updateProjectionUniforms(int w, int h, QOpenGLShaderProgram &shader) {
+    void TrussScene::updateProjectionUniforms(const QRect &tile, const QSize &imageSize, QOpenGLShaderProgram &shader) {
         assert(shadersInitialized);
 
+        // the 60 degree perspective of the whole image, cut down to the tile; equal to it for the whole image
+        const float nearPlane = 0.01f;
+        const float top = nearPlane * std::tan(30.0f * 3.14159265358979323846f / 180.0f);
+        const float right = top * (float) imageSize.width() / (float) imageSize.height();
+        const float xScale = 2.0f * right / imageSize.width();
+        const float yScale = 2.0f * top / imageSize.height();
+
         shader.bind();
         projection.setToIdentity();
-        projection.perspective(60.0f, (float) w / (float) h, 0.01, 1000.0);
+        projection.frustum(-right + xScale * tile.left(), -right + xScale * (tile.left() + tile.width()),
+                           top - yScale * (tile.top() + tile.height()), top - yScale * tile.top(),
+                           nearPlane, 1000.0f);
         shader.setUniformValue("projection", projection);
     }
 
@@ -1,37 +1,44 @@
 #include "window.h"
 
+#include <QCoreApplication>
+#include <QExposeEvent>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QInputDialog>
 #include <QMouseEvent>
-#include <QOpenGLContext>
-#include <QTimer>
 #include <QMessageBox>
-#include <QScreen>
-#include <QtWidgets/qfiledialog.h>
+#include <cstdlib>
 
-#include "glassert.h"
+#include "gltf_exporter.h"
+#include "memory_tracker.h"
+#include "ply_exporter.h"
+#include "render_thread.h"
+#include "truss_scene.h"
 
 namespace tresta {
 
     namespace {
-        static void infoGL() {
-            glCheckError();
-            const GLubyte *str;
-            std::cout << "OpenGL infos with gl functions" << std::endl;
-            str = glGetString(GL_RENDERER);
-            std::cout << "Renderer : " << str << std::endl;
-            str = glGetString(GL_VENDOR);
-            std::cout << "Vendor : " << str << std::endl;
-            str = glGetString(GL_VERSION);
-            std::cout << "OpenGL Version : " << str << std::endl;
-            str = glGetString(GL_SHADING_LANGUAGE_VERSION);
-            std::cout << "GLSL Version : " << str << std::endl;
-            glCheckError();
+        /**
+         * Gives `fileName` the extension of the chosen export format, replacing a `.ply` or `.glb` extension of the
+         * other format and appending it to any other name.
+         */
+        QString withSuffix(const QString &fileName, const QString &suffix) {
+            const QFileInfo info(fileName);
+            const QString current = info.suffix().toLower();
+            if (current == suffix)
+                return fileName;
+            if (current == "ply" || current == "glb")
+                return fileName.left(fileName.size() - current.size()) + suffix;
+            return fileName + "." + suffix;
         }
     }
 
     Window::Window(Job &job, QScreen *screen) :
             QWindow(screen),
-            mScene(new TrussScene(job, this)),
+            mScene(new TrussScene(job)),
+            renderThread(0),
             demoSaveDirectory(QDir::currentPath()),
+            colorDialog(job.colors.size() > 0, job.displacements.size() > 0, mScene->getScalarStatistics()),
             rotatePressed(false),
             keyboardRotate(false),
             translatePressed(false),
@@ -40,18 +47,15 @@ namespace tresta {
             keyboardZoom(false),
             keyboardOverride(false),
             demoMode(false),
-            currDemoFrame(0) {
+            statsOverlay(false),
+            displacementsProvided(job.displacements.size() > 0),
+            deformationScale(mScene->getDeformationScale()) {
         setSurfaceType(OpenGLSurface);
 
         create();
 
-        mContext = new QOpenGLContext();
-        mContext->create();
-
-        mScene->setContext(mContext);
-
-        printContextInfos();
-        initializeGl();
+        exportCylinder.initialize();
+        mScene->setColorSettings(colorDialog.getSettings());
 
         resize(QSize(640, 480));
         setTitle("tresta");
@@ -60,63 +64,194 @@ namespace tresta {
         connect(this, &Window::widthChanged, this, &Window::resizeGl);
         connect(this, &Window::heightChanged, this, &Window::resizeGl);
 
-        QTimer *timer = new QTimer(this);
-        connect(timer, &QTimer::timeout, this, &Window::updateScene);
-        timer->start(16);
+        connect(&colorDialog, &ColorDialog::origColorChanged, this, &Window::updateColorSettings);
+        connect(&colorDialog, &ColorDialog::defColorChanged, this, &Window::updateColorSettings);
+        connect(&colorDialog, &ColorDialog::useUserColorsChanged, this, &Window::updateColorSettings);
+        connect(&colorDialog, &ColorDialog::transparencyEnabledChanged, this, &Window::updateColorSettings);
+        connect(&colorDialog, &ColorDialog::alphaCutoffChanged, this, &Window::updateColorSettings);
+        connect(&colorDialog, &ColorDialog::scalarColoringChanged, this, &Window::updateColorSettings);
+
+        // the scene and the context belong to the render thread from here on
+        renderThread = new RenderThread(this, mScene);
+        connect(renderThread, &RenderThread::renderFailed, this, &Window::showRenderError, Qt::QueuedConnection);
+        resizeGl();
+        renderThread->start();
     }
 
-    void Window::printContextInfos() {
-        if (!mContext->isValid())
-            throw std::runtime_error("The OpenGL context is invalid!");
+    Window::~Window() {
+        renderThread->stop();
+        renderThread->wait();
+        delete renderThread;
+    }
 
-        mContext->makeCurrent(this);
+    void Window::resizeGl() {
+        renderThread->resize(width(), height());
+    }
 
-        std::cout << "Window format version is: "
-        << format().majorVersion() << "."
-        << format().minorVersion() << std::endl;
+    void Window::updateColorSettings() {
+        TrussScene *scene = mScene;
+        const ColorSettings settings = colorDialog.getSettings();
+        renderThread->enqueue([scene, settings]() { scene->setColorSettings(settings); });
+    }
 
-        std::cout << "Context format version is: "
-        << mContext->format().majorVersion()
-        << "." << mContext->format().minorVersion() << std::endl;
-        infoGL();
+    void Window::exposeEvent(QExposeEvent *e) {
+        Q_UNUSED(e);
+        renderThread->setExposed(isExposed());
     }
 
-    void Window::initializeGl() {
-        mContext->makeCurrent(this);
-        mScene->initialize();
+    void Window::chooseDeformationScale() {
+        if (!displacementsProvided) {
+            QMessageBox::warning(0, QString("Warning"), QString("Cannot select scale.\nNo displacements provided."));
+            return;
+        }
+
+        bool ok;
+        const float scale = (float) QInputDialog::getDouble(0, QString("Choose deformation scale"), 0,
+                                                            (double) deformationScale, 1.0e-4, 1.0e8, 4, &ok);
+        if (ok) {
+            deformationScale = scale;
+            session.recordScale(scale);
+            TrussScene *scene = mScene;
+            renderThread->enqueue([scene, scale]() { scene->setDeformationScale(scale); });
+        }
     }
 
-    void Window::paintGl() {
-        if (!isExposed())
+    void Window::exportJob() {
+        const QString binaryFilter = tr("Binary PLY (*.ply)");
+        const QString asciiFilter = tr("ASCII PLY (*.ply)");
+        const QString weldedFilter = tr("Welded binary PLY (*.ply)");
+        const QString glbFilter = tr("Instanced glTF (*.glb)");
+
+        QFileDialog dialog(0, tr("Export the current mesh"));
+        dialog.setAcceptMode(QFileDialog::AcceptSave);
+        dialog.setNameFilters(QStringList() << binaryFilter << asciiFilter << weldedFilter << glbFilter);
+        dialog.setDefaultSuffix("ply");
+        dialog.selectFile("mesh.ply");
+        // the suggested name follows the format, so a glTF export is not offered as mesh.ply
+        connect(&dialog, &QFileDialog::filterSelected, [&dialog, glbFilter](const QString &filter) {
+            const QString suffix = filter == glbFilter ? QString("glb") : QString("ply");
+            dialog.setDefaultSuffix(suffix);
+            dialog.selectFile(QString("mesh.") + suffix);
+        });
+        if (dialog.exec() != QDialog::Accepted || dialog.selectedFiles().isEmpty())
+            return;
+
+        const QString selectedFilter = dialog.selectedNameFilter();
+        const QString fileName = withSuffix(dialog.selectedFiles().first(),
+                                            selectedFilter == glbFilter ? QString("glb") : QString("ply"));
+
+        // take the instance transforms on the render thread so the export reads a consistent state
+        TrussScene *scene = mScene;
+        const SceneSnapshot snapshot = renderThread->query<SceneSnapshot>([scene]() { return scene->getSnapshot(); });
+
+        QString defFileName("");
+        if (displacementsProvided) {
+            QStringList qsl = fileName.split('.');
+            for (int i = 0; i < qsl.size() - 1; ++i)
+                defFileName += qsl[0];
+            defFileName += QString("_deformed.") + qsl[qsl.size() - 1];
+        }
+
+        if (selectedFilter == glbFilter) {
+            GltfExporter exporter;
+            exporter.setIncludeColors(true);
+            exporter.exportGlb(fileName, &exportCylinder, *snapshot.job, *snapshot.vertexViewVector);
+            if (displacementsProvided)
+                exporter.exportGlb(defFileName, &exportCylinder, *snapshot.job, snapshot.deformedVertexViewVector);
             return;
+        }
 
-        mContext->makeCurrent(this);
-        if (demoMode)
-            demo();
+        // both meshes are written at the same time behind one progress dialog
+        std::vector<PlyExporter::Mesh> meshes(1);
+        meshes[0].fileName = fileName;
+        meshes[0].vertexViewVector = snapshot.vertexViewVector.get();
+        if (displacementsProvided) {
+            PlyExporter::Mesh deformed;
+            deformed.fileName = defFileName;
+            deformed.vertexViewVector = &snapshot.deformedVertexViewVector;
+            meshes.push_back(deformed);
+        }
+
+        PlyExporter exporter;
+        exporter.setFormat(selectedFilter == asciiFilter ? PlyExporter::ASCII : PlyExporter::BINARY_LITTLE_ENDIAN);
+        exporter.setIncludeColors(true);
+        exporter.setWelded(selectedFilter == weldedFilter);
+        exporter.exportMeshes(meshes, displacementsProvided ? QString("Original and deformed meshes") : QString("Original mesh"),
+                              &exportCylinder, *snapshot.job);
+    }
+
+    void Window::exportFrameStatistics() {
+        TrussScene *scene = mScene;
+        const FrameProfiler::Statistics statistics = renderThread->query<FrameProfiler::Statistics>([scene]() {
+            return scene->getProfiler().getStatistics();
+        });
+
+        if (statistics.samples.empty()) {
+            QMessageBox::warning(0, QString("Warning"),
+                                 QString("No frame timings recorded.\nPress T to show and record them."));
+            return;
+        }
+
+        const QString jsonFilter = tr("JSON (*.json)");
+        QString selectedFilter;
+        QString fileName = QFileDialog::getSaveFileName(0, tr("Export the frame timings"), "frame_timings.csv",
+                                                        tr("CSV (*.csv)") + ";;" + jsonFilter, &selectedFilter);
+        if (fileName.isEmpty())
+            return;
+
+        if (selectedFilter == jsonFilter)
+            statistics.saveJson(fileName.toStdString());
         else
-            mScene->render();
-        mContext->swapBuffers(this);
+            statistics.saveCsv(fileName.toStdString());
     }
 
-    void Window::demo() {
-        currDemoFrame %= 360;
-        mScene->demo(currDemoFrame);
-        QString filename = demoDialog.getDirectory() + "/" + demoDialog.getFilenamePrefix() + "_" +
-                           QString::number(currDemoFrame) + ".png";
-        if (!screen()->grabWindow(winId()).save(filename, qPrintable("PNG")))
-            throw std::runtime_error("Frame could not be saved.");
+    void Window::showRenderError(const QString &message, bool fatal) {
+        if (fatal) {
+            QMessageBox::critical(0, QString("Error"), QString("Cannot render the scene.\n") + message);
+            QCoreApplication::exit(EXIT_FAILURE);
+            return;
+        }
 
-        ++currDemoFrame;
+        QMessageBox::warning(0, QString("Warning"), message);
+        if (demoMode) {
+            demoMode = false;
+            emit demoChanged(false);
+        }
     }
 
-    void Window::resizeGl() {
-        mContext->makeCurrent(this);
-        mScene->resize(width(), height());
+    void Window::showMemoryReport() {
+        TrussScene *scene = mScene;
+        const std::string gpuSummary = renderThread->query<std::string>([scene]() {
+            return scene->gpuMemorySummary();
+        });
+
+        QMessageBox box;
+        box.setWindowTitle(tr("Memory usage"));
+        box.setTextFormat(Qt::RichText);
+        box.setText(tr("<p>Bytes held by the job, its geometry and its video memory buffers.</p>") +
+                    "<pre>" + QString::fromStdString(MemoryTracker::report() + "\n" + gpuSummary).toHtmlEscaped() +
+                    "</pre>");
+        box.exec();
     }
 
-    void Window::updateScene() {
-        mScene->update(0.0f);
-        paintGl();
+    void Window::toggleSessionRecording() {
+        if (!session.isRecording()) {
+            // the commands posted so far run first, so the state is the one the next recorded event applies to
+            TrussScene *scene = mScene;
+            const TrussScene::ViewState start = renderThread->query<TrussScene::ViewState>([scene]() {
+                return scene->getViewState();
+            });
+            session.startRecording(width(), height(), start);
+            setTitle("tresta - recording session");
+            return;
+        }
+
+        session.stopRecording();
+        setTitle("tresta");
+        QString fileName = QFileDialog::getSaveFileName(0, tr("Save the interaction session"), "session.json",
+                                                        tr("JSON (*.json)"));
+        if (!fileName.isEmpty())
+            session.save(fileName.toStdString());
     }
 
     void Window::handleKeyEvent(QKeyEvent *e) {
@@ -155,13 +290,22 @@ namespace tresta {
 
     void Window::mouseMoveEvent(QMouseEvent *e) {
         if (rotatePressed) {
-            mScene->setRotate(e->x() - currX, e->y() - currY);
+            const int dx = e->x() - currX, dy = e->y() - currY;
+            session.recordMouse(InteractionSession::ROTATE_EVENT, dx, dy);
+            TrussScene *scene = mScene;
+            renderThread->enqueue([scene, dx, dy]() { scene->setRotate(dx, dy); });
         }
         else if (translatePressed) {
-            mScene->setTranslate(e->x() - currX, e->y() - currY);
+            const int dx = e->x() - currX, dy = e->y() - currY;
+            session.recordMouse(InteractionSession::TRANSLATE_EVENT, dx, dy);
+            TrussScene *scene = mScene;
+            renderThread->enqueue([scene, dx, dy]() { scene->setTranslate(dx, dy); });
         }
         else if (zoomPressed) {
-            mScene->setZoom(e->x() - currX, e->y() - currY);
+            const int dx = e->x() - currX, dy = e->y() - currY;
+            session.recordMouse(InteractionSession::ZOOM_EVENT, dx, dy);
+            TrussScene *scene = mScene;
+            renderThread->enqueue([scene, dx, dy]() { scene->setZoom(dx, dy); });
         }
         currX = e->x();
         currY = e->y();
@@ -228,22 +372,95 @@ namespace tresta {
             case Qt::Key_F:
                 if (demoMode) {
                     demoMode = false;
-                    currDemoFrame = 0;
+                    renderThread->setDemo(false);
                 }
                 else {
                     demoDialog.exec();
                     if (demoDialog.result()) {
                         demoMode = true;
+                        renderThread->setDemo(true, demoDialog.getSettings());
                     }
                 }
 
                 emit demoChanged(demoMode);
                 break;
 
+            case Qt::Key_S:
+                chooseDeformationScale();
+                break;
+
+            case Qt::Key_C:
+                colorDialog.show();
+                break;
+
+            case Qt::Key_E:
+                try {
+                    exportJob();
+                }
+                catch (const std::exception &e) {
+                    QMessageBox::warning(0, QString("Warning"), QString(e.what()));
+                }
+                break;
+
+            case Qt::Key_T:
+                statsOverlay = !statsOverlay;
+                renderThread->setStatsOverlay(statsOverlay);
+                break;
+
+            case Qt::Key_X:
+                try {
+                    exportFrameStatistics();
+                }
+                catch (const std::exception &e) {
+                    QMessageBox::warning(0, QString("Warning"), QString(e.what()));
+                }
+                break;
+
+            case Qt::Key_U:
+                try {
+                    showMemoryReport();
+                }
+                catch (const std::exception &e) {
+                    QMessageBox::warning(0, QString("Warning"), QString(e.what()));
+                }
+                break;
+
+            case Qt::Key_K:
+                try {
+                    toggleSessionRecording();
+                }
+                catch (const std::exception &e) {
+                    QMessageBox::warning(0, QString("Warning"), QString(e.what()));
+                }
+                break;
+
+            case Qt::Key_D:
+                if (!displacementsProvided) {
+                    QMessageBox::warning(0, QString("Warning"),
+                                         QString("Cannot toggle deformed shape.\nNo displacements provided."));
+                    break;
+                }
+                enqueueKeyEvent(e->key());
+                break;
+
+            case Qt::Key_H:
+                if (!renderThread->isCullingSupported()) {
+                    QMessageBox::warning(0, QString("Warning"), QString("Occlusion culling requires OpenGL 4.3."));
+                    break;
+                }
+                enqueueKeyEvent(e->key());
+                break;
+
             default:
-                mScene->handleKeyEvent(e->key());
+                enqueueKeyEvent(e->key());
         }
 
     }
 
+    void Window::enqueueKeyEvent(int key) {
+        session.recordKey(key);
+        TrussScene *scene = mScene;
+        renderThread->enqueue([scene, key]() { scene->handleKeyEvent(key); });
+    }
+
 } // namespace tresta
@@ -16,6 +16,9 @@ QT      += core gui opengl concurrent
 TARGET   = tresta
 TEMPLATE = app
 
+# load stages are traced when TRESTA_TRACE names a file; remove to compile the trace scopes away
+DEFINES += TRESTA_TRACING
+
 INCLUDEPATH += $$PWD \
                $$PWD/ext \
                $$PWD/ext/eigen-3.2.5 \
@@ -23,32 +26,73 @@ INCLUDEPATH += $$PWD \
                $$PWD/ext/rapidjson/include \
                $$PWD/include
 
-SOURCES += src/color_dialog.cpp \
+SOURCES += src/camera_path.cpp \
+           src/color_dialog.cpp \
            src/cylinder.cpp \
            src/demo_dialog.cpp \
+           src/displacement_container.cpp \
+           src/displacement_playback.cpp \
+           src/displacement_sequence.cpp \
+           src/frame_capture.cpp \
+           src/frame_profiler.cpp \
+           src/frame_stream.cpp \
+           src/gbuffer.cpp \
+           src/gltf_exporter.cpp \
+           src/image_encoder_pool.cpp \
+           src/interaction_session.cpp \
            src/main.cpp \
+           src/lattice_generator.cpp \
            src/mainwindow.cpp \
+           src/memory_tracker.cpp \
+           src/modal_basis.cpp \
+           src/occlusion_culler.cpp \
+           src/offscreen.cpp \
            src/ply_exporter.cpp \
+           src/poster_writer.cpp \
+           src/render_thread.cpp \
+           src/scalar_field.cpp \
            src/setup.cpp \
            src/shape.cpp \
            src/sphere.cpp \
+           src/trace.cpp \
            src/truss_scene.cpp \
            src/window.cpp \
            ext/boost_1_59_0/libs/smart_ptr/src/sp_collector.cpp \
            ext/boost_1_59_0/libs/smart_ptr/src/sp_debug_hooks.cpp
 
 HEADERS += include/abstract_scene.h \
+           include/camera_path.h \
            include/color_dialog.h \
            include/containers.h \
            include/csv_parser.h \
            include/cylinder.h \
            include/demo_dialog.h \
+           include/displacement_container.h \
+           include/displacement_playback.h \
+           include/displacement_sequence.h \
+           include/frame_capture.h \
+           include/frame_profiler.h \
+           include/frame_stream.h \
+           include/gbuffer.h \
+           include/gltf_exporter.h \
+           include/image_encoder_pool.h \
            include/glassert.h \
+           include/interaction_session.h \
+           include/lattice_generator.h \
            include/mainwindow.h \
+           include/memory_tracker.h \
+           include/modal_basis.h \
+           include/occlusion_culler.h \
+           include/offscreen.h \
            include/ply_exporter.h \
+           include/poster_writer.h \
+           include/render_thread.h \
+           include/scalar_field.h \
            include/setup.h \
            include/shape.h \
            include/sphere.h \
+           include/spsc_queue.h \
+           include/trace.h \
            include/truss_scene.h \
            include/window.h
 